@@ -0,0 +1,298 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Micro-benchmarks of low-level image processing functions.
+
+    Usage: bench_micro [min_time_per_benchmark_in_seconds]
+
+    Results are printed as one JSON object per line. Parallelized functions
+    use the number of threads set by OMP_NUM_THREADS.
+*/
+
+// Needed for MinGW, so that is uses its own string formatting functions.
+#define __USE_MINGW_ANSI_STDIO 1
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <skry/skry.h>
+
+#include "bench_utils.h"
+#include "../src/utils/demosaic.h"
+#include "../src/utils/filters.h"
+#include "../src/utils/logging.h"
+#include "../src/utils/match.h"
+
+
+#define IMG_WIDTH  1024
+#define IMG_HEIGHT 768
+
+/// Number of block positions compared in a single call of 'bench_ssd()'
+#define SSD_POSITIONS_PER_CALL 256
+
+/// Returns a new image in 'pix_fmt' filled with pseudo-random values
+static
+SKRY_Image *create_random_img(unsigned width, unsigned height, enum SKRY_pixel_format pix_fmt, uint32_t *rng)
+{
+    SKRY_Image *img = SKRY_new_image(width, height, pix_fmt, 0, 0);
+    if (!img)
+        return 0;
+
+    size_t line_bytes = (size_t)width * BYTES_PER_PIXEL[pix_fmt];
+    for (unsigned y = 0; y < height; y++)
+    {
+        uint8_t *line = SKRY_get_line(img, y);
+        if (SKRY_PIX_MONO32F == pix_fmt || SKRY_PIX_RGB32F == pix_fmt)
+            for (size_t i = 0; i < line_bytes / sizeof(float); i++)
+                ((float *)line)[i] = bench_rand_flt(rng);
+        else
+            for (size_t i = 0; i < line_bytes; i++)
+                line[i] = (uint8_t)bench_rand(rng);
+    }
+
+    return img;
+}
+
+// Sum of squared differences ---------------------------------------
+
+struct ssd_ctx
+{
+    const SKRY_Image *img, *ref_block;
+    struct SKRY_point positions[SSD_POSITIONS_PER_CALL];
+    uint64_t result; ///< Prevents the calls from being optimized out
+};
+
+static
+void bench_ssd(void *ctx)
+{
+    struct ssd_ctx *c = ctx;
+    struct SKRY_rect refblk_rect = SKRY_get_img_rect(c->ref_block);
+    for (size_t i = 0; i < SSD_POSITIONS_PER_CALL; i++)
+        c->result += calc_sum_of_squared_diffs(c->img, c->ref_block, &c->positions[i], refblk_rect);
+}
+
+static
+void run_ssd_benchmarks(double min_time, uint32_t *rng)
+{
+    const unsigned block_sizes[] = { 16, 32, 64 };
+
+    struct ssd_ctx ctx = { .img = create_random_img(IMG_WIDTH, IMG_HEIGHT, SKRY_PIX_MONO8, rng) };
+
+    for (size_t b = 0; b < sizeof(block_sizes)/sizeof(*block_sizes); b++)
+    {
+        unsigned bsize = block_sizes[b];
+        SKRY_Image *ref_block = create_random_img(bsize, bsize, SKRY_PIX_MONO8, rng);
+        ctx.ref_block = ref_block;
+        for (size_t i = 0; i < SSD_POSITIONS_PER_CALL; i++)
+            ctx.positions[i] = (struct SKRY_point) { .x = bsize + bench_rand(rng) % (IMG_WIDTH - 2*bsize),
+                                                     .y = bsize + bench_rand(rng) % (IMG_HEIGHT - 2*bsize) };
+
+        size_t num_calls;
+        double t = measure_calls(bench_ssd, &ctx, min_time, &num_calls);
+
+        char params[64];
+        sprintf(params, "block=%ux%u", bsize, bsize);
+        print_bench_result("sum_of_squared_diffs", params, 1, num_calls * SSD_POSITIONS_PER_CALL, "evals",
+                           t * num_calls, (double)bsize * bsize);
+
+        SKRY_free_image(ref_block);
+    }
+
+    SKRY_free_image((SKRY_Image *)ctx.img);
+}
+
+// Box blur ---------------------------------------------------------
+
+struct blur_ctx
+{
+    const SKRY_Image *img;
+    unsigned box_radius;
+};
+
+static
+void bench_box_blur(void *ctx)
+{
+    struct blur_ctx *c = ctx;
+    SKRY_free_image(box_blur_img(c->img, c->box_radius, QUALITY_ESTIMATE_BOX_BLUR_ITERATIONS));
+}
+
+static
+void run_box_blur_benchmarks(double min_time, uint32_t *rng)
+{
+    const unsigned radii[] = { 1, 3, 8 };
+
+    struct blur_ctx ctx = { .img = create_random_img(IMG_WIDTH, IMG_HEIGHT, SKRY_PIX_MONO8, rng) };
+
+    for (size_t r = 0; r < sizeof(radii)/sizeof(*radii); r++)
+    {
+        ctx.box_radius = radii[r];
+        size_t num_calls;
+        double t = measure_calls(bench_box_blur, &ctx, min_time, &num_calls);
+
+        char params[64];
+        sprintf(params, "%ux%u mono8, radius=%u, iterations=%d", IMG_WIDTH, IMG_HEIGHT, radii[r],
+                QUALITY_ESTIMATE_BOX_BLUR_ITERATIONS);
+        print_bench_result("box_blur", params, 1, num_calls, "calls", t * num_calls,
+                           (double)IMG_WIDTH * IMG_HEIGHT);
+    }
+
+    SKRY_free_image((SKRY_Image *)ctx.img);
+}
+
+// Demosaicing ------------------------------------------------------
+
+struct demosaic_ctx
+{
+    SKRY_Image *src, *dest; ///< 'src' contains raw color data (but is stored as mono)
+    enum SKRY_demosaic_method method;
+};
+
+static
+void bench_demosaic_8_as_RGB(void *ctx)
+{
+    struct demosaic_ctx *c = ctx;
+    demosaic_8_as_RGB(SKRY_get_line(c->src, 0), IMG_WIDTH, IMG_HEIGHT, SKRY_get_line_stride_in_bytes(c->src),
+                      SKRY_get_line(c->dest, 0), SKRY_get_line_stride_in_bytes(c->dest),
+                      SKRY_CFA_RGGB, c->method);
+}
+
+static
+void bench_demosaic_8_as_mono8(void *ctx)
+{
+    struct demosaic_ctx *c = ctx;
+    demosaic_8_as_mono8(SKRY_get_line(c->src, 0), IMG_WIDTH, IMG_HEIGHT, SKRY_get_line_stride_in_bytes(c->src),
+                        SKRY_get_line(c->dest, 0), SKRY_get_line_stride_in_bytes(c->dest),
+                        SKRY_CFA_RGGB, c->method);
+}
+
+static
+void bench_demosaic_16_as_RGB(void *ctx)
+{
+    struct demosaic_ctx *c = ctx;
+    demosaic_16_as_RGB(SKRY_get_line(c->src, 0), IMG_WIDTH, IMG_HEIGHT, SKRY_get_line_stride_in_bytes(c->src),
+                       SKRY_get_line(c->dest, 0), SKRY_get_line_stride_in_bytes(c->dest),
+                       SKRY_CFA_RGGB, c->method);
+}
+
+static
+void run_demosaic_benchmarks(double min_time, uint32_t *rng)
+{
+    const struct
+    {
+        const char *name;
+        fn_bench *func;
+        enum SKRY_pixel_format src_fmt, dest_fmt;
+        enum SKRY_demosaic_method method;
+    } cases[] =
+    {
+        { "8_as_RGB, simple",     bench_demosaic_8_as_RGB,   SKRY_PIX_MONO8,  SKRY_PIX_RGB8,  SKRY_DEMOSAIC_SIMPLE },
+        { "8_as_RGB, HQ linear",  bench_demosaic_8_as_RGB,   SKRY_PIX_MONO8,  SKRY_PIX_RGB8,  SKRY_DEMOSAIC_HQLINEAR },
+        { "8_as_mono8, simple",   bench_demosaic_8_as_mono8, SKRY_PIX_MONO8,  SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE },
+        { "16_as_RGB, HQ linear", bench_demosaic_16_as_RGB,  SKRY_PIX_MONO16, SKRY_PIX_RGB16, SKRY_DEMOSAIC_HQLINEAR },
+    };
+
+    for (size_t i = 0; i < sizeof(cases)/sizeof(*cases); i++)
+    {
+        struct demosaic_ctx ctx = { .src = create_random_img(IMG_WIDTH, IMG_HEIGHT, cases[i].src_fmt, rng),
+                                    .dest = SKRY_new_image(IMG_WIDTH, IMG_HEIGHT, cases[i].dest_fmt, 0, 0),
+                                    .method = cases[i].method };
+        size_t num_calls;
+        double t = measure_calls(cases[i].func, &ctx, min_time, &num_calls);
+
+        char params[64];
+        sprintf(params, "%ux%u, %s", IMG_WIDTH, IMG_HEIGHT, cases[i].name);
+        print_bench_result("demosaic", params, 1, num_calls, "calls", t * num_calls,
+                           (double)IMG_WIDTH * IMG_HEIGHT * BYTES_PER_PIXEL[cases[i].src_fmt]);
+
+        SKRY_free_image(ctx.dest);
+        SKRY_free_image(ctx.src);
+    }
+}
+
+// Pixel format conversion ------------------------------------------
+
+struct conversion_ctx
+{
+    const SKRY_Image *src;
+    SKRY_Image *dest;
+};
+
+static
+void bench_conversion(void *ctx)
+{
+    struct conversion_ctx *c = ctx;
+    SKRY_convert_pix_fmt_of_subimage_into(c->src, c->dest, 0, 0, 0, 0, IMG_WIDTH, IMG_HEIGHT,
+                                          SKRY_DEMOSAIC_SIMPLE);
+}
+
+static
+void run_conversion_benchmarks(double min_time, uint32_t *rng)
+{
+    const enum SKRY_pixel_format conversions[][2] =
+    {
+        { SKRY_PIX_MONO8,     SKRY_PIX_MONO32F },
+        { SKRY_PIX_MONO16,    SKRY_PIX_MONO8   },
+        { SKRY_PIX_MONO16,    SKRY_PIX_MONO32F },
+        { SKRY_PIX_RGB8,      SKRY_PIX_MONO8   },
+        { SKRY_PIX_RGB8,      SKRY_PIX_RGB32F  },
+        { SKRY_PIX_RGB16,     SKRY_PIX_RGB32F  },
+        { SKRY_PIX_CFA_RGGB8, SKRY_PIX_MONO8   },
+    };
+
+    for (size_t i = 0; i < sizeof(conversions)/sizeof(*conversions); i++)
+    {
+        enum SKRY_pixel_format src_fmt = conversions[i][0], dest_fmt = conversions[i][1];
+        struct conversion_ctx ctx = { .src = create_random_img(IMG_WIDTH, IMG_HEIGHT, src_fmt, rng),
+                                      .dest = SKRY_new_image(IMG_WIDTH, IMG_HEIGHT, dest_fmt, 0, 0) };
+        size_t num_calls;
+        double t = measure_calls(bench_conversion, &ctx, min_time, &num_calls);
+
+        char params[64];
+        sprintf(params, "%ux%u, %s -> %s", IMG_WIDTH, IMG_HEIGHT, pix_fmt_str[src_fmt], pix_fmt_str[dest_fmt]);
+        print_bench_result("convert_pix_fmt", params, omp_get_max_threads(), num_calls, "calls", t * num_calls,
+                           (double)IMG_WIDTH * IMG_HEIGHT * BYTES_PER_PIXEL[src_fmt]);
+
+        SKRY_free_image(ctx.dest);
+        SKRY_free_image((SKRY_Image *)ctx.src);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    double min_time = argc > 1 ? atof(argv[1]) : BENCH_DEFAULT_MIN_TIME;
+    if (min_time <= 0)
+    {
+        fprintf(stderr, "Usage: %s [min_time_per_benchmark_in_seconds]\n", argv[0]);
+        return 1;
+    }
+
+    if (SKRY_SUCCESS != SKRY_initialize())
+        return 1;
+
+    uint32_t rng = 12345;
+    run_ssd_benchmarks(min_time, &rng);
+    run_box_blur_benchmarks(min_time, &rng);
+    run_demosaic_benchmarks(min_time, &rng);
+    run_conversion_benchmarks(min_time, &rng);
+
+    SKRY_deinitialize();
+    return 0;
+}
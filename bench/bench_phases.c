@@ -0,0 +1,244 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    End-to-end benchmark of processing phases.
+
+    Usage: bench_phases [-d work_dir] [-n num_frames] [-s WxH[,WxH...]] [-t threads[,threads...]]
+
+    For every frame size, a synthetic SER video is generated in 'work_dir'
+    (deleted afterwards) and processed through all phases with each number
+    of threads. Results (frames/s and MB/s of each phase) are printed
+    as one JSON object per line.
+*/
+
+// Needed for MinGW, so that is uses its own string formatting functions.
+#define __USE_MINGW_ANSI_STDIO 1
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <skry/skry.h>
+
+#include "bench_utils.h"
+#include "synth_ser.h"
+#include "../src/utils/misc.h"
+
+
+#define MAX_LIST_LEN 16
+
+#define DEFAULT_NUM_FRAMES 40
+
+enum phase
+{
+    PHASE_IMG_ALIGN,
+    PHASE_QUALITY,
+    PHASE_REF_PT_ALIGN,
+    PHASE_STACKING,
+
+    NUM_PHASES
+};
+
+static const char *PHASE_NAME[NUM_PHASES] =
+{
+    [PHASE_IMG_ALIGN]    = "img_align",
+    [PHASE_QUALITY]      = "quality_est",
+    [PHASE_REF_PT_ALIGN] = "ref_pt_align",
+    [PHASE_STACKING]     = "stacking"
+};
+
+/// Performs steps of a phase until completion; returns SKRY_LAST_STEP or an error
+static
+enum SKRY_result run_steps(enum SKRY_result (*step)(void *), void *phase_obj,
+                           double *time ///< Receives duration (in seconds) of all steps
+                          )
+{
+    enum SKRY_result status;
+    double t_start = get_precise_time_sec();
+    while (SKRY_SUCCESS == (status = step(phase_obj)))
+        ;
+
+    *time = get_precise_time_sec() - t_start;
+    return status;
+}
+
+static enum SKRY_result img_align_step(void *obj) { return SKRY_img_alignment_step(obj); }
+static enum SKRY_result quality_step(void *obj)   { return SKRY_quality_est_step(obj); }
+static enum SKRY_result ref_pt_step(void *obj)    { return SKRY_ref_pt_alignment_step(obj); }
+static enum SKRY_result stacking_step(void *obj)  { return SKRY_stacking_step(obj); }
+
+/// Processes the video through all phases; returns SKRY_SUCCESS or an error
+/** Each phase processes all frames of the video. */
+static
+enum SKRY_result process_video(const char *file_name,
+                               double phase_times[NUM_PHASES] ///< Receives durations of phases (in seconds)
+                              )
+{
+    enum SKRY_result status;
+    SKRY_ImgAlignment *img_align = 0;
+    SKRY_QualityEstimation *qual_est = 0;
+    SKRY_RefPtAlignment *ref_pt_align = 0;
+    SKRY_Stacking *stacking = 0;
+
+    SKRY_ImgSequence *img_seq = SKRY_init_video_file(file_name, 0, &status);
+    if (img_seq)
+        img_align = SKRY_init_img_alignment(img_seq, SKRY_IMG_ALGN_ANCHORS, 0, 0, 32, 32, 0.33f, &status);
+
+    if (img_align && SKRY_LAST_STEP == (status = run_steps(img_align_step, img_align, &phase_times[PHASE_IMG_ALIGN])))
+    {
+        qual_est = SKRY_init_quality_est(img_align, 40, 3);
+        status = qual_est ? SKRY_SUCCESS : SKRY_OUT_OF_MEMORY;
+    }
+
+    if (qual_est && SKRY_LAST_STEP == (status = run_steps(quality_step, qual_est, &phase_times[PHASE_QUALITY])))
+        ref_pt_align = SKRY_init_ref_pt_alignment(qual_est, 0, 0, SKRY_PERCENTAGE_BEST, 30, 32, 20, &status,
+                                                  0.33f, 1.2f, 1, 40);
+
+    if (ref_pt_align && SKRY_LAST_STEP == (status = run_steps(ref_pt_step, ref_pt_align, &phase_times[PHASE_REF_PT_ALIGN])))
+        stacking = SKRY_init_stacking(ref_pt_align, 0, &status);
+
+    if (stacking && SKRY_LAST_STEP == (status = run_steps(stacking_step, stacking, &phase_times[PHASE_STACKING])))
+        status = SKRY_SUCCESS;
+
+    SKRY_free_stacking(stacking);
+    SKRY_free_ref_pt_alignment(ref_pt_align);
+    SKRY_free_quality_est(qual_est);
+    SKRY_free_img_alignment(img_align);
+    SKRY_free_img_sequence(img_seq);
+
+    return status;
+}
+
+/// Parses a comma-separated list of numbers or sizes ("WxH") into 'values' (2 per element if 'is_size'); returns the number of elements
+static
+size_t parse_list(const char *str, int is_size, unsigned values[])
+{
+    size_t count = 0;
+    while (*str && count < MAX_LIST_LEN)
+    {
+        char *end;
+        unsigned long value = strtoul(str, &end, 10);
+        values[count * (is_size ? 2 : 1)] = (unsigned)value;
+        if (is_size)
+        {
+            if (*end != 'x')
+                return 0;
+            value = strtoul(end + 1, &end, 10);
+            values[count*2 + 1] = (unsigned)value;
+        }
+        if (0 == value || (*end && *end != ','))
+            return 0;
+
+        count++;
+        str = *end ? end + 1 : end;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *work_dir = ".";
+    unsigned num_frames = DEFAULT_NUM_FRAMES;
+    unsigned sizes[2*MAX_LIST_LEN] = { 320, 240,  640, 480,  1280, 960 };
+    size_t num_sizes = 3;
+    unsigned thread_counts[MAX_LIST_LEN];
+    size_t num_thread_counts = 0;
+
+    // By default: 1, 2, 4, ... and the number of processors
+    unsigned num_procs = (unsigned)omp_get_num_procs();
+    for (unsigned t = 1; t < num_procs && num_thread_counts < MAX_LIST_LEN - 1; t *= 2)
+        thread_counts[num_thread_counts++] = t;
+    thread_counts[num_thread_counts++] = num_procs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        int is_valid = (i + 1 < argc);
+        if (is_valid && !strcmp(argv[i], "-d"))
+            work_dir = argv[++i];
+        else if (is_valid && !strcmp(argv[i], "-n"))
+            is_valid = ((num_frames = (unsigned)atoi(argv[++i])) > 0);
+        else if (is_valid && !strcmp(argv[i], "-s"))
+            is_valid = ((num_sizes = parse_list(argv[++i], 1, sizes)) > 0);
+        else if (is_valid && !strcmp(argv[i], "-t"))
+            is_valid = ((num_thread_counts = parse_list(argv[++i], 0, thread_counts)) > 0);
+        else
+            is_valid = 0;
+
+        if (!is_valid)
+        {
+            fprintf(stderr, "Usage: %s [-d work_dir] [-n num_frames] [-s WxH[,WxH...]] [-t threads[,threads...]]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (SKRY_SUCCESS != SKRY_initialize())
+        return 1;
+
+    int exit_code = 0;
+    for (size_t s = 0; s < num_sizes && !exit_code; s++)
+    {
+        unsigned width = sizes[2*s], height = sizes[2*s + 1];
+
+        char file_name[1024];
+        snprintf(file_name, sizeof(file_name), "%s/bench_%ux%u.ser", work_dir, width, height);
+        if (!write_synthetic_ser(file_name, width, height, num_frames, 0x5EE1 + s))
+        {
+            fprintf(stderr, "Cannot write %s.\n", file_name);
+            exit_code = 1;
+            break;
+        }
+
+        for (size_t t = 0; t < num_thread_counts && !exit_code; t++)
+        {
+            omp_set_num_threads(thread_counts[t]);
+
+            double phase_times[NUM_PHASES] = { 0 };
+            enum SKRY_result status = process_video(file_name, phase_times);
+            if (SKRY_SUCCESS != status)
+            {
+                fprintf(stderr, "Processing of %s failed: %s.\n", file_name, SKRY_get_error_message(status));
+                exit_code = 1;
+                break;
+            }
+
+            char params[64];
+            sprintf(params, "%ux%u mono8", width, height);
+
+            double total_time = 0;
+            for (int p = 0; p < NUM_PHASES; p++)
+            {
+                char benchmark[64];
+                sprintf(benchmark, "phase_%s", PHASE_NAME[p]);
+                print_bench_result(benchmark, params, thread_counts[t], num_frames, "frames",
+                                   phase_times[p], (double)width * height);
+                total_time += phase_times[p];
+            }
+            print_bench_result("all_phases", params, thread_counts[t], num_frames, "frames",
+                               total_time, (double)width * height);
+        }
+
+        remove(file_name);
+    }
+
+    SKRY_deinitialize();
+    return exit_code;
+}
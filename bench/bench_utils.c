@@ -0,0 +1,75 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Benchmark utilities implementation.
+*/
+
+#include <stdio.h>
+
+#include "bench_utils.h"
+#include "../src/utils/misc.h"
+
+
+double measure_calls(fn_bench *fn, void *ctx, double min_time, size_t *num_calls)
+{
+    fn(ctx);
+
+    size_t count = 0;
+    double t_start = get_precise_time_sec(), elapsed;
+    do
+    {
+        fn(ctx);
+        count++;
+        elapsed = get_precise_time_sec() - t_start;
+    } while (elapsed < min_time);
+
+    *num_calls = count;
+    return elapsed / count;
+}
+
+void print_bench_result(const char *benchmark, const char *params, unsigned threads,
+                        size_t num_items, const char *item_name, double time,
+                        double bytes_per_item)
+{
+    printf("{\"benchmark\":\"%s\",\"params\":\"%s\"", benchmark, params);
+    if (threads)
+        printf(",\"threads\":%u", threads);
+    printf(",\"%s\":%zu,\"time_s\":%.6f,\"%s_per_s\":%.3f",
+           item_name, num_items, time, item_name, time > 0 ? num_items / time : 0.0);
+    if (bytes_per_item)
+        printf(",\"MB_per_s\":%.3f", time > 0 ? num_items * bytes_per_item / time * 1.0e-6 : 0.0);
+    printf("}\n");
+    fflush(stdout);
+}
+
+uint32_t bench_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+float bench_rand_flt(uint32_t *state)
+{
+    return (bench_rand(state) >> 8) * (1.0f / (1U << 24));
+}
@@ -0,0 +1,59 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Benchmark utilities header.
+*/
+
+#ifndef LIBSKRY_BENCH_UTILS_HEADER
+#define LIBSKRY_BENCH_UTILS_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Default min. duration (in seconds) of measuring a single micro-benchmark
+#define BENCH_DEFAULT_MIN_TIME 0.5
+
+/// Function measured by 'measure_calls()'
+typedef void fn_bench(void *ctx);
+
+/// Calls 'fn' (after one warm-up call) repeatedly for at least 'min_time' seconds; returns the mean duration of a call
+double measure_calls(fn_bench *fn, void *ctx, double min_time,
+                     size_t *num_calls ///< Receives the number of measured calls
+                    );
+
+/// Prints a benchmark result as a single line of JSON to standard output
+/** Fields with value 0 ('threads', 'bytes_per_item') are omitted. */
+void print_bench_result(const char *benchmark,
+                        const char *params, ///< Description of the benchmark's parameters (e.g. the image size)
+                        unsigned threads,   ///< Number of threads used
+                        size_t num_items,   ///< Number of processed items (calls, frames)
+                        const char *item_name, ///< Name of items; the output contains '<item_name>_per_s'
+                        double time,        ///< Total duration (in seconds) of processing 'num_items'
+                        double bytes_per_item ///< Output contains 'MB_per_s' calculated from this
+                       );
+
+/// Returns the next value of a xorshift pseudo-random number generator
+uint32_t bench_rand(uint32_t *state);
+
+/// Returns a pseudo-random value from [0; 1)
+float bench_rand_flt(uint32_t *state);
+
+#endif // LIBSKRY_BENCH_UTILS_HEADER
@@ -0,0 +1,300 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Synthetic image sequence generator implementation.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_utils.h"
+#include "synth_ser.h"
+
+
+#define PI_FLT 3.14159265f
+
+/// Width of the surface's border (in pixels) which is not visible in a frame without jitter
+#define SURFACE_MARGIN 16
+
+/// Max. distance (in pixels) of frame's shift (image jitter) from the initial position
+#define MAX_JITTER (SURFACE_MARGIN / 2)
+
+/// Max. local displacement (in pixels) caused by seeing
+#define MAX_LOCAL_DISPLACEMENT 1.5f
+
+/// Max. box blur radius of a frame
+#define MAX_BLUR_RADIUS 2
+
+#define NOISE_AMPLITUDE 0.03f
+
+#define SER_HEADER_SIZE 178
+
+/// Number of sinusoidal components of the local displacement field (per axis)
+#define NUM_WARP_COMPONENTS 2
+
+struct warp_component
+{
+    float kx, ky; ///< Spatial frequencies (radians per pixel)
+    float phase;
+    float amplitude;
+};
+
+/// Adds value noise (random values at nodes of a grid with 'cell_size' spacing, smoothly interpolated)
+static
+void add_value_noise(float *surface, unsigned width, unsigned height,
+                     unsigned cell_size, float weight, uint32_t *rng)
+{
+    unsigned grid_w = width / cell_size + 2,
+             grid_h = height / cell_size + 2;
+
+    float *nodes = malloc(sizeof(*nodes) * grid_w * grid_h);
+    if (!nodes)
+        return;
+
+    for (size_t i = 0; i < (size_t)grid_w * grid_h; i++)
+        nodes[i] = bench_rand_flt(rng);
+
+    for (unsigned y = 0; y < height; y++)
+    {
+        unsigned gy = y / cell_size;
+        float ty = (float)(y % cell_size) / cell_size;
+        ty = ty * ty * (3 - 2*ty);
+
+        for (unsigned x = 0; x < width; x++)
+        {
+            unsigned gx = x / cell_size;
+            float tx = (float)(x % cell_size) / cell_size;
+            tx = tx * tx * (3 - 2*tx);
+
+            const float *n0 = nodes + gx + (size_t)gy * grid_w,
+                        *n1 = n0 + grid_w;
+
+            surface[x + (size_t)y * width] += weight *
+                ((1-ty) * ((1-tx)*n0[0] + tx*n0[1]) + ty * ((1-tx)*n1[0] + tx*n1[1]));
+        }
+    }
+
+    free(nodes);
+}
+
+/// Returns a new surface (brightness values from [0; 1]) or null if out of memory
+static
+float *create_surface(unsigned width, unsigned height, uint32_t *rng)
+{
+    float *detail = calloc((size_t)width * height, sizeof(*detail));
+    if (!detail)
+        return 0;
+
+    // Granulation-like detail of several scales
+    add_value_noise(detail, width, height, 32, 0.40f, rng);
+    add_value_noise(detail, width, height, 12, 0.30f, rng);
+    add_value_noise(detail, width, height, 5,  0.20f, rng);
+    add_value_noise(detail, width, height, 2,  0.10f, rng);
+
+    float cx = width * 0.5f, cy = height * 0.5f;
+    float radius = 0.45f * (width < height ? width : height);
+
+    struct { float x, y, r; } spots[3];
+    for (int i = 0; i < 3; i++)
+    {
+        spots[i].x = cx + (bench_rand_flt(rng) - 0.5f) * radius;
+        spots[i].y = cy + (bench_rand_flt(rng) - 0.5f) * radius;
+        spots[i].r = (0.03f + 0.04f * bench_rand_flt(rng)) * radius;
+    }
+
+    for (unsigned y = 0; y < height; y++)
+        for (unsigned x = 0; x < width; x++)
+        {
+            float *val = detail + x + (size_t)y * width;
+            float r = sqrtf((x - cx)*(x - cx) + (y - cy)*(y - cy)) / radius;
+            if (r >= 1)
+            {
+                *val = 0.02f;
+                continue;
+            }
+
+            float limb_darkening = 0.4f + 0.6f * sqrtf(1 - r*r);
+            float spot_factor = 1;
+            for (int i = 0; i < 3; i++)
+            {
+                float d2 = ((x - spots[i].x)*(x - spots[i].x) + (y - spots[i].y)*(y - spots[i].y))
+                           / (spots[i].r * spots[i].r);
+                spot_factor -= 0.7f * expf(-d2);
+            }
+
+            *val = limb_darkening * (0.55f + 0.4f * *val) * (spot_factor < 0.1f ? 0.1f : spot_factor);
+        }
+
+    return detail;
+}
+
+/// Blurs the lines (if 'horizontal') or columns of 'pixels' with a box filter of 'radius'; 'tmp' is a work buffer of width*height
+static
+void box_blur_1d(float *pixels, float *tmp, unsigned width, unsigned height, unsigned radius, int horizontal)
+{
+    unsigned len = horizontal ? width : height,
+             count = horizontal ? height : width;
+    size_t step = horizontal ? 1 : width,
+           line_step = horizontal ? width : 1;
+
+    memcpy(tmp, pixels, sizeof(*pixels) * width * height);
+
+    for (unsigned l = 0; l < count; l++)
+    {
+        const float *src = tmp + l * line_step;
+        float *dest = pixels + l * line_step;
+
+        for (unsigned i = 0; i < len; i++)
+        {
+            float sum = 0;
+            for (int j = -(int)radius; j <= (int)radius; j++)
+            {
+                int k = (int)i + j;
+                k = k < 0 ? 0 : (k >= (int)len ? (int)len - 1 : k);
+                sum += src[k * step];
+            }
+            dest[i * step] = sum / (2*radius + 1);
+        }
+    }
+}
+
+/// Renders a frame of 'surface' displaced by (shift_x, shift_y) and 'warp'
+static
+void render_frame(const float *surface, unsigned surf_width, unsigned surf_height,
+                  float *frame, unsigned width, unsigned height,
+                  float shift_x, float shift_y,
+                  struct warp_component warp[2][NUM_WARP_COMPONENTS])
+{
+    for (unsigned y = 0; y < height; y++)
+        for (unsigned x = 0; x < width; x++)
+        {
+            float src_x = x + SURFACE_MARGIN + shift_x,
+                  src_y = y + SURFACE_MARGIN + shift_y;
+
+            for (int c = 0; c < NUM_WARP_COMPONENTS; c++)
+            {
+                src_x += warp[0][c].amplitude * sinf(warp[0][c].kx * x + warp[0][c].ky * y + warp[0][c].phase);
+                src_y += warp[1][c].amplitude * sinf(warp[1][c].kx * x + warp[1][c].ky * y + warp[1][c].phase);
+            }
+
+            if (src_x < 0) src_x = 0;
+            if (src_y < 0) src_y = 0;
+            if (src_x > surf_width - 2) src_x = surf_width - 2;
+            if (src_y > surf_height - 2) src_y = surf_height - 2;
+
+            unsigned x0 = (unsigned)src_x, y0 = (unsigned)src_y;
+            float tx = src_x - x0, ty = src_y - y0;
+            const float *p0 = surface + x0 + (size_t)y0 * surf_width,
+                        *p1 = p0 + surf_width;
+
+            frame[x + (size_t)y * width] = (1-ty) * ((1-tx)*p0[0] + tx*p0[1]) + ty * ((1-tx)*p1[0] + tx*p1[1]);
+        }
+}
+
+static
+void put_u32_le(uint8_t *dest, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        dest[i] = (uint8_t)(value >> (8*i));
+}
+
+static
+int write_ser_header(FILE *file, unsigned width, unsigned height, unsigned num_frames)
+{
+    uint8_t header[SER_HEADER_SIZE] = { 0 };
+    memcpy(header, "LUCAM-RECORDER", 14);
+    // Camera series ID, color ID (mono) and endianness are 0
+    put_u32_le(header + 26, width);
+    put_u32_le(header + 30, height);
+    put_u32_le(header + 34, 8); // bits per channel
+    put_u32_le(header + 38, num_frames);
+
+    return 1 == fwrite(header, sizeof(header), 1, file);
+}
+
+int write_synthetic_ser(const char *file_name, unsigned width, unsigned height, unsigned num_frames, uint32_t seed)
+{
+    uint32_t rng = seed;
+    unsigned surf_width = width + 2*SURFACE_MARGIN,
+             surf_height = height + 2*SURFACE_MARGIN;
+
+    float *surface = create_surface(surf_width, surf_height, &rng);
+    float *frame = malloc(sizeof(*frame) * width * height);
+    float *tmp = malloc(sizeof(*tmp) * width * height);
+    uint8_t *pixels = malloc((size_t)width * height);
+    FILE *file = fopen(file_name, "wb");
+
+    int success = surface && frame && tmp && pixels && file
+                  && write_ser_header(file, width, height, num_frames);
+
+    float shift_x = 0, shift_y = 0;
+    for (unsigned i = 0; i < num_frames && success; i++)
+    {
+        // Image jitter: a bounded random walk
+        shift_x += 3 * (bench_rand_flt(&rng) - 0.5f);
+        shift_y += 3 * (bench_rand_flt(&rng) - 0.5f);
+        if (fabsf(shift_x) > MAX_JITTER) shift_x *= 0.5f;
+        if (fabsf(shift_y) > MAX_JITTER) shift_y *= 0.5f;
+
+        struct warp_component warp[2][NUM_WARP_COMPONENTS];
+        for (int axis = 0; axis < 2; axis++)
+            for (int c = 0; c < NUM_WARP_COMPONENTS; c++)
+            {
+                // Wavelengths between ca. 1/5 and 1/2 of the frame size
+                float wavelength_x = width * (0.2f + 0.3f * bench_rand_flt(&rng)),
+                      wavelength_y = height * (0.2f + 0.3f * bench_rand_flt(&rng));
+                warp[axis][c] = (struct warp_component) {
+                    .kx = 2*PI_FLT / wavelength_x,
+                    .ky = 2*PI_FLT / wavelength_y,
+                    .phase = 2*PI_FLT * bench_rand_flt(&rng),
+                    .amplitude = MAX_LOCAL_DISPLACEMENT / NUM_WARP_COMPONENTS * bench_rand_flt(&rng)
+                };
+            }
+
+        render_frame(surface, surf_width, surf_height, frame, width, height, shift_x, shift_y, warp);
+
+        unsigned blur_radius = bench_rand(&rng) % (MAX_BLUR_RADIUS + 1);
+        if (blur_radius > 0)
+        {
+            box_blur_1d(frame, tmp, width, height, blur_radius, 1);
+            box_blur_1d(frame, tmp, width, height, blur_radius, 0);
+        }
+
+        for (size_t p = 0; p < (size_t)width * height; p++)
+        {
+            float val = frame[p] + NOISE_AMPLITUDE * (bench_rand_flt(&rng) - 0.5f);
+            pixels[p] = (uint8_t)(val <= 0 ? 0 : (val >= 1 ? 255 : val * 255 + 0.5f));
+        }
+
+        success = (1 == fwrite(pixels, (size_t)width * height, 1, file));
+    }
+
+    if (file && fclose(file))
+        success = 0;
+
+    free(pixels);
+    free(tmp);
+    free(frame);
+    free(surface);
+
+    return success;
+}
@@ -0,0 +1,39 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Synthetic image sequence generator header.
+*/
+
+#ifndef LIBSKRY_SYNTH_SER_HEADER
+#define LIBSKRY_SYNTH_SER_HEADER
+
+#include <stdint.h>
+
+
+/// Writes a mono 8-bit SER video of a synthetic surface observed through simulated seeing
+/** The surface is a disc (with limb darkening) filled with granulation-like detail
+    and a few dark spots. In every frame it is shifted as a whole (image jitter),
+    warped locally by a smooth random displacement field, blurred by a random amount
+    (so that frames' quality varies) and overlaid with noise. Returns 0 on failure. */
+int write_synthetic_ser(const char *file_name, unsigned width, unsigned height, unsigned num_frames,
+                        uint32_t seed ///< Non-zero seed of the pseudo-random generator
+                       );
+
+#endif // LIBSKRY_SYNTH_SER_HEADER
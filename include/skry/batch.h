@@ -0,0 +1,122 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Batch processing header.
+*/
+
+#ifndef LIB_STACKISTRY_BATCH_HEADER
+#define LIB_STACKISTRY_BATCH_HEADER
+
+#include <stddef.h>
+
+#include "defs.h"
+#include "image.h"
+#include "imgseq.h"
+
+
+/** Processes several image sequences (jobs) through all phases (image alignment,
+    quality estimation, reference point alignment and stacking) using a shared set
+    of worker threads. Steps of different jobs are interleaved, so that reading
+    images of one job overlaps with computations of another. Each worker performs
+    its steps' parallel loops using an equal share of the processors.
+
+    Jobs' image sequences may be connected to the same image pool (see SKRY_create_image_pool()),
+    which then limits the memory used for cached images by all jobs together. */
+typedef struct SKRY_batch SKRY_Batch;
+
+/// Parameters of a batch job
+/** Meaning of the fields is the same as of the corresponding parameters of
+    SKRY_init_img_alignment(), SKRY_init_quality_est(), SKRY_init_ref_pt_alignment()
+    and SKRY_init_stacking(). */
+struct SKRY_batch_job_params
+{
+    /// Must not be used elsewhere until the job completes
+    SKRY_ImgSequence *img_seq;
+
+    // Image alignment --------------------------------------------
+
+    enum SKRY_img_alignment_method img_align_method;
+    size_t num_anchors; ///< If zero, anchors will be placed automatically
+    const struct SKRY_point *anchors; ///< May be null if num_anchors==0; copied by SKRY_add_batch_job()
+    unsigned anchor_block_radius;
+    unsigned anchor_search_radius;
+    float anchor_placement_brightness_threshold;
+
+    // Quality estimation -----------------------------------------
+
+    unsigned estimation_area_size;
+    unsigned detail_scale;
+
+    // Reference point alignment ----------------------------------
+
+    size_t num_ref_points; ///< If zero, reference points will be placed automatically
+    const struct SKRY_point *ref_points; ///< May be null if num_ref_points==0; copied by SKRY_add_batch_job()
+    enum SKRY_quality_criterion quality_criterion;
+    unsigned quality_threshold;
+    unsigned ref_block_size;
+    unsigned ref_pt_search_radius;
+    float ref_pt_placement_brightness_threshold;
+    float structure_threshold;
+    unsigned structure_scale;
+    unsigned ref_pt_spacing;
+
+    // Stacking ---------------------------------------------------
+
+    const SKRY_Image *flatfield; ///< May be null; copied by SKRY_add_batch_job()
+    /// Memory budget of stacking (see SKRY_set_stacking_mem_budget()); if zero, the default is used
+    size_t stacking_mem_budget;
+};
+
+/// Creates a batch and starts its worker threads; returns null on failure
+SKRY_Batch *SKRY_create_batch(
+    /// Number of worker threads; if zero, equals the number of processors (or 1 if built without OpenMP)
+    unsigned num_workers,
+    /// Max. number of jobs being processed at the same time (the rest wait); if zero, equals 'num_workers'
+    /** Each job in progress keeps its processing phases' data in memory. */
+    unsigned max_active_jobs,
+    /// If not null, receives operation result
+    enum SKRY_result *result);
+
+/// Stops the worker threads (unfinished jobs are abandoned) and frees 'batch'; returns null
+SKRY_Batch *SKRY_free_batch(SKRY_Batch *batch);
+
+/// Adds a job to the batch; it is started as soon as fewer than 'max_active_jobs' jobs are in progress
+/** Returns SKRY_SUCCESS or SKRY_OUT_OF_MEMORY. Can be called at any time and from any thread.
+    The arrays and the flat-field image referred to by 'params' are copied, so they can be freed
+    right after the call. The logging callback (see SKRY_set_logging()) may be called from the worker threads. */
+enum SKRY_result SKRY_add_batch_job(SKRY_Batch *batch,
+                                    const struct SKRY_batch_job_params *params,
+                                    /// If not null, receives the job's index (jobs are numbered from 0 in the order of adding)
+                                    size_t *job_idx);
+
+/// Returns non-zero if the job has completed (successfully or not)
+int SKRY_is_batch_job_complete(const SKRY_Batch *batch, size_t job_idx);
+
+/// Waits until the job completes; returns SKRY_SUCCESS or the error which stopped the job
+enum SKRY_result SKRY_wait_for_batch_job(SKRY_Batch *batch, size_t job_idx);
+
+/// Waits until all jobs added so far complete
+void SKRY_wait_for_batch(SKRY_Batch *batch);
+
+/// Returns the completed job's final image stack, or null if the job has failed or is not complete
+/** The caller becomes the image's owner; subsequent calls for the same job return null. */
+SKRY_Image *SKRY_take_batch_job_stack(SKRY_Batch *batch, size_t job_idx);
+
+#endif // LIB_STACKISTRY_BATCH_HEADER
@@ -0,0 +1,67 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Checkpoint (saved results of processing phases) header.
+*/
+
+#ifndef LIB_STACKISTRY_CHECKPOINT_HEADER
+#define LIB_STACKISTRY_CHECKPOINT_HEADER
+
+#include "defs.h"
+#include "img_align.h"
+#include "imgseq.h"
+#include "quality.h"
+#include "ref_pt_align.h"
+
+
+/// Saves the results of completed processing phases to a checkpoint file
+/** A checkpoint contains images' offsets and intersection, areas' quality in all images
+    and reference points' positions in all images (each only if the corresponding object
+    is specified), together with an identification of the image sequence (its type,
+    number of images, active images and a hash of the first and the last active image).
+    Reference blocks are not stored. The file format does not depend on the machine's
+    endianness.
+
+    'qual_est' and 'ref_pt_align' may be null. All specified objects have to be complete;
+    'qual_est' has to use 'img_algn' and 'ref_pt_align' has to use 'qual_est'.
+    Returns SKRY_SUCCESS or an error. */
+enum SKRY_result SKRY_save_checkpoint(const char *file_name,
+                                      const SKRY_ImgAlignment *img_algn,
+                                      const SKRY_QualityEstimation *qual_est,
+                                      const SKRY_RefPtAlignment *ref_pt_align);
+
+/// Restores processing phases' objects saved with SKRY_save_checkpoint()
+/** The restored objects are complete, i.e. they can be passed directly to the next phase's
+    SKRY_init_ function (e.g. a restored 'ref_pt_align' to SKRY_init_stacking()); they have to
+    be freed as usual. Restoring the quality estimation reads the images where the quality
+    estimation areas have the best quality (to recreate the areas' reference blocks).
+
+    'img_seq' has to be the sequence (with the same active images) that was processed
+    to create the checkpoint; otherwise SKRY_CHECKPOINT_MISMATCH is returned.
+    'qual_est' and 'ref_pt_align' may be null; if 'ref_pt_align' is not null, 'qual_est'
+    must not be null either. The objects not stored in the checkpoint (or not requested)
+    are set to null. On error, all objects are set to null. Returns SKRY_SUCCESS or an error. */
+enum SKRY_result SKRY_load_checkpoint(const char *file_name,
+                                      SKRY_ImgSequence *img_seq,
+                                      SKRY_ImgAlignment **img_algn,
+                                      SKRY_QualityEstimation **qual_est,
+                                      SKRY_RefPtAlignment **ref_pt_align);
+
+#endif // LIB_STACKISTRY_CHECKPOINT_HEADER
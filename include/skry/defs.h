@@ -25,6 +25,7 @@ File description:
 #define LIB_STACKISTRY_DEFS_HEADER
 
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -48,7 +49,12 @@ enum
     SKRY_LOG_IMG_ALIGNMENT    = 1U <<  7,
     SKRY_LOG_SER              = 1U <<  8,
     SKRY_LOG_IMG_POOL         = 1U <<  9,
-    SKRY_LOG_LIBAV_VIDEO      = 1U << 10
+    SKRY_LOG_LIBAV_VIDEO      = 1U << 10,
+    SKRY_LOG_IMG_PREFETCH     = 1U << 11,
+    SKRY_LOG_IMG_SEQ_INDEX    = 1U << 12,
+    SKRY_LOG_ACCEL            = 1U << 13,
+    SKRY_LOG_BATCH            = 1U << 14,
+    SKRY_LOG_CHECKPOINT       = 1U << 15
 };
 
 #define SKRY_LOG_ALL UINT_MAX
@@ -157,6 +163,15 @@ enum SKRY_result
     SKRY_LIBAV_DECODING_ERROR,
     SKRY_LIBAV_INTERNAL_ERROR,
 
+    SKRY_CANNOT_START_THREAD,
+
+    SKRY_ACCEL_UNAVAILABLE,
+    SKRY_ACCEL_ERROR,
+
+    SKRY_CHECKPOINT_MISMATCH, ///< Checkpoint file was created for a different image sequence
+
+    SKRY_CANCELLED, ///< Processing was cancelled by the caller (see SKRY_img_alignment_run())
+
     SKRY_RESULT_LAST
 };
 
@@ -187,7 +202,35 @@ enum SKRY_img_alignment_method
     SKRY_IMG_ALGN_ANCHORS,
 
     /// Alignment using the image centroid
-    SKRY_IMG_ALGN_CENTROID
+    SKRY_IMG_ALGN_CENTROID,
+
+    /// Alignment via phase correlation of a square image region (centered on the first image's centroid)
+    /** The cost does not depend on the search radius; translations of up to half
+        the region's size (at most 512 pixels) between consecutive images are detected. */
+    SKRY_IMG_ALGN_PHASE_CORR
+};
+
+/// Device performing block matching of anchors and reference points, and stacking
+enum SKRY_accelerator
+{
+    /// All processing is performed by the CPU
+    SKRY_ACCEL_NONE,
+
+    /// Block matching and stacking are offloaded to an OpenCL device (a GPU, if available)
+    /** Requires libskry built with USE_OPENCL=1. See SKRY_set_accelerator(). */
+    SKRY_ACCEL_OPENCL
+};
+
+/// Image quality metric used by quality estimation
+enum SKRY_quality_metric
+{
+    /// Average difference between the image and its blurred version (sum of high-frequency components)
+    SKRY_QUALITY_METRIC_HIGH_PASS,
+
+    /// Variance of the 3x3 Laplacian of the image
+    /** Does not depend on the quality estimation's detail scale (box blur radius)
+        and is much faster to compute. Edge pixels of estimation areas are skipped. */
+    SKRY_QUALITY_METRIC_LAPLACIAN_VARIANCE
 };
 
 /// Selection criterion used for reference point alignment and stacking
@@ -228,6 +271,25 @@ struct SKRY_rect
 #define SKRY_RECT_CONTAINS(r, p) \
     ((p).x >= (r).x && (p).x < (r).x + (int)(r).width && (p).y >= (r).y && (p).y < (r).y + (int)(r).height)
 
+/// Performance counters (see SKRY_enable_perf_stats())
+/** Times of operations performed in parallel are summed over all threads. */
+struct SKRY_perf_stats
+{
+    uint64_t num_steps; ///< Number of processing steps (calls to XXX_step() functions)
+    double   step_time; ///< Total duration (in seconds) of the steps
+
+    uint64_t frames_read;     ///< Number of images (or image fragments) read from image sequences
+    uint64_t bytes_read;      ///< Total size of the read images' pixel data
+    double   read_time;       ///< Time (in seconds) spent reading and decoding images (or waiting for the prefetcher)
+    double   conversion_time; ///< Time (in seconds) spent converting pixel formats (including demosaicing)
+
+    uint64_t block_match_evals; ///< Number of positions at which blocks were compared during block matching on CPU
+    uint64_t blur_calls;        ///< Number of box blur operations
+    uint64_t triangles_stacked; ///< Number of triangles (of the ref. points' triangulation) stacked in all images
+    uint64_t pool_hits;         ///< Number of images found in an image pool
+    uint64_t pool_misses;       ///< Number of images not found in an image pool
+};
+
 #define SKRY_ADD_POINT_TO(dest, src) \
     ((dest) = (struct SKRY_point) { .x = (dest).x + (src).x, .y = (dest).y + (src).y })
 
@@ -242,4 +304,10 @@ typedef void SKRY_log_callback_fn(unsigned log_event_type, const char *msg);
 
 typedef double SKRY_clock_sec_fn(void);
 
+/// Called by the SKRY_xx_run() functions (e.g. SKRY_img_alignment_run()) after each step
+typedef void SKRY_progress_callback_fn(
+    size_t num_done,  ///< Number of active images processed so far (in all passes, see SKRY_stacking_run())
+    size_t num_total, ///< Number of active images (for SKRY_stacking_run(): times the number of passes)
+    void *user_data);
+
 #endif // LIB_STACKISTRY_DEFS_HEADER
@@ -32,6 +32,8 @@ File description:
 
 typedef struct SKRY_image SKRY_Image;
 
+typedef struct SKRY_frame_allocator SKRY_FrameAllocator;
+
 #define SKRY_PALETTE_NUM_ENTRIES 256
 
 struct SKRY_palette
@@ -53,6 +55,27 @@ extern const size_t OUTPUT_FMT_BITS_PER_CHANNEL[SKRY_OUTP_FMT_LAST];
 
 SKRY_Image *SKRY_free_image(SKRY_Image *img); ///< Returns null
 
+/// Creates a frame buffer allocator; returns null if out of memory
+/** When set with SKRY_set_frame_allocator(), pixel buffers of images created by
+    SKRY_new_image() (including those created internally during processing) are
+    obtained from the allocator, and are returned to it by SKRY_free_image().
+    A request for a buffer reuses a previously returned buffer of the same size,
+    so that steady-state processing of same-sized frames performs no large
+    allocations. The allocator is thread-safe. */
+SKRY_FrameAllocator *SKRY_create_frame_allocator(
+    /// Max. total size (in bytes) of unused buffers kept for reuse
+    size_t capacity);
+
+/// Frees all buffers kept by 'allocator'; returns null
+/** Images allocated from 'allocator' remain valid; their buffers are freed
+    normally once the images are freed. If 'allocator' is the one set with
+    SKRY_set_frame_allocator(), images are no longer allocated from it. */
+SKRY_FrameAllocator *SKRY_free_frame_allocator(SKRY_FrameAllocator *allocator);
+
+/// Sets the allocator used by SKRY_new_image(); if null, buffers are allocated normally (default)
+/** Should not be called while images are being created by other threads. */
+void SKRY_set_frame_allocator(SKRY_FrameAllocator *allocator);
+
 /// Allocates a new image (with lines stored top-to-bottom, no padding)
 SKRY_Image *SKRY_new_image(
     unsigned width, unsigned height, enum SKRY_pixel_format pixel_format,
@@ -80,6 +103,14 @@ enum SKRY_result SKRY_get_palette(const SKRY_Image *img, struct SKRY_palette *pa
 /// Returned image has lines stored top-to-bottom, no padding
 SKRY_Image *SKRY_get_img_copy(const SKRY_Image *img);
 
+/// Returns median-filtered copy of 'img' (e.g. for removal of hot pixels), or null on error
+/** Every channel is filtered separately using a (2*radius+1) x (2*radius+1) window.
+    Supported are images with 8 or 16 bits per channel (except palette and raw color
+    formats). Returned image has lines stored top-to-bottom, no padding. */
+SKRY_Image *SKRY_median_filter_image(const SKRY_Image *img, unsigned radius,
+                                     enum SKRY_result *result ///< If not null, receives operation result
+);
+
 /** Copies (with cropping or padding) a fragment of image to another. There is no scaling.
     Pixel formats of source and destination must be the same. 'src_img' must not equal 'dest_img'.
     NOTE: care must be taken if pixel format is one of SKRY_CFA. The caller may need to adjust
@@ -163,4 +194,17 @@ void SKRY_reinterpret_as_CFA(SKRY_Image *img, enum SKRY_CFA_pattern CFA_pattern)
 struct SKRY_point SKRY_get_centroid(const SKRY_Image *img,
                                     const struct SKRY_rect img_fragment);
 
+/// Finds the centroid of pixels of the specified image fragment brighter than a threshold
+/** Returned coords are relative to 'img_fragment'. Pixels are used directly
+    in their format (raw color images are treated as mono).
+    Equivalent to SKRY_get_centroid() if 'brightness_threshold' is 0 and 'decimation' is 1. */
+struct SKRY_point SKRY_get_thresholded_centroid(
+    const SKRY_Image *img,
+    const struct SKRY_rect img_fragment,
+    /// Pixels darker than this are ignored (values: [0; 1])
+    /** Value is relative to the pixel format's max. brightness (1.0 for floating-point formats). */
+    float brightness_threshold,
+    /// Only every 'decimation'-th pixel in every 'decimation'-th line is used; must be at least 1
+    unsigned decimation);
+
 #endif // LIB_STACKISTRY_IMAGE_HEADER
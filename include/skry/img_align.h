@@ -62,8 +62,26 @@ SKRY_ImgAlignment *SKRY_init_img_alignment(
 /// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
 enum SKRY_result SKRY_img_alignment_step(SKRY_ImgAlignment *img_algn);
 
+/// Performs up to 'max_steps' steps of image alignment (all remaining steps if 'max_steps' is zero)
+/** Equivalent to calling SKRY_img_alignment_step() repeatedly. 'progress_callback' (may be null)
+    is called after every step. 'cancel_flag' (may be null) may be set to non-zero by another
+    thread; it is checked before every step, and if set, the function returns SKRY_CANCELLED.
+    After cancellation 'img_algn' remains valid and processing can be resumed.
+    Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps),
+    SKRY_CANCELLED or an error. */
+enum SKRY_result SKRY_img_alignment_run(SKRY_ImgAlignment *img_algn, size_t max_steps,
+                                        SKRY_progress_callback_fn progress_callback, void *callback_data,
+                                        const int *cancel_flag);
+
 int SKRY_is_img_alignment_complete(const SKRY_ImgAlignment *img_algn);
 
+/// Receives performance counters of all steps performed so far (see SKRY_enable_perf_stats())
+/** The counters of a step are the change of the process-wide totals during the step,
+    so they include all work done in the meantime, also by other threads. If more than
+    one image sequence is processed at a time (e.g. by SKRY_Batch), the values are
+    meaningless; use SKRY_get_perf_stats() for the totals instead. */
+void SKRY_get_img_align_perf_stats(const SKRY_ImgAlignment *img_algn, struct SKRY_perf_stats *stats);
+
 /** The return value may increase during processing (when all existing
     anchors became invalid and a new one(s) had to be automatically created). */
 size_t SKRY_get_anchor_count(const SKRY_ImgAlignment *img_algn);
@@ -104,5 +122,29 @@ enum SKRY_img_alignment_method SKRY_get_alignment_method(const SKRY_ImgAlignment
 /// Returns current centroid position
 struct SKRY_point SKRY_get_current_centroid_pos(const SKRY_ImgAlignment *img_algn);
 
+/// Sets parameters of centroid determination (used if the alignment method is SKRY_IMG_ALGN_CENTROID)
+/** Has to be called before the first SKRY_img_alignment_step(); returns SKRY_SUCCESS
+    or SKRY_INVALID_PARAMETERS. Default: no threshold, no decimation.
+    See SKRY_get_thresholded_centroid(). */
+enum SKRY_result SKRY_set_centroid_alignment_params(
+    SKRY_ImgAlignment *img_algn,
+    /// Pixels darker than this are ignored, e.g. to suppress sky background (values: [0; 1])
+    /** Value is relative to the pixel format's max. brightness. */
+    float brightness_threshold,
+    /// Only every 'decimation'-th pixel in every 'decimation'-th line is used; must be at least 1
+    unsigned decimation);
+
+
+/// Enables estimation of images' quality during image alignment
+/** A subsequent quality estimation with the same 'estimation_area_size' and 'detail_scale'
+    (and default settings) then needs only a single SKRY_quality_est_step() and does not read
+    all the images again. Quality is estimated on a grid of areas fixed relative to
+    the first image (as the final images' intersection is not known during alignment)
+    and then interpolated onto the estimation areas, so it is approximate (see
+    SKRY_is_qual_est_approximate()). Has to be called before the first SKRY_img_alignment_step();
+    'estimation_area_size' = 0 disables (default). Returns SKRY_SUCCESS or SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_img_align_quality_est(SKRY_ImgAlignment *img_algn,
+                                                unsigned estimation_area_size,
+                                                unsigned detail_scale);
 
 #endif // LIB_STACKISTRY_IMAGE_ALIGNMENT_HEADER
@@ -50,9 +50,25 @@ SKRY_ImgSequence *SKRY_init_video_file(
     /// If not null, receives operation result
     enum SKRY_result *result);
 
+/// Enables or disables the use of image sequence index files (disabled by default)
+/** When enabled, the results of parsing a video file (or of reading the metadata
+    of an image list's files) are stored in an index file located next to the video
+    (or next to the image list's first file) and named "<file name>.skryidx".
+    Subsequent opening of the same file(s) uses the index instead of parsing them
+    again, as long as they have not been modified in the meantime. The setting
+    applies to image sequences created afterwards. */
+void SKRY_set_img_seq_index_files(int enabled);
+
 enum SKRY_result SKRY_image_list_add_img(SKRY_ImgSequence *img_seq,
                                          const char *file_name);
 
+/// Loads the next 'num_images' active images of an image list (starting with the current one) in parallel
+/** Subsequent reads of these images are performed from memory. Images not read
+    by the time of SKRY_deactivate_img_seq() are discarded. Has no effect for video files.
+    When read-ahead is enabled (see SKRY_enable_prefetching()), image lists are preloaded
+    automatically in batches of the read-ahead queue's length. */
+enum SKRY_result SKRY_image_list_preload(SKRY_ImgSequence *img_seq, size_t num_images);
+
 /// Returns absolute index (refers to the whole set, including non-active images)
 size_t SKRY_get_curr_img_idx(const SKRY_ImgSequence *img_seq);
 
@@ -73,12 +89,21 @@ SKRY_Image *SKRY_get_curr_img(const SKRY_ImgSequence *img_seq,
                               enum SKRY_result *result ///< If not null, receives operation result
                               );
 
+/// Returns a fragment of the current image, reading (if possible) only the pixels within 'rect'
+/** 'rect' is cropped to the image and its origin is moved to even coordinates,
+    so that the CFA pattern of raw color images is preserved. On success, 'rect'
+    receives the area covered by the returned image, which contains the requested
+    one (it may be the whole image, e.g. if the sequence is being prefetched). */
+SKRY_Image *SKRY_get_curr_img_fragment(const SKRY_ImgSequence *img_seq,
+                                       struct SKRY_rect *rect,
+                                       enum SKRY_result *result ///< If not null, receives operation result
+                                       );
+
 /// Returns the current image in specified format
 /** If 'img_seq' is connected to an image pool, the image is taken from the pool
-    if it exists there (and has 'pix_fmt'). If the image is not yet in the pool,
-    it will be converted to 'pix_fmt' and stored there, if the pool's capacity
-    is not yet exhausted. Otherwise, the image is read as usual and converted
-    without being added to the pool.
+    if it exists there in 'pix_fmt'. If not, it will be read, converted to 'pix_fmt'
+    and stored there (evicting other images if needed and possible).
+    The same image can be stored in several pixel formats.
     In any case, once the caller is done with the image, it *has to* call
     'SKRY_release_img_to_pool' and must not attempt to free the returned image. */
 SKRY_Image *SKRY_get_curr_img_from_pool(
@@ -122,6 +147,24 @@ size_t SKRY_get_active_img_count(const SKRY_ImgSequence *img_seq);
 
 enum SKRY_img_sequence_type SKRY_get_img_seq_type(const SKRY_ImgSequence *img_seq);
 
+/// Averages the active images of 'img_seq' into a master calibration frame (dark, bias or flat)
+/** Images are read one by one, but converted and accumulated in parallel. Returns
+    null on error (all images must have the same size) or an image of the same kind
+    as the images: SKRY_PIX_RGB32F for color images, SKRY_PIX_MONO32F for mono and raw color
+    images. Raw color images are not demosaiced, i.e. the result contains the averaged mosaic
+    (see SKRY_set_stacking_dark_frame()). */
+SKRY_Image *SKRY_create_master_frame(
+    SKRY_ImgSequence *img_seq,
+    /** If positive, pixel values differing from their mean by more than 'rejection_kappa'
+        times their standard deviation are rejected (this requires reading the images twice). */
+    float rejection_kappa,
+    /// May be null; subtracted from each image (e.g. a master bias); has the images' size and the result's pixel format
+    const SKRY_Image *subtracted,
+    /// If not null, receives operation result
+    enum SKRY_result *result
+);
+
+/// Returns a flat-field (the average of active images of 'img_seq' scaled to max. value of 1) or null on error
 SKRY_Image *SKRY_create_flatfield(
     /// All images must have the same size
     SKRY_ImgSequence *img_seq,
@@ -133,6 +176,9 @@ SKRY_Image *SKRY_create_flatfield(
 void SKRY_disconnect_from_img_pool(SKRY_ImgSequence *img_seq);
 
 /// Returns null if out of memory
+/** When the pool is full, individual images not being currently used are evicted,
+    starting with those which are the least expensive to re-create (per byte)
+    and have not been used recently, regardless of the image sequence they belong to. */
 SKRY_ImagePool *SKRY_create_image_pool(
     /// Value in bytes
     /** Concerns only the size of stored images. The pool's internal data
@@ -159,4 +205,27 @@ void SKRY_reinterpret_img_seq_as_CFA(
 /// Translates index in the active images' subset into absolute index
 size_t SKRY_get_absolute_img_idx(const SKRY_ImgSequence *img_seq, size_t active_img_idx);
 
+/// Enables reading of images in a background thread, ahead of their use
+/** Images are read following the active images' subset, starting from
+    the current image. When a processing phase requests the current image,
+    it is usually already available. Calling this function again replaces
+    the previous prefetching settings. */
+enum SKRY_result SKRY_enable_prefetching(
+    SKRY_ImgSequence *img_seq,
+    /// Max. number of images read ahead
+    size_t queue_len,
+    /** If not SKRY_PIX_INVALID, the images are additionally converted
+        to this format in the background; the converted images are used
+        by SKRY_get_curr_img_from_pool() if the requested format matches.
+        Image alignment (using anchors or phase correlation), quality estimation
+        and ref. point alignment use SKRY_PIX_MONO8 and SKRY_DEMOSAIC_SIMPLE;
+        when prefetching with these settings, the conversion of the next image
+        overlaps with processing of the current one. */
+    enum SKRY_pixel_format pix_fmt,
+    /// Used if 'pix_fmt' is not SKRY_PIX_INVALID and images contain raw color data
+    enum SKRY_demosaic_method demosaic_method);
+
+/// Stops the background reading and frees all images read ahead
+void SKRY_disable_prefetching(SKRY_ImgSequence *img_seq);
+
 #endif // LIB_STACKISTRY_IMG_SEQ_HEADER
@@ -48,6 +48,49 @@ int SKRY_is_qual_est_complete(const SKRY_QualityEstimation *qual_est);
 /// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
 enum SKRY_result SKRY_quality_est_step(SKRY_QualityEstimation *qual_est);
 
+/// Performs up to 'max_steps' steps (all remaining steps if zero); see SKRY_img_alignment_run()
+/** Equivalent to calling SKRY_quality_est_step() repeatedly. */
+enum SKRY_result SKRY_quality_est_run(SKRY_QualityEstimation *qual_est, size_t max_steps,
+                                      SKRY_progress_callback_fn progress_callback, void *callback_data,
+                                      const int *cancel_flag);
+
+/// Receives performance counters of all steps performed so far (see SKRY_enable_perf_stats())
+/** The counters of a step are the change of the process-wide totals during the step,
+    so they include all work done in the meantime, also by other threads. If more than
+    one image sequence is processed at a time (e.g. by SKRY_Batch), the values are
+    meaningless; use SKRY_get_perf_stats() for the totals instead. */
+void SKRY_get_quality_est_perf_stats(const SKRY_QualityEstimation *qual_est, struct SKRY_perf_stats *stats);
+
+/// Enables or disables blurring the whole images' intersection at once during quality estimation
+/** By default, each estimation area is blurred separately (with its edge pixels
+    replicated). Blurring the whole intersection is faster for very small areas (below
+    ca. 8 pixels) and avoids artifacts at areas' edges, which are then blurred with their
+    actual neighbors; the resulting quality values are slightly different. Has to be called before the first
+    SKRY_quality_est_step(); returns SKRY_SUCCESS or SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_quality_est_whole_intersection_blur(SKRY_QualityEstimation *qual_est, int enabled);
+
+/// Selects the image quality metric (default: SKRY_QUALITY_METRIC_HIGH_PASS)
+/** Has to be called before the first SKRY_quality_est_step(); returns SKRY_SUCCESS
+    or SKRY_INVALID_PARAMETERS. SKRY_set_quality_est_whole_intersection_blur() has
+    no effect on metrics other than SKRY_QUALITY_METRIC_HIGH_PASS. */
+enum SKRY_result SKRY_set_quality_est_metric(SKRY_QualityEstimation *qual_est, enum SKRY_quality_metric metric);
+
+/// Max. value of 'level' accepted by SKRY_set_quality_est_decimation()
+#define SKRY_QUALITY_EST_MAX_DECIMATION 2
+
+/// Makes quality estimation use images downsampled 2^'level' times (i.e. 2x for level 1, 4x for level 2)
+/** Meant for fast evaluation of sequences (e.g. selecting the best images), where exact
+    quality values are not needed. Areas' and images' quality is then approximate (see
+    SKRY_is_qual_est_approximate()), but comparable between images. Border areas cover
+    whole pixels of the downsampled image. Level 0 (default) disables decimation; when
+    enabled, SKRY_set_quality_est_whole_intersection_blur() has no effect. Has to be called
+    before the first SKRY_quality_est_step(); returns SKRY_SUCCESS or SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_quality_est_decimation(SKRY_QualityEstimation *qual_est, unsigned level);
+
+/// Returns nonzero if quality has been estimated using downsampled images or during image alignment
+/** See SKRY_set_quality_est_decimation() and SKRY_set_img_align_quality_est(). */
+int SKRY_is_qual_est_approximate(const SKRY_QualityEstimation *qual_est);
+
 size_t SKRY_get_qual_est_num_areas(const SKRY_QualityEstimation *qual_est);
 
 /// Fills 'qual_array' with overall quality values of subsequent images
@@ -82,6 +125,11 @@ size_t SKRY_get_best_img_idx(const SKRY_QualityEstimation *qual_est);
 SKRY_Image *SKRY_get_best_fragments_img(const SKRY_QualityEstimation *qual_est);
 
 /// Returns an array of suggested reference point positions; return null if out of memory
+/** Suitability for block matching is assessed using gradient directions
+    of the whole best fragments image. Versions up to 0.3.0 assessed each
+    candidate's neighborhood separately (with zero padding) in its quality
+    area's reference block; the returned positions (and their number) may
+    therefore differ from those returned by earlier versions. */
 struct SKRY_point *SKRY_suggest_ref_point_positions(
     const SKRY_QualityEstimation *qual_est,
     size_t *num_points, ///< Receives number of elements in the result
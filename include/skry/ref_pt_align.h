@@ -25,6 +25,7 @@ File description:
 #define LIB_STACKISTRY_REFERENCE_POINT_ALIGNMENT_HEADER
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "quality.h"
 #include "triangulation.h"
@@ -57,6 +58,7 @@ SKRY_RefPtAlignment *SKRY_init_ref_pt_alignment(
     enum SKRY_result *result,
 
     // Parameters used if num_points==0 (automatic placement of ref. points) -----------------
+    // (see SKRY_suggest_ref_point_positions(); the placement may differ from versions up to 0.3.0)
 
     /// Min. image brightness that a ref. point can be placed at (values: [0; 1])
     /** Value is relative to the image's darkest (0.0) and brightest (1.0) pixels. */
@@ -85,11 +87,32 @@ struct SKRY_point SKRY_get_ref_pt_pos(const SKRY_RefPtAlignment *ref_pt_align, s
                                       /// If not null, receives 1 if the point is valid in specified image
                                       int *is_valid);
 
+/// Fills 'positions' and 'is_valid' with positions of all reference points in the specified image
+/** Both arrays need SKRY_get_num_ref_pts() elements. Faster than calling
+    SKRY_get_ref_pt_pos() for every point. */
+void SKRY_get_ref_pt_positions_in_img(const SKRY_RefPtAlignment *ref_pt_align, size_t img_idx,
+                                      struct SKRY_point positions[],
+                                      /// If not null, element [i] receives 1 if point 'i' is valid in the image
+                                      uint8_t is_valid[]);
+
 /// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
 enum SKRY_result SKRY_ref_pt_alignment_step(SKRY_RefPtAlignment *ref_pt_align);
 
+/// Performs up to 'max_steps' steps (all remaining steps if zero); see SKRY_img_alignment_run()
+/** Equivalent to calling SKRY_ref_pt_alignment_step() repeatedly. */
+enum SKRY_result SKRY_ref_pt_alignment_run(SKRY_RefPtAlignment *ref_pt_align, size_t max_steps,
+                                           SKRY_progress_callback_fn progress_callback, void *callback_data,
+                                           const int *cancel_flag);
+
 int SKRY_is_ref_pt_alignment_complete(const SKRY_RefPtAlignment *ref_pt_align);
 
+/// Receives performance counters of all steps performed so far (see SKRY_enable_perf_stats())
+/** The counters of a step are the change of the process-wide totals during the step,
+    so they include all work done in the meantime, also by other threads. If more than
+    one image sequence is processed at a time (e.g. by SKRY_Batch), the values are
+    meaningless; use SKRY_get_perf_stats() for the totals instead. */
+void SKRY_get_ref_pt_perf_stats(const SKRY_RefPtAlignment *ref_pt_align, struct SKRY_perf_stats *stats);
+
 /// Returns the quality estimation object associated with 'ref_pt_align'
 const SKRY_QualityEstimation *SKRY_get_qual_est(const SKRY_RefPtAlignment *ref_pt_align);
 
@@ -101,6 +124,13 @@ struct SKRY_point_flt *SKRY_get_final_positions(const SKRY_RefPtAlignment *ref_p
 
 int SKRY_is_ref_pt_valid(const SKRY_RefPtAlignment *ref_pt_align, size_t pt_idx, size_t img_idx);
 
+/// Enables or disables the adaptive search radius (disabled by default)
+/** When enabled, each reference point is first searched for within a radius
+    derived from the recent translations of all points (usually much smaller than
+    the 'search_radius' passed to SKRY_init_ref_pt_alignment()). The full search
+    radius is used only if the best match lies at the edge of that area. */
+void SKRY_set_ref_pt_adaptive_search(SKRY_RefPtAlignment *ref_pt_align, int enabled);
+
 /// Triangulation contains 3 additional points at the end of vertex list: a triangle that covers all the other points
 const struct SKRY_triangulation *SKRY_get_ref_pts_triangulation(const SKRY_RefPtAlignment *ref_pt_align);
 
@@ -63,6 +63,8 @@ File description:
 extern "C" {
 #endif
 
+#include "batch.h"
+#include "checkpoint.h"
 #include "defs.h"
 #include "image.h"
 #include "img_align.h"
@@ -83,12 +85,81 @@ enum SKRY_result SKRY_initialize(void);
 /// Must be called after finished using libskry
 void SKRY_deinitialize(void);
 
+/// Selects the device used for block matching during image and reference point alignment, and for stacking
+/** Default: SKRY_ACCEL_NONE. Must not be called while processing is in progress.
+    If the accelerator cannot be initialized (SKRY_ACCEL_UNAVAILABLE or SKRY_ACCEL_ERROR
+    is returned), the CPU is used. If the accelerator fails later, the CPU is used
+    for the affected images.
+
+    Results obtained with an accelerator differ from those obtained with SKRY_ACCEL_NONE:
+      - block matching performs an exhaustive search over the whole search radius,
+        whereas the CPU searches coarse-to-fine; the accelerator may thus find a different
+        (better matching) position, and all subsequent processing changes accordingly;
+      - stacking values are calculated with the device's floating-point arithmetic,
+        so they may differ by rounding (which may also decide whether a pixel at
+        a triangle's edge is stacked).
+
+    Stacking is offloaded only for SKRY_STACK_MEAN with SKRY_STACK_ACCUM_FLOAT and
+    without a preview (see SKRY_set_stacking_preview_decimation()); otherwise the CPU
+    stacks the images. The stack is kept on the device and is copied to the host
+    when needed (e.g. by SKRY_get_partial_image_stack()). */
+enum SKRY_result SKRY_set_accelerator(enum SKRY_accelerator accel);
+
+/// Enables or disables coarse-to-fine block matching over image pyramids (disabled by default)
+/** When enabled, image and reference point alignment match blocks whose search radius
+    is large compared with the block size first in images downsampled 2x or 4x, and then
+    refine the positions at full resolution. This is faster for large search radii, but
+    may find different positions than the default search (and so change all subsequent
+    results). Not used by an accelerator (see SKRY_set_accelerator()). Must not be called
+    while processing is in progress. */
+void SKRY_enable_pyramid_matching(int enabled);
+
 /// Provides a callback for messages generated by libskry.
 /** The string pointer and the string's contents passed to the callback
-    are valid only for the duration of callback's execution. */
+    are valid only for the duration of callback's execution. The callback may
+    be called from different threads, but never concurrently. */
 void SKRY_set_logging(unsigned log_event_type_mask,
                       SKRY_log_callback_fn callback_func);
 
+/// Enables or disables delivering log messages from a background thread
+/** By default, the callback (see SKRY_set_logging()) is called by the thread
+    which generated the message (calls are serialized, so the callback is never
+    executed concurrently). With asynchronous logging, messages are queued
+    and the callback is called by a background thread, so that processing
+    does not wait for it. If the queue is full, further messages are dropped;
+    their number is reported in a subsequent message.
+
+    'queue_len' is the max. number of queued messages; specify 0 to disable
+    (all queued messages are delivered first). Must not be called while processing
+    is in progress. Returns SKRY_SUCCESS, SKRY_OUT_OF_MEMORY, SKRY_CANNOT_START_THREAD
+    or SKRY_INVALID_PARAMETERS (if libskry has not been initialized). */
+enum SKRY_result SKRY_set_async_logging(size_t queue_len);
+
+/// Enables or disables collection of performance counters (disabled by default)
+/** See 'struct SKRY_perf_stats', SKRY_get_perf_stats() and SKRY_get_XXX_perf_stats()
+    functions of processing phases. When disabled, the counters cost a single test
+    of a flag. Must not be called while processing is in progress. */
+void SKRY_enable_perf_stats(int enabled);
+
+/// Receives the totals of performance counters since they were enabled (or reset)
+void SKRY_get_perf_stats(struct SKRY_perf_stats *stats);
+
+/// Must not be called while processing is in progress
+void SKRY_reset_perf_stats(void);
+
+/// Starts writing spans of processing steps to a file in the Chrome trace event format
+/** The file can be viewed e.g. in chrome://tracing; steps of each image sequence
+    are shown in a separate row. Tracing works independently of SKRY_enable_perf_stats(),
+    but the spans' counters are recorded only if the latter is enabled (like the phases'
+    counters, they are meaningless if image sequences are processed concurrently). Must not be called
+    while processing is in progress. Returns SKRY_SUCCESS, SKRY_CANNOT_CREATE_FILE
+    or SKRY_OUT_OF_MEMORY. */
+enum SKRY_result SKRY_start_trace(const char *file_name);
+
+/// Finishes and closes the trace file; returns SKRY_SUCCESS or SKRY_FILE_IO_ERROR
+/** Must not be called while processing is in progress. */
+enum SKRY_result SKRY_stop_trace(void);
+
 /** Provides a timer function used for timing of processing phases;
     if not used, a default timer is used (with 1-second resolution). */
 void SKRY_set_clock_func(SKRY_clock_sec_fn clock_func);
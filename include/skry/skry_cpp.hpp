@@ -25,8 +25,10 @@ File description:
 #define LIB_STACKISTRY_CPP_HEADER
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "skry.h"
@@ -70,6 +72,16 @@ namespace libskry
         (even if active ones are not sequential).
 
     5. Some of the C++ classes are bound via shared pointers to reflect the bounds between C objects.
+
+    6. Pixel data can be accessed without copying via c_ImageView and c_LineView (non-owning views,
+       valid as long as the viewed image exists), e.g.:
+
+        c_ImageView<const uint16_t> view = img.GetView<const uint16_t>();
+        for (unsigned y = 0; y < view.GetHeight(); y++)
+            for (uint16_t value: view[y])
+                //process 'value'
+
+       Views count elements of type T (e.g. an RGB8 line of width W contains 3*W elements of 'uint8_t').
     */
 
     class ISkryPtrWrapper
@@ -79,6 +91,93 @@ namespace libskry
         bool IsValid() const { return operator bool(); }
     };
 
+    /// Non-owning view of a line (or its fragment) of pixel data; elements are of type T
+    template<typename T>
+    class c_LineView
+    {
+        T *data;
+        size_t size;
+
+    public:
+        c_LineView(): data(nullptr), size(0) { }
+
+        c_LineView(T *data, size_t size): data(data), size(size) { }
+
+        T *GetData() const { return data; }
+
+        /// Returns number of elements
+        size_t GetSize() const { return size; }
+
+        T &operator[](size_t idx) const { return data[idx]; }
+
+        T *begin() const { return data; }
+
+        T *end() const { return data + size; }
+    };
+
+    /// Non-owning view of a rectangular fragment of an image; elements are of type T
+    /** Use a const T (e.g. 'const uint8_t') for read-only access. The view is valid
+        as long as the viewed image exists. */
+    template<typename T>
+    class c_ImageView
+    {
+        typedef typename std::conditional<std::is_const<T>::value, const uint8_t, uint8_t>::type Byte_t;
+
+        Byte_t *data; ///< Start of the first line
+        ptrdiff_t lineStride; ///< In bytes; may be negative
+        unsigned width, height; ///< In pixels
+        size_t elemsPerPixel;
+
+    public:
+        c_ImageView(): data(nullptr), lineStride(0), width(0), height(0), elemsPerPixel(0) { }
+
+        c_ImageView(T *firstLine, ptrdiff_t lineStrideInBytes, unsigned width, unsigned height, size_t bytesPerPixel)
+        : data(reinterpret_cast<Byte_t *>(firstLine)), lineStride(lineStrideInBytes),
+          width(width), height(height), elemsPerPixel(bytesPerPixel / sizeof(T))
+        { }
+
+        /// Returns a view of the whole 'img'; 'img' must not be null
+        explicit c_ImageView(const SKRY_Image *img)
+        : c_ImageView(static_cast<T *>(SKRY_get_line(img, 0)), SKRY_get_line_stride_in_bytes(img),
+                      SKRY_get_img_width(img), SKRY_get_img_height(img), SKRY_get_bytes_per_pixel(img))
+        { }
+
+        /// Conversion of a writable view to a read-only one
+        template<typename U,
+                 typename = typename std::enable_if<std::is_same<const U, T>::value
+                                                    && !std::is_same<U, T>::value>::type>
+        c_ImageView(const c_ImageView<U> &view)
+        : c_ImageView(view.GetLine(0), view.GetLineStrideInBytes(), view.GetWidth(), view.GetHeight(),
+                      view.GetBytesPerPixel())
+        { }
+
+        explicit operator bool() const { return data != nullptr; }
+
+        unsigned GetWidth() const  { return width; }
+
+        unsigned GetHeight() const { return height; }
+
+        ptrdiff_t GetLineStrideInBytes() const { return lineStride; }
+
+        size_t GetBytesPerPixel() const { return elemsPerPixel * sizeof(T); }
+
+        /// Returns number of elements per line
+        size_t GetLineSize() const { return width * elemsPerPixel; }
+
+        T *GetLine(unsigned line) const { return reinterpret_cast<T *>(data + line * lineStride); }
+
+        c_LineView<T> operator[](unsigned line) const { return c_LineView<T>(GetLine(line), GetLineSize()); }
+
+        /// Returns the first element of pixel (x, y)
+        T &operator()(unsigned x, unsigned y) const { return GetLine(y)[x * elemsPerPixel]; }
+
+        /// Returns a view of a fragment; the fragment must lie within the view
+        c_ImageView GetFragment(unsigned x0, unsigned y0, unsigned fragWidth, unsigned fragHeight) const
+        {
+            return c_ImageView(&(*this)(x0, y0), lineStride, fragWidth, fragHeight, GetBytesPerPixel());
+        }
+    };
+
     class c_Image: public ISkryPtrWrapper
     {
         std::unique_ptr<SKRY_Image,
@@ -134,6 +233,14 @@ namespace libskry
         /// Returns pointer to start of the specified line
         void *GetLine(unsigned line) const { return SKRY_get_line(pimpl.get(), line); }
 
+        /// Returns a view of the image's pixels; T has to be the type of pixel format's channel values
+        template<typename T>
+        c_ImageView<T> GetView() { return c_ImageView<T>(pimpl.get()); }
+
+        /// Returns a read-only view of the image's pixels; T has to be the type of pixel format's channel values
+        template<typename T>
+        c_ImageView<const T> GetView() const { return c_ImageView<const T>(pimpl.get()); }
+
         enum SKRY_pixel_format GetPixelFormat() const { return SKRY_get_img_pix_fmt(pimpl.get()); }
 
         /// Fills 'pal'; returns SKRY_NO_PALETTE if image does not contain a palette
@@ -173,6 +280,14 @@ namespace libskry
             return result;
         }
 
+        /// See SKRY_median_filter_image()
+        static c_Image MedianFilter(const c_Image &srcImg, unsigned radius,
+                                    /// If not null, receives operation result
+                                    enum SKRY_result *result = nullptr)
+        {
+            return c_Image(SKRY_median_filter_image(srcImg.pimpl.get(), radius, result));
+        }
+
         static c_Image Load(const char *fileName,
                             /// If not null, receives operation result
                             enum SKRY_result *result = nullptr)
@@ -199,6 +314,80 @@ namespace libskry
         friend class c_QualityEstimation;
         friend class c_RefPointAlignment;
         friend class c_Stacking;
+        friend class c_Batch;
+        friend class c_PooledImage;
+    };
+
+    /// Image borrowed from an image sequence's pool; movable, non-copyable
+    /** Returned by c_ImageSequence::GetCurrentImageFromPool(). The image is released
+        to the pool (see SKRY_release_img_to_pool()) when the object is destroyed
+        or Release() is called. Pooled images may be shared, so only read-only access is provided. */
+    class c_PooledImage: public ISkryPtrWrapper
+    {
+        std::shared_ptr<SKRY_ImgSequence> imgSeq_pimpl;
+        size_t imgIdx;
+        SKRY_Image *img;
+
+        c_PooledImage(std::shared_ptr<SKRY_ImgSequence> imgSeq, size_t imgIdx, SKRY_Image *img)
+        : imgSeq_pimpl(std::move(imgSeq)), imgIdx(imgIdx), img(img)
+        { }
+
+    public:
+        explicit virtual operator bool() const { return img != nullptr; }
+
+        c_PooledImage(): imgIdx(0), img(nullptr) { }
+
+        c_PooledImage(const c_PooledImage &)             = delete;
+
+        c_PooledImage & operator=(const c_PooledImage &) = delete;
+
+        c_PooledImage(c_PooledImage &&other) noexcept
+        : imgSeq_pimpl(std::move(other.imgSeq_pimpl)), imgIdx(other.imgIdx), img(other.img)
+        {
+            other.img = nullptr;
+        }
+
+        c_PooledImage & operator=(c_PooledImage &&other) noexcept
+        {
+            if (this != &other)
+            {
+                Release();
+                imgSeq_pimpl = std::move(other.imgSeq_pimpl);
+                imgIdx = other.imgIdx;
+                img = other.img;
+                other.img = nullptr;
+            }
+            return *this;
+        }
+
+        ~c_PooledImage() { Release(); }
+
+        /// Returns the image to the pool; afterwards the object is null
+        void Release()
+        {
+            if (img)
+                SKRY_release_img_to_pool(imgSeq_pimpl.get(), imgIdx, img);
+            img = nullptr;
+            imgSeq_pimpl.reset();
+        }
+
+        /// Returns the image's absolute index in its image sequence
+        size_t GetImgIdx() const { return imgIdx; }
+
+        unsigned GetWidth() const  { return SKRY_get_img_width(img); }
+
+        unsigned GetHeight() const { return SKRY_get_img_height(img); }
+
+        enum SKRY_pixel_format GetPixelFormat() const { return SKRY_get_img_pix_fmt(img); }
+
+        /// Returns a read-only view of the image's pixels; T has to be the type of pixel format's channel values
+        template<typename T>
+        c_ImageView<const T> GetView() const { return c_ImageView<const T>(img); }
+
+        /// Returns a deep copy of the image
+        c_Image GetCopy() const { return c_Image(SKRY_get_img_copy(img)); }
+
+        friend class c_ImageSequence;
     };
 
     /// Movable, non-copyable
@@ -238,6 +427,8 @@ namespace libskry
             return c_ImageSequence(SKRY_init_video_file(fileName, nullptr, result));
         }
 
+        static void SetIndexFiles(bool enabled) { SKRY_set_img_seq_index_files(enabled); }
+
         size_t GetCurrentImgIdx() const { return SKRY_get_curr_img_idx(pimpl.get()); }
 
         size_t GetCurrentImgIdxWithinActiveSubset() const { return SKRY_get_curr_img_idx_within_active_subset(pimpl.get()); }
@@ -259,6 +450,31 @@ namespace libskry
             return c_Image(SKRY_get_curr_img(pimpl.get(), result));
         }
 
+        /// Returns a fragment of the current image; see SKRY_get_curr_img_fragment()
+        c_Image GetCurrentImageFragment(
+            struct SKRY_rect &rect, ///< Requested area; receives the area covered by the returned image
+            enum SKRY_result *result = nullptr ///< If not null, receives operation result
+            ) const
+        {
+            return c_Image(SKRY_get_curr_img_fragment(pimpl.get(), &rect, result));
+        }
+
+        /// Returns the current image (in 'pixFmt') from the sequence's image pool without copying
+        /** If the sequence is not connected to a pool, the image is read (and freed on release).
+            See SKRY_get_curr_img_from_pool(). */
+        c_PooledImage GetCurrentImageFromPool(
+            enum SKRY_pixel_format pixFmt,
+            enum SKRY_demosaic_method demosaicMethod = SKRY_DEMOSAIC_SIMPLE,
+            enum SKRY_result *result = nullptr ///< If not null, receives operation result
+            ) const
+        {
+            SKRY_Image *img = SKRY_get_curr_img_from_pool(pimpl.get(), pixFmt, demosaicMethod, result);
+            if (!img)
+                return c_PooledImage();
+            else
+                return c_PooledImage(pimpl, SKRY_get_curr_img_idx(pimpl.get()), img);
+        }
+
         enum SKRY_result GetCurrentImageMetadata(
                             unsigned *width, ///< If not null, receives current image's width
                             unsigned *height, ///< If not null, receives current image's height
@@ -312,6 +528,15 @@ namespace libskry
             return c_Image(SKRY_create_flatfield(pimpl.get(), result));
         }
 
+        /// See SKRY_create_master_frame()
+        c_Image CreateMasterFrame(float rejectionKappa,
+                                  const c_Image &subtracted = c_Image(),
+                                  /// If not null, receives operation result
+                                  enum SKRY_result *result = nullptr)
+        {
+            return c_Image(SKRY_create_master_frame(pimpl.get(), rejectionKappa, subtracted.pimpl.get(), result));
+        }
+
         /** Reinterprets mono images in the sequence as containing
             color filter array data (raw color). */
         void ReinterpretAsCFA(
@@ -327,8 +552,26 @@ namespace libskry
             return SKRY_get_absolute_img_idx(pimpl.get(), activeImgIdx);
         }
 
+        /// Enables reading of images in a background thread, ahead of their use
+        enum SKRY_result EnablePrefetching(
+            size_t queueLen, ///< Max. number of images read ahead
+            /// If not SKRY_PIX_INVALID, the images are additionally converted to this format
+            enum SKRY_pixel_format pixFmt = SKRY_PIX_INVALID,
+            enum SKRY_demosaic_method demosaicMethod = SKRY_DEMOSAIC_SIMPLE)
+        {
+            return SKRY_enable_prefetching(pimpl.get(), queueLen, pixFmt, demosaicMethod);
+        }
+
+        /// Stops the background reading and frees all images read ahead
+        void DisablePrefetching()
+        {
+            SKRY_disable_prefetching(pimpl.get());
+        }
+
         friend class c_ImageAlignment;
         friend class c_QualityEstimation;
+        friend class c_Batch;
+        friend class c_Checkpoint;
     };
 
     /// Movable, non-copyable
@@ -389,6 +632,22 @@ namespace libskry
             return SKRY_img_alignment_step(pimpl.get());
         }
 
+        /// See SKRY_img_alignment_run()
+        enum SKRY_result Run(size_t maxSteps = 0,
+                             SKRY_progress_callback_fn progressCallback = nullptr, void *callbackData = nullptr,
+                             const int *cancelFlag = nullptr)
+        {
+            return SKRY_img_alignment_run(pimpl.get(), maxSteps, progressCallback, callbackData, cancelFlag);
+        }
+
+        /// See SKRY_get_img_align_perf_stats()
+        struct SKRY_perf_stats GetPerfStats() const
+        {
+            struct SKRY_perf_stats stats;
+            SKRY_get_img_align_perf_stats(pimpl.get(), &stats);
+            return stats;
+        }
+
         bool IsComplete() const
         {
             return SKRY_is_img_alignment_complete(pimpl.get());
@@ -414,6 +673,18 @@ namespace libskry
             return SKRY_get_current_centroid_pos(pimpl.get());
         }
 
+        /// See SKRY_set_centroid_alignment_params()
+        enum SKRY_result SetCentroidParams(float brightnessThreshold, unsigned decimation)
+        {
+            return SKRY_set_centroid_alignment_params(pimpl.get(), brightnessThreshold, decimation);
+        }
+
+        /// See SKRY_set_img_align_quality_est()
+        enum SKRY_result SetQualityEstimation(unsigned estimationAreaSize, unsigned detailScale)
+        {
+            return SKRY_set_img_align_quality_est(pimpl.get(), estimationAreaSize, detailScale);
+        }
+
         bool IsAnchorValid(size_t anchorIdx) const
         {
             return SKRY_is_anchor_valid(pimpl.get(), anchorIdx);
@@ -465,6 +736,7 @@ namespace libskry
         }
 
         friend class c_QualityEstimation;
+        friend class c_Checkpoint;
     };
 
     /// Movable, non-copyable
@@ -512,6 +784,42 @@ namespace libskry
         /// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
         enum SKRY_result Step() { return SKRY_quality_est_step(pimpl.get()); }
 
+        /// See SKRY_quality_est_run()
+        enum SKRY_result Run(size_t maxSteps = 0,
+                             SKRY_progress_callback_fn progressCallback = nullptr, void *callbackData = nullptr,
+                             const int *cancelFlag = nullptr)
+        {
+            return SKRY_quality_est_run(pimpl.get(), maxSteps, progressCallback, callbackData, cancelFlag);
+        }
+
+        /// See SKRY_get_quality_est_perf_stats()
+        struct SKRY_perf_stats GetPerfStats() const
+        {
+            struct SKRY_perf_stats stats;
+            SKRY_get_quality_est_perf_stats(pimpl.get(), &stats);
+            return stats;
+        }
+
+        /// See SKRY_set_quality_est_whole_intersection_blur()
+        enum SKRY_result SetWholeIntersectionBlur(bool enabled)
+        {
+            return SKRY_set_quality_est_whole_intersection_blur(pimpl.get(), enabled);
+        }
+
+        /// See SKRY_set_quality_est_metric()
+        enum SKRY_result SetMetric(enum SKRY_quality_metric metric)
+        {
+            return SKRY_set_quality_est_metric(pimpl.get(), metric);
+        }
+
+        /// See SKRY_set_quality_est_decimation()
+        enum SKRY_result SetDecimation(unsigned level)
+        {
+            return SKRY_set_quality_est_decimation(pimpl.get(), level);
+        }
+
+        bool IsApproximate() const { return SKRY_is_qual_est_approximate(pimpl.get()); }
+
         int GetNumOfQualityEstAreas() const { return SKRY_get_qual_est_num_areas(pimpl.get()); }
 
         /// Returns overall quality of each active image in the sequence
@@ -584,6 +892,7 @@ namespace libskry
         }
 
         friend class c_RefPointAlignment;
+        friend class c_Checkpoint;
     };
 
     /// Movable, non-copyable
@@ -684,13 +993,39 @@ namespace libskry
             return result;
         }
 
+        /// Element count of 'positions' and 'isValid' has to be GetNumReferencePoints()
+        void GetReferencePointPositions(int imgIdx, struct SKRY_point positions[], uint8_t isValid[]) const
+        {
+            SKRY_get_ref_pt_positions_in_img(pimpl.get(), imgIdx, positions, isValid);
+        }
+
         bool IsComplete() const { return SKRY_is_ref_pt_alignment_complete(pimpl.get()); }
 
         enum SKRY_result Step() { return SKRY_ref_pt_alignment_step(pimpl.get()); }
 
+        /// See SKRY_ref_pt_alignment_run()
+        enum SKRY_result Run(size_t maxSteps = 0,
+                             SKRY_progress_callback_fn progressCallback = nullptr, void *callbackData = nullptr,
+                             const int *cancelFlag = nullptr)
+        {
+            return SKRY_ref_pt_alignment_run(pimpl.get(), maxSteps, progressCallback, callbackData, cancelFlag);
+        }
+
+        /// See SKRY_get_ref_pt_perf_stats()
+        struct SKRY_perf_stats GetPerfStats() const
+        {
+            struct SKRY_perf_stats stats;
+            SKRY_get_ref_pt_perf_stats(pimpl.get(), &stats);
+            return stats;
+        }
+
+        /// See SKRY_set_ref_pt_adaptive_search()
+        void SetAdaptiveSearch(bool enabled) { SKRY_set_ref_pt_adaptive_search(pimpl.get(), enabled); }
+
         const struct SKRY_triangulation *GetTriangulation() const { return SKRY_get_ref_pts_triangulation(pimpl.get()); }
 
         friend class c_Stacking;
+        friend class c_Checkpoint;
     };
 
     /// Movable, non-copyable
@@ -739,10 +1074,98 @@ namespace libskry
 
         enum SKRY_result Step() { return SKRY_stacking_step(pimpl.get()); }
 
+        /// See SKRY_stacking_run()
+        enum SKRY_result Run(size_t maxSteps = 0,
+                             SKRY_progress_callback_fn progressCallback = nullptr, void *callbackData = nullptr,
+                             const int *cancelFlag = nullptr)
+        {
+            return SKRY_stacking_run(pimpl.get(), maxSteps, progressCallback, callbackData, cancelFlag);
+        }
+
+        /// See SKRY_get_stacking_perf_stats()
+        struct SKRY_perf_stats GetPerfStats() const
+        {
+            struct SKRY_perf_stats stats;
+            SKRY_get_stacking_perf_stats(pimpl.get(), &stats);
+            return stats;
+        }
+
+        /// See SKRY_set_stacking_method()
+        enum SKRY_result SetMethod(enum SKRY_stacking_method method, float kappa = 2.0f)
+        {
+            return SKRY_set_stacking_method(pimpl.get(), method, kappa);
+        }
+
+        /// See SKRY_set_stacking_mem_budget()
+        enum SKRY_result SetMemoryBudget(size_t maxBytes)
+        {
+            return SKRY_set_stacking_mem_budget(pimpl.get(), maxBytes);
+        }
+
+        /// See SKRY_set_stacking_accumulator()
+        enum SKRY_result SetAccumulator(enum SKRY_stacking_accumulator accum)
+        {
+            return SKRY_set_stacking_accumulator(pimpl.get(), accum);
+        }
+
+        /// See SKRY_set_stacking_dark_frame()
+        enum SKRY_result SetDarkFrame(const c_Image &dark)
+        {
+            return SKRY_set_stacking_dark_frame(pimpl.get(), dark.pimpl.get());
+        }
+
+        /// See SKRY_set_stacking_images_per_step()
+        enum SKRY_result SetImagesPerStep(size_t numImages)
+        {
+            return SKRY_set_stacking_images_per_step(pimpl.get(), numImages);
+        }
+
+        /// See SKRY_set_stacking_preview_decimation()
+        enum SKRY_result SetPreviewDecimation(unsigned decimation)
+        {
+            return SKRY_set_stacking_preview_decimation(pimpl.get(), decimation);
+        }
+
+        size_t GetNumPasses() const { return SKRY_get_stacking_num_passes(pimpl.get()); }
+
+        /// See SKRY_set_stacking_img_range()
+        enum SKRY_result SetImageRange(size_t first, size_t count)
+        {
+            return SKRY_set_stacking_img_range(pimpl.get(), first, count);
+        }
+
+        /// See SKRY_set_stacking_ref_pt_positions()
+        enum SKRY_result SetRefPointPositions(const struct SKRY_point_flt positions[], size_t numPoints)
+        {
+            return SKRY_set_stacking_ref_pt_positions(pimpl.get(), positions, numPoints);
+        }
+
+        /// See SKRY_save_partial_stack()
+        enum SKRY_result SavePartialStack(const char *fileName) const
+        {
+            return SKRY_save_partial_stack(pimpl.get(), fileName);
+        }
+
+        /// See SKRY_merge_partial_stacks()
+        static c_Image MergePartialStacks(size_t numFiles, const char *fileNames[],
+                                          enum SKRY_result *result = nullptr)
+        {
+            return c_Image(SKRY_merge_partial_stacks(numFiles, fileNames, result));
+        }
+
         c_Image GetPartialImageStack() const { return c_Image(SKRY_get_partial_image_stack(pimpl.get())); }
 
+        c_Image GetPreviewImageStack() const { return c_Image(SKRY_get_preview_image_stack(pimpl.get())); }
+
         c_Image GetFinalImageStack() const { return c_Image(SKRY_get_img_copy(SKRY_get_image_stack(pimpl.get()))); }
 
+        /// Returns a read-only view of the image stack (without copying); valid as long as the object exists
+        /** Can be used only after stacking completes. The stack has pixel format SKRY_PIX_MONO32F or SKRY_PIX_RGB32F. */
+        c_ImageView<const float> GetImageStackView() const
+        {
+            return c_ImageView<const float>(SKRY_get_image_stack(pimpl.get()));
+        }
+
         bool IsComplete() const { return SKRY_is_stacking_complete(pimpl.get()); }
 
         /// Returns an array of triangle indices stacked in current step
@@ -762,6 +1185,107 @@ namespace libskry
             return SKRY_get_ref_pt_stacking_pos(pimpl.get());
         }
     };
+
+    /// Saving and restoring of processing phases' results
+    class c_Checkpoint
+    {
+    public:
+        /// See SKRY_save_checkpoint(); 'qualEst' and 'refPtAlign' may be null
+        static enum SKRY_result Save(const char *fileName,
+                                     const c_ImageAlignment &imgAlign,
+                                     const c_QualityEstimation *qualEst = nullptr,
+                                     const c_RefPointAlignment *refPtAlign = nullptr)
+        {
+            return SKRY_save_checkpoint(fileName, imgAlign.pimpl.get(),
+                                        qualEst ? qualEst->pimpl.get() : nullptr,
+                                        refPtAlign ? refPtAlign->pimpl.get() : nullptr);
+        }
+
+        /// See SKRY_load_checkpoint(); 'qualEst' and 'refPtAlign' may be null
+        /** The restored objects are bound to 'imgSeq' (and to each other) as if they
+            were created with their respective constructors. */
+        static enum SKRY_result Load(const char *fileName,
+                                     const c_ImageSequence &imgSeq,
+                                     c_ImageAlignment &imgAlign,
+                                     c_QualityEstimation *qualEst = nullptr,
+                                     c_RefPointAlignment *refPtAlign = nullptr)
+        {
+            SKRY_ImgAlignment *skryImgAlign;
+            SKRY_QualityEstimation *skryQualEst;
+            SKRY_RefPtAlignment *skryRefPtAlign;
+            enum SKRY_result result = SKRY_load_checkpoint(fileName, imgSeq.pimpl.get(), &skryImgAlign,
+                                                           qualEst ? &skryQualEst : nullptr,
+                                                           refPtAlign ? &skryRefPtAlign : nullptr);
+
+            imgAlign = c_ImageAlignment(skryImgAlign);
+            imgAlign.imgSeq_pimpl = imgSeq.pimpl;
+            if (qualEst)
+            {
+                *qualEst = c_QualityEstimation(skryQualEst);
+                qualEst->imgSeq_pimpl = imgSeq.pimpl;
+                qualEst->imgAlgn_pimpl = imgAlign.pimpl;
+            }
+            if (refPtAlign && qualEst)
+            {
+                *refPtAlign = c_RefPointAlignment(skryRefPtAlign);
+                refPtAlign->imgSeq_pimpl = imgSeq.pimpl;
+                refPtAlign->imgAlgn_pimpl = imgAlign.pimpl;
+                refPtAlign->qualEst_pimpl = qualEst->pimpl;
+            }
+
+            return result;
+        }
+    };
+
+    /// Movable, non-copyable
+    class c_Batch: public ISkryPtrWrapper
+    {
+        /// Image sequences of all jobs; declared before 'pimpl', so that they are freed after the batch
+        std::vector<std::shared_ptr<SKRY_ImgSequence>> imgSeqs;
+        std::unique_ptr<SKRY_Batch, SKRY_Batch *(*)(SKRY_Batch *)> pimpl;
+
+    public:
+        explicit virtual operator bool() const { return pimpl != nullptr; }
+
+        c_Batch(): pimpl(nullptr, SKRY_free_batch) { }
+
+        c_Batch(const c_Batch &)             = delete;
+
+        c_Batch & operator=(const c_Batch &) = delete;
+
+        c_Batch(c_Batch &&)                  = default;
+
+        c_Batch & operator=(c_Batch &&)      = default;
+
+        /// See SKRY_create_batch()
+        c_Batch(unsigned numWorkers, unsigned maxActiveJobs = 0, enum SKRY_result *result = nullptr)
+        : pimpl(SKRY_create_batch(numWorkers, maxActiveJobs, result), SKRY_free_batch)
+        { }
+
+        /// Adds a job processing 'imgSeq'; the 'img_seq' and 'flatfield' fields of 'params' are ignored
+        /** 'imgSeq' must not be used until the job completes. See SKRY_add_batch_job(). */
+        enum SKRY_result AddJob(const c_ImageSequence &imgSeq,
+                                struct SKRY_batch_job_params params,
+                                /// May be null; has to remain valid until the job starts
+                                const c_Image *flatfield = nullptr,
+                                /// If not null, receives the job's index
+                                size_t *jobIdx = nullptr)
+        {
+            params.img_seq = imgSeq.pimpl.get();
+            params.flatfield = flatfield ? flatfield->pimpl.get() : nullptr;
+            imgSeqs.push_back(imgSeq.pimpl);
+            return SKRY_add_batch_job(pimpl.get(), &params, jobIdx);
+        }
+
+        bool IsJobComplete(size_t jobIdx) const { return SKRY_is_batch_job_complete(pimpl.get(), jobIdx); }
+
+        enum SKRY_result WaitForJob(size_t jobIdx) { return SKRY_wait_for_batch_job(pimpl.get(), jobIdx); }
+
+        void WaitForAll() { SKRY_wait_for_batch(pimpl.get()); }
+
+        /// See SKRY_take_batch_job_stack()
+        c_Image TakeJobStack(size_t jobIdx) { return c_Image(SKRY_take_batch_job_stack(pimpl.get(), jobIdx)); }
+    };
 }
 
 #endif // LIB_STACKISTRY_CPP_HEADER
@@ -30,6 +30,41 @@ File description:
 
 typedef struct SKRY_stacking SKRY_Stacking;
 
+enum SKRY_stacking_method
+{
+    /// Average of all values of a pixel (default)
+    SKRY_STACK_MEAN = 0,
+
+    /// Average of values not farther than kappa*sigma from the mean
+    /** Requires two passes over the image sequence: the first one determines each pixel's mean
+        and standard deviation, the second one skips pixels deviating too much in any channel. */
+    SKRY_STACK_KAPPA_SIGMA,
+
+    /// Median of all values of a pixel
+    /** All values of a pixel have to be collected, so the stack is built in bands of rows,
+        each requiring a pass over the image sequence. Band height is determined by
+        the memory budget (see SKRY_set_stacking_mem_budget()). */
+    SKRY_STACK_MEDIAN
+};
+
+enum SKRY_stacking_accumulator
+{
+    /// Single-precision floating-point sums and pixel counts (default)
+    SKRY_STACK_ACCUM_FLOAT = 0,
+
+    /// 32-bit integer sums and 16-bit pixel counts
+    /** Images are stacked in their native integer format (demosaiced if needed)
+        instead of being converted to floating-point; sums are fixed-point values
+        whose precision depends on the number of images and the flat-field.
+        Uses ca. half the memory of SKRY_STACK_ACCUM_FLOAT. Used only with SKRY_STACK_MEAN,
+        images with 8 or 16 bits per channel and at most 65535 images; otherwise
+        SKRY_STACK_ACCUM_FLOAT is used instead. */
+    SKRY_STACK_ACCUM_FIXED_POINT
+};
+
+/// Default memory budget (in bytes) of SKRY_STACK_MEDIAN
+#define SKRY_STACKING_DEFAULT_MEM_BUDGET ((size_t)512 * 1024 * 1024)
+
 SKRY_Stacking *SKRY_init_stacking(const SKRY_RefPtAlignment *ref_pt_align,
                                   /// May be null; no longer used after the function returns
                                   const SKRY_Image *flatfield,
@@ -40,18 +75,121 @@ SKRY_Stacking *SKRY_init_stacking(const SKRY_RefPtAlignment *ref_pt_align,
 SKRY_Stacking *SKRY_free_stacking(SKRY_Stacking *stacking);
 
 /// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
+/** Each step stacks one image (or more, see SKRY_set_stacking_images_per_step()).
+    Methods other than SKRY_STACK_MEAN may perform several passes over the image
+    sequence (see SKRY_get_stacking_num_passes()). */
 enum SKRY_result SKRY_stacking_step(SKRY_Stacking *stacking);
 
+/// Performs up to 'max_steps' steps (all remaining steps if zero); see SKRY_img_alignment_run()
+/** Equivalent to calling SKRY_stacking_step() repeatedly. Progress covers all passes over the image sequence
+    (see SKRY_get_stacking_num_passes()): in pass 'p', 'num_done' is 'p' times the number of active images
+    plus the images processed in that pass, and 'num_total' is the number of passes times the number of active images. */
+enum SKRY_result SKRY_stacking_run(SKRY_Stacking *stacking, size_t max_steps,
+                                   SKRY_progress_callback_fn progress_callback, void *callback_data,
+                                   const int *cancel_flag);
+
+/// Receives performance counters of all steps performed so far (see SKRY_enable_perf_stats())
+/** The counters of a step are the change of the process-wide totals during the step,
+    so they include all work done in the meantime, also by other threads. If more than
+    one image sequence is processed at a time (e.g. by SKRY_Batch), the values are
+    meaningless; use SKRY_get_perf_stats() for the totals instead. */
+void SKRY_get_stacking_perf_stats(const SKRY_Stacking *stacking, struct SKRY_perf_stats *stats);
+
+/// Selects the way pixel values from subsequent images are combined (default: SKRY_STACK_MEAN)
+/** 'kappa' (used by SKRY_STACK_KAPPA_SIGMA) has to be positive. Has to be called before the first
+    SKRY_stacking_step(); returns SKRY_SUCCESS or SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_stacking_method(SKRY_Stacking *stacking, enum SKRY_stacking_method method, float kappa);
+
+/// Sets the max. amount of memory used for pixel values collected by SKRY_STACK_MEDIAN
+/** The fewer rows of the stack fit in the budget, the more passes over the image sequence
+    are needed. The default is SKRY_STACKING_DEFAULT_MEM_BUDGET. Has to be called before
+    the first SKRY_stacking_step(); returns SKRY_SUCCESS or SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_stacking_mem_budget(SKRY_Stacking *stacking, size_t max_bytes);
+
+/// Selects the accumulator format (default: SKRY_STACK_ACCUM_FLOAT)
+/** Has to be called before the first SKRY_stacking_step(); returns SKRY_SUCCESS or SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_stacking_accumulator(SKRY_Stacking *stacking, enum SKRY_stacking_accumulator accum);
+
+/// Sets the dark frame subtracted from images before applying the flat-field (default: none)
+/** 'dark' (e.g. created with SKRY_create_master_frame()) should have the size of the images;
+    it is copied, so it can be freed after the call. For color images, an RGB 'dark' is subtracted
+    per channel (a mono one from all channels). For raw color images, a mono 'dark' is treated
+    as a mosaic of raw values (as created by SKRY_create_master_frame()) and demosaiced like the images;
+    as the demosaicing is linear, this is equivalent to subtracting it before demosaicing
+    (up to the images' rounding). Negative results of the subtraction are clamped to zero, with every
+    stacking method and accumulator. Has to be called before the first SKRY_stacking_step();
+    returns SKRY_SUCCESS, SKRY_INVALID_PARAMETERS or SKRY_OUT_OF_MEMORY. */
+enum SKRY_result SKRY_set_stacking_dark_frame(SKRY_Stacking *stacking, const SKRY_Image *dark);
+
+/// Sets the max. number of images stacked at the same time in each step (default: 1)
+/** The images are read one by one, and then converted and warped into the stack
+    in parallel. This keeps all threads busy even if few triangles are valid in each
+    image (e.g. in bad seeing). The stack does not depend on the number of images
+    per step, but fragments of all of them are kept in memory at once. Has to be
+    called before the first SKRY_stacking_step(); returns SKRY_SUCCESS or
+    SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_stacking_images_per_step(SKRY_Stacking *stacking, size_t num_images);
+
+/// Enables a downsampled preview of the stack (see SKRY_get_preview_image_stack())
+/** 'decimation' is the preview's downsampling factor; it has to be a power of 2 not greater
+    than 64, or 0 (disables the preview; default). Maintaining the preview costs little
+    compared to stacking. Has to be called before the first SKRY_stacking_step(); returns
+    SKRY_SUCCESS or SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_stacking_preview_decimation(SKRY_Stacking *stacking, unsigned decimation);
+
+/// Returns the number of passes over the image sequence (known after the first SKRY_stacking_step())
+size_t SKRY_get_stacking_num_passes(const SKRY_Stacking *stacking);
+
+/// Restricts stacking to 'count' active images, starting with the active image no. 'first'
+/** Meant for distributing stacking of a sequence among several processes or machines;
+    the results are combined with SKRY_save_partial_stack() and SKRY_merge_partial_stacks().
+    Has to be called before the first SKRY_stacking_step(); returns SKRY_SUCCESS
+    or SKRY_INVALID_PARAMETERS. */
+enum SKRY_result SKRY_set_stacking_img_range(SKRY_Stacking *stacking, size_t first, size_t count);
+
+/// Replaces the reference points' stacking positions (by default calculated by reference point alignment)
+/** All partial stacks to be merged have to use the same positions (e.g. those returned by
+    SKRY_get_ref_pt_stacking_pos() of one of them). 'num_points' has to equal the number
+    of reference points. Has to be called before the first SKRY_stacking_step(); returns
+    SKRY_SUCCESS, SKRY_INVALID_PARAMETERS or SKRY_OUT_OF_MEMORY. */
+enum SKRY_result SKRY_set_stacking_ref_pt_positions(SKRY_Stacking *stacking,
+                                                    const struct SKRY_point_flt positions[],
+                                                    size_t num_points);
+
+/// Saves the accumulated (not yet averaged) pixel values and counts
+/** Can be used only with SKRY_STACK_MEAN, after stacking completes. The file format
+    does not depend on the machine's endianness. */
+enum SKRY_result SKRY_save_partial_stack(const SKRY_Stacking *stacking, const char *file_name);
+
+/// Combines partial stacks saved with SKRY_save_partial_stack() into the final image stack
+/** All partial stacks have to have the same size and pixel format and have to be created
+    with (or all without) a flat-field. Returns SKRY_PIX_MONO32F or SKRY_PIX_RGB32F image
+    or null on error. */
+SKRY_Image *SKRY_merge_partial_stacks(size_t num_files,
+                                      const char *file_names[],
+                                      /// If not null, receives operation result
+                                      enum SKRY_result *result);
+
 /// Can be used only after stacking completes
 const SKRY_Image *SKRY_get_image_stack(const SKRY_Stacking *stacking);
 
 /// Returns an incomplete image stack, updated after every stacking step
+/** For SKRY_STACK_MEDIAN, only the bands of rows completed in previous passes are filled. */
 SKRY_Image *SKRY_get_partial_image_stack(const SKRY_Stacking *stacking);
 
+/// Returns a downsampled incomplete image stack, updated after every stacking step
+/** Each pixel is the average of all values stacked in the corresponding block of the stack's
+    pixels, so the preview is much cheaper to obtain than SKRY_get_partial_image_stack().
+    For methods other than SKRY_STACK_MEAN it shows the average of the values accepted
+    in the current pass. Returns null if the preview has not been enabled with
+    SKRY_set_stacking_preview_decimation() or if out of memory. */
+SKRY_Image *SKRY_get_preview_image_stack(const SKRY_Stacking *stacking);
+
 int SKRY_is_stacking_complete(const SKRY_Stacking *stacking);
 
 /// Returns an array of triangle indices stacked in current step
-/** Meant to be called right after SKRY_stacking_step(). Values are indices into triangle array
+/** Meant to be called right after SKRY_stacking_step(); contains the triangles stacked
+    in any of the step's images. Values are indices into triangle array
     of the triangulation returned by SKRY_get_ref_pts_triangulation(). Vertex coordinates do not
     correspond with the triangulation, but with the array returned by 'SKRY_get_ref_pt_stacking_pos'. */
 const size_t *SKRY_get_curr_step_stacked_triangles(
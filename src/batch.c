@@ -0,0 +1,492 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Batch processing implementation.
+*/
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include <skry/batch.h>
+#include <skry/img_align.h>
+#include <skry/quality.h>
+#include <skry/ref_pt_align.h>
+#include <skry/stacking.h>
+
+#include "utils/dnarray.h"
+#include "utils/logging.h"
+#include "utils/threads.h"
+
+
+/// Processing phase of a job; accessed only by the worker performing the job's step
+enum job_phase
+{
+    JOB_NOT_STARTED,
+    JOB_IMG_ALIGNMENT,
+    JOB_QUALITY_EST,
+    JOB_REF_PT_ALIGNMENT,
+    JOB_STACKING
+};
+
+struct batch_job
+{
+    /// The pointer fields refer to the job's own copies (see 'copy_job_params()')
+    struct SKRY_batch_job_params params;
+
+    // Fields below are accessed with 'SKRY_batch::mutex' locked
+    int is_started;
+    int is_running; ///< True if a worker is performing the job's step
+    int is_complete;
+    enum SKRY_result result; ///< Valid only if 'is_complete'
+
+    /// Set by the job's last step; can be taken once 'is_complete' is set
+    SKRY_Image *image_stack;
+
+    // Fields below are accessed only by the worker performing the job's step
+    enum job_phase phase;
+    SKRY_ImgAlignment      *img_algn;
+    SKRY_QualityEstimation *qual_est;
+    SKRY_RefPtAlignment    *ref_pt_align;
+    SKRY_Stacking          *stacking;
+};
+
+struct SKRY_batch
+{
+    struct mutex *mutex;
+
+    /// Broadcast when a job becomes ready for its next step or completes, and on shutdown
+    struct cond_var *jobs_changed;
+
+    /// Jobs in the order of adding; they are separately allocated, so that workers can access them without locking
+    DA_DECLARE(struct batch_job *) jobs;
+
+    /// All jobs before this one are complete
+    size_t first_incomplete_job;
+
+    /// Index in 'jobs' where the search for the next step to perform starts (so that jobs get their steps in turn)
+    size_t next_job;
+
+    size_t num_active_jobs; ///< Number of started and not yet completed jobs
+    size_t max_active_jobs;
+
+    int quit; ///< If true, workers finish their current steps and exit
+
+    size_t num_workers;
+    struct thread **workers;
+
+    /// Number of threads used by each worker's OpenMP parallel regions
+    int threads_per_worker;
+};
+
+/// Frees the job's objects of all processing phases
+static
+void free_job_phases(struct batch_job *job)
+{
+    job->stacking     = SKRY_free_stacking(job->stacking);
+    job->ref_pt_align = SKRY_free_ref_pt_alignment(job->ref_pt_align);
+    job->qual_est     = SKRY_free_quality_est(job->qual_est);
+    job->img_algn     = SKRY_free_img_alignment(job->img_algn);
+}
+
+/// Frees the job's copies of the arrays and images referred to by its parameters
+static
+void free_job_params(struct batch_job *job)
+{
+    free((void *)job->params.anchors);
+    job->params.anchors = 0;
+    free((void *)job->params.ref_points);
+    job->params.ref_points = 0;
+    SKRY_free_image((SKRY_Image *)job->params.flatfield);
+    job->params.flatfield = 0;
+}
+
+/// Sets 'job->params' to 'params', copying the arrays and images they refer to; returns SKRY_SUCCESS or SKRY_OUT_OF_MEMORY
+/** On failure, no copies remain allocated. */
+static
+enum SKRY_result copy_job_params(struct batch_job *job, const struct SKRY_batch_job_params *params)
+{
+    job->params = *params;
+    job->params.anchors = 0;
+    job->params.ref_points = 0;
+    job->params.flatfield = 0;
+
+    if (params->num_anchors && params->anchors)
+    {
+        struct SKRY_point *anchors = malloc(params->num_anchors * sizeof(*anchors));
+        if (!anchors)
+            return SKRY_OUT_OF_MEMORY;
+        memcpy(anchors, params->anchors, params->num_anchors * sizeof(*anchors));
+        job->params.anchors = anchors;
+    }
+
+    if (params->num_ref_points && params->ref_points)
+    {
+        struct SKRY_point *ref_points = malloc(params->num_ref_points * sizeof(*ref_points));
+        if (!ref_points)
+        {
+            free_job_params(job);
+            return SKRY_OUT_OF_MEMORY;
+        }
+        memcpy(ref_points, params->ref_points, params->num_ref_points * sizeof(*ref_points));
+        job->params.ref_points = ref_points;
+    }
+
+    if (params->flatfield)
+    {
+        job->params.flatfield = SKRY_get_img_copy(params->flatfield);
+        if (!job->params.flatfield)
+        {
+            free_job_params(job);
+            return SKRY_OUT_OF_MEMORY;
+        }
+    }
+
+    return SKRY_SUCCESS;
+}
+
+/// Performs a single step of the job's processing
+/** Returns SKRY_SUCCESS (more steps left to do), SKRY_LAST_STEP (job completed) or an error.
+    Advances to the next phase when the current one completes. */
+static
+enum SKRY_result perform_job_step(struct batch_job *job)
+{
+    const struct SKRY_batch_job_params *params = &job->params;
+    enum SKRY_result result = SKRY_SUCCESS;
+
+    switch (job->phase)
+    {
+    case JOB_NOT_STARTED:
+        job->img_algn = SKRY_init_img_alignment(params->img_seq, params->img_align_method,
+                                                params->num_anchors, params->anchors,
+                                                params->anchor_block_radius, params->anchor_search_radius,
+                                                params->anchor_placement_brightness_threshold,
+                                                &result);
+        if (SKRY_SUCCESS == result)
+            job->phase = JOB_IMG_ALIGNMENT;
+        break;
+
+    case JOB_IMG_ALIGNMENT:
+        result = SKRY_img_alignment_step(job->img_algn);
+        if (SKRY_LAST_STEP == result)
+        {
+            job->qual_est = SKRY_init_quality_est(job->img_algn, params->estimation_area_size, params->detail_scale);
+            if (job->qual_est)
+            {
+                job->phase = JOB_QUALITY_EST;
+                result = SKRY_SUCCESS;
+            }
+            else
+                result = SKRY_OUT_OF_MEMORY;
+        }
+        break;
+
+    case JOB_QUALITY_EST:
+        result = SKRY_quality_est_step(job->qual_est);
+        if (SKRY_LAST_STEP == result)
+        {
+            job->ref_pt_align = SKRY_init_ref_pt_alignment(job->qual_est,
+                                                           params->num_ref_points, params->ref_points,
+                                                           params->quality_criterion, params->quality_threshold,
+                                                           params->ref_block_size, params->ref_pt_search_radius,
+                                                           &result,
+                                                           params->ref_pt_placement_brightness_threshold,
+                                                           params->structure_threshold,
+                                                           params->structure_scale,
+                                                           params->ref_pt_spacing);
+            if (SKRY_SUCCESS == result)
+                job->phase = JOB_REF_PT_ALIGNMENT;
+        }
+        break;
+
+    case JOB_REF_PT_ALIGNMENT:
+        result = SKRY_ref_pt_alignment_step(job->ref_pt_align);
+        if (SKRY_LAST_STEP == result)
+        {
+            job->stacking = SKRY_init_stacking(job->ref_pt_align, params->flatfield, &result);
+            if (SKRY_SUCCESS == result && params->stacking_mem_budget)
+                result = SKRY_set_stacking_mem_budget(job->stacking, params->stacking_mem_budget);
+            if (SKRY_SUCCESS == result)
+                job->phase = JOB_STACKING;
+        }
+        break;
+
+    case JOB_STACKING:
+        result = SKRY_stacking_step(job->stacking);
+        if (SKRY_LAST_STEP == result)
+        {
+            job->image_stack = SKRY_get_img_copy(SKRY_get_image_stack(job->stacking));
+            if (!job->image_stack)
+                result = SKRY_OUT_OF_MEMORY;
+        }
+        break;
+    }
+
+    if (SKRY_SUCCESS != result)
+    {
+        free_job_phases(job);
+        free_job_params(job);
+    }
+
+    return result;
+}
+
+/// Returns the job whose step is to be performed next, or null if there is none; 'batch->mutex' has to be locked
+static
+struct batch_job *find_job_to_step(SKRY_Batch *batch)
+{
+    size_t num_jobs = DA_SIZE(batch->jobs);
+    if (batch->first_incomplete_job == num_jobs)
+        return 0;
+
+    // First, continue jobs in progress, in turn
+    if (batch->next_job < batch->first_incomplete_job || batch->next_job >= num_jobs)
+        batch->next_job = batch->first_incomplete_job;
+
+    size_t i = batch->next_job;
+    do
+    {
+        struct batch_job *job = batch->jobs.data[i];
+        if (job->is_started && !job->is_running && !job->is_complete)
+        {
+            batch->next_job = i + 1;
+            return job;
+        }
+
+        if (++i == num_jobs)
+            i = batch->first_incomplete_job;
+    } while (i != batch->next_job);
+
+    // Otherwise start the earliest added job, if allowed
+    if (batch->num_active_jobs < batch->max_active_jobs)
+        for (i = batch->first_incomplete_job; i < num_jobs; i++)
+        {
+            struct batch_job *job = batch->jobs.data[i];
+            if (!job->is_started)
+            {
+                job->is_started = 1;
+                batch->num_active_jobs++;
+                return job;
+            }
+        }
+
+    return 0;
+}
+
+static
+void worker_func(void *arg)
+{
+    SKRY_Batch *batch = arg;
+
+#if defined(_OPENMP)
+    // Applies to the parallel regions started by this thread
+    omp_set_num_threads(batch->threads_per_worker);
+#endif
+
+    lock_mutex(batch->mutex);
+    for (;;)
+    {
+        struct batch_job *job = 0;
+        while (!batch->quit && !(job = find_job_to_step(batch)))
+            wait_cond_var(batch->jobs_changed, batch->mutex);
+
+        if (batch->quit)
+            break;
+
+        job->is_running = 1;
+        unlock_mutex(batch->mutex);
+
+        enum SKRY_result result = perform_job_step(job);
+
+        lock_mutex(batch->mutex);
+        job->is_running = 0;
+        if (SKRY_SUCCESS != result)
+        {
+            job->is_complete = 1;
+            job->result = (SKRY_LAST_STEP == result) ? SKRY_SUCCESS : result;
+            batch->num_active_jobs--;
+
+            while (batch->first_incomplete_job < DA_SIZE(batch->jobs)
+                   && batch->jobs.data[batch->first_incomplete_job]->is_complete)
+            {
+                batch->first_incomplete_job++;
+            }
+
+            LOG_MSG(SKRY_LOG_BATCH, "Batch job %p (img. seq. %p) completed: %s.",
+                    (void *)job, (void *)job->params.img_seq,
+                    (SKRY_SUCCESS == job->result) ? "success" : "failure");
+        }
+        // Another worker may be waiting for the job's next step
+        broadcast_cond_var(batch->jobs_changed);
+    }
+    unlock_mutex(batch->mutex);
+}
+
+SKRY_Batch *SKRY_create_batch(unsigned num_workers, unsigned max_active_jobs, enum SKRY_result *result)
+{
+#if defined(_OPENMP)
+    int num_procs = omp_get_num_procs();
+#else
+    int num_procs = 1;
+#endif
+    if (0 == num_workers)
+        num_workers = num_procs;
+    if (0 == max_active_jobs)
+        max_active_jobs = num_workers;
+
+    SKRY_Batch *batch = malloc(sizeof(*batch));
+    if (!batch)
+    {
+        if (result) *result = SKRY_OUT_OF_MEMORY;
+        return 0;
+    }
+    *batch = (SKRY_Batch) { 0 };
+
+    batch->max_active_jobs = max_active_jobs;
+    batch->threads_per_worker = (num_procs > (int)num_workers) ? num_procs / (int)num_workers : 1;
+    DA_ALLOC(batch->jobs, 0);
+
+    batch->mutex = create_mutex();
+    batch->jobs_changed = create_cond_var();
+    batch->workers = malloc(num_workers * sizeof(*batch->workers));
+    if (!batch->mutex || !batch->jobs_changed || !batch->workers)
+    {
+        SKRY_free_batch(batch);
+        if (result) *result = SKRY_OUT_OF_MEMORY;
+        return 0;
+    }
+
+    for (; batch->num_workers < num_workers; batch->num_workers++)
+    {
+        batch->workers[batch->num_workers] = start_thread(worker_func, batch);
+        if (!batch->workers[batch->num_workers])
+        {
+            SKRY_free_batch(batch);
+            if (result) *result = SKRY_CANNOT_START_THREAD;
+            return 0;
+        }
+    }
+
+    LOG_MSG(SKRY_LOG_BATCH, "Created batch %p with %u worker(s), %d thread(s) each.",
+            (void *)batch, num_workers, batch->threads_per_worker);
+
+    if (result) *result = SKRY_SUCCESS;
+    return batch;
+}
+
+SKRY_Batch *SKRY_free_batch(SKRY_Batch *batch)
+{
+    if (batch)
+    {
+        if (batch->num_workers)
+        {
+            lock_mutex(batch->mutex);
+            batch->quit = 1;
+            broadcast_cond_var(batch->jobs_changed);
+            unlock_mutex(batch->mutex);
+
+            for (size_t i = 0; i < batch->num_workers; i++)
+                join_thread(batch->workers[i]);
+        }
+        free(batch->workers);
+
+        for (size_t i = 0; i < DA_SIZE(batch->jobs); i++)
+        {
+            free_job_phases(batch->jobs.data[i]);
+            free_job_params(batch->jobs.data[i]);
+            SKRY_free_image(batch->jobs.data[i]->image_stack);
+            free(batch->jobs.data[i]);
+        }
+        DA_FREE(batch->jobs);
+
+        free_cond_var(batch->jobs_changed);
+        free_mutex(batch->mutex);
+        free(batch);
+    }
+    return 0;
+}
+
+enum SKRY_result SKRY_add_batch_job(SKRY_Batch *batch,
+                                    const struct SKRY_batch_job_params *params,
+                                    size_t *job_idx)
+{
+    struct batch_job *job = malloc(sizeof(*job));
+    if (!job)
+        return SKRY_OUT_OF_MEMORY;
+
+    *job = (struct batch_job) { .phase = JOB_NOT_STARTED };
+    if (SKRY_SUCCESS != copy_job_params(job, params))
+    {
+        free(job);
+        return SKRY_OUT_OF_MEMORY;
+    }
+
+    lock_mutex(batch->mutex);
+    if (job_idx)
+        *job_idx = DA_SIZE(batch->jobs);
+    DA_APPEND(batch->jobs, job);
+    broadcast_cond_var(batch->jobs_changed);
+    unlock_mutex(batch->mutex);
+
+    return SKRY_SUCCESS;
+}
+
+int SKRY_is_batch_job_complete(const SKRY_Batch *batch, size_t job_idx)
+{
+    lock_mutex(batch->mutex);
+    int is_complete = batch->jobs.data[job_idx]->is_complete;
+    unlock_mutex(batch->mutex);
+    return is_complete;
+}
+
+enum SKRY_result SKRY_wait_for_batch_job(SKRY_Batch *batch, size_t job_idx)
+{
+    lock_mutex(batch->mutex);
+    struct batch_job *job = batch->jobs.data[job_idx];
+    while (!job->is_complete)
+        wait_cond_var(batch->jobs_changed, batch->mutex);
+    enum SKRY_result result = job->result;
+    unlock_mutex(batch->mutex);
+    return result;
+}
+
+void SKRY_wait_for_batch(SKRY_Batch *batch)
+{
+    lock_mutex(batch->mutex);
+    while (batch->first_incomplete_job < DA_SIZE(batch->jobs))
+        wait_cond_var(batch->jobs_changed, batch->mutex);
+    unlock_mutex(batch->mutex);
+}
+
+SKRY_Image *SKRY_take_batch_job_stack(SKRY_Batch *batch, size_t job_idx)
+{
+    lock_mutex(batch->mutex);
+    struct batch_job *job = batch->jobs.data[job_idx];
+    SKRY_Image *image_stack = 0;
+    if (job->is_complete)
+    {
+        image_stack = job->image_stack;
+        job->image_stack = 0;
+    }
+    unlock_mutex(batch->mutex);
+    return image_stack;
+}
@@ -0,0 +1,381 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Checkpoint (saved results of processing phases) implementation.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <skry/checkpoint.h>
+#include <skry/defs.h>
+#include <skry/image.h>
+#include <skry/img_align.h>
+#include <skry/imgseq.h>
+#include <skry/quality.h>
+#include <skry/ref_pt_align.h>
+#include <skry/skry.h>
+
+#include "checkpoint_internal.h"
+#include "utils/logging.h"
+#include "utils/misc.h"
+
+
+/// Signature of checkpoint files created by SKRY_save_checkpoint()
+static const char CHECKPOINT_SIGNATURE[8] = { 'S', 'K', 'R', 'Y', 'C', 'K', 'P', 'T' };
+
+#define CHECKPOINT_FILE_VERSION 1
+
+/** A checkpoint file consists of:
+      - signature, version and the set of stored phases (a combination of PHASE_ flags)
+      - image sequence identification (see 'write_img_seq_identity()')
+      - image alignment state
+      - quality estimation state (if PHASE_QUALITY_EST is set)
+      - reference point alignment state (if PHASE_REF_PT_ALIGNMENT is set) */
+enum
+{
+    PHASE_IMG_ALIGNMENT    = 1U << 0,
+    PHASE_QUALITY_EST      = 1U << 1,
+    PHASE_REF_PT_ALIGNMENT = 1U << 2
+};
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME        1099511628211ULL
+
+void ckpt_set_error(struct checkpoint_file *ckpt, enum SKRY_result result)
+{
+    if (SKRY_SUCCESS == ckpt->result)
+        ckpt->result = result;
+}
+
+static
+void write_bytes(struct checkpoint_file *ckpt, const void *bytes, size_t count)
+{
+    if (SKRY_SUCCESS == ckpt->result && fwrite(bytes, count, 1, ckpt->file) != 1)
+        ckpt->result = SKRY_FILE_IO_ERROR;
+}
+
+/// Fills 'bytes' with zeros on failure
+static
+void read_bytes(struct checkpoint_file *ckpt, void *bytes, size_t count)
+{
+    if (SKRY_SUCCESS != ckpt->result || fread(bytes, count, 1, ckpt->file) != 1)
+    {
+        // A truncated file is as unusable as a malformed one
+        ckpt_set_error(ckpt, SKRY_UNSUPPORTED_FILE_FORMAT);
+        memset(bytes, 0, count);
+    }
+}
+
+void ckpt_write_u8(struct checkpoint_file *ckpt, uint8_t value)
+{
+    write_bytes(ckpt, &value, sizeof(value));
+}
+
+void ckpt_write_u16(struct checkpoint_file *ckpt, uint16_t value)
+{
+    value = cnd_swap_16(value, ckpt->do_swap);
+    write_bytes(ckpt, &value, sizeof(value));
+}
+
+void ckpt_write_u32(struct checkpoint_file *ckpt, uint32_t value)
+{
+    value = cnd_swap_32(value, ckpt->do_swap);
+    write_bytes(ckpt, &value, sizeof(value));
+}
+
+void ckpt_write_u64(struct checkpoint_file *ckpt, uint64_t value)
+{
+    value = cnd_swap_64(value, ckpt->do_swap);
+    write_bytes(ckpt, &value, sizeof(value));
+}
+
+void ckpt_write_i32(struct checkpoint_file *ckpt, int32_t value)
+{
+    ckpt_write_u32(ckpt, (uint32_t)value);
+}
+
+void ckpt_write_flt(struct checkpoint_file *ckpt, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    ckpt_write_u32(ckpt, bits);
+}
+
+void ckpt_write_point(struct checkpoint_file *ckpt, struct SKRY_point point)
+{
+    ckpt_write_i32(ckpt, point.x);
+    ckpt_write_i32(ckpt, point.y);
+}
+
+uint8_t ckpt_read_u8(struct checkpoint_file *ckpt)
+{
+    uint8_t value;
+    read_bytes(ckpt, &value, sizeof(value));
+    return value;
+}
+
+uint16_t ckpt_read_u16(struct checkpoint_file *ckpt)
+{
+    uint16_t value;
+    read_bytes(ckpt, &value, sizeof(value));
+    return cnd_swap_16(value, ckpt->do_swap);
+}
+
+uint32_t ckpt_read_u32(struct checkpoint_file *ckpt)
+{
+    uint32_t value;
+    read_bytes(ckpt, &value, sizeof(value));
+    return cnd_swap_32(value, ckpt->do_swap);
+}
+
+uint64_t ckpt_read_u64(struct checkpoint_file *ckpt)
+{
+    uint64_t value;
+    read_bytes(ckpt, &value, sizeof(value));
+    return cnd_swap_64(value, ckpt->do_swap);
+}
+
+int32_t ckpt_read_i32(struct checkpoint_file *ckpt)
+{
+    return (int32_t)ckpt_read_u32(ckpt);
+}
+
+float ckpt_read_flt(struct checkpoint_file *ckpt)
+{
+    uint32_t bits = ckpt_read_u32(ckpt);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+struct SKRY_point ckpt_read_point(struct checkpoint_file *ckpt)
+{
+    struct SKRY_point point;
+    point.x = ckpt_read_i32(ckpt);
+    point.y = ckpt_read_i32(ckpt);
+    return point;
+}
+
+static
+uint64_t fnv1a_update(uint64_t hash, const uint8_t *bytes, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    return hash;
+}
+
+/// Updates 'hash' with the size, pixel format and pixel values of the specified image
+/** 16-bit values are hashed in little-endian byte order, so the result does not depend
+    on the machine's endianness. */
+static
+enum SKRY_result hash_image(const SKRY_ImgSequence *img_seq, size_t img_idx, int do_swap, uint64_t *hash)
+{
+    enum SKRY_result result;
+    SKRY_Image *img = SKRY_get_img_by_index(img_seq, img_idx, &result);
+    if (!img)
+        return result;
+
+    uint32_t props[3] = { SKRY_get_img_width(img), SKRY_get_img_height(img), SKRY_get_img_pix_fmt(img) };
+    for (int i = 0; i < 3; i++)
+    {
+        props[i] = cnd_swap_32(props[i], do_swap);
+        *hash = fnv1a_update(*hash, (const uint8_t *)&props[i], sizeof(props[i]));
+    }
+
+    size_t line_len = SKRY_get_img_width(img) * SKRY_get_bytes_per_pixel(img);
+    int swap_words = do_swap && 16 == BITS_PER_CHANNEL[SKRY_get_img_pix_fmt(img)];
+    for (unsigned y = 0; y < SKRY_get_img_height(img); y++)
+    {
+        const uint8_t *line = SKRY_get_line(img, y);
+        if (swap_words)
+            for (size_t i = 0; i < line_len; i += 2)
+            {
+                const uint8_t swapped[2] = { line[i+1], line[i] };
+                *hash = fnv1a_update(*hash, swapped, 2);
+            }
+        else
+            *hash = fnv1a_update(*hash, line, line_len);
+    }
+
+    SKRY_free_image(img);
+    return SKRY_SUCCESS;
+}
+
+/// Returns a hash of the first and the last active image of 'img_seq'
+static
+enum SKRY_result get_img_seq_hash(const SKRY_ImgSequence *img_seq, int do_swap, uint64_t *hash)
+{
+    size_t num_active = SKRY_get_active_img_count(img_seq);
+
+    *hash = FNV_OFFSET_BASIS;
+    enum SKRY_result result = hash_image(img_seq, SKRY_get_absolute_img_idx(img_seq, 0), do_swap, hash);
+    if (SKRY_SUCCESS == result && num_active > 1)
+        result = hash_image(img_seq, SKRY_get_absolute_img_idx(img_seq, num_active - 1), do_swap, hash);
+
+    return result;
+}
+
+/** Stores the type of 'img_seq', its number of images, active images' flags
+    and a hash of the first and the last active image. */
+static
+void write_img_seq_identity(struct checkpoint_file *ckpt, const SKRY_ImgSequence *img_seq)
+{
+    uint64_t hash;
+    enum SKRY_result result = get_img_seq_hash(img_seq, ckpt->do_swap, &hash);
+    if (SKRY_SUCCESS != result)
+    {
+        ckpt_set_error(ckpt, result);
+        return;
+    }
+
+    ckpt_write_u32(ckpt, SKRY_get_img_seq_type(img_seq));
+    ckpt_write_u64(ckpt, SKRY_get_img_count(img_seq));
+    for (size_t i = 0; i < SKRY_get_img_count(img_seq); i++)
+        ckpt_write_u8(ckpt, 0 != SKRY_is_img_active(img_seq, i));
+    ckpt_write_u64(ckpt, hash);
+}
+
+/// Sets 'ckpt->result' to SKRY_CHECKPOINT_MISMATCH if the stored identification does not match 'img_seq'
+static
+void check_img_seq_identity(struct checkpoint_file *ckpt, const SKRY_ImgSequence *img_seq)
+{
+    int matches = (ckpt_read_u32(ckpt) == (uint32_t)SKRY_get_img_seq_type(img_seq));
+    matches = (ckpt_read_u64(ckpt) == SKRY_get_img_count(img_seq)) && matches;
+    if (SKRY_SUCCESS != ckpt->result || !matches)
+    {
+        ckpt_set_error(ckpt, SKRY_CHECKPOINT_MISMATCH);
+        return;
+    }
+
+    for (size_t i = 0; i < SKRY_get_img_count(img_seq); i++)
+        if (ckpt_read_u8(ckpt) != (0 != SKRY_is_img_active(img_seq, i)))
+            matches = 0;
+
+    uint64_t stored_hash = ckpt_read_u64(ckpt);
+    if (SKRY_SUCCESS != ckpt->result)
+        return;
+
+    uint64_t hash = 0;
+    enum SKRY_result result = matches ? get_img_seq_hash(img_seq, ckpt->do_swap, &hash) : SKRY_SUCCESS;
+    if (SKRY_SUCCESS != result)
+        ckpt_set_error(ckpt, result);
+    else if (!matches || hash != stored_hash)
+        ckpt_set_error(ckpt, SKRY_CHECKPOINT_MISMATCH);
+}
+
+enum SKRY_result SKRY_save_checkpoint(const char *file_name,
+                                      const SKRY_ImgAlignment *img_algn,
+                                      const SKRY_QualityEstimation *qual_est,
+                                      const SKRY_RefPtAlignment *ref_pt_align)
+{
+    if (!SKRY_is_img_alignment_complete(img_algn)
+        || (qual_est && (!SKRY_is_qual_est_complete(qual_est) || SKRY_get_img_align(qual_est) != img_algn))
+        || (ref_pt_align && (!qual_est || !SKRY_is_ref_pt_alignment_complete(ref_pt_align)
+                             || SKRY_get_qual_est(ref_pt_align) != qual_est)))
+    {
+        return SKRY_INVALID_PARAMETERS;
+    }
+
+    struct checkpoint_file ckpt = { .file = fopen(file_name, "wb"),
+                                    .do_swap = is_machine_big_endian(),
+                                    .result = SKRY_SUCCESS };
+    if (!ckpt.file)
+        return SKRY_CANNOT_CREATE_FILE;
+
+    write_bytes(&ckpt, CHECKPOINT_SIGNATURE, sizeof(CHECKPOINT_SIGNATURE));
+    ckpt_write_u32(&ckpt, CHECKPOINT_FILE_VERSION);
+    ckpt_write_u32(&ckpt, PHASE_IMG_ALIGNMENT
+                          | (qual_est ? PHASE_QUALITY_EST : 0)
+                          | (ref_pt_align ? PHASE_REF_PT_ALIGNMENT : 0));
+
+    write_img_seq_identity(&ckpt, SKRY_get_img_seq(img_algn));
+    write_img_align_checkpoint(&ckpt, img_algn);
+    if (qual_est)
+        write_quality_checkpoint(&ckpt, qual_est);
+    if (ref_pt_align)
+        write_ref_pt_checkpoint(&ckpt, ref_pt_align);
+
+    if (0 != fclose(ckpt.file))
+        ckpt_set_error(&ckpt, SKRY_FILE_IO_ERROR);
+
+    return ckpt.result;
+}
+
+enum SKRY_result SKRY_load_checkpoint(const char *file_name,
+                                      SKRY_ImgSequence *img_seq,
+                                      SKRY_ImgAlignment **img_algn,
+                                      SKRY_QualityEstimation **qual_est,
+                                      SKRY_RefPtAlignment **ref_pt_align)
+{
+    *img_algn = 0;
+    if (qual_est)
+        *qual_est = 0;
+    if (ref_pt_align)
+        *ref_pt_align = 0;
+
+    if (ref_pt_align && !qual_est)
+        return SKRY_INVALID_PARAMETERS;
+
+    struct checkpoint_file ckpt = { .file = fopen(file_name, "rb"),
+                                    .do_swap = is_machine_big_endian(),
+                                    .result = SKRY_SUCCESS };
+    if (!ckpt.file)
+        return SKRY_CANNOT_OPEN_FILE;
+
+    char signature[sizeof(CHECKPOINT_SIGNATURE)];
+    read_bytes(&ckpt, signature, sizeof(signature));
+    uint32_t version = ckpt_read_u32(&ckpt);
+    uint32_t phases = ckpt_read_u32(&ckpt);
+    if (0 != memcmp(signature, CHECKPOINT_SIGNATURE, sizeof(signature))
+        || CHECKPOINT_FILE_VERSION != version
+        || !(phases & PHASE_IMG_ALIGNMENT))
+    {
+        ckpt_set_error(&ckpt, SKRY_UNSUPPORTED_FILE_FORMAT);
+    }
+
+    check_img_seq_identity(&ckpt, img_seq);
+
+    if (SKRY_SUCCESS == ckpt.result)
+        *img_algn = read_img_align_checkpoint(&ckpt, img_seq);
+
+    if (*img_algn && qual_est && (phases & PHASE_QUALITY_EST))
+        *qual_est = read_quality_checkpoint(&ckpt, *img_algn);
+
+    if (qual_est && *qual_est && ref_pt_align && (phases & PHASE_REF_PT_ALIGNMENT))
+        *ref_pt_align = read_ref_pt_checkpoint(&ckpt, *qual_est);
+
+    fclose(ckpt.file);
+
+    if (SKRY_SUCCESS != ckpt.result)
+    {
+        LOG_MSG(SKRY_LOG_CHECKPOINT, "Could not load checkpoint %s (error: %s).",
+                file_name, SKRY_get_error_message(ckpt.result));
+
+        if (ref_pt_align)
+            *ref_pt_align = SKRY_free_ref_pt_alignment(*ref_pt_align);
+        if (qual_est)
+            *qual_est = SKRY_free_quality_est(*qual_est);
+        *img_algn = SKRY_free_img_alignment(*img_algn);
+    }
+
+    return ckpt.result;
+}
@@ -0,0 +1,82 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Checkpoint non-public header.
+*/
+
+#ifndef LIB_STACKISTRY_CHECKPOINT_INTERNAL_HEADER
+#define LIB_STACKISTRY_CHECKPOINT_INTERNAL_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <skry/defs.h>
+#include <skry/img_align.h>
+#include <skry/imgseq.h>
+#include <skry/quality.h>
+#include <skry/ref_pt_align.h>
+
+
+/// Checkpoint file being written or read
+/** All values are stored little-endian. Once an operation fails, 'result' is set
+    to an error and all subsequent writes and reads do nothing (reads return zeros),
+    so callers can check 'result' once, after a series of operations. */
+struct checkpoint_file
+{
+    FILE *file;
+    int do_swap; ///< Nonzero if the machine is big-endian
+    enum SKRY_result result;
+};
+
+void ckpt_write_u8 (struct checkpoint_file *ckpt, uint8_t value);
+void ckpt_write_u16(struct checkpoint_file *ckpt, uint16_t value);
+void ckpt_write_u32(struct checkpoint_file *ckpt, uint32_t value);
+void ckpt_write_u64(struct checkpoint_file *ckpt, uint64_t value);
+void ckpt_write_i32(struct checkpoint_file *ckpt, int32_t value);
+void ckpt_write_flt(struct checkpoint_file *ckpt, float value);
+void ckpt_write_point(struct checkpoint_file *ckpt, struct SKRY_point point);
+
+uint8_t  ckpt_read_u8 (struct checkpoint_file *ckpt);
+uint16_t ckpt_read_u16(struct checkpoint_file *ckpt);
+uint32_t ckpt_read_u32(struct checkpoint_file *ckpt);
+uint64_t ckpt_read_u64(struct checkpoint_file *ckpt);
+int32_t  ckpt_read_i32(struct checkpoint_file *ckpt);
+float    ckpt_read_flt(struct checkpoint_file *ckpt);
+struct SKRY_point ckpt_read_point(struct checkpoint_file *ckpt);
+
+/// Sets 'ckpt->result' to 'result' (if no error has occurred so far)
+void ckpt_set_error(struct checkpoint_file *ckpt, enum SKRY_result result);
+
+// Each phase stores and restores its own state (implemented in the phase's source file).
+// Readers return null on error (and set 'ckpt->result').
+
+void write_img_align_checkpoint(struct checkpoint_file *ckpt, const SKRY_ImgAlignment *img_algn);
+
+SKRY_ImgAlignment *read_img_align_checkpoint(struct checkpoint_file *ckpt, SKRY_ImgSequence *img_seq);
+
+void write_quality_checkpoint(struct checkpoint_file *ckpt, const SKRY_QualityEstimation *qual_est);
+
+SKRY_QualityEstimation *read_quality_checkpoint(struct checkpoint_file *ckpt, const SKRY_ImgAlignment *img_algn);
+
+void write_ref_pt_checkpoint(struct checkpoint_file *ckpt, const SKRY_RefPtAlignment *ref_pt_align);
+
+SKRY_RefPtAlignment *read_ref_pt_checkpoint(struct checkpoint_file *ckpt, const SKRY_QualityEstimation *qual_est);
+
+#endif // LIB_STACKISTRY_CHECKPOINT_INTERNAL_HEADER
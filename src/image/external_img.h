@@ -0,0 +1,46 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    External-buffer image header.
+*/
+
+#ifndef LIB_STACKISTRY_EXTERNAL_IMAGE_HEADER
+#define LIB_STACKISTRY_EXTERNAL_IMAGE_HEADER
+
+#include <stddef.h>
+
+#include <skry/image.h>
+
+
+/// Called when an external-buffer image is freed
+typedef void fn_release_ext_pixels(void *owner);
+
+/// Creates an image referring to an external pixel buffer; returns null if out of memory
+/** When the image is freed, 'release_pixels' (if not null) is called with 'owner'.
+    If creation fails, 'release_pixels' is not called. */
+SKRY_Image *create_external_buf_img(
+    unsigned width, unsigned height,
+    enum SKRY_pixel_format pix_fmt, ///< Must not be SKRY_PIX_PAL8
+    void *pixels,
+    ptrdiff_t line_stride,
+    void *owner,
+    fn_release_ext_pixels *release_pixels);
+
+#endif // LIB_STACKISTRY_EXTERNAL_IMAGE_HEADER
@@ -0,0 +1,207 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Frame buffer allocator implementation.
+
+    Released buffers are kept in a list ordered from the least to the most
+    recently released one. A request for a buffer takes the most recently
+    released one of the same size; if the total size of kept buffers would
+    exceed the allocator's capacity, the least recently released buffers
+    are freed. Every buffer handed out holds a reference to the allocator,
+    so that the allocator can be freed while images allocated from it
+    still exist.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <skry/image.h>
+
+#include "frame_alloc.h"
+#include "../utils/dnarray.h"
+#include "../utils/logging.h"
+#include "../utils/threads.h"
+
+
+struct free_buf
+{
+    void *ptr;
+    size_t size;
+};
+
+struct SKRY_frame_allocator
+{
+    size_t capacity; ///< Max. total size of kept buffers
+
+    /// Guards all fields below
+    struct mutex *mutex;
+
+    DA_DECLARE(struct free_buf) free_bufs;
+    size_t free_bytes; ///< Total size of 'free_bufs'
+
+    /// Number of buffers handed out, plus 1 if the allocator has not been freed by the user yet
+    size_t ref_count;
+
+    /// Statistics
+    size_t num_reused;
+    size_t num_allocated;
+};
+
+static SKRY_FrameAllocator *g_frame_allocator = 0;
+
+/// Frees the least recently released buffers until at most 'max_free_bytes' are kept
+static
+void trim_free_bufs(SKRY_FrameAllocator *allocator, size_t max_free_bytes)
+{
+    size_t num_trimmed = 0;
+    while (allocator->free_bytes > max_free_bytes)
+    {
+        free(allocator->free_bufs.data[num_trimmed].ptr);
+        allocator->free_bytes -= allocator->free_bufs.data[num_trimmed].size;
+        num_trimmed++;
+    }
+
+    if (num_trimmed)
+    {
+        size_t num_remaining = DA_SIZE(allocator->free_bufs) - num_trimmed;
+        memmove(allocator->free_bufs.data, allocator->free_bufs.data + num_trimmed,
+                num_remaining * sizeof(*allocator->free_bufs.data));
+        DA_SET_SIZE(allocator->free_bufs, num_remaining);
+    }
+}
+
+/// Must be called with 'allocator->mutex' locked; returns non-zero if 'allocator' has been destroyed
+static
+int unref_allocator(SKRY_FrameAllocator *allocator)
+{
+    if (0 == --allocator->ref_count)
+    {
+        unlock_mutex(allocator->mutex);
+        free_mutex(allocator->mutex);
+        DA_FREE(allocator->free_bufs);
+        free(allocator);
+        return 1;
+    }
+    return 0;
+}
+
+SKRY_FrameAllocator *SKRY_create_frame_allocator(size_t capacity)
+{
+    SKRY_FrameAllocator *allocator = malloc(sizeof(*allocator));
+    if (!allocator)
+        return 0;
+
+    *allocator = (SKRY_FrameAllocator) { 0 };
+    allocator->capacity = capacity;
+    allocator->ref_count = 1;
+    allocator->mutex = create_mutex();
+    if (!allocator->mutex)
+    {
+        free(allocator);
+        return 0;
+    }
+    DA_ALLOC(allocator->free_bufs, 0);
+
+    return allocator;
+}
+
+SKRY_FrameAllocator *SKRY_free_frame_allocator(SKRY_FrameAllocator *allocator)
+{
+    if (allocator)
+    {
+        if (g_frame_allocator == allocator)
+            g_frame_allocator = 0;
+
+        lock_mutex(allocator->mutex);
+
+        LOG_MSG(SKRY_LOG_IMAGE, "Freeing frame allocator %p (buffers allocated: %zu, reused: %zu).",
+                (void *)allocator, allocator->num_allocated, allocator->num_reused);
+
+        trim_free_bufs(allocator, 0);
+        allocator->capacity = 0; // buffers released from now on are freed immediately
+        if (!unref_allocator(allocator))
+            unlock_mutex(allocator->mutex);
+    }
+    return 0;
+}
+
+void SKRY_set_frame_allocator(SKRY_FrameAllocator *allocator)
+{
+    g_frame_allocator = allocator;
+}
+
+SKRY_FrameAllocator *get_frame_allocator(void)
+{
+    return g_frame_allocator;
+}
+
+void *alloc_frame_buf(SKRY_FrameAllocator *allocator, size_t size)
+{
+    void *buf = 0;
+
+    lock_mutex(allocator->mutex);
+
+    for (size_t i = DA_SIZE(allocator->free_bufs); i > 0; i--)
+    {
+        if (allocator->free_bufs.data[i - 1].size == size)
+        {
+            buf = allocator->free_bufs.data[i - 1].ptr;
+            allocator->free_bytes -= size;
+            memmove(allocator->free_bufs.data + i - 1, allocator->free_bufs.data + i,
+                    (DA_SIZE(allocator->free_bufs) - i) * sizeof(*allocator->free_bufs.data));
+            allocator->free_bufs.data_end--;
+            allocator->num_reused++;
+            break;
+        }
+    }
+
+    if (!buf)
+    {
+        // Do not keep other threads waiting during a (possibly lengthy) large allocation
+        unlock_mutex(allocator->mutex);
+        buf = malloc(size);
+        lock_mutex(allocator->mutex);
+        if (buf)
+            allocator->num_allocated++;
+    }
+
+    if (buf)
+        allocator->ref_count++;
+
+    unlock_mutex(allocator->mutex);
+    return buf;
+}
+
+void release_frame_buf(SKRY_FrameAllocator *allocator, void *buf, size_t size)
+{
+    lock_mutex(allocator->mutex);
+
+    if (size > allocator->capacity)
+        free(buf);
+    else
+    {
+        trim_free_bufs(allocator, allocator->capacity - size);
+        DA_APPEND(allocator->free_bufs, ((struct free_buf) { .ptr = buf, .size = size }));
+        allocator->free_bytes += size;
+    }
+
+    if (!unref_allocator(allocator))
+        unlock_mutex(allocator->mutex);
+}
@@ -0,0 +1,42 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Frame buffer allocator header.
+*/
+
+#ifndef LIB_STACKISTRY_FRAME_ALLOC_HEADER
+#define LIB_STACKISTRY_FRAME_ALLOC_HEADER
+
+#include <stddef.h>
+
+#include <skry/image.h>
+
+
+/// Returns the allocator set with SKRY_set_frame_allocator(); may be null
+SKRY_FrameAllocator *get_frame_allocator(void);
+
+/// Returns a buffer of 'size' bytes (recycled if possible) or null if out of memory
+/** The buffer has to be released with 'release_frame_buf()'. */
+void *alloc_frame_buf(SKRY_FrameAllocator *allocator, size_t size);
+
+/// Returns 'buf' obtained from 'alloc_frame_buf()' to 'allocator' for reuse
+void release_frame_buf(SKRY_FrameAllocator *allocator, void *buf, size_t size);
+
+#endif // LIB_STACKISTRY_FRAME_ALLOC_HEADER
@@ -23,6 +23,7 @@ File description:
 
 #include <assert.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -32,11 +33,14 @@ File description:
 #include <skry/image.h>
 
 #include "bmp.h"
+#include "frame_alloc.h"
 #include "tiff.h"
 #include "image_internal.h"
 #include "../utils/demosaic.h"
+#include "../utils/filters.h"
 #include "../utils/logging.h"
 #include "../utils/misc.h"
+#include "../utils/perf.h"
 
 
 const size_t BYTES_PER_PIXEL[SKRY_NUM_PIX_FORMATS] =
@@ -173,7 +177,11 @@ static
 SKRY_Image *free_internal_img(SKRY_Image *img)
 {
     LOG_MSG(SKRY_LOG_IMAGE, "Freeing image pixels array at %p.", IMG_DATA(img)->pixels);
-    free(IMG_DATA(img)->pixels);
+    if (IMG_DATA(img)->allocator)
+        release_frame_buf(IMG_DATA(img)->allocator, IMG_DATA(img)->pixels,
+                          IMG_DATA(img)->width * IMG_DATA(img)->height * BYTES_PER_PIXEL[img->pix_fmt]);
+    else
+        free(IMG_DATA(img)->pixels);
     free(IMG_DATA(img));
     free(img);
     return 0;
@@ -241,6 +249,7 @@ SKRY_Image *create_internal_img(void)
     img->pix_fmt = SKRY_PIX_INVALID;
     IMG_DATA(img)->width = IMG_DATA(img)->height = 0;
     IMG_DATA(img)->pixels = 0;
+    IMG_DATA(img)->allocator = 0;
 
     img->free                     = free_internal_img;
     img->get_width                = get_internal_img_width;
@@ -253,6 +262,89 @@ SKRY_Image *create_internal_img(void)
     return img;
 }
 
+// ------------ Implementation of the external-buffer image class --------------
+
+#define EXT_IMG_DATA(img) ((struct external_img_data *)(img)->data)
+
+static
+SKRY_Image *free_external_buf_img(SKRY_Image *img)
+{
+    struct external_img_data *data = EXT_IMG_DATA(img);
+    if (data->release_pixels)
+        data->release_pixels(data->owner);
+    free(data);
+    free(img);
+    return 0;
+}
+
+static
+unsigned get_external_buf_img_width(const SKRY_Image *img)
+{
+    return EXT_IMG_DATA(img)->width;
+}
+
+static
+unsigned get_external_buf_img_height(const SKRY_Image *img)
+{
+    return EXT_IMG_DATA(img)->height;
+}
+
+static
+ptrdiff_t get_external_buf_line_stride_in_bytes(const SKRY_Image *img)
+{
+    return EXT_IMG_DATA(img)->line_stride;
+}
+
+static
+void *get_external_buf_img_line(const SKRY_Image *img, size_t line)
+{
+    return (char *)EXT_IMG_DATA(img)->pixels + (ptrdiff_t)line * EXT_IMG_DATA(img)->line_stride;
+}
+
+static
+enum SKRY_result get_external_buf_img_palette(const SKRY_Image *img, struct SKRY_palette *pal)
+{
+    (void)img; (void)pal;
+    return SKRY_NO_PALETTE;
+}
+
+SKRY_Image *create_external_buf_img(
+    unsigned width, unsigned height,
+    enum SKRY_pixel_format pix_fmt,
+    void *pixels,
+    ptrdiff_t line_stride,
+    void *owner,
+    fn_release_ext_pixels *release_pixels)
+{
+    assert(pix_fmt != SKRY_PIX_PAL8);
+
+    SKRY_Image *img = malloc(sizeof(*img));
+    if (!img)
+        return 0;
+
+    img->data = malloc(sizeof(struct external_img_data));
+    if (!img->data)
+    {
+        free(img);
+        return 0;
+    }
+
+    *EXT_IMG_DATA(img) = (struct external_img_data) {
+        .width = width, .height = height, .line_stride = line_stride,
+        .pixels = pixels, .owner = owner, .release_pixels = release_pixels };
+
+    img->pix_fmt                  = pix_fmt;
+    img->free                     = free_external_buf_img;
+    img->get_width                = get_external_buf_img_width;
+    img->get_height               = get_external_buf_img_height;
+    img->get_line_stride_in_bytes = get_external_buf_line_stride_in_bytes;
+    img->get_bytes_per_pixel      = get_internal_img_bytes_per_pixel;
+    img->get_line                 = get_external_buf_img_line;
+    img->get_palette              = get_external_buf_img_palette;
+
+    return img;
+}
+
 // -------------- Public interface implementation ------------------------------
 
 /// Returns null
@@ -432,7 +524,15 @@ SKRY_Image *SKRY_new_image(
     IMG_DATA(img)->height = height;
     img->pix_fmt = pixel_format;
     size_t pixel_total_bytes = width * height * BYTES_PER_PIXEL[pixel_format];
-    IMG_DATA(img)->pixels = malloc(pixel_total_bytes);
+    SKRY_FrameAllocator *allocator = get_frame_allocator();
+    if (allocator)
+    {
+        IMG_DATA(img)->pixels = alloc_frame_buf(allocator, pixel_total_bytes);
+        if (IMG_DATA(img)->pixels)
+            IMG_DATA(img)->allocator = allocator;
+    }
+    else
+        IMG_DATA(img)->pixels = malloc(pixel_total_bytes);
     if (!IMG_DATA(img)->pixels)
     {
         SKRY_free_image(img);
@@ -458,10 +558,94 @@ SKRY_Image *SKRY_convert_pix_fmt(const SKRY_Image *src_img,
             0, 0, SKRY_get_img_width(src_img), SKRY_get_img_height(src_img), demosaic_method);
 }
 
-/// Converts a fragment of 'src_img' to 'dest_img's pixel format and writes it into 'dest_img'
-/** Cropping is performed if necessary. If 'src_img' is in raw color format, the CFA pattern
-    will be appropriately adjusted depending on 'x0', 'y0'. */
-void SKRY_convert_pix_fmt_of_subimage_into(
+/// Min. number of pixels for which 'SKRY_convert_pix_fmt_of_subimage_into()' converts lines in parallel
+#define PARALLEL_CONVERSION_MIN_PIXELS (1U << 16)
+
+/// Converts 'width' pixels of a line
+typedef void fn_convert_line(const void *restrict input, void *restrict output, unsigned width);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define CONVERT_LINE_AVX2 1
+#endif
+
+/** Defines a line conversion function, which executes 'operation' for every 'i' in [0; values_per_px*width),
+    where 'in' and 'out' are the input and output line of types 'InputT' and 'OutputT'. The results are
+    identical to those of the generic conversion code in 'SKRY_convert_pix_fmt_of_subimage_into()',
+    but the loop is vectorized by the compiler. On x86, an AVX2 version 'func_name'_avx2
+    is defined too (some of the loops cannot be vectorized using SSE2 only). */
+#define DEFINE_CONVERT_LINE_IMPL(func_name, attributes, InputT, OutputT, values_per_px, operation) \
+attributes                                                                                 \
+static                                                                                     \
+void func_name(const void *restrict input, void *restrict output, unsigned width)          \
+{                                                                                          \
+    const InputT *restrict in = input;                                                     \
+    OutputT *restrict out = output;                                                        \
+    for (size_t i = 0; i < (size_t)(values_per_px) * width; i++)                           \
+        operation;                                                                         \
+}
+
+#if CONVERT_LINE_AVX2
+#define DEFINE_CONVERT_LINE(func_name, InputT, OutputT, values_per_px, operation)                          \
+    DEFINE_CONVERT_LINE_IMPL(func_name, , InputT, OutputT, values_per_px, operation)                       \
+    DEFINE_CONVERT_LINE_IMPL(func_name##_avx2, __attribute__((target("avx2"))), InputT, OutputT, values_per_px, operation)
+#else
+#define DEFINE_CONVERT_LINE(func_name, InputT, OutputT, values_per_px, operation) \
+    DEFINE_CONVERT_LINE_IMPL(func_name, , InputT, OutputT, values_per_px, operation)
+#endif
+
+DEFINE_CONVERT_LINE(convert_line_mono16_to_mono8,   uint16_t, uint8_t, 1, out[i] = (uint8_t)(in[i] >> 8))
+DEFINE_CONVERT_LINE(convert_line_mono8_to_mono32f,  uint8_t,  float,   1, out[i] = in[i] * 1.0f/0xFF)
+DEFINE_CONVERT_LINE(convert_line_mono16_to_mono32f, uint16_t, float,   1, out[i] = in[i] * 1.0f/0xFFFF)
+DEFINE_CONVERT_LINE(convert_line_rgb8_to_rgb32f,    uint8_t,  float,   3, out[i] = in[i] * 1.0f/0xFF)
+DEFINE_CONVERT_LINE(convert_line_rgb16_to_rgb32f,   uint16_t, float,   3, out[i] = in[i] * 1.0f/0xFFFF)
+// Also handles BGR8, as the channels' order does not matter
+DEFINE_CONVERT_LINE(convert_line_rgb8_to_mono8,     uint8_t,  uint8_t, 1,
+                    out[i] = (uint8_t)(((int)in[3*i] + in[3*i+1] + in[3*i+2])/3))
+
+#if CONVERT_LINE_AVX2
+  #define LINE_CONVERTER(src_pix_fmt, dest_pix_fmt, func_name) { src_pix_fmt, dest_pix_fmt, func_name, func_name##_avx2 }
+#else
+  #define LINE_CONVERTER(src_pix_fmt, dest_pix_fmt, func_name) { src_pix_fmt, dest_pix_fmt, func_name, 0 }
+#endif
+
+/// Specialized conversions, used instead of the generic conversion code
+static const struct
+{
+    enum SKRY_pixel_format src_pix_fmt, dest_pix_fmt;
+    fn_convert_line *convert_line;
+    fn_convert_line *convert_line_avx2; ///< Null if not available
+} LINE_CONVERTERS[] =
+{
+    LINE_CONVERTER(SKRY_PIX_MONO16, SKRY_PIX_MONO8,   convert_line_mono16_to_mono8),
+    LINE_CONVERTER(SKRY_PIX_MONO8,  SKRY_PIX_MONO32F, convert_line_mono8_to_mono32f),
+    LINE_CONVERTER(SKRY_PIX_MONO16, SKRY_PIX_MONO32F, convert_line_mono16_to_mono32f),
+    LINE_CONVERTER(SKRY_PIX_RGB8,   SKRY_PIX_RGB32F,  convert_line_rgb8_to_rgb32f),
+    LINE_CONVERTER(SKRY_PIX_RGB16,  SKRY_PIX_RGB32F,  convert_line_rgb16_to_rgb32f),
+    LINE_CONVERTER(SKRY_PIX_RGB8,   SKRY_PIX_MONO8,   convert_line_rgb8_to_mono8),
+    LINE_CONVERTER(SKRY_PIX_BGR8,   SKRY_PIX_MONO8,   convert_line_rgb8_to_mono8)
+};
+
+#undef LINE_CONVERTER
+
+/// Returns the specialized line conversion function or null if there is none
+static
+fn_convert_line *get_line_converter(enum SKRY_pixel_format src_pix_fmt, enum SKRY_pixel_format dest_pix_fmt)
+{
+    for (size_t i = 0; i < sizeof(LINE_CONVERTERS)/sizeof(LINE_CONVERTERS[0]); i++)
+        if (LINE_CONVERTERS[i].src_pix_fmt == src_pix_fmt && LINE_CONVERTERS[i].dest_pix_fmt == dest_pix_fmt)
+        {
+#if CONVERT_LINE_AVX2
+            if (__builtin_cpu_supports("avx2"))
+                return LINE_CONVERTERS[i].convert_line_avx2;
+#endif
+            return LINE_CONVERTERS[i].convert_line;
+        }
+
+    return 0;
+}
+
+static
+void convert_pix_fmt_of_subimage_into(
         const SKRY_Image *src_img,
         SKRY_Image       *dest_img,
         int src_x0, int src_y0,
@@ -632,7 +816,7 @@ void SKRY_convert_pix_fmt_of_subimage_into(
                   SKRY_PIX_CFA_PATTERN[src_pix_fmt], demosaic_method);
             }
 
-            SKRY_convert_pix_fmt_of_subimage_into(
+            convert_pix_fmt_of_subimage_into(
                 demosaiced, dest_img, 0, 0,
                 dest_pos.x, dest_pos.y, width, height,
                 demosaic_method);
@@ -643,6 +827,18 @@ void SKRY_convert_pix_fmt_of_subimage_into(
         return;
     }
 
+    fn_convert_line *convert_line = get_line_converter(src_pix_fmt, dest_pix_fmt);
+    if (convert_line)
+    {
+        #pragma omp parallel for if ((size_t)width * height >= PARALLEL_CONVERSION_MIN_PIXELS)
+        for (int y = 0; y < (int)height; y++)
+            convert_line((uint8_t *)SKRY_get_line(src_img, y + src_pos.y) + src_pos.x * BYTES_PER_PIXEL[src_pix_fmt],
+                         (uint8_t *)SKRY_get_line(dest_img, y + dest_pos.y) + dest_pos.x * BYTES_PER_PIXEL[dest_pix_fmt],
+                         width);
+
+        return;
+    }
+
     ptrdiff_t in_ptr_step = BYTES_PER_PIXEL[src_pix_fmt],
               out_ptr_step = BYTES_PER_PIXEL[dest_pix_fmt];
 
@@ -1085,6 +1281,24 @@ void SKRY_convert_pix_fmt_of_subimage_into(
     }
 }
 
+/// Converts a fragment of 'src_img' to 'dest_img's pixel format and writes it into 'dest_img'
+/** Cropping is performed if necessary. If 'src_img' is in raw color format, the CFA pattern
+    will be appropriately adjusted depending on 'x0', 'y0'. */
+void SKRY_convert_pix_fmt_of_subimage_into(
+        const SKRY_Image *src_img,
+        SKRY_Image       *dest_img,
+        int src_x0, int src_y0,
+        int dest_x0, int dest_y0,
+        unsigned width, unsigned height,
+        /// Used if 'img' contains raw color data
+        enum SKRY_demosaic_method demosaic_method)
+{
+    double start_time = PERF_TIME();
+    convert_pix_fmt_of_subimage_into(src_img, dest_img, src_x0, src_y0, dest_x0, dest_y0,
+                                     width, height, demosaic_method);
+    PERF_ADD_TIME_SINCE(conversion_time, start_time);
+}
+
 /// Returned image has lines stored top-to-bottom, no padding
 /** If 'src_img' is in raw color format, the CFA pattern will be
     appropriately adjusted depending on 'x0', 'y0'. */
@@ -1135,6 +1349,23 @@ SKRY_Image *SKRY_get_img_copy(const SKRY_Image *img)
     return img_copy;
 }
 
+SKRY_Image *SKRY_median_filter_image(const SKRY_Image *img, unsigned radius, enum SKRY_result *result)
+{
+    enum SKRY_pixel_format pix_fmt = SKRY_get_img_pix_fmt(img);
+    if (0 == radius
+        || SKRY_PIX_PAL8 == pix_fmt
+        || (pix_fmt > SKRY_PIX_CFA_MIN && pix_fmt < SKRY_PIX_CFA_MAX)
+        || (BITS_PER_CHANNEL[pix_fmt] != 8 && BITS_PER_CHANNEL[pix_fmt] != 16))
+    {
+        if (result) *result = SKRY_INVALID_PARAMETERS;
+        return 0;
+    }
+
+    SKRY_Image *filtered = median_filter_img(img, radius);
+    if (result) *result = (filtered ? SKRY_SUCCESS : SKRY_OUT_OF_MEMORY);
+    return filtered;
+}
+
 /// Returns null on error
 SKRY_Image *SKRY_load_image(const char *file_name,
                             enum SKRY_result *result ///< If not null, receives operation result
@@ -1231,11 +1462,103 @@ void SKRY_reinterpret_as_CFA(SKRY_Image *img, enum SKRY_CFA_pattern CFA_pattern)
     }
 }
 
+/** Defines a function calculating moments M0 (sum of brightness) and M1 (sum of x*brightness)
+    of every 'decimation'-th pixel of a line of 'width' pixels of integer type 'T'. A pixel's brightness
+    is the sum of its channels' values; brightness below 'threshold' is treated as zero.
+    Moments of a line are exact; the mono, non-decimated case is vectorized by the compiler. */
+#define DEFINE_GET_LINE_MOMENTS(func_name, T)                                              \
+static                                                                                     \
+void func_name(const void *line_ptr, unsigned width, size_t num_channels,                  \
+               uint64_t threshold, unsigned decimation, double *m0, double *m1)            \
+{                                                                                          \
+    const T *line = line_ptr;                                                              \
+    uint64_t sum = 0, sum_x = 0;                                                           \
+                                                                                           \
+    if (1 == num_channels && 1 == decimation && 0 == threshold)                            \
+    {                                                                                      \
+        for (unsigned x = 0; x < width; x++)                                               \
+        {                                                                                  \
+            sum   += line[x];                                                              \
+            sum_x += (uint64_t)x * line[x];                                                \
+        }                                                                                  \
+    }                                                                                      \
+    else                                                                                   \
+    {                                                                                      \
+        for (unsigned x = 0; x < width; x += decimation)                                   \
+        {                                                                                  \
+            uint64_t brightness = 0;                                                       \
+            for (size_t i = 0; i < num_channels; i++)                                      \
+                brightness += line[num_channels*x + i];                                    \
+                                                                                           \
+            brightness = (brightness >= threshold) ? brightness : 0;                       \
+            sum   += brightness;                                                           \
+            sum_x += x * brightness;                                                       \
+        }                                                                                  \
+    }                                                                                      \
+                                                                                           \
+    *m0 = sum;                                                                             \
+    *m1 = sum_x;                                                                           \
+}
+
+DEFINE_GET_LINE_MOMENTS(get_line_moments_8,  uint8_t)
+DEFINE_GET_LINE_MOMENTS(get_line_moments_16, uint16_t)
+
+/// Floating-point counterpart of the DEFINE_GET_LINE_MOMENTS() functions
+#define DEFINE_GET_LINE_MOMENTS_FLT(func_name, T)                                          \
+static                                                                                     \
+void func_name(const void *line_ptr, unsigned width, size_t num_channels,                  \
+               double threshold, unsigned decimation, double *m0, double *m1)              \
+{                                                                                          \
+    const T *line = line_ptr;                                                              \
+    double sum = 0, sum_x = 0;                                                             \
+    for (unsigned x = 0; x < width; x += decimation)                                       \
+    {                                                                                      \
+        double brightness = 0;                                                             \
+        for (size_t i = 0; i < num_channels; i++)                                          \
+            brightness += line[num_channels*x + i];                                        \
+                                                                                           \
+        brightness = (brightness >= threshold) ? brightness : 0;                           \
+        sum   += brightness;                                                               \
+        sum_x += x * brightness;                                                           \
+    }                                                                                      \
+    *m0 = sum;                                                                             \
+    *m1 = sum_x;                                                                           \
+}
+
+DEFINE_GET_LINE_MOMENTS_FLT(get_line_moments_32f, float)
+DEFINE_GET_LINE_MOMENTS_FLT(get_line_moments_64f, double)
+
+static
+void get_line_moments_pal8(const uint8_t *line, unsigned width, const struct SKRY_palette *palette,
+                           uint64_t threshold, unsigned decimation, double *m0, double *m1)
+{
+    uint64_t sum = 0, sum_x = 0;
+    for (unsigned x = 0; x < width; x += decimation)
+    {
+        uint64_t brightness = palette->pal[3*line[x]] + palette->pal[3*line[x] + 1] + palette->pal[3*line[x] + 2];
+        brightness = (brightness >= threshold) ? brightness : 0;
+        sum   += brightness;
+        sum_x += x * brightness;
+    }
+    *m0 = sum;
+    *m1 = sum_x;
+}
+
 /// Finds the centroid of the specified image fragment
 /** Returned coords are relative to 'img_fragment'. */
 struct SKRY_point SKRY_get_centroid(const SKRY_Image *img,
                                     const struct SKRY_rect img_fragment)
 {
+    return SKRY_get_thresholded_centroid(img, img_fragment, 0.0f, 1);
+}
+
+struct SKRY_point SKRY_get_thresholded_centroid(const SKRY_Image *img,
+                                                const struct SKRY_rect img_fragment,
+                                                float brightness_threshold,
+                                                unsigned decimation)
+{
+    assert(decimation > 0);
+
     double M00 = 0.0; // image moment 00, i.e. sum of pixels' brightness
     double M10 = 0.0; // image moment 10
     double M01 = 0.0; // image moment 01
@@ -1245,76 +1568,70 @@ struct SKRY_point SKRY_get_centroid(const SKRY_Image *img,
 
     enum SKRY_pixel_format pix_fmt = SKRY_get_img_pix_fmt(img);
     size_t num_channels = NUM_CHANNELS[pix_fmt];
+    size_t bytes_per_pixel = BYTES_PER_PIXEL[pix_fmt];
 
-    for (unsigned y = img_fragment.y; y < img_fragment.y + img_fragment.height; y++)
-    {
-        void *line = SKRY_get_line(img, y);
-        for (unsigned x = img_fragment.x; x < img_fragment.x + img_fragment.width; x++)
-        {
-            double current_brightness = 0.0;
-
-            switch (pix_fmt)
-            {
-            case SKRY_PIX_PAL8:
-                {
-                    uint8_t pix_val = ((uint8_t *)line)[x];
-                    current_brightness =
-                           palette.pal[3*pix_val    ] +
-                           palette.pal[3*pix_val + 1] +
-                           palette.pal[3*pix_val + 2];
-                    break;
-                }
-
-            case SKRY_PIX_MONO8:
-            case SKRY_PIX_RGB8:
-            case SKRY_PIX_BGR8:
-            case SKRY_PIX_BGRA8:
-            case SKRY_PIX_CFA_RGGB8:
-            case SKRY_PIX_CFA_GRBG8:
-            case SKRY_PIX_CFA_GBRG8:
-            case SKRY_PIX_CFA_BGGR8:
-                for (size_t i = 0; i < num_channels; i++)
-                {
-                    current_brightness += ((uint8_t *)line)[num_channels*x + i];
-                }
-                break;
+    // Threshold of the sum of a pixel's channel values
+    double threshold = brightness_threshold * (double)num_channels;
+    if (SKRY_PIX_PAL8 == pix_fmt)
+        threshold *= 3 * 0xFF; // 3 palette channels
+    else if (BITS_PER_CHANNEL[pix_fmt] <= 16)
+        threshold *= (1U << BITS_PER_CHANNEL[pix_fmt]) - 1;
 
-            case SKRY_PIX_MONO16:
-            case SKRY_PIX_RGB16:
-            case SKRY_PIX_RGBA16:
-            case SKRY_PIX_CFA_RGGB16:
-            case SKRY_PIX_CFA_GRBG16:
-            case SKRY_PIX_CFA_GBRG16:
-            case SKRY_PIX_CFA_BGGR16:
-                for (size_t i = 0; i < num_channels; i++)
-                {
-                    current_brightness += ((uint16_t *)line)[num_channels*x + i];
-                }
-                break;
+    uint64_t int_threshold = (uint64_t)ceil(threshold);
 
-            case SKRY_PIX_MONO32F:
-            case SKRY_PIX_RGB32F:
-                for (size_t i = 0; i < num_channels; i++)
-                {
-                    current_brightness += ((float *)line)[num_channels*x + i];
-                }
-                break;
+    unsigned num_lines = (img_fragment.height + decimation - 1) / decimation;
 
-            case SKRY_PIX_MONO64F:
-            case SKRY_PIX_RGB64F:
-                for (size_t i = 0; i < num_channels; i++)
-                {
-                    current_brightness += ((double *)line)[num_channels*x + i];
-                }
-                break;
+    #pragma omp parallel for reduction(+:M00, M10, M01)
+    for (unsigned i = 0; i < num_lines; i++)
+    {
+        unsigned y = img_fragment.y + i*decimation;
+        const uint8_t *line = (const uint8_t *)SKRY_get_line(img, y) + img_fragment.x * bytes_per_pixel;
 
-            default: break;
-            }
+        double m0 = 0.0, m1 = 0.0;
 
-            M00 += current_brightness;
-            M10 += (x - img_fragment.x) * current_brightness;
-            M01 += (y - img_fragment.y) * current_brightness;
+        switch (pix_fmt)
+        {
+        case SKRY_PIX_PAL8:
+            get_line_moments_pal8(line, img_fragment.width, &palette, int_threshold, decimation, &m0, &m1);
+            break;
+
+        case SKRY_PIX_MONO8:
+        case SKRY_PIX_RGB8:
+        case SKRY_PIX_BGR8:
+        case SKRY_PIX_BGRA8:
+        case SKRY_PIX_CFA_RGGB8:
+        case SKRY_PIX_CFA_GRBG8:
+        case SKRY_PIX_CFA_GBRG8:
+        case SKRY_PIX_CFA_BGGR8:
+            get_line_moments_8(line, img_fragment.width, num_channels, int_threshold, decimation, &m0, &m1);
+            break;
+
+        case SKRY_PIX_MONO16:
+        case SKRY_PIX_RGB16:
+        case SKRY_PIX_RGBA16:
+        case SKRY_PIX_CFA_RGGB16:
+        case SKRY_PIX_CFA_GRBG16:
+        case SKRY_PIX_CFA_GBRG16:
+        case SKRY_PIX_CFA_BGGR16:
+            get_line_moments_16(line, img_fragment.width, num_channels, int_threshold, decimation, &m0, &m1);
+            break;
+
+        case SKRY_PIX_MONO32F:
+        case SKRY_PIX_RGB32F:
+            get_line_moments_32f(line, img_fragment.width, num_channels, threshold, decimation, &m0, &m1);
+            break;
+
+        case SKRY_PIX_MONO64F:
+        case SKRY_PIX_RGB64F:
+            get_line_moments_64f(line, img_fragment.width, num_channels, threshold, decimation, &m0, &m1);
+            break;
+
+        default: break;
         }
+
+        M00 += m0;
+        M10 += m1;
+        M01 += (double)(y - img_fragment.y) * m0;
     }
 
     if (M00 == 0.0)
@@ -29,6 +29,8 @@ File description:
 
 #include <skry/image.h>
 
+#include "external_img.h"
+
 
 
 typedef      SKRY_Image *fn_free(SKRY_Image *);
@@ -61,6 +63,9 @@ struct internal_img_data
 
     /// Lines stored top-to-bottom, no padding
     void *pixels;
+
+    /// If not null, 'pixels' have been obtained from it
+    SKRY_FrameAllocator *allocator;
 };
 
 /// 'img' is a pointer to 'struct SKRY_image'
@@ -69,4 +74,17 @@ struct internal_img_data
 /// Allocates and initializes an empty internal image structure; returns null if out of memory
 SKRY_Image *create_internal_img(void);
 
+/// Image whose pixels are stored in a buffer not owned by the image (e.g. a file mapping)
+struct external_img_data
+{
+    unsigned width;
+    unsigned height;
+    ptrdiff_t line_stride;
+
+    void *pixels; ///< Start of the first line
+
+    void *owner;
+    fn_release_ext_pixels *release_pixels; ///< Can be null
+};
+
 #endif // LIB_STACKISTRY_IMAGE_INTERNAL_HEADER
@@ -163,6 +163,15 @@ enum SKRY_result parse_tag_BITS_PER_SAMPLE(const struct TIFF_field tiff_field,
 SKRY_Image *load_TIFF(const char *file_name,
                       enum SKRY_result *result ///< If not null, receives operation result
 )
+{
+    return load_TIFF_fragment(file_name, 0, result);
+}
+
+/// Returns null on error
+SKRY_Image *load_TIFF_fragment(const char *file_name,
+                               struct SKRY_rect *rect,
+                               enum SKRY_result *result ///< If not null, receives operation result
+)
 {
     unsigned img_width = 0, img_height = 0;
     enum SKRY_pixel_format pix_fmt = SKRY_PIX_INVALID;
@@ -329,26 +338,49 @@ SKRY_Image *load_TIFF(const char *file_name,
             pix_fmt = SKRY_PIX_RGB16;
     }
 
-    img = SKRY_new_image(img_width, img_height, pix_fmt, 0, 0);
+    struct SKRY_rect frag = { .x = 0, .y = 0, .width = img_width, .height = img_height };
+    if (rect)
+    {
+        int x_end = SKRY_MIN(rect->x + (int)rect->width, (int)img_width),
+            y_end = SKRY_MIN(rect->y + (int)rect->height, (int)img_height);
+        frag.x = SKRY_MAX(rect->x, 0);
+        frag.y = SKRY_MAX(rect->y, 0);
+        if (x_end <= frag.x || y_end <= frag.y)
+            FAIL_ON_ERROR(SKRY_INVALID_PARAMETERS);
+        frag.width = x_end - frag.x;
+        frag.height = y_end - frag.y;
+    }
+
+    if (0 == rows_per_strip || num_strips < (img_height + rows_per_strip - 1) / rows_per_strip)
+        FAIL_ON_ERROR(SKRY_TIFF_INCOMPLETE_PIXEL_DATA);
+
+    img = SKRY_new_image(frag.width, frag.height, pix_fmt, 0, 0);
     if (!img)
         FAIL_ON_ERROR(SKRY_OUT_OF_MEMORY);
 
-    size_t curr_line = 0;
-    for (size_t i = 0; i < num_strips; i++)
+    // Only the fragment's part of each line is read; consecutive reads
+    // are not preceded by a seek (so that whole images are read sequentially)
+    size_t line_byte_count = img_width * BYTES_PER_PIXEL[pix_fmt];
+    size_t num_bytes_to_read = frag.width * BYTES_PER_PIXEL[pix_fmt];
+    long file_pos = -1;
+    for (unsigned y = 0; y < frag.height; y++)
     {
-        fseek(file, strip_offsets[i], SEEK_SET);
+        size_t src_line = frag.y + y;
+        size_t strip = src_line / rows_per_strip;
+        long line_pos = (long)(strip_offsets[strip] + (src_line % rows_per_strip) * line_byte_count
+                               + frag.x * BYTES_PER_PIXEL[pix_fmt]);
+
+        if (line_pos != file_pos)
+            fseek(file, line_pos, SEEK_SET);
 
-        for (size_t j = 0; j < rows_per_strip && curr_line < img_height; j++, curr_line++)
+        if (1 != fread(SKRY_get_line(img, y), num_bytes_to_read, 1, file))
         {
-            size_t num_bytes_to_read = img_width * BYTES_PER_PIXEL[pix_fmt];
-            if (1 != fread(SKRY_get_line(img, curr_line), num_bytes_to_read, 1, file))
-            {
-                LOG_MSG(SKRY_LOG_IMAGE, "The file is incomplete: pixel data in strip %zu is too short; "
-                                        "expected %"PRIu32" bytes.",
-                                        i, strip_byte_counts[i]);
-                FAIL_ON_ERROR(SKRY_TIFF_INCOMPLETE_PIXEL_DATA);
-            }
+            LOG_MSG(SKRY_LOG_IMAGE, "The file is incomplete: pixel data in strip %zu is too short; "
+                                    "expected %"PRIu32" bytes.",
+                                    strip, strip_byte_counts[strip]);
+            FAIL_ON_ERROR(SKRY_TIFF_INCOMPLETE_PIXEL_DATA);
         }
+        file_pos = line_pos + (long)num_bytes_to_read;
     }
 
     if ((pix_fmt == SKRY_PIX_MONO16 || pix_fmt == SKRY_PIX_RGB16) && endianess_diff)
@@ -363,8 +395,13 @@ SKRY_Image *load_TIFF(const char *file_name,
             negate_grayscale_16(img);
     }
 
+    free(strip_offsets);
+    free(strip_byte_counts);
     fclose(file);
 
+    if (rect)
+        *rect = frag;
+
     if (result)
         *result = SKRY_SUCCESS;
 
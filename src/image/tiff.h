@@ -33,6 +33,14 @@ SKRY_Image *load_TIFF(const char *file_name,
                       enum SKRY_result *result ///< If not null, receives operation result
                      );
 
+/// Reads only the pixels within 'rect' (cropped to the image); returns null on error
+/** Supports uncompressed TIFFs split into strips. On success, 'rect' receives
+    the fragment actually read. */
+SKRY_Image *load_TIFF_fragment(const char *file_name,
+                               struct SKRY_rect *rect,
+                               enum SKRY_result *result ///< If not null, receives operation result
+                              );
+
 enum SKRY_result save_TIFF(const SKRY_Image *img, const char *file_name);
 
 /// Returns metadata without reading the pixel data
@@ -23,6 +23,7 @@ File description:
 
 #include <assert.h>
 #include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,22 +33,35 @@ File description:
 #include <skry/imgseq.h>
 #include <skry/img_align.h>
 
+#include "checkpoint_internal.h"
+#include "imgseq/derived_img.h"
+#include "quality_internal.h"
+#include "utils/accel.h"
 #include "utils/dnarray.h"
+#include "utils/fft.h"
 #include "utils/filters.h"
 #include "utils/logging.h"
 #include "utils/match.h"
 #include "utils/misc.h"
+#include "utils/perf.h"
 
 
 #define QUALITY_EST_BOX_BLUR_RADIUS 2
 
+/// Max. size of the square region used for phase correlation
+#define PHASE_CORR_MAX_SIZE 512
+#define PHASE_CORR_MIN_SIZE 16
+
 struct anchor_data
 {
     struct SKRY_point pos; ///< Current position
     int is_valid;
     /// Square image fragment (of the best quality so far) centered (after alignment) on 'pos'
     SKRY_Image *ref_block;
+    /// Downsampled 'ref_block' for pyramid matching; created when first needed, freed when 'ref_block' changes
+    struct image_pyramid ref_block_pyramid;
     SKRY_quality_t ref_block_qual;
+    struct SKRY_point matched_pos; ///< Position in the current image found by 'match_anchors_using_accel()'
 };
 
 struct SKRY_img_alignment
@@ -74,8 +88,34 @@ struct SKRY_img_alignment
     /** Value is relative to the image's darkest (0.0) and brightest (1.0) pixels. */
     float placement_brightness_threshold;
 
+    /// Used by 'estimate_quality()' for anchors
+    struct thread_filter_buffers filter_buffers;
+
     struct SKRY_point centroid_pos;
 
+    /// Used if 'algn_method' is SKRY_IMG_ALGN_CENTROID; see SKRY_set_centroid_alignment_params()
+    struct
+    {
+        float brightness_threshold;
+        unsigned decimation;
+        /// If true, 'centroid_pos' has to be determined again for the first image
+        int is_first_pos_outdated;
+    } centroid;
+
+    /// Used if 'algn_method' is SKRY_IMG_ALGN_PHASE_CORR
+    struct
+    {
+        struct fft_plan *plan;
+        /// Position of the reference square in the first image
+        struct SKRY_point ref_pos;
+        /// Normalized spectrum of the reference square (n x n)
+        struct complex_f *ref_spectrum;
+        /// Work buffer (n x n)
+        struct complex_f *buf;
+        /// Hann window coefficients (n), applied separably
+        float *window;
+    } phase_corr;
+
     /// Set-theoretic intersection of all images after alignment (i.e. the fragment which is visible in all images)
     struct
     {
@@ -90,6 +130,11 @@ struct SKRY_img_alignment
 
     /// Image offsets (relative to each image's origin) necessary for them to be aligned
     struct SKRY_point *img_offsets;
+
+    /// See SKRY_set_img_align_quality_est()
+    struct provisional_quality prov_quality;
+
+    struct SKRY_perf_stats perf_stats; ///< Counters of all steps (see SKRY_get_img_align_perf_stats())
 };
 
 /// Returns null
@@ -102,12 +147,22 @@ SKRY_ImgAlignment *SKRY_free_img_alignment(SKRY_ImgAlignment *img_algn)
         if (img_algn->anchors.data)
         {
             for (size_t i = 0; i < DA_SIZE(img_algn->anchors); i++)
+            {
                 SKRY_free_image(img_algn->anchors.data[i].ref_block);
+                free_image_pyramid(&img_algn->anchors.data[i].ref_block_pyramid);
+            }
 
             DA_FREE(img_algn->anchors);
         }
 
         free(img_algn->img_offsets);
+        free_thread_filter_buffers(&img_algn->filter_buffers);
+        free_provisional_quality(&img_algn->prov_quality);
+
+        free_fft_plan(img_algn->phase_corr.plan);
+        free(img_algn->phase_corr.ref_spectrum);
+        free(img_algn->phase_corr.buf);
+        free(img_algn->phase_corr.window);
 
         free(img_algn);
     }
@@ -119,6 +174,104 @@ int SKRY_is_img_alignment_complete(const SKRY_ImgAlignment *img_algn)
     return img_algn->is_complete;
 }
 
+/// Fills 'dest' (n x n) with the windowed, zero-mean square of 'img' at 'pos'
+static
+void load_phase_corr_square(const SKRY_Image *img, ///< Must be SKRY_PIX_MONO8
+                            struct SKRY_point pos,
+                            size_t n,
+                            const float window[],
+                            struct complex_f dest[])
+{
+    uint64_t sum = 0;
+    for (size_t y = 0; y < n; y++)
+    {
+        const uint8_t *line = (const uint8_t *)SKRY_get_line(img, pos.y + y) + pos.x;
+        for (size_t x = 0; x < n; x++)
+            sum += line[x];
+    }
+    float mean = (float)sum / (n*n);
+
+    for (size_t y = 0; y < n; y++)
+    {
+        const uint8_t *line = (const uint8_t *)SKRY_get_line(img, pos.y + y) + pos.x;
+        struct complex_f *row = dest + y*n;
+        for (size_t x = 0; x < n; x++)
+        {
+            row[x].re = (line[x] - mean) * window[y] * window[x];
+            row[x].im = 0;
+        }
+    }
+}
+
+/// Returns position of the phase correlation square clamped to 'img'
+static
+struct SKRY_point clamp_phase_corr_pos(struct SKRY_point pos, size_t n, const SKRY_Image *img)
+{
+    pos.x = SKRY_MAX(0, SKRY_MIN(pos.x, (int)(SKRY_get_img_width(img) - n)));
+    pos.y = SKRY_MAX(0, SKRY_MIN(pos.y, (int)(SKRY_get_img_height(img) - n)));
+    return pos;
+}
+
+/// Returns SKRY_SUCCESS, SKRY_OUT_OF_MEMORY or SKRY_INVALID_PARAMETERS (image too small)
+static
+enum SKRY_result init_phase_corr(SKRY_ImgAlignment *img_algn, const SKRY_Image *first_img)
+{
+    unsigned width = SKRY_get_img_width(first_img),
+             height = SKRY_get_img_height(first_img);
+
+    size_t n = PHASE_CORR_MAX_SIZE;
+    while (n > SKRY_MIN(width, height))
+        n /= 2;
+    if (n < PHASE_CORR_MIN_SIZE)
+        return SKRY_INVALID_PARAMETERS;
+
+    img_algn->phase_corr.plan = create_fft_plan(n);
+    img_algn->phase_corr.ref_spectrum = malloc(n*n * sizeof(*img_algn->phase_corr.ref_spectrum));
+    img_algn->phase_corr.buf = malloc(n*n * sizeof(*img_algn->phase_corr.buf));
+    img_algn->phase_corr.window = malloc(n * sizeof(*img_algn->phase_corr.window));
+    if (!img_algn->phase_corr.plan || !img_algn->phase_corr.ref_spectrum
+        || !img_algn->phase_corr.buf || !img_algn->phase_corr.window)
+    {
+        return SKRY_OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        img_algn->phase_corr.window[i] = 0.5f - 0.5f * cosf(2 * 3.14159265f * i / (n-1));
+
+    SKRY_Image *img8 = (SKRY_Image *)first_img;
+    if (SKRY_get_img_pix_fmt(first_img) != SKRY_PIX_MONO8)
+    {
+        img8 = SKRY_convert_pix_fmt(first_img, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE);
+        if (!img8)
+            return SKRY_OUT_OF_MEMORY;
+    }
+
+    // Center the square on the object (typically a planetary disc), which need not be in the middle of the image
+    struct SKRY_point centroid = SKRY_get_centroid(img8, SKRY_get_img_rect(img8));
+    img_algn->phase_corr.ref_pos = clamp_phase_corr_pos(
+            (struct SKRY_point) { .x = centroid.x - (int)n/2, .y = centroid.y - (int)n/2 }, n, img8);
+
+    LOG_MSG(SKRY_LOG_IMG_ALIGNMENT, "Using a %zux%zu phase correlation region at (%d, %d).",
+            n, n, img_algn->phase_corr.ref_pos.x, img_algn->phase_corr.ref_pos.y);
+
+    load_phase_corr_square(img8, img_algn->phase_corr.ref_pos, n,
+                           img_algn->phase_corr.window, img_algn->phase_corr.ref_spectrum);
+    fft_2d(img_algn->phase_corr.plan, img_algn->phase_corr.ref_spectrum, 0);
+
+    if (img8 != first_img)
+        SKRY_free_image(img8);
+
+    return SKRY_SUCCESS;
+}
+
+static
+struct SKRY_point find_centroid(const SKRY_ImgAlignment *img_algn, const SKRY_Image *img)
+{
+    return SKRY_get_thresholded_centroid(img, SKRY_get_img_rect(img),
+                                         img_algn->centroid.brightness_threshold,
+                                         img_algn->centroid.decimation);
+}
+
 #define FAIL_ON_NULL(ptr)                         \
     if (!(ptr))                                   \
     {                                             \
@@ -208,7 +361,7 @@ SKRY_ImgAlignment *SKRY_init_img_alignment(
         DA_SET_SIZE(img_algn->anchors, num_anchors);
         FAIL_ON_NULL(img_algn->anchors.data);
         for (size_t i = 0; i < num_anchors; i++)
-            img_algn->anchors.data[i].is_valid = 1;
+            img_algn->anchors.data[i] = (struct anchor_data) { .is_valid = 1 };
 
         for (size_t i = 0; i < DA_SIZE(img_algn->anchors); i++)
         {
@@ -223,12 +376,25 @@ SKRY_ImgAlignment *SKRY_init_img_alignment(
                     SKRY_get_img_width(blk),
                     SKRY_get_img_height(blk),
                     SKRY_get_line_stride_in_bytes(blk),
-                    QUALITY_EST_BOX_BLUR_RADIUS);
+                    QUALITY_EST_BOX_BLUR_RADIUS, 0);
         }
     }
     else if (SKRY_IMG_ALGN_CENTROID == method)
     {
-        img_algn->centroid_pos = SKRY_get_centroid(first_img, SKRY_get_img_rect(first_img));
+        img_algn->centroid.decimation = 1;
+        img_algn->centroid_pos = find_centroid(img_algn, first_img);
+    }
+    else if (SKRY_IMG_ALGN_PHASE_CORR == method)
+    {
+        local_result = init_phase_corr(img_algn, first_img);
+        if (local_result != SKRY_SUCCESS)
+        {
+            SKRY_free_image(first_img);
+            SKRY_free_img_alignment(img_algn);
+            if (result)
+                *result = local_result;
+            return 0;
+        }
     }
 
     if (result)
@@ -239,20 +405,84 @@ SKRY_ImgAlignment *SKRY_init_img_alignment(
     return img_algn;
 }
 
+/// Fills 'matched_pos' of all valid anchors; returns SKRY_SUCCESS or an error code
+static
+enum SKRY_result match_anchors_using_accel(SKRY_ImgAlignment *img_algn, const SKRY_Image *img)
+{
+    size_t num_anchors = DA_SIZE(img_algn->anchors);
+    struct accel_match_block *blocks = malloc(num_anchors * sizeof(*blocks));
+    struct SKRY_point *new_pos = malloc(num_anchors * sizeof(*new_pos));
+    if (!blocks || !new_pos)
+    {
+        free(blocks);
+        free(new_pos);
+        return SKRY_OUT_OF_MEMORY;
+    }
+
+    size_t num_blocks = 0;
+    for (size_t i = 0; i < num_anchors; i++)
+        if (img_algn->anchors.data[i].is_valid)
+            blocks[num_blocks++] = (struct accel_match_block) { .ref_pos = img_algn->anchors.data[i].pos,
+                                                                .ref_block = img_algn->anchors.data[i].ref_block };
+
+    enum SKRY_result result = accel_find_matching_positions(img, num_blocks, blocks, img_algn->search_radius, new_pos);
+    if (SKRY_SUCCESS == result)
+    {
+        size_t blk_idx = 0;
+        for (size_t i = 0; i < num_anchors; i++)
+            if (img_algn->anchors.data[i].is_valid)
+                img_algn->anchors.data[i].matched_pos = new_pos[blk_idx++];
+    }
+
+    free(blocks);
+    free(new_pos);
+    return result;
+}
+
 static
 struct SKRY_point determine_img_offset_using_anchors(SKRY_ImgAlignment *img_algn,
                                                      const SKRY_Image *img /* must be SKRY_PIX_MONO8 */)
 {
     struct SKRY_point active_anchor_offset = { 0 };
 
+    int are_anchors_matched = is_accel_matching_enabled()
+                              && SKRY_SUCCESS == match_anchors_using_accel(img_algn, img);
+
+    // Shared by all anchors (and stored in the image pool for the reference point alignment phase);
+    // without it (when disabled or out of memory), matching is performed at full resolution only
+    struct image_pyramid pyramid;
+    int has_pyramid = !are_anchors_matched && g_pyramid_matching_enabled && (SKRY_SUCCESS == get_curr_img_pyramid(
+        img_algn->img_seq, img,
+        get_num_pyramid_levels_for_matching(2*img_algn->block_radius,
+                                            2*img_algn->block_radius,
+                                            img_algn->search_radius),
+        &pyramid));
+
+    // If out of memory, 'estimate_quality()' allocates temporary buffers instead
+    reserve_thread_filter_buffers(&img_algn->filter_buffers);
+
+    // Anchors are independent of one another (each one only reads 'img' and updates itself)
+    #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < DA_SIZE(img_algn->anchors); i++)
     {
         struct anchor_data *anchor = &img_algn->anchors.data[i];
         if (img_algn->anchors.data[i].is_valid)
         {
             struct SKRY_point new_pos;
-            find_matching_position(anchor->pos, anchor->ref_block,
-                                   img, img_algn->search_radius, 4, &new_pos);
+            if (are_anchors_matched)
+                new_pos = anchor->matched_pos;
+            else
+            {
+                // If out of memory, the block has no levels and is matched at full resolution
+                if (has_pyramid && anchor->ref_block_pyramid.num_levels < pyramid.num_levels)
+                {
+                    free_image_pyramid(&anchor->ref_block_pyramid);
+                    create_image_pyramid(anchor->ref_block, pyramid.num_levels, &anchor->ref_block_pyramid);
+                }
+                find_matching_position(anchor->pos, anchor->ref_block, &anchor->ref_block_pyramid,
+                                       img, has_pyramid ? &pyramid : 0,
+                                       img_algn->search_radius, 4, &new_pos);
+            }
 
             unsigned blkw = SKRY_get_img_width(anchor->ref_block),
                      blkh = SKRY_get_img_height(anchor->ref_block);
@@ -268,7 +498,8 @@ struct SKRY_point determine_img_offset_using_anchors(SKRY_ImgAlignment *img_algn
             SKRY_quality_t new_qual = estimate_quality((uint8_t *)SKRY_get_line(img, new_pos.y) + new_pos.x,
                                                        blkw, blkh,
                                                        SKRY_get_line_stride_in_bytes(img),
-                                                       QUALITY_EST_BOX_BLUR_RADIUS);
+                                                       QUALITY_EST_BOX_BLUR_RADIUS,
+                                                       get_thread_filter_buffers(&img_algn->filter_buffers));
             if (new_qual > anchor->ref_block_qual)
             {
                 anchor->ref_block_qual = new_qual;
@@ -280,10 +511,12 @@ struct SKRY_point determine_img_offset_using_anchors(SKRY_ImgAlignment *img_algn
                                                       0, 0,
                                                       blkw, blkh,
                                                       SKRY_DEMOSAIC_SIMPLE);
+                free_image_pyramid(&anchor->ref_block_pyramid);
             }
 
             if (i == img_algn->active_anchor_idx)
             {
+                // Only one thread gets here
                 active_anchor_offset.x = new_pos.x - anchor->pos.x;
                 active_anchor_offset.y = new_pos.y - anchor->pos.y;
             }
@@ -292,6 +525,9 @@ struct SKRY_point determine_img_offset_using_anchors(SKRY_ImgAlignment *img_algn
         }
     }
 
+    if (has_pyramid)
+        release_curr_img_pyramid(img_algn->img_seq, &pyramid);
+
     if (!img_algn->anchors.data[img_algn->active_anchor_idx].is_valid)
     {
         // Select the next available valid anchor as "active"
@@ -311,6 +547,7 @@ struct SKRY_point determine_img_offset_using_anchors(SKRY_ImgAlignment *img_algn
             // There are no more existing valid anchors; choose and add a new one
             DA_SET_SIZE(img_algn->anchors, DA_SIZE(img_algn->anchors) + 1);
             struct anchor_data *new_anchor = &DA_LAST(img_algn->anchors);
+            *new_anchor = (struct anchor_data) { 0 };
 
             new_anchor->pos = SKRY_suggest_anchor_pos(img,
                                                       img_algn->placement_brightness_threshold,
@@ -328,7 +565,7 @@ struct SKRY_point determine_img_offset_using_anchors(SKRY_ImgAlignment *img_algn
                                                           SKRY_get_img_width(new_anchor->ref_block),
                                                           SKRY_get_img_height(new_anchor->ref_block),
                                                           SKRY_get_line_stride_in_bytes(new_anchor->ref_block),
-                                                          QUALITY_EST_BOX_BLUR_RADIUS);
+                                                          QUALITY_EST_BOX_BLUR_RADIUS, 0);
             new_anchor->is_valid = 1;
             img_algn->active_anchor_idx = DA_SIZE(img_algn->anchors)-1;
 
@@ -348,14 +585,85 @@ struct SKRY_point determine_img_offset_using_anchors(SKRY_ImgAlignment *img_algn
 static
 struct SKRY_point determine_img_offset_using_centroid(SKRY_ImgAlignment *img_algn, const SKRY_Image *img)
 {
-    struct SKRY_point new_centroid_pos = SKRY_get_centroid(img, SKRY_get_img_rect(img));
+    struct SKRY_point new_centroid_pos = find_centroid(img_algn, img);
     return (struct SKRY_point)
         { .x = new_centroid_pos.x - img_algn->centroid_pos.x,
           .y = new_centroid_pos.y - img_algn->centroid_pos.y };
 }
 
-/// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
-enum SKRY_result SKRY_img_alignment_step(SKRY_ImgAlignment *img_algn)
+/// Returns offset of 'img' relative to the previous image
+static
+struct SKRY_point determine_img_offset_using_phase_corr(SKRY_ImgAlignment *img_algn,
+                                                        const SKRY_Image *img /* must be SKRY_PIX_MONO8 */)
+{
+    size_t n = get_fft_length(img_algn->phase_corr.plan);
+    struct SKRY_point prev_ofs = img_algn->img_offsets[img_algn->curr_img_idx-1];
+
+    if (SKRY_get_img_width(img) < n || SKRY_get_img_height(img) < n)
+    {
+        LOG_MSG(SKRY_LOG_IMG_ALIGNMENT, "Image %zu is smaller than the phase correlation region; assuming no offset.",
+                img_algn->curr_img_idx);
+        return (struct SKRY_point) { 0 };
+    }
+
+    // Follow the object: the reference square's contents should be found in 'img' at 'ref_pos' + 'prev_ofs'
+    struct SKRY_point pos = clamp_phase_corr_pos(SKRY_ADD_POINTS(img_algn->phase_corr.ref_pos, prev_ofs), n, img);
+
+    struct complex_f *buf = img_algn->phase_corr.buf;
+    const struct complex_f *ref = img_algn->phase_corr.ref_spectrum;
+
+    load_phase_corr_square(img, pos, n, img_algn->phase_corr.window, buf);
+    fft_2d(img_algn->phase_corr.plan, buf, 0);
+
+    // Normalized cross-power spectrum; its inverse transform has a peak at the translation between the squares
+    #pragma omp parallel for
+    for (size_t i = 0; i < n*n; i++)
+    {
+        struct complex_f c = { .re = buf[i].re * ref[i].re + buf[i].im * ref[i].im,
+                               .im = buf[i].im * ref[i].re - buf[i].re * ref[i].im };
+        float mag = sqrtf(c.re*c.re + c.im*c.im);
+        if (mag > 1.0e-12f)
+        {
+            c.re /= mag;
+            c.im /= mag;
+        }
+        buf[i] = c;
+    }
+
+    fft_2d(img_algn->phase_corr.plan, buf, 1);
+
+    size_t peak_idx = 0;
+    for (size_t i = 1; i < n*n; i++)
+        if (buf[i].re > buf[peak_idx].re)
+            peak_idx = i;
+
+    // The transform is periodic; indices over n/2 correspond to negative translations
+    int shift_x = peak_idx % n,
+        shift_y = peak_idx / n;
+    if (shift_x > (int)n/2) shift_x -= n;
+    if (shift_y > (int)n/2) shift_y -= n;
+
+    return (struct SKRY_point) { .x = pos.x - img_algn->phase_corr.ref_pos.x + shift_x - prev_ofs.x,
+                                 .y = pos.y - img_algn->phase_corr.ref_pos.y + shift_y - prev_ofs.y };
+}
+
+/// Estimates provisional quality of the current image (whose offset has to be already determined)
+static
+enum SKRY_result estimate_curr_img_provisional_quality(SKRY_ImgAlignment *img_algn, size_t img_idx)
+{
+    enum SKRY_result result;
+    SKRY_Image *img = SKRY_get_curr_img_from_pool(img_algn->img_seq, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE, &result);
+    if (!img)
+        return result;
+
+    estimate_provisional_quality(&img_algn->prov_quality, img, img_idx, img_algn->img_offsets[img_idx]);
+    SKRY_release_img_to_pool(img_algn->img_seq, SKRY_get_curr_img_idx(img_algn->img_seq), img);
+
+    return SKRY_SUCCESS;
+}
+
+static
+enum SKRY_result img_alignment_step(SKRY_ImgAlignment *img_algn)
 {
     enum SKRY_result result = SKRY_SUCCESS;
 
@@ -366,6 +674,24 @@ enum SKRY_result SKRY_img_alignment_step(SKRY_ImgAlignment *img_algn)
 
         unsigned width, height;
         result = SKRY_get_curr_img_metadata(img_algn->img_seq, &width, &height, 0);
+        if (SKRY_SUCCESS == result && img_algn->centroid.is_first_pos_outdated)
+        {
+            // Centroid determination parameters have changed after SKRY_init_img_alignment()
+            SKRY_Image *first_img = SKRY_get_curr_img(img_algn->img_seq, &result);
+            if (first_img)
+            {
+                img_algn->centroid_pos = find_centroid(img_algn, first_img);
+                img_algn->centroid.is_first_pos_outdated = 0;
+                SKRY_free_image(first_img);
+            }
+        }
+        if (SKRY_SUCCESS == result && img_algn->prov_quality.area_size > 0)
+        {
+            result = alloc_provisional_quality(&img_algn->prov_quality, width, height,
+                                               SKRY_get_active_img_count(img_algn->img_seq));
+            if (SKRY_SUCCESS == result)
+                result = estimate_curr_img_provisional_quality(img_algn, 0);
+        }
         if (SKRY_SUCCESS == result)
         {
             img_algn->intersection.bottom_right.x = width - 1;
@@ -388,7 +714,16 @@ enum SKRY_result SKRY_img_alignment_step(SKRY_ImgAlignment *img_algn)
             return SKRY_LAST_STEP;
         }
 
-        SKRY_Image *img = SKRY_get_curr_img(img_algn->img_seq, &result);
+        // Anchors and phase correlation use MONO8 images, which can be reused by subsequent phases via the image pool.
+        // If the sequence is prefetched with conversion to MONO8, the next image is converted while this one is processed.
+        int uses_pool = (SKRY_IMG_ALGN_ANCHORS == img_algn->algn_method
+                         || SKRY_IMG_ALGN_PHASE_CORR == img_algn->algn_method);
+        SKRY_Image *img;
+        if (uses_pool)
+            img = SKRY_get_curr_img_from_pool(img_algn->img_seq, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE, &result);
+        else
+            img = SKRY_get_curr_img(img_algn->img_seq, &result);
+
         if (!img)
             return result;
 
@@ -397,16 +732,6 @@ enum SKRY_result SKRY_img_alignment_step(SKRY_ImgAlignment *img_algn)
 
         if (SKRY_IMG_ALGN_ANCHORS == img_algn->algn_method)
         {
-            if (SKRY_get_img_pix_fmt(img) != SKRY_PIX_MONO8)
-            {
-                SKRY_Image *img_mono8 = SKRY_convert_pix_fmt(img, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE);
-                SKRY_free_image(img);
-                if (!img_mono8)
-                    return SKRY_OUT_OF_MEMORY;
-
-                img = img_mono8;
-            }
-
             detected_img_offset = determine_img_offset_using_anchors(img_algn, img);
         }
         else if (SKRY_IMG_ALGN_CENTROID == img_algn->algn_method)
@@ -414,6 +739,10 @@ enum SKRY_result SKRY_img_alignment_step(SKRY_ImgAlignment *img_algn)
             detected_img_offset = determine_img_offset_using_centroid(img_algn, img);
             SKRY_ADD_POINT_TO(img_algn->centroid_pos, detected_img_offset);
         }
+        else if (SKRY_IMG_ALGN_PHASE_CORR == img_algn->algn_method)
+        {
+            detected_img_offset = determine_img_offset_using_phase_corr(img_algn, img);
+        }
 
         // 'img_offsets' contain offsets relative to the first frame, so store the current offset incrementally w.r.t. the previous one
         struct SKRY_point *curr_img_ofs = &img_algn->img_offsets[img_algn->curr_img_idx];
@@ -425,14 +754,59 @@ enum SKRY_result SKRY_img_alignment_step(SKRY_ImgAlignment *img_algn)
         img_algn->intersection.offset.y = SKRY_MAX(img_algn->intersection.offset.y, -curr_img_ofs->y);
         img_algn->intersection.bottom_right.x = SKRY_MIN(img_algn->intersection.bottom_right.x, -curr_img_ofs->x + (int)SKRY_get_img_width(img) - 1);
         img_algn->intersection.bottom_right.y = SKRY_MIN(img_algn->intersection.bottom_right.y, -curr_img_ofs->y + (int)SKRY_get_img_height(img) - 1);
+
+        if (img_algn->prov_quality.area_size > 0)
+        {
+            if (uses_pool)
+                estimate_provisional_quality(&img_algn->prov_quality, img, img_algn->curr_img_idx, *curr_img_ofs);
+            else
+                result = estimate_curr_img_provisional_quality(img_algn, img_algn->curr_img_idx);
+        }
+
         img_algn->curr_img_idx += 1;
 
-        img = SKRY_free_image(img);
+        if (uses_pool)
+            SKRY_release_img_to_pool(img_algn->img_seq, SKRY_get_curr_img_idx(img_algn->img_seq), img);
+        else
+            SKRY_free_image(img);
 
         return result;
     }
 }
 
+/// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
+enum SKRY_result SKRY_img_alignment_step(SKRY_ImgAlignment *img_algn)
+{
+    struct perf_step perf_step;
+    begin_perf_step(&perf_step);
+
+    enum SKRY_result result = img_alignment_step(img_algn);
+
+    const SKRY_ImgSequence *img_seq = img_algn->img_seq;
+    end_perf_step(&perf_step, &img_algn->perf_stats, "Image alignment", img_seq,
+                  SKRY_get_curr_img_idx_within_active_subset(img_seq));
+    return result;
+}
+
+static
+enum SKRY_result img_alignment_step_func(void *img_algn) { return SKRY_img_alignment_step(img_algn); }
+
+enum SKRY_result SKRY_img_alignment_run(SKRY_ImgAlignment *img_algn, size_t max_steps,
+                                        SKRY_progress_callback_fn progress_callback, void *callback_data,
+                                        const int *cancel_flag)
+{
+    if (SKRY_is_img_alignment_complete(img_algn))
+        return SKRY_LAST_STEP;
+
+    return run_phase_steps(img_alignment_step_func, img_algn, img_algn->img_seq, 0, max_steps,
+                           progress_callback, callback_data, cancel_flag);
+}
+
+void SKRY_get_img_align_perf_stats(const SKRY_ImgAlignment *img_algn, struct SKRY_perf_stats *stats)
+{
+    *stats = img_algn->perf_stats;
+}
+
 /** The return value may increase during processing (when all existing
     anchors became invalid and a new one(s) had to be automatically created). */
 size_t SKRY_get_anchor_count(const SKRY_ImgAlignment *img_algn)
@@ -508,14 +882,30 @@ struct SKRY_point SKRY_suggest_anchor_pos(
 
     struct SKRY_point result = { .x = width/2, .y = height/2 };
     SKRY_quality_t best_qual = 0;
+    /// Index (in scan order) of the row of 'result'; used to make the parallel search deterministic
+    size_t best_row_idx = SIZE_MAX;
 
     size_t num_pixels_in_block = SKRY_SQR(ref_block_size);
 
     // Consider only the middle 3/4 of 'image'
-    for (unsigned y = height/8 + ref_block_size/2;
-                  y < 7*height/8 - ref_block_size/2;
-                  y += ref_block_size/3)
+    unsigned y_start = height/8 + ref_block_size/2,
+             y_end = 7*height/8 - ref_block_size/2,
+             y_step = ref_block_size/3;
+    size_t num_rows = (y_start < y_end && y_step > 0) ? (y_end - y_start + y_step - 1) / y_step : 0;
+
+    // If out of memory, 'estimate_quality()' allocates temporary buffers instead
+    struct thread_filter_buffers filter_buffers = { 0 };
+    reserve_thread_filter_buffers(&filter_buffers);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t row_idx = 0; row_idx < num_rows; row_idx++)
     {
+        unsigned y = y_start + row_idx * y_step;
+
+        // Best position in this row; the first one (in scan order) is chosen among those of equal quality
+        struct SKRY_point row_best_pos = { 0 };
+        SKRY_quality_t row_best_qual = 0;
+
         for (unsigned x = width/8 + ref_block_size/2;
                       x < 7*width/8 - ref_block_size;
                       x += ref_block_size/3)
@@ -546,18 +936,34 @@ struct SKRY_point SKRY_suggest_anchor_pos(
                         SKRY_MAX(ref_block_size/2, 32)))
             {
                 SKRY_quality_t qual = estimate_quality((uint8_t *)SKRY_get_line(img8, y - ref_block_size/2) + x-ref_block_size/2, ref_block_size, ref_block_size,
-                                                       SKRY_get_line_stride_in_bytes(img8), 4);
+                                                       SKRY_get_line_stride_in_bytes(img8), 4,
+                                                       get_thread_filter_buffers(&filter_buffers));
 
-                if (qual > best_qual)
+                if (qual > row_best_qual)
                 {
-                    best_qual = qual;
-                    result.x = x;
-                    result.y = y;
+                    row_best_qual = qual;
+                    row_best_pos.x = x;
+                    row_best_pos.y = y;
+                }
+            }
+        }
+
+        if (row_best_qual > 0)
+        {
+            #pragma omp critical(suggest_anchor_pos)
+            {
+                if (row_best_qual > best_qual || row_best_qual == best_qual && row_idx < best_row_idx)
+                {
+                    best_qual = row_best_qual;
+                    best_row_idx = row_idx;
+                    result = row_best_pos;
                 }
             }
         }
     }
 
+    free_thread_filter_buffers(&filter_buffers);
+
     if (img8 != image)
         SKRY_free_image(img8);
     return result;
@@ -579,3 +985,220 @@ struct SKRY_point SKRY_get_current_centroid_pos(const SKRY_ImgAlignment *img_alg
 {
     return img_algn->centroid_pos;
 }
+
+enum SKRY_result SKRY_set_centroid_alignment_params(SKRY_ImgAlignment *img_algn,
+                                                    float brightness_threshold,
+                                                    unsigned decimation)
+{
+    if (img_algn->algn_method != SKRY_IMG_ALGN_CENTROID
+        || img_algn->curr_img_idx > 0
+        || !(brightness_threshold >= 0.0f && brightness_threshold <= 1.0f)
+        || 0 == decimation)
+    {
+        return SKRY_INVALID_PARAMETERS;
+    }
+
+    img_algn->centroid.brightness_threshold = brightness_threshold;
+    img_algn->centroid.decimation = decimation;
+    img_algn->centroid.is_first_pos_outdated = 1;
+
+    return SKRY_SUCCESS;
+}
+
+enum SKRY_result SKRY_set_img_align_quality_est(SKRY_ImgAlignment *img_algn,
+                                                unsigned estimation_area_size,
+                                                unsigned detail_scale)
+{
+    if (img_algn->curr_img_idx > 0 || (estimation_area_size > 0 && 0 == detail_scale))
+        return SKRY_INVALID_PARAMETERS;
+
+    img_algn->prov_quality.area_size = estimation_area_size;
+    img_algn->prov_quality.box_blur_radius = detail_scale;
+
+    return SKRY_SUCCESS;
+}
+
+const struct provisional_quality *get_provisional_quality(const SKRY_ImgAlignment *img_algn)
+{
+    if (img_algn->prov_quality.area_size > 0 && img_algn->prov_quality.area_quality)
+        return &img_algn->prov_quality;
+    else
+        return 0;
+}
+
+void write_img_align_checkpoint(struct checkpoint_file *ckpt, const SKRY_ImgAlignment *img_algn)
+{
+    ckpt_write_u32(ckpt, img_algn->algn_method);
+    ckpt_write_u32(ckpt, img_algn->block_radius);
+    ckpt_write_u32(ckpt, img_algn->search_radius);
+    ckpt_write_flt(ckpt, img_algn->placement_brightness_threshold);
+    ckpt_write_flt(ckpt, img_algn->centroid.brightness_threshold);
+    ckpt_write_u32(ckpt, img_algn->centroid.decimation);
+    ckpt_write_point(ckpt, img_algn->centroid_pos);
+
+    ckpt_write_point(ckpt, img_algn->intersection.offset);
+    ckpt_write_point(ckpt, img_algn->intersection.bottom_right);
+    ckpt_write_u32(ckpt, img_algn->intersection.width);
+    ckpt_write_u32(ckpt, img_algn->intersection.height);
+
+    ckpt_write_u32(ckpt, DA_SIZE(img_algn->anchors));
+    for (size_t i = 0; i < DA_SIZE(img_algn->anchors); i++)
+    {
+        ckpt_write_point(ckpt, img_algn->anchors.data[i].pos);
+        ckpt_write_u8(ckpt, 0 != img_algn->anchors.data[i].is_valid);
+    }
+
+    for (size_t i = 0; i < SKRY_get_active_img_count(img_algn->img_seq); i++)
+        ckpt_write_point(ckpt, img_algn->img_offsets[i]);
+
+    const struct provisional_quality *pq = get_provisional_quality(img_algn);
+    ckpt_write_u32(ckpt, pq ? pq->area_size : 0);
+    if (pq)
+    {
+        ckpt_write_u32(ckpt, pq->box_blur_radius);
+        ckpt_write_u32(ckpt, pq->num_areas_horz);
+        ckpt_write_u32(ckpt, pq->num_areas_vert);
+        for (size_t i = 0; i < pq->num_imgs * pq->num_areas_horz * pq->num_areas_vert; i++)
+            ckpt_write_flt(ckpt, pq->area_quality[i]);
+    }
+}
+
+/** Checks that the intersection read from a checkpoint is consistent and that,
+    shifted by each image's offset, it lies within that image. */
+static
+enum SKRY_result check_ckpt_intersection(const SKRY_ImgAlignment *img_algn)
+{
+    const struct SKRY_point ofs = img_algn->intersection.offset;
+    const int64_t width = img_algn->intersection.width,
+                  height = img_algn->intersection.height;
+
+    if (img_algn->intersection.bottom_right.x != ofs.x + width - 1
+        || img_algn->intersection.bottom_right.y != ofs.y + height - 1
+        || img_algn->img_offsets[0].x != 0 || img_algn->img_offsets[0].y != 0)
+    {
+        return SKRY_UNSUPPORTED_FILE_FORMAT;
+    }
+
+    SKRY_ImgSequence *img_seq = img_algn->img_seq;
+    enum SKRY_result result = SKRY_SUCCESS;
+    SKRY_seek_start(img_seq);
+    for (size_t i = 0; i < SKRY_get_active_img_count(img_seq); i++)
+    {
+        if (i > 0 && SKRY_SUCCESS != (result = SKRY_seek_next(img_seq)))
+            break;
+
+        unsigned img_width, img_height;
+        if (SKRY_SUCCESS != (result = SKRY_get_curr_img_metadata(img_seq, &img_width, &img_height, 0)))
+            break;
+
+        // Position of the intersection in image 'i'
+        int64_t x0 = (int64_t)ofs.x + img_algn->img_offsets[i].x,
+                y0 = (int64_t)ofs.y + img_algn->img_offsets[i].y;
+        if (x0 < 0 || y0 < 0 || x0 + width > img_width || y0 + height > img_height)
+        {
+            result = SKRY_UNSUPPORTED_FILE_FORMAT;
+            break;
+        }
+    }
+    SKRY_seek_start(img_seq);
+
+    return result;
+}
+
+SKRY_ImgAlignment *read_img_align_checkpoint(struct checkpoint_file *ckpt, SKRY_ImgSequence *img_seq)
+{
+    SKRY_ImgAlignment *img_algn = malloc(sizeof(*img_algn));
+    if (!img_algn)
+    {
+        ckpt_set_error(ckpt, SKRY_OUT_OF_MEMORY);
+        return 0;
+    }
+    *img_algn = (SKRY_ImgAlignment) { 0 };
+
+    size_t num_active_imgs = SKRY_get_active_img_count(img_seq);
+
+    img_algn->img_seq = img_seq;
+    img_algn->algn_method = ckpt_read_u32(ckpt);
+    img_algn->block_radius = ckpt_read_u32(ckpt);
+    img_algn->search_radius = ckpt_read_u32(ckpt);
+    img_algn->placement_brightness_threshold = ckpt_read_flt(ckpt);
+    img_algn->centroid.brightness_threshold = ckpt_read_flt(ckpt);
+    img_algn->centroid.decimation = ckpt_read_u32(ckpt);
+    img_algn->centroid_pos = ckpt_read_point(ckpt);
+
+    img_algn->intersection.offset = ckpt_read_point(ckpt);
+    img_algn->intersection.bottom_right = ckpt_read_point(ckpt);
+    img_algn->intersection.width = ckpt_read_u32(ckpt);
+    img_algn->intersection.height = ckpt_read_u32(ckpt);
+
+    // Anchors' reference blocks are not stored, as they are not needed once alignment is complete
+    uint32_t num_anchors = ckpt_read_u32(ckpt);
+    if (img_algn->algn_method > SKRY_IMG_ALGN_PHASE_CORR
+        || 0 == img_algn->intersection.width || 0 == img_algn->intersection.height
+        || num_anchors > (size_t)img_algn->intersection.width * img_algn->intersection.height)
+    {
+        ckpt_set_error(ckpt, SKRY_UNSUPPORTED_FILE_FORMAT);
+    }
+    if (SKRY_SUCCESS != ckpt->result)
+        return SKRY_free_img_alignment(img_algn);
+
+    DA_ALLOC(img_algn->anchors, num_anchors);
+    DA_SET_SIZE(img_algn->anchors, num_anchors);
+    for (size_t i = 0; i < num_anchors; i++)
+    {
+        img_algn->anchors.data[i] = (struct anchor_data) { .pos = ckpt_read_point(ckpt) };
+        img_algn->anchors.data[i].is_valid = ckpt_read_u8(ckpt);
+    }
+
+    img_algn->img_offsets = malloc(num_active_imgs * sizeof(*img_algn->img_offsets));
+    if (!img_algn->img_offsets)
+    {
+        ckpt_set_error(ckpt, SKRY_OUT_OF_MEMORY);
+        return SKRY_free_img_alignment(img_algn);
+    }
+    for (size_t i = 0; i < num_active_imgs; i++)
+        img_algn->img_offsets[i] = ckpt_read_point(ckpt);
+    if (SKRY_SUCCESS == ckpt->result)
+        ckpt_set_error(ckpt, check_ckpt_intersection(img_algn));
+    if (SKRY_SUCCESS != ckpt->result)
+        return SKRY_free_img_alignment(img_algn);
+
+    struct provisional_quality *pq = &img_algn->prov_quality;
+    pq->area_size = ckpt_read_u32(ckpt);
+    if (pq->area_size > 0)
+    {
+        pq->box_blur_radius = ckpt_read_u32(ckpt);
+        pq->num_areas_horz = ckpt_read_u32(ckpt);
+        pq->num_areas_vert = ckpt_read_u32(ckpt);
+        pq->num_imgs = num_active_imgs;
+
+        // The grid covers the first image, which is not smaller than the intersection
+        size_t num_areas = (size_t)pq->num_areas_horz * pq->num_areas_vert;
+        if (SKRY_SUCCESS == ckpt->result
+            && (pq->num_areas_horz * pq->area_size < img_algn->intersection.width
+                || pq->num_areas_vert * pq->area_size < img_algn->intersection.height
+                || num_areas > (size_t)img_algn->intersection.width * img_algn->intersection.height))
+        {
+            ckpt_set_error(ckpt, SKRY_UNSUPPORTED_FILE_FORMAT);
+        }
+        if (SKRY_SUCCESS != ckpt->result)
+            return SKRY_free_img_alignment(img_algn);
+
+        pq->area_quality = malloc(num_active_imgs * num_areas * sizeof(*pq->area_quality));
+        if (!pq->area_quality)
+        {
+            ckpt_set_error(ckpt, SKRY_OUT_OF_MEMORY);
+            return SKRY_free_img_alignment(img_algn);
+        }
+        for (size_t i = 0; i < num_active_imgs * num_areas; i++)
+            pq->area_quality[i] = ckpt_read_flt(ckpt);
+    }
+
+    if (SKRY_SUCCESS != ckpt->result)
+        return SKRY_free_img_alignment(img_algn);
+
+    img_algn->curr_img_idx = num_active_imgs;
+    img_algn->is_complete = 1;
+
+    return img_algn;
+}
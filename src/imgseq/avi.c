@@ -22,6 +22,7 @@ File description:
 */
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,8 +33,10 @@ File description:
 
 #include "../image/bmp.h"
 #include "imgseq_internal.h"
+#include "../utils/dnarray.h"
 #include "../utils/logging.h"
 #include "../utils/misc.h"
+#include "seq_index.h"
 #include "video.h"
 
 
@@ -43,10 +46,23 @@ File description:
 // Returns the lowest multiple of 4 which is >= x
 #define UP4MULT(x) ((x+3)/4*4)
 
+// Returns the lowest multiple of 2 which is >= x (RIFF chunks are word-aligned)
+#define UP2MULT(x) ((x+1)/2*2)
+
+/// Number of OpenDML standard index entries read at once
+#define STD_INDEX_BATCH_LEN 512
+
 #define CHARS_TO_UINT32(str) ((uint32_t)(str)[0] + ((uint32_t)(str)[1]<<8) + ((uint32_t)(str)[2]<<16) + ((uint32_t)(str)[3]<<24))
 
 #define AVIF_HAS_INDEX 0x00000010U
 
+// OpenDML index types
+#define AVI_INDEX_OF_INDEXES 0x00
+#define AVI_INDEX_OF_CHUNKS  0x01
+
+/// Set in 'AVI_std_index_entry::size' for non-key frames
+#define AVI_INDEX_DELTA_FRAME 0x80000000U
+
 #define FCC_COMPARE(fcc, string) ((fcc)[0] == string[0] \
                                && (fcc)[1] == string[1] \
                                && (fcc)[2] == string[2] \
@@ -149,6 +165,46 @@ struct AVI_old_index
     uint32_t frame_size;
 };
 
+/// OpenDML super index ('indx' chunk in the stream list); followed by 'AVI_super_index_entry's
+#pragma pack(1)
+struct AVI_super_index
+{
+    uint16_t longs_per_entry; // 4
+    uint8_t index_sub_type;
+    uint8_t index_type; // AVI_INDEX_OF_INDEXES
+    uint32_t entries_in_use;
+    fourcc_t chunk_id;
+    uint32_t reserved[3];
+};
+
+#pragma pack(1)
+struct AVI_super_index_entry
+{
+    uint64_t offset; // absolute offset of an 'ix##' chunk
+    uint32_t size;
+    uint32_t duration;
+};
+
+/// OpenDML standard index ('ix##' chunk); followed by 'AVI_std_index_entry's
+#pragma pack(1)
+struct AVI_std_index
+{
+    uint16_t longs_per_entry; // 2
+    uint8_t index_sub_type;
+    uint8_t index_type; // AVI_INDEX_OF_CHUNKS
+    uint32_t entries_in_use;
+    fourcc_t chunk_id;
+    uint64_t base_offset;
+    uint32_t reserved;
+};
+
+#pragma pack(1)
+struct AVI_std_index_entry
+{
+    uint32_t offset; // offset of frame contents (following its 'AVI_chunk') counted from 'base_offset'
+    uint32_t size;
+};
+
 #pragma pack(pop)
 
 enum AVI_pixel_format
@@ -182,11 +238,23 @@ enum SKRY_pixel_format AVI_to_SKRY_pix_fmt[] =
     [AVI_PIX_Y800]     = SKRY_PIX_MONO8
 };
 
+/// Consecutive frames whose offsets are stored relative to a common base
+struct frame_ofs_group
+{
+    uint64_t base;
+    size_t first_frame;
+};
+
 struct AVI_data
 {
     char *file_name;
     FILE *file;
-    uint32_t *frame_offsets; ///< Absolute file offsets (point to each frame's 'AVI_chunk')
+
+    /** Absolute file offsets of frames (pointing to each frame's 'AVI_chunk')
+        are stored as 32-bit deltas from 64-bit offsets of frame groups;
+        use 'add_frame_offset()' and 'get_frame_offset()'. */
+    DA_DECLARE(struct frame_ofs_group) frame_ofs_groups;
+    DA_DECLARE(uint32_t) frame_ofs_deltas; ///< Contains one element per frame
     struct SKRY_palette palette; ///< Valid for an AVI with palette
     enum AVI_pixel_format pix_fmt;
     unsigned width, height;
@@ -194,6 +262,39 @@ struct AVI_data
 
 #define AVI_DATA(data) ((struct AVI_data *)data)
 
+/// Appends the offset of the next frame
+static
+void add_frame_offset(struct AVI_data *data, uint64_t offset)
+{
+    if (0 == DA_SIZE(data->frame_ofs_groups)
+        || offset < DA_LAST(data->frame_ofs_groups).base
+        || offset - DA_LAST(data->frame_ofs_groups).base > UINT32_MAX)
+    {
+        struct frame_ofs_group group = { .base = offset,
+                                         .first_frame = DA_SIZE(data->frame_ofs_deltas) };
+        DA_APPEND(data->frame_ofs_groups, group);
+    }
+
+    DA_APPEND(data->frame_ofs_deltas, (uint32_t)(offset - DA_LAST(data->frame_ofs_groups).base));
+}
+
+static
+uint64_t get_frame_offset(const struct AVI_data *data, size_t index)
+{
+    // Find the last group starting at or before 'index'
+    size_t lo = 0, hi = DA_SIZE(data->frame_ofs_groups);
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (data->frame_ofs_groups.data[mid].first_frame <= index)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return data->frame_ofs_groups.data[lo].base + data->frame_ofs_deltas.data[index];
+}
+
 static
 enum SKRY_result AVI_get_curr_img_metadata(const struct SKRY_img_sequence *img_seq,
                                            unsigned *width, unsigned *height,
@@ -213,8 +314,9 @@ enum SKRY_result AVI_get_curr_img_metadata(const struct SKRY_img_sequence *img_s
     }
 
 static
-struct SKRY_image *AVI_get_img_by_index(const struct SKRY_img_sequence *img_seq,
-                                        size_t index, enum SKRY_result *result)
+struct SKRY_image *AVI_get_img_fragment_by_index(const struct SKRY_img_sequence *img_seq,
+                                                 size_t index, struct SKRY_rect *rect,
+                                                 enum SKRY_result *result)
 {
     assert(index < img_seq->num_images);
     struct AVI_data *data = (struct AVI_data *)img_seq->data;
@@ -226,9 +328,10 @@ struct SKRY_image *AVI_get_img_by_index(const struct SKRY_img_sequence *img_seq,
     {
         LOG_MSG(SKRY_LOG_AVI, "Cannot open %s.", data->file_name);
         if (result) *result = SKRY_CANNOT_OPEN_FILE;
+        return 0;
     }
 
-    SKRY_Image *img = SKRY_new_image(data->width, data->height, AVI_to_SKRY_pix_fmt[data->pix_fmt],
+    SKRY_Image *img = SKRY_new_image(rect->width, rect->height, AVI_to_SKRY_pix_fmt[data->pix_fmt],
                                      &data->palette, 0);
 
     if (!img)
@@ -237,7 +340,8 @@ struct SKRY_image *AVI_get_img_by_index(const struct SKRY_img_sequence *img_seq,
         return 0;
     }
 
-    if (fseek(data->file, data->frame_offsets[index], SEEK_SET))
+    uint64_t frame_ofs = get_frame_offset(data, index);
+    if (FSEEK64(data->file, (int64_t)frame_ofs, SEEK_SET))
     {
         LOG_MSG(SKRY_LOG_AVI, "Cannot seek to frame %zu.", index);
         FRAME_FAIL(SKRY_FILE_IO_ERROR);
@@ -250,7 +354,8 @@ struct SKRY_image *AVI_get_img_by_index(const struct SKRY_img_sequence *img_seq,
         FRAME_FAIL(SKRY_FILE_IO_ERROR);
     }
 
-    size_t line_byte_count = data->width * BYTES_PER_PIXEL[AVI_to_SKRY_pix_fmt[data->pix_fmt]];
+    size_t bytes_per_pixel = BYTES_PER_PIXEL[AVI_to_SKRY_pix_fmt[data->pix_fmt]];
+    size_t line_byte_count = data->width * bytes_per_pixel;
     if (IS_DIB(data->pix_fmt))
         line_byte_count = UP4MULT(line_byte_count);
 
@@ -261,34 +366,54 @@ struct SKRY_image *AVI_get_img_by_index(const struct SKRY_img_sequence *img_seq,
         FRAME_FAIL(SKRY_AVI_MALFORMED_FILE);
     }
 
-    uint8_t *line = malloc(line_byte_count);
-    for (unsigned y = 0; y < data->height; y++)
+    // Lines are read in file order; line order in a DIB is reversed
+    unsigned first_file_line = IS_DIB(data->pix_fmt) ? data->height - rect->y - rect->height : (unsigned)rect->y;
+    int64_t pixels_start = (int64_t)frame_ofs + (int64_t)sizeof(chunk);
+    int64_t file_pos = pixels_start;
+    size_t frag_line_byte_count = rect->width * bytes_per_pixel;
+    for (unsigned i = 0; i < rect->height; i++)
     {
-        fread(line, line_byte_count, 1, data->file);
+        unsigned file_line = first_file_line + i;
+        int64_t line_pos = pixels_start + (int64_t)(file_line * line_byte_count + rect->x * bytes_per_pixel);
+        if (line_pos != file_pos && FSEEK64(data->file, line_pos, SEEK_SET))
+            FRAME_FAIL(SKRY_FILE_IO_ERROR);
+
         uint8_t *img_line =
-            SKRY_get_line(img, IS_DIB(data->pix_fmt) ? SKRY_get_img_height(img) - y - 1 // line order in a DIB is reversed
-                                                     : y);
+            SKRY_get_line(img, IS_DIB(data->pix_fmt) ? rect->height - i - 1 : i);
+
+        if (1 != fread(img_line, frag_line_byte_count, 1, data->file))
+        {
+            LOG_MSG(SKRY_LOG_AVI, "Could not read frame %zu.", index);
+            FRAME_FAIL(SKRY_FILE_IO_ERROR);
+        }
+        file_pos = line_pos + (int64_t)frag_line_byte_count;
 
         if (data->pix_fmt == AVI_PIX_DIB_RGB8)
         {
             // Rearrange channels to RGB order
-            for (unsigned x = 0; x < data->width; x++)
+            for (unsigned x = 0; x < rect->width; x++)
             {
-                img_line[3*x + 0] = line[3*x + 2];
-                img_line[3*x + 1] = line[3*x + 1];
-                img_line[3*x + 2] = line[3*x + 0];
+                uint8_t ch0 = img_line[3*x + 0];
+                img_line[3*x + 0] = img_line[3*x + 2];
+                img_line[3*x + 2] = ch0;
             }
         }
-        else
-            memcpy(img_line, line, SKRY_get_bytes_per_pixel(img) * SKRY_get_img_width(img));
     }
-    free(line);
 
     if (result) *result = SKRY_SUCCESS;
 
     return img;
 }
 
+static
+struct SKRY_image *AVI_get_img_by_index(const struct SKRY_img_sequence *img_seq,
+                                        size_t index, enum SKRY_result *result)
+{
+    struct AVI_data *data = (struct AVI_data *)img_seq->data;
+    struct SKRY_rect whole_img = { .x = 0, .y = 0, .width = data->width, .height = data->height };
+    return AVI_get_img_fragment_by_index(img_seq, index, &whole_img, result);
+}
+
 static
 struct SKRY_image *AVI_get_current_img(const struct SKRY_img_sequence *img_seq, enum SKRY_result *result)
 {
@@ -313,7 +438,8 @@ void AVI_free(struct SKRY_img_sequence *img_seq)
         if (img_seq->data)
         {
             struct AVI_data *avi_data = (struct AVI_data *)img_seq->data;
-            free(avi_data->frame_offsets);
+            DA_FREE(avi_data->frame_ofs_groups);
+            DA_FREE(avi_data->frame_ofs_deltas);
             free(avi_data->file_name);
             if (avi_data->file)
                 fclose(avi_data->file);
@@ -324,6 +450,195 @@ void AVI_free(struct SKRY_img_sequence *img_seq)
     }
 }
 
+/// Contents of 'struct seq_index::extra' of an AVI index file
+struct AVI_index_extra
+{
+    uint32_t pix_fmt; ///< Element of 'enum AVI_pixel_format'
+    struct SKRY_palette palette;
+};
+
+/// Returns 0 if there is no valid index file
+static
+int load_AVI_index(struct SKRY_img_sequence *img_seq)
+{
+    struct AVI_data *avi_data = AVI_DATA(img_seq->data);
+    struct seq_index index = { .type = SKRY_IMG_SEQ_AVI,
+                               .extra_size = sizeof(struct AVI_index_extra),
+                               .entry_size = sizeof(uint64_t) };
+
+    if (!load_seq_index(avi_data->file_name, &index))
+        return 0;
+
+    const struct AVI_index_extra *extra = index.extra;
+    const uint64_t *offsets = index.entries;
+
+    int is_valid = (index.num_entries > 0
+                    && (IS_DIB(extra->pix_fmt) || AVI_PIX_Y800 == extra->pix_fmt)
+                    && index.width > 0 && index.height > 0);
+
+    if (is_valid)
+    {
+        DA_ALLOC(avi_data->frame_ofs_deltas, index.num_entries);
+        for (size_t i = 0; i < index.num_entries; i++)
+            add_frame_offset(avi_data, offsets[i]);
+
+        img_seq->num_images = index.num_entries;
+        avi_data->width = index.width;
+        avi_data->height = index.height;
+        avi_data->pix_fmt = extra->pix_fmt;
+        avi_data->palette = extra->palette;
+
+        LOG_MSG(SKRY_LOG_AVI, "Video size: %ux%u, %zu frames, %s (from index file)",
+                avi_data->width, avi_data->height,
+                img_seq->num_images,
+                AVI_pixel_format_str[avi_data->pix_fmt]);
+    }
+
+    free(index.extra);
+    free(index.entries);
+    return is_valid;
+}
+
+static
+void save_AVI_index(const struct SKRY_img_sequence *img_seq)
+{
+    const struct AVI_data *avi_data = AVI_DATA(img_seq->data);
+
+    struct AVI_index_extra extra = { .pix_fmt = avi_data->pix_fmt,
+                                     .palette = avi_data->palette };
+
+    uint64_t *offsets = malloc(img_seq->num_images * sizeof(*offsets));
+    if (!offsets)
+        return;
+
+    for (size_t i = 0; i < img_seq->num_images; i++)
+        offsets[i] = get_frame_offset(avi_data, i);
+
+    struct seq_index index = { .type = SKRY_IMG_SEQ_AVI,
+                               .width = avi_data->width,
+                               .height = avi_data->height,
+                               .pix_fmt = AVI_to_SKRY_pix_fmt[avi_data->pix_fmt],
+                               .CFA_pattern = SKRY_CFA_NONE,
+                               .extra = &extra,
+                               .extra_size = sizeof(extra),
+                               .entries = offsets,
+                               .num_entries = img_seq->num_images,
+                               .entry_size = sizeof(*offsets) };
+
+    save_seq_index(avi_data->file_name, &index);
+    free(offsets);
+}
+
+static
+int is_video_frame_chunk_id(const fourcc_t chunk_id)
+{
+    return FCC_COMPARE(chunk_id, "00db") || FCC_COMPARE(chunk_id, "00dc");
+}
+
+/// Appends frame offsets from the OpenDML standard index ('ix##' chunk) at 'std_index_pos'
+static
+enum SKRY_result read_ODML_std_index(struct AVI_data *avi_data, uint64_t std_index_pos,
+                                     size_t frame_size, int is_machine_b_e)
+{
+    struct AVI_chunk chunk;
+    struct AVI_std_index std_index;
+
+    if (FSEEK64(avi_data->file, (int64_t)std_index_pos, SEEK_SET)
+        || 1 != fread(&chunk, sizeof(chunk), 1, avi_data->file)
+        || 1 != fread(&std_index, sizeof(std_index), 1, avi_data->file))
+    {
+        LOG_MSG(SKRY_LOG_AVI, "Could not read standard index at offset %"PRIu64".", std_index_pos);
+        return SKRY_AVI_MALFORMED_FILE;
+    }
+
+    if (std_index.index_type != AVI_INDEX_OF_CHUNKS
+        || cnd_swap_16(std_index.longs_per_entry, is_machine_b_e) != sizeof(struct AVI_std_index_entry)/4
+        || !is_video_frame_chunk_id(std_index.chunk_id))
+    {
+        LOG_MSG(SKRY_LOG_AVI, "Invalid standard index at offset %"PRIu64".", std_index_pos);
+        return SKRY_AVI_MALFORMED_FILE;
+    }
+
+    uint64_t base_offset = cnd_swap_64(std_index.base_offset, is_machine_b_e);
+    uint32_t num_entries = cnd_swap_32(std_index.entries_in_use, is_machine_b_e);
+
+    struct AVI_std_index_entry entries[STD_INDEX_BATCH_LEN];
+    for (uint32_t i = 0; i < num_entries; i += STD_INDEX_BATCH_LEN)
+    {
+        size_t batch_len = SKRY_MIN(num_entries - i, STD_INDEX_BATCH_LEN);
+        if (batch_len != fread(entries, sizeof(*entries), batch_len, avi_data->file))
+        {
+            LOG_MSG(SKRY_LOG_AVI, "Standard index at offset %"PRIu64" is incomplete.", std_index_pos);
+            return SKRY_AVI_MALFORMED_FILE;
+        }
+
+        for (size_t j = 0; j < batch_len; j++)
+        {
+            uint32_t offset = cnd_swap_32(entries[j].offset, is_machine_b_e);
+            uint32_t size = cnd_swap_32(entries[j].size, is_machine_b_e) & ~AVI_INDEX_DELTA_FRAME;
+
+            // Skip dropped frames
+            if (0 == size)
+                continue;
+
+            if (size != frame_size || offset < sizeof(struct AVI_chunk))
+            {
+                LOG_MSG(SKRY_LOG_AVI, "Invalid standard index entry %"PRIu32" at offset %"PRIu64".",
+                        (uint32_t)(i + j), std_index_pos);
+                return SKRY_AVI_MALFORMED_FILE;
+            }
+
+            // Store the offset of frame's chunk rather than of its contents
+            add_frame_offset(avi_data, base_offset + offset - sizeof(struct AVI_chunk));
+        }
+    }
+
+    return SKRY_SUCCESS;
+}
+
+/// Reads frame offsets from the OpenDML super index ('indx' chunk) at 'super_index_pos'
+static
+enum SKRY_result read_ODML_index(struct AVI_data *avi_data, long super_index_pos,
+                                 size_t frame_size, int is_machine_b_e)
+{
+    struct AVI_super_index super_index;
+
+    fseek(avi_data->file, super_index_pos + sizeof(struct AVI_chunk), SEEK_SET);
+    if (1 != fread(&super_index, sizeof(super_index), 1, avi_data->file))
+    {
+        LOG_MSG(SKRY_LOG_AVI, "Could not read super index.");
+        return SKRY_AVI_MALFORMED_FILE;
+    }
+
+    if (super_index.index_type != AVI_INDEX_OF_INDEXES
+        || cnd_swap_16(super_index.longs_per_entry, is_machine_b_e) != sizeof(struct AVI_super_index_entry)/4
+        || !is_video_frame_chunk_id(super_index.chunk_id))
+    {
+        LOG_MSG(SKRY_LOG_AVI, "Unsupported super index.");
+        return SKRY_AVI_UNSUPPORTED_FORMAT;
+    }
+
+    uint32_t num_entries = cnd_swap_32(super_index.entries_in_use, is_machine_b_e);
+    struct AVI_super_index_entry *entries = malloc(num_entries * sizeof(*entries));
+    if (num_entries > 0 && !entries)
+        return SKRY_OUT_OF_MEMORY;
+
+    if (num_entries != fread(entries, sizeof(*entries), num_entries, avi_data->file))
+    {
+        LOG_MSG(SKRY_LOG_AVI, "Super index is incomplete.");
+        free(entries);
+        return SKRY_AVI_MALFORMED_FILE;
+    }
+
+    enum SKRY_result result = SKRY_SUCCESS;
+    for (uint32_t i = 0; i < num_entries && SKRY_SUCCESS == result; i++)
+        result = read_ODML_std_index(avi_data, cnd_swap_64(entries[i].offset, is_machine_b_e),
+                                     frame_size, is_machine_b_e);
+
+    free(entries);
+    return result;
+}
+
 #define FAIL_ON_NULL(ptr)                         \
     if (!(ptr))                                   \
     {                                             \
@@ -376,6 +691,10 @@ struct SKRY_img_sequence *init_AVI(const char *file_name,
             | | ...
             | | (ignored)
             | | ...
+            | | OpenDML: indx                // AVI_super_index
+            | | ...
+            | | (ignored)
+            | | ...
             | |_____
             |_________
             ...
@@ -389,11 +708,14 @@ struct SKRY_img_sequence *init_AVI(const char *file_name,
             ...
             (ignored)
             ...
-            idx1
+            idx1 (not needed if there is 'indx')
               ...
               (index entries)                // AVI_old_index
               ...
-
+            ...
+            OpenDML: further RIFF/AVIX lists with frames; the super index
+            points to standard indices ('ix##' chunks, AVI_std_index)
+            which contain frame offsets
     */
     struct AVI_chunk chunk;
     struct AVI_list list;
@@ -413,6 +735,7 @@ struct SKRY_img_sequence *init_AVI(const char *file_name,
     img_seq->get_curr_img = AVI_get_current_img;
     img_seq->get_curr_img_metadata = AVI_get_curr_img_metadata;
     img_seq->get_img_by_index = AVI_get_img_by_index;
+    img_seq->get_img_fragment_by_index = AVI_get_img_fragment_by_index;
     img_seq->deactivate_img_seq = AVI_deactivate_img_seq;
 
     struct AVI_data *avi_data = (struct AVI_data *)img_seq->data;
@@ -420,6 +743,14 @@ struct SKRY_img_sequence *init_AVI(const char *file_name,
     avi_data->file_name = malloc(strlen(file_name) + 1);
     FAIL_ON_NULL(avi_data->file_name);
     strcpy(avi_data->file_name, file_name);
+
+    if (are_seq_index_files_enabled() && load_AVI_index(img_seq))
+    {
+        base_init(img_seq, img_pool);
+        if (result) *result = SKRY_SUCCESS;
+        return img_seq;
+    }
+
     avi_data->file = fopen(file_name, "rb");
     FAIL_ON_NULL(avi_data->file);
 
@@ -472,15 +803,11 @@ struct SKRY_img_sequence *init_AVI(const char *file_name,
     avi_data->width = cnd_swap_32(avi_header.width, is_machine_b_e);
     avi_data->height = cnd_swap_32(avi_header.height, is_machine_b_e);
 
-    if (!(cnd_swap_32(avi_header.flags, is_machine_b_e) & AVIF_HAS_INDEX))
-    {
-        //TODO: don't do this; add ODML index support
-        LOG_MSG(SKRY_LOG_AVI, "Index not present.");
-        FAIL(SKRY_AVI_MALFORMED_FILE);
-    }
+    uint32_t avi_flags = cnd_swap_32(avi_header.flags, is_machine_b_e);
 
     SEEK_TO_NEXT();
 
+    long stream_list_pos = ftell(avi_data->file);
     if (1 != fread(&list, sizeof(list), 1, avi_data->file))
     {
         LOG_MSG(SKRY_LOG_AVI, "Could not read stream list.");
@@ -491,6 +818,8 @@ struct SKRY_img_sequence *init_AVI(const char *file_name,
         LOG_MSG(SKRY_LOG_AVI, "Invalid stream list.");
         FAIL(SKRY_AVI_MALFORMED_FILE);
     }
+    long stream_list_end = stream_list_pos + sizeof(list.list) + sizeof(list.list_size)
+                           + cnd_swap_32(list.list_size, is_machine_b_e);
 
     READ_CHUNK("Could not read stream header.");
     if (!FCC_COMPARE(chunk.ck_id, "strh"))
@@ -605,6 +934,21 @@ struct SKRY_img_sequence *init_AVI(const char *file_name,
     else
         avi_data->pix_fmt = AVI_PIX_Y800;
 
+    // Look for an OpenDML super index among the remaining chunks of the stream list
+    long super_index_pos = -1;
+    long next_chunk_pos = last_chunk_pos + sizeof(chunk) + UP2MULT(last_chunk_size);
+    while (next_chunk_pos + (long)sizeof(chunk) <= stream_list_end)
+    {
+        fseek(avi_data->file, next_chunk_pos, SEEK_SET);
+        READ_CHUNK("Could not read stream list.");
+        if (FCC_COMPARE(chunk.ck_id, "indx"))
+        {
+            super_index_pos = last_chunk_pos;
+            break;
+        }
+        next_chunk_pos = last_chunk_pos + sizeof(chunk) + UP2MULT(last_chunk_size);
+    }
+
     // Jump to the location immediately after 'hdrl'
 
     fseek(avi_data->file, header_list_pos + cnd_swap_32(header_list.list_size, is_machine_b_e)
@@ -669,72 +1013,112 @@ struct SKRY_img_sequence *init_AVI(const char *file_name,
 
     long frame_chunks_start_ofs = ftell(avi_data->file) - sizeof(list.list_type);
 
-    // Jump to the old-style AVI index
-    fseek(avi_data->file, cnd_swap_32(list.list_size, is_machine_b_e) - sizeof(list.list_size),
-          SEEK_CUR);
+    size_t line_byte_count = avi_data->width * BYTES_PER_PIXEL[AVI_to_SKRY_pix_fmt[avi_data->pix_fmt]];
+    if (IS_DIB(avi_data->pix_fmt))
+        line_byte_count = UP4MULT(line_byte_count);
 
-    READ_CHUNK("Could not read index.");
-    if (!FCC_COMPARE(chunk.ck_id, "idx1")
-        || cnd_swap_32(chunk.ck_size, is_machine_b_e) < img_seq->num_images * sizeof(struct AVI_old_index))
+    if (super_index_pos >= 0)
     {
-        LOG_MSG(SKRY_LOG_AVI, "Invalid index.");
-        FAIL(SKRY_AVI_MALFORMED_FILE);
+        enum SKRY_result index_result = read_ODML_index(avi_data, super_index_pos,
+                                                        line_byte_count * avi_data->height,
+                                                        is_machine_b_e);
+        if (SKRY_SUCCESS != index_result)
+            FAIL(index_result);
+
+        // The main header's frame count covers only the first RIFF list
+        img_seq->num_images = DA_SIZE(avi_data->frame_ofs_deltas);
     }
+    else
+    {
+        if (!(avi_flags & AVIF_HAS_INDEX))
+        {
+            LOG_MSG(SKRY_LOG_AVI, "Index not present.");
+            FAIL(SKRY_AVI_MALFORMED_FILE);
+        }
 
-    // Index may contain bogus entries, this will make it longer
-    // than img_seq->num_images * sizeof(struct AVI_old_index)
-    uint32_t index_length = cnd_swap_32(chunk.ck_size, is_machine_b_e);
+        // Jump to the old-style AVI index
+        fseek(avi_data->file, cnd_swap_32(list.list_size, is_machine_b_e) - sizeof(list.list_size),
+              SEEK_CUR);
 
-    avi_data->frame_offsets = malloc(img_seq->num_images * sizeof(*avi_data->frame_offsets));
-    FAIL_ON_NULL(avi_data->frame_offsets);
+        READ_CHUNK("Could not read index.");
+        if (!FCC_COMPARE(chunk.ck_id, "idx1")
+            || cnd_swap_32(chunk.ck_size, is_machine_b_e) < img_seq->num_images * sizeof(struct AVI_old_index))
+        {
+            LOG_MSG(SKRY_LOG_AVI, "Invalid index.");
+            FAIL(SKRY_AVI_MALFORMED_FILE);
+        }
 
-    struct AVI_old_index *avi_old_index = malloc(index_length);
-    if (1 != fread(avi_old_index, index_length, 1, avi_data->file))
-    {
-        LOG_MSG(SKRY_LOG_AVI, "Index incomplete.");
-        free(avi_old_index);
-        FAIL(SKRY_AVI_MALFORMED_FILE);
-    }
+        // Index may contain bogus entries, this will make it longer
+        // than img_seq->num_images * sizeof(struct AVI_old_index)
+        uint32_t index_length = cnd_swap_32(chunk.ck_size, is_machine_b_e);
 
-    size_t line_byte_count = avi_data->width * BYTES_PER_PIXEL[AVI_to_SKRY_pix_fmt[avi_data->pix_fmt]];
-    if (IS_DIB(avi_data->pix_fmt))
-        line_byte_count = UP4MULT(line_byte_count);
+        struct AVI_old_index *avi_old_index = malloc(index_length);
+        FAIL_ON_NULL(avi_old_index);
+        if (1 != fread(avi_old_index, index_length, 1, avi_data->file))
+        {
+            LOG_MSG(SKRY_LOG_AVI, "Index incomplete.");
+            free(avi_old_index);
+            FAIL(SKRY_AVI_MALFORMED_FILE);
+        }
+
+        size_t num_entries = index_length / sizeof(*avi_old_index);
 
-    struct AVI_old_index *curr_entry = avi_old_index;
-    size_t valid_entry_counter = 0;
-    while (curr_entry - avi_old_index < (ptrdiff_t)(index_length / sizeof(curr_entry))
-           && valid_entry_counter < img_seq->num_images)
-    {
         // Ignore bogus entries (they may have "7Fxx" as their ID)
-        if (FCC_COMPARE(curr_entry->chunk_id, "00db") ||
-            FCC_COMPARE(curr_entry->chunk_id, "00dc"))
+        size_t first_entry = 0;
+        while (first_entry < num_entries && !is_video_frame_chunk_id(avi_old_index[first_entry].chunk_id))
+            first_entry++;
+
+        if (first_entry == num_entries)
+        {
+            LOG_MSG(SKRY_LOG_AVI, "Index contains no frames.");
+            free(avi_old_index);
+            FAIL(SKRY_AVI_MALFORMED_FILE);
+        }
+
+        // Check if frame offsets in the index are actually absolute file offsets
+        uint64_t offsets_base = frame_chunks_start_ofs;
+        fseek(avi_data->file, cnd_swap_32(avi_old_index[first_entry].offset, is_machine_b_e), SEEK_SET);
+        if (1 == fread(&chunk, sizeof(chunk), 1, avi_data->file)
+            && is_video_frame_chunk_id(chunk.ck_id)
+            && cnd_swap_32(chunk.ck_size, is_machine_b_e) == line_byte_count*avi_data->height)
+        {
+            offsets_base = 0;
+        }
+
+        DA_ALLOC(avi_data->frame_ofs_deltas, img_seq->num_images);
+        for (size_t i = first_entry; i < num_entries && DA_SIZE(avi_data->frame_ofs_deltas) < img_seq->num_images; i++)
         {
-            if (cnd_swap_32(curr_entry->frame_size, is_machine_b_e) != line_byte_count * avi_data->height)
+            const struct AVI_old_index *entry = &avi_old_index[i];
+            if (!is_video_frame_chunk_id(entry->chunk_id))
+                continue;
+
+            if (cnd_swap_32(entry->frame_size, is_machine_b_e) != line_byte_count * avi_data->height)
             {
                 free(avi_old_index);
                 FAIL(SKRY_AVI_MALFORMED_FILE);
             }
-            else
-            {
-                avi_data->frame_offsets[valid_entry_counter] = frame_chunks_start_ofs + cnd_swap_32(curr_entry->offset, is_machine_b_e);
-                valid_entry_counter++;
-            }
+
+            add_frame_offset(avi_data, offsets_base + cnd_swap_32(entry->offset, is_machine_b_e));
+        }
+        free(avi_old_index);
+
+        if (DA_SIZE(avi_data->frame_ofs_deltas) < img_seq->num_images)
+        {
+            LOG_MSG(SKRY_LOG_AVI, "Index contains only %zu of %zu frames.",
+                    DA_SIZE(avi_data->frame_ofs_deltas), img_seq->num_images);
+            img_seq->num_images = DA_SIZE(avi_data->frame_ofs_deltas);
         }
-        curr_entry++;
     }
 
-    // Check if frame offsets in the index are actually absolute file offsets
-    fseek(avi_data->file, avi_data->frame_offsets[0] - frame_chunks_start_ofs, SEEK_SET);
-    READ_CHUNK("Could not read first frame.");
-    if ((FCC_COMPARE(chunk.ck_id, "00db") || FCC_COMPARE(chunk.ck_id, "00dc"))
-        && chunk.ck_size == line_byte_count*avi_data->height)
+    if (0 == img_seq->num_images)
     {
-        // Indeed, index frame offsets are absolute; must correct the values in `avi_data`
-        for (size_t i = 0; i < img_seq->num_images; i++)
-            avi_data->frame_offsets[i] -= frame_chunks_start_ofs;
+        LOG_MSG(SKRY_LOG_AVI, "No frames found.");
+        FAIL(SKRY_AVI_MALFORMED_FILE);
     }
 
-    free(avi_old_index);
+    if (are_seq_index_files_enabled())
+        save_AVI_index(img_seq);
+
     fclose(avi_data->file);
     avi_data->file = 0;
 
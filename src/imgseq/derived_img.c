@@ -0,0 +1,122 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Derived (preprocessed) images of an image sequence implementation.
+*/
+
+#include <assert.h>
+
+#include "derived_img.h"
+#include "imgseq_internal.h"
+#include "../utils/filters.h"
+#include "../utils/misc.h"
+
+
+/// Function creating a derived image from the SKRY_PIX_MONO8 original or from another derived image
+typedef SKRY_Image *fn_derive_img(const SKRY_ImgSequence *img_seq, unsigned kind_param, enum SKRY_result *result);
+
+/// Takes the derived image from the pool, or creates it with 'derive' and stores it there
+static
+SKRY_Image *get_curr_derived_img(const SKRY_ImgSequence *img_seq,
+                                 enum pooled_img_kind kind,
+                                 unsigned kind_param,
+                                 fn_derive_img *derive,
+                                 enum SKRY_result *result)
+{
+    if (result) *result = SKRY_SUCCESS;
+
+    if (img_seq->img_pool)
+    {
+        SKRY_Image *img = get_image_from_pool(img_seq->img_pool, img_seq->pool_node,
+                                              img_seq->curr_image_idx, SKRY_PIX_MONO8,
+                                              kind, kind_param);
+        if (img)
+            return img;
+    }
+
+    double t_start = get_precise_time_sec();
+    SKRY_Image *img = derive(img_seq, kind_param, result);
+    if (img && img_seq->img_pool)
+        put_image_in_pool(img_seq->img_pool, img_seq->pool_node,
+                          img_seq->curr_image_idx, img, kind, kind_param,
+                          get_precise_time_sec() - t_start);
+
+    return img;
+}
+
+static
+SKRY_Image *create_downsampled(const SKRY_ImgSequence *img_seq, unsigned level, enum SKRY_result *result)
+{
+    // Each level is created from the previous one (which gets stored in the pool as well)
+    SKRY_Image *src = (1 == level) ?
+        SKRY_get_curr_img_from_pool(img_seq, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE, result) :
+        get_curr_img_downsampled(img_seq, level - 1, result);
+    if (!src)
+        return 0;
+
+    SKRY_Image *img = downsample_img_2x(src);
+    SKRY_release_img_to_pool(img_seq, img_seq->curr_image_idx, src);
+    if (!img && result)
+        *result = SKRY_OUT_OF_MEMORY;
+
+    return img;
+}
+
+SKRY_Image *get_curr_img_downsampled(const SKRY_ImgSequence *img_seq,
+                                     unsigned level,
+                                     enum SKRY_result *result)
+{
+    assert(level > 0);
+    return get_curr_derived_img(img_seq, POOLED_IMG_DOWNSAMPLED, level, create_downsampled, result);
+}
+
+enum SKRY_result get_curr_img_pyramid(const SKRY_ImgSequence *img_seq,
+                                      const SKRY_Image *curr_img,
+                                      unsigned num_levels,
+                                      struct image_pyramid *pyramid)
+{
+    assert(num_levels <= PYRAMID_MAX_LEVELS);
+
+    // Without a pool, there is nothing to reuse; build all levels from 'curr_img'
+    // instead of fetching and converting the image again for each one
+    if (!img_seq->img_pool)
+        return create_image_pyramid(curr_img, num_levels, pyramid);
+
+    *pyramid = (struct image_pyramid) { 0 };
+    enum SKRY_result result = SKRY_SUCCESS;
+    for (unsigned i = 0; i < num_levels; i++)
+    {
+        pyramid->levels[i] = get_curr_img_downsampled(img_seq, i + 1, &result);
+        if (!pyramid->levels[i])
+        {
+            release_curr_img_pyramid(img_seq, pyramid);
+            return result;
+        }
+        pyramid->num_levels++;
+    }
+    return SKRY_SUCCESS;
+}
+
+void release_curr_img_pyramid(const SKRY_ImgSequence *img_seq, struct image_pyramid *pyramid)
+{
+    for (unsigned i = 0; i < pyramid->num_levels; i++)
+        SKRY_release_img_to_pool(img_seq, img_seq->curr_image_idx, pyramid->levels[i]);
+    *pyramid = (struct image_pyramid) { 0 };
+}
@@ -0,0 +1,61 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Derived (preprocessed) images of an image sequence header.
+*/
+
+#ifndef LIB_STACKISTRY_IMG_SEQ_DERIVED_IMG_HEADER
+#define LIB_STACKISTRY_IMG_SEQ_DERIVED_IMG_HEADER
+
+#include <skry/defs.h>
+#include <skry/image.h>
+#include <skry/imgseq.h>
+
+#include "../utils/match.h"
+
+
+/*
+    Images derived from the SKRY_PIX_MONO8 version (converted with SKRY_DEMOSAIC_SIMPLE)
+    of the current image. They are used by several processing phases, so if the sequence
+    is connected to an image pool, they are stored there and created only once (as long
+    as the pool has room for them).
+
+    As with SKRY_get_curr_img_from_pool(), the caller has to pass each returned image
+    to SKRY_release_img_to_pool() and must not free it.
+*/
+
+/// Returns the current image downsampled 2^'level' times (see 'downsample_img_2x()'), or null on error
+/** Requirements: level > 0. */
+SKRY_Image *get_curr_img_downsampled(const SKRY_ImgSequence *img_seq,
+                                     unsigned level,
+                                     enum SKRY_result *result ///< If not null, receives operation result
+);
+
+/// Fills 'pyramid' with images returned by 'get_curr_img_downsampled()'
+/** If 'img_seq' is not connected to an image pool, the levels are created directly from 'curr_img'.
+    On success, the pyramid has to be released with 'release_curr_img_pyramid()'. */
+enum SKRY_result get_curr_img_pyramid(const SKRY_ImgSequence *img_seq,
+                                      const SKRY_Image *curr_img, ///< The current image as SKRY_PIX_MONO8
+                                      unsigned num_levels,
+                                      struct image_pyramid *pyramid);
+
+void release_curr_img_pyramid(const SKRY_ImgSequence *img_seq, struct image_pyramid *pyramid);
+
+#endif // LIB_STACKISTRY_IMG_SEQ_DERIVED_IMG_HEADER
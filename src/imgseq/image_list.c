@@ -28,8 +28,11 @@ File description:
 #include <skry/defs.h>
 #include <skry/imgseq.h>
 
+#include "../image/tiff.h"
 #include "../utils/logging.h"
+#include "../utils/misc.h"
 #include "imgseq_internal.h"
+#include "seq_index.h"
 
 
 struct image_list_data
@@ -41,11 +44,137 @@ struct image_list_data
     size_t last_loaded_img_idx; // May be SKRY_EMPTY
 
     size_t next_file_name_idx_to_add;
+
+    /// Contains 'num_images' elements; images loaded by 'image_list_preload()' and not yet read
+    SKRY_Image **preloaded;
+
+    /// Contains 'num_images' elements; null if not (yet) loaded
+    struct img_list_index_entry *index;
+    int is_index_modified;
+};
+
+/// Element of an image list's index file; fields are ordered so that the structure contains no padding
+struct img_list_index_entry
+{
+    uint64_t file_name_hash;
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pix_fmt;
+    uint32_t is_valid;
 };
 
 /// 'img_seq' is a pointer to 'SKRY_ImgSequence'
 #define IMG_LIST_DATA(img_seq) ((struct image_list_data *)img_seq->data)
 
+/// 64-bit FNV-1a hash
+static
+uint64_t get_file_name_hash(const char *file_name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = file_name; *c; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// Loads the index file (if any) of the list with all file names specified
+static
+void load_image_list_index(const SKRY_ImgSequence *img_seq)
+{
+    struct image_list_data *data = IMG_LIST_DATA(img_seq);
+
+    data->index = calloc(img_seq->num_images, sizeof(*data->index));
+    if (!data->index)
+        return;
+
+    struct seq_index index = { .type = SKRY_IMG_SEQ_IMAGE_FILES,
+                               .entry_size = sizeof(*data->index) };
+
+    if (load_seq_index(data->file_names[0], &index))
+    {
+        if (index.num_entries == img_seq->num_images)
+            memcpy(data->index, index.entries, img_seq->num_images * sizeof(*data->index));
+
+        free(index.entries);
+    }
+}
+
+static
+void save_image_list_index(const SKRY_ImgSequence *img_seq)
+{
+    const struct image_list_data *data = IMG_LIST_DATA(img_seq);
+
+    struct seq_index index = { .type = SKRY_IMG_SEQ_IMAGE_FILES,
+                               .width = data->index[0].width,
+                               .height = data->index[0].height,
+                               .pix_fmt = data->index[0].pix_fmt,
+                               .CFA_pattern = SKRY_CFA_NONE,
+                               .entries = data->index,
+                               .num_entries = img_seq->num_images,
+                               .entry_size = sizeof(*data->index) };
+
+    save_seq_index(data->file_names[0], &index);
+}
+
+/// Returns the metadata of image 'img_idx', using and updating the list's index
+static
+enum SKRY_result get_indexed_img_metadata(
+    const SKRY_ImgSequence *img_seq,
+    size_t img_idx,
+    unsigned *width,
+    unsigned *height,
+    enum SKRY_pixel_format *pix_fmt)
+{
+    struct image_list_data *data = IMG_LIST_DATA(img_seq);
+    const char *file_name = data->file_names[img_idx];
+
+    if (!data->index)
+        load_image_list_index(img_seq);
+
+    if (!data->index)
+        return SKRY_get_image_metadata(file_name, width, height, pix_fmt);
+
+    struct img_list_index_entry *entry = &data->index[img_idx];
+    struct file_stamp stamp;
+    int has_stamp = get_file_stamp(file_name, &stamp);
+    uint64_t file_name_hash = get_file_name_hash(file_name);
+
+    if (!has_stamp
+        || !entry->is_valid
+        || entry->file_name_hash != file_name_hash
+        || entry->file_size != stamp.size
+        || entry->file_mtime != stamp.mtime
+        || entry->pix_fmt >= SKRY_NUM_PIX_FORMATS)
+    {
+        unsigned w, h;
+        enum SKRY_pixel_format pf;
+        enum SKRY_result result = SKRY_get_image_metadata(file_name, &w, &h, &pf);
+        if (SKRY_SUCCESS != result)
+            return result;
+
+        *entry = (struct img_list_index_entry) {
+            .file_name_hash = file_name_hash,
+            .file_size = has_stamp ? stamp.size : 0,
+            .file_mtime = has_stamp ? stamp.mtime : 0,
+            .width = w,
+            .height = h,
+            .pix_fmt = pf,
+            .is_valid = has_stamp
+        };
+        data->is_index_modified = 1;
+    }
+
+    if (width) *width = entry->width;
+    if (height) *height = entry->height;
+    if (pix_fmt) *pix_fmt = entry->pix_fmt;
+
+    return SKRY_SUCCESS;
+}
+
 static
 void image_list_free(SKRY_ImgSequence *img_seq)
 {
@@ -53,11 +182,19 @@ void image_list_free(SKRY_ImgSequence *img_seq)
     {
         if (img_seq->data)
         {
+            if (IMG_LIST_DATA(img_seq)->index && IMG_LIST_DATA(img_seq)->is_index_modified)
+                save_image_list_index(img_seq);
+
             for (size_t i = 0; i < img_seq->num_images; i++)
                 free(IMG_LIST_DATA(img_seq)->file_names[i]);
 
             free(IMG_LIST_DATA(img_seq)->file_names);
-            free(IMG_LIST_DATA(img_seq)->last_loaded_img);
+            SKRY_free_image(IMG_LIST_DATA(img_seq)->last_loaded_img);
+            if (IMG_LIST_DATA(img_seq)->preloaded)
+                for (size_t i = 0; i < img_seq->num_images; i++)
+                    SKRY_free_image(IMG_LIST_DATA(img_seq)->preloaded[i]);
+            free(IMG_LIST_DATA(img_seq)->preloaded);
+            free(IMG_LIST_DATA(img_seq)->index);
             free(img_seq->data);
         }
         free(img_seq);
@@ -85,11 +222,21 @@ SKRY_Image *image_list_get_img(
     {
         const char *file_name = data->file_names[img_idx];
 
-        SKRY_Image *loaded_img = SKRY_load_image(file_name, result);
+        SKRY_Image *loaded_img;
+        if (data->preloaded[img_idx])
+        {
+            loaded_img = data->preloaded[img_idx];
+            data->preloaded[img_idx] = 0;
+            if (result) *result = SKRY_SUCCESS;
+        }
+        else
+            loaded_img = SKRY_load_image(file_name, result);
+
         if (loaded_img)
         {
             SKRY_free_image(data->last_loaded_img);
             data->last_loaded_img = loaded_img;
+            data->last_loaded_img_idx = img_idx;
             return SKRY_get_img_copy(data->last_loaded_img);
         }
         else
@@ -97,6 +244,50 @@ SKRY_Image *image_list_get_img(
     }
 }
 
+static
+SKRY_Image *image_list_get_img_fragment(
+    const SKRY_ImgSequence *img_seq,
+    size_t img_idx,
+    struct SKRY_rect *rect,
+    enum SKRY_result *result ///< If not null, receives operation result
+)
+{
+    struct image_list_data *data = IMG_LIST_DATA(img_seq);
+    const char *file_name = data->file_names[img_idx];
+
+    if (data->last_loaded_img && data->last_loaded_img_idx == img_idx
+        || data->preloaded[img_idx]
+        || !compare_extension(file_name, "tif") && !compare_extension(file_name, "tiff"))
+    {
+        // The whole image is already in memory or has to be loaded anyway
+        SKRY_Image *img = image_list_get_img(img_seq, img_idx, result);
+        if (img)
+            *rect = SKRY_get_img_rect(img);
+        return img;
+    }
+
+    return load_TIFF_fragment(file_name, rect, result);
+}
+
+/// Loads the specified images in parallel
+static
+void image_list_preload(const SKRY_ImgSequence *img_seq, const size_t *indices, size_t count)
+{
+    struct image_list_data *data = IMG_LIST_DATA(img_seq);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t idx = indices[i];
+        if (!data->preloaded[idx]
+            && !(data->last_loaded_img && data->last_loaded_img_idx == idx))
+        {
+            // On failure the image will be loaded again (and the error reported) when requested
+            data->preloaded[idx] = SKRY_load_image(data->file_names[idx], 0);
+        }
+    }
+}
+
 static
 SKRY_Image *image_list_get_curr_img(
     const SKRY_ImgSequence *img_seq,
@@ -130,15 +321,22 @@ enum SKRY_result image_list_get_curr_img_metadata(
     }
     else
     {
-        return SKRY_get_image_metadata(data->file_names[img_seq->curr_image_idx], width, height, pix_fmt);
+        if (are_seq_index_files_enabled()
+            && data->next_file_name_idx_to_add == img_seq->num_images)
+        {
+            return get_indexed_img_metadata(img_seq, img_seq->curr_image_idx, width, height, pix_fmt);
+        }
+        else
+            return SKRY_get_image_metadata(data->file_names[img_seq->curr_image_idx], width, height, pix_fmt);
     }
 }
 
 static
 void image_list_deactivate(SKRY_ImgSequence *img_seq)
 {
-    // Do nothing
-    (void)img_seq; // suppress the "unused parameter" warning
+    // Release memory taken by images preloaded, but not read
+    for (size_t i = 0; i < img_seq->num_images; i++)
+        IMG_LIST_DATA(img_seq)->preloaded[i] = SKRY_free_image(IMG_LIST_DATA(img_seq)->preloaded[i]);
 }
 
 #define FAIL_ON_NULL(ptr)                \
@@ -168,7 +366,9 @@ SKRY_ImgSequence *SKRY_init_image_list(
     img_seq->get_curr_img =           image_list_get_curr_img;
     img_seq->get_curr_img_metadata =  image_list_get_curr_img_metadata;
     img_seq->get_img_by_index =       image_list_get_img;
+    img_seq->get_img_fragment_by_index = image_list_get_img_fragment;
     img_seq->deactivate_img_seq =     image_list_deactivate;
+    img_seq->preload_imgs =           image_list_preload;
 
     base_init(img_seq, img_pool);
 
@@ -181,6 +381,8 @@ SKRY_ImgSequence *SKRY_init_image_list(
     data->last_loaded_img_idx = SKRY_EMPTY;
     data->file_names = malloc(num_images * sizeof(char *));
     FAIL_ON_NULL(data->file_names);
+    data->preloaded = calloc(num_images, sizeof(*data->preloaded));
+    FAIL_ON_NULL(data->preloaded);
     for (size_t i = 0; i < num_images; i++)
     {
         if (file_names)
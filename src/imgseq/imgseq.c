@@ -22,6 +22,8 @@ File description:
 */
 
 #include <float.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -30,6 +32,7 @@ File description:
 #include "imgseq_internal.h"
 #include "video.h"
 #include "../utils/misc.h"
+#include "../utils/perf.h"
 
 
 /// Returns null
@@ -37,6 +40,7 @@ SKRY_ImgSequence *SKRY_free_img_sequence(SKRY_ImgSequence *img_seq)
 {
     if (img_seq)
     {
+        img_seq->prefetcher = stop_prefetching(img_seq->prefetcher);
         SKRY_disconnect_from_img_pool(img_seq);
         free(img_seq->is_img_active);
         img_seq->free(img_seq);
@@ -65,22 +69,98 @@ void SKRY_seek_start(SKRY_ImgSequence *img_seq)
     img_seq->curr_img_idx_within_active_subset = 0;
 }
 
+/// Updates performance counters after reading 'img' (may be null), which started at 'start_time' (see PERF_TIME())
+static
+void count_read_img(const SKRY_Image *img, double start_time)
+{
+    if (g_perf_enabled && img)
+    {
+        PERF_ADD(frames_read, 1);
+        PERF_ADD(bytes_read, SKRY_get_img_byte_count(img));
+        PERF_ADD_TIME_SINCE(read_time, start_time);
+    }
+}
+
+/// Applies 'img_seq->CFA_pattern' (if any) to 'img' freshly read from 'img_seq'
+void apply_CFA_override(const SKRY_ImgSequence *img_seq, SKRY_Image *img)
+{
+    enum SKRY_pixel_format pix_fmt = SKRY_get_img_pix_fmt(img);
+    if (img_seq->CFA_pattern != SKRY_CFA_NONE &&
+        (pix_fmt == SKRY_PIX_MONO8 ||
+         pix_fmt == SKRY_PIX_MONO16 ||
+         pix_fmt > SKRY_PIX_CFA_MIN && pix_fmt < SKRY_PIX_CFA_MAX))
+    {
+        SKRY_reinterpret_as_CFA(img, img_seq->CFA_pattern);
+    }
+}
+
 SKRY_Image *SKRY_get_curr_img(const SKRY_ImgSequence *img_seq,
                               enum SKRY_result *result ///< If not null, receives operation result
 )
 {
-    SKRY_Image *img = img_seq->get_curr_img(img_seq, result);
+    double start_time = PERF_TIME();
+
+    SKRY_Image *img;
+    if (img_seq->prefetcher)
+        img = take_prefetched_img(img_seq->prefetcher, img_seq->curr_image_idx,
+                                  SKRY_PIX_INVALID, result);
+    else
+    {
+        img = img_seq->get_curr_img(img_seq, result);
+        if (img)
+            apply_CFA_override(img_seq, img);
+    }
+
+    count_read_img(img, start_time);
+    return img;
+}
+
+SKRY_Image *SKRY_get_curr_img_fragment(const SKRY_ImgSequence *img_seq,
+                                       struct SKRY_rect *rect,
+                                       enum SKRY_result *result ///< If not null, receives operation result
+)
+{
+    if (img_seq->prefetcher || !img_seq->get_img_fragment_by_index)
+    {
+        // The whole image is read anyway
+        SKRY_Image *img = SKRY_get_curr_img(img_seq, result);
+        if (img)
+            *rect = SKRY_get_img_rect(img);
+        return img;
+    }
+
+    unsigned width, height;
+    enum SKRY_result loc_result = SKRY_get_curr_img_metadata(img_seq, &width, &height, 0);
+    if (SKRY_SUCCESS != loc_result)
+    {
+        if (result) *result = loc_result;
+        return 0;
+    }
+
+    int x_end = SKRY_MIN(rect->x + (int)rect->width, (int)width),
+        y_end = SKRY_MIN(rect->y + (int)rect->height, (int)height);
+    struct SKRY_rect frag = { .x = SKRY_MAX(rect->x, 0) & ~1,
+                              .y = SKRY_MAX(rect->y, 0) & ~1 };
+    if (x_end <= frag.x || y_end <= frag.y)
+    {
+        if (result) *result = SKRY_INVALID_PARAMETERS;
+        return 0;
+    }
+    frag.width = x_end - frag.x;
+    frag.height = y_end - frag.y;
+
+    double start_time = PERF_TIME();
+    lock_img_seq_io(img_seq);
+    SKRY_Image *img = img_seq->get_img_fragment_by_index(img_seq, img_seq->curr_image_idx, &frag, result);
+    unlock_img_seq_io(img_seq);
+    count_read_img(img, start_time);
+
     if (img)
     {
-        enum SKRY_pixel_format pix_fmt = SKRY_get_img_pix_fmt(img);
-        if (img_seq->CFA_pattern != SKRY_CFA_NONE &&
-            (pix_fmt == SKRY_PIX_MONO8 ||
-             pix_fmt == SKRY_PIX_MONO16 ||
-             pix_fmt > SKRY_PIX_CFA_MIN && pix_fmt < SKRY_PIX_CFA_MAX))
-        {
-            SKRY_reinterpret_as_CFA(img, img_seq->CFA_pattern);
-        }
+        apply_CFA_override(img_seq, img);
+        *rect = frag;
     }
+
     return img;
 }
 
@@ -90,7 +170,9 @@ enum SKRY_result SKRY_get_curr_img_metadata(const SKRY_ImgSequence *img_seq,
                                         enum SKRY_pixel_format *pix_fmt ///< If not null, receives current image's pixel format
 )
 {
+    lock_img_seq_io(img_seq);
     enum SKRY_result result = img_seq->get_curr_img_metadata(img_seq, width, height, pix_fmt);
+    unlock_img_seq_io(img_seq);
     if (SKRY_SUCCESS == result)
     {
         if (img_seq->CFA_pattern != SKRY_CFA_NONE && pix_fmt)
@@ -144,26 +226,52 @@ SKRY_Image *SKRY_get_img_by_index(const SKRY_ImgSequence *img_seq, size_t index,
                                   enum SKRY_result *result ///< If not null, receives operation result
 )
 {
+    double start_time = PERF_TIME();
+    lock_img_seq_io(img_seq);
     SKRY_Image *img = img_seq->get_img_by_index(img_seq, index, result);
+    unlock_img_seq_io(img_seq);
+    count_read_img(img, start_time);
+
     if (img)
-    {
-        enum SKRY_pixel_format pix_fmt = SKRY_get_img_pix_fmt(img);
-        if (img_seq->CFA_pattern != SKRY_CFA_NONE &&
-            (pix_fmt == SKRY_PIX_MONO8 || pix_fmt == SKRY_PIX_MONO16 ||
-             pix_fmt > SKRY_PIX_CFA_MIN && pix_fmt < SKRY_PIX_CFA_MAX))
-        {
-            SKRY_reinterpret_as_CFA(img, img_seq->CFA_pattern);
-        }
-    }
+        apply_CFA_override(img_seq, img);
+
     return img;
 }
 
 /// Should be called when 'img_seq' will not be read for some time
 /** In case of image lists, the function does nothing. For video files, it closes them.
-    Video files are opened automatically (and kept open) every time a frame is loaded. */
+    Video files are opened automatically (and kept open) every time a frame is loaded.
+    If prefetching is enabled, it is paused until the next image is requested. */
 void SKRY_deactivate_img_seq(SKRY_ImgSequence *img_seq)
 {
+    if (img_seq->prefetcher)
+        reset_prefetching(img_seq->prefetcher);
+
+    lock_img_seq_io(img_seq);
     img_seq->deactivate_img_seq(img_seq);
+    unlock_img_seq_io(img_seq);
+}
+
+enum SKRY_result SKRY_image_list_preload(SKRY_ImgSequence *img_seq, size_t num_images)
+{
+    if (!img_seq->preload_imgs || 0 == num_images)
+        return SKRY_SUCCESS;
+
+    size_t *indices = malloc(num_images * sizeof(*indices));
+    if (!indices)
+        return SKRY_OUT_OF_MEMORY;
+
+    size_t count = 0;
+    for (size_t idx = img_seq->curr_image_idx; idx < img_seq->num_images && count < num_images; idx++)
+        if (img_seq->is_img_active[idx])
+            indices[count++] = idx;
+
+    lock_img_seq_io(img_seq);
+    img_seq->preload_imgs(img_seq, indices, count);
+    unlock_img_seq_io(img_seq);
+
+    free(indices);
+    return SKRY_SUCCESS;
 }
 
 SKRY_ImgSequence *SKRY_init_video_file(
@@ -223,6 +331,9 @@ void SKRY_set_active_imgs(SKRY_ImgSequence *img_seq,
             img_seq->num_active_images++;
         }
     }
+
+    if (img_seq->prefetcher)
+        reset_prefetching(img_seq->prefetcher);
 }
 
 int SKRY_is_img_active(const SKRY_ImgSequence *img_seq, size_t img_idx)
@@ -262,60 +373,278 @@ void SKRY_disconnect_from_img_pool(SKRY_ImgSequence *img_seq)
     }
 }
 
+/// Number of images read before they are converted and accumulated in parallel by SKRY_create_master_frame()
+#define MASTER_FRAME_BATCH_SIZE 8
+
+/// Returns a SKRY_PIX_MONO32F copy of raw color 'img' (without demosaicing) or null if out of memory
+static
+SKRY_Image *convert_raw_color_to_mono32f(const SKRY_Image *img)
+{
+    unsigned width = SKRY_get_img_width(img),
+             height = SKRY_get_img_height(img);
+    int is_8bit = (BITS_PER_CHANNEL[SKRY_get_img_pix_fmt(img)] == 8);
+
+    SKRY_Image *result = SKRY_new_image(width, height, SKRY_PIX_MONO32F, 0, 0);
+    if (!result)
+        return 0;
+
+    for (unsigned y = 0; y < height; y++)
+    {
+        const void *src_line = SKRY_get_line(img, y);
+        float *dest_line = SKRY_get_line(result, y);
+        for (unsigned x = 0; x < width; x++)
+            dest_line[x] = is_8bit ? ((const uint8_t *)src_line)[x] * (1.0f/0xFF)
+                                   : ((const uint16_t *)src_line)[x] * (1.0f/0xFFFF);
+    }
+
+    return result;
+}
+
+/// Reads up to MASTER_FRAME_BATCH_SIZE images of 'img_seq' starting with the current one and converts them to 'pix_fmt'
+/** Raw color images are converted without demosaicing if 'pix_fmt' is SKRY_PIX_MONO32F and 'keep_raw' is nonzero.
+    Returns SKRY_SUCCESS or an error. On error, the images read so far are freed. */
+static
+enum SKRY_result read_master_frame_batch(
+    SKRY_ImgSequence *img_seq,
+    unsigned width, unsigned height, ///< Required image size
+    enum SKRY_pixel_format pix_fmt, ///< SKRY_PIX_MONO32F or SKRY_PIX_RGB32F
+    int keep_raw,
+    SKRY_Image *batch[], ///< Receives the images
+    size_t *batch_len, ///< Receives the number of images in 'batch'
+    int *more_imgs ///< Receives 0 if the last image of 'img_seq' has been read
+)
+{
+    *batch_len = 0;
+    enum SKRY_result result = SKRY_SUCCESS;
+    do
+    {
+        batch[*batch_len] = SKRY_get_curr_img(img_seq, &result);
+        if (batch[*batch_len])
+        {
+            (*batch_len)++;
+            if (SKRY_get_img_width(batch[*batch_len - 1]) != width ||
+                SKRY_get_img_height(batch[*batch_len - 1]) != height)
+            {
+                result = SKRY_INVALID_IMG_DIMENSIONS;
+            }
+        }
+        *more_imgs = (SKRY_SUCCESS == SKRY_seek_next(img_seq));
+    } while (SKRY_SUCCESS == result && *more_imgs && *batch_len < MASTER_FRAME_BATCH_SIZE);
+
+    // Reading is sequential, but the images can be converted at the same time
+    int conversion_failed = 0;
+    if (SKRY_SUCCESS == result)
+    {
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < *batch_len; i++)
+            if (SKRY_get_img_pix_fmt(batch[i]) != pix_fmt)
+            {
+                enum SKRY_pixel_format img_pix_fmt = SKRY_get_img_pix_fmt(batch[i]);
+                SKRY_Image *float_img =
+                    (keep_raw && img_pix_fmt > SKRY_PIX_CFA_MIN && img_pix_fmt < SKRY_PIX_CFA_MAX) ?
+                        convert_raw_color_to_mono32f(batch[i]) :
+                        SKRY_convert_pix_fmt(batch[i], pix_fmt, SKRY_DEMOSAIC_HQLINEAR);
+                SKRY_free_image(batch[i]);
+                batch[i] = float_img;
+                if (!float_img)
+                {
+                    #pragma omp atomic write
+                    conversion_failed = 1;
+                }
+            }
+    }
+
+    if (conversion_failed)
+        result = SKRY_OUT_OF_MEMORY;
+
+    if (SKRY_SUCCESS != result)
+    {
+        for (size_t i = 0; i < *batch_len; i++)
+            SKRY_free_image(batch[i]);
+        *batch_len = 0;
+    }
+
+    return result;
+}
+
 #define FAIL(error)                  \
     do {                             \
-        SKRY_free_image(flatfield);  \
+        SKRY_free_image(master);     \
+        free(value_stats);           \
+        free(num_accepted);          \
         if (result) *result = error; \
         return 0;                    \
     } while (0)
 
-SKRY_Image *SKRY_create_flatfield(
-    /// All images must have the same size
+/// Implements SKRY_create_master_frame() (if 'keep_color' is nonzero) and SKRY_create_flatfield()
+/** If 'keep_color' is zero, all images are converted to SKRY_PIX_MONO32F (raw color images are demosaiced). */
+static
+SKRY_Image *create_master_frame(
     SKRY_ImgSequence *img_seq,
-    /// If not null, receives operation result
+    float rejection_kappa,
+    const SKRY_Image *subtracted,
+    int keep_color,
     enum SKRY_result *result)
 {
-    SKRY_Image *flatfield = 0;
+    SKRY_Image *master = 0;
+
+    // Used for outlier rejection. For each pixel: mean and sum of squared differences
+    // from the mean (replaced by the max. accepted difference after the first pass).
+    float *value_stats = 0;
+    // Element [i] = number of accepted values of the i-th pixel
+    uint32_t *num_accepted = 0;
+
     unsigned width, height;
+    enum SKRY_pixel_format img_pix_fmt;
+    enum SKRY_result loc_result;
 
     SKRY_seek_start(img_seq);
-    do
+    if (SKRY_SUCCESS != (loc_result = SKRY_get_curr_img_metadata(img_seq, &width, &height, &img_pix_fmt)))
+        FAIL(loc_result);
+
+    // Raw color images are averaged without demosaicing, color images per channel
+    int is_raw_color = (img_pix_fmt > SKRY_PIX_CFA_MIN && img_pix_fmt < SKRY_PIX_CFA_MAX);
+    enum SKRY_pixel_format master_pix_fmt =
+        (keep_color && !is_raw_color && NUM_CHANNELS[img_pix_fmt] > 1) ? SKRY_PIX_RGB32F : SKRY_PIX_MONO32F;
+    size_t num_channels = NUM_CHANNELS[master_pix_fmt];
+    // Number of values in each line of 'master'
+    size_t line_len = (size_t)width * num_channels;
+
+    if (subtracted && (SKRY_get_img_pix_fmt(subtracted) != master_pix_fmt ||
+                       SKRY_get_img_width(subtracted) != width ||
+                       SKRY_get_img_height(subtracted) != height))
     {
-        enum SKRY_result loc_result;
-        SKRY_Image *img = SKRY_get_curr_img(img_seq, &loc_result);
-        if (!img)
-            FAIL(loc_result);
+        FAIL(SKRY_INVALID_PARAMETERS);
+    }
 
-        if (flatfield && (SKRY_get_img_width(img) != width ||
-                          SKRY_get_img_height(img) != height))
-        {
-            FAIL(SKRY_INVALID_IMG_DIMENSIONS);
-        }
-        else if (!flatfield)
-        {
-            width = SKRY_get_img_width(img);
-            height = SKRY_get_img_height(img);
-            flatfield = SKRY_new_image(width, height, SKRY_PIX_MONO32F, 0, 1);
-        }
+    master = SKRY_new_image(width, height, master_pix_fmt, 0, 1);
+    if (!master)
+        FAIL(SKRY_OUT_OF_MEMORY);
+
+    size_t num_passes = 1;
+    if (rejection_kappa > 0.0f)
+    {
+        value_stats = calloc(line_len * height * 2, sizeof(*value_stats));
+        num_accepted = calloc(line_len * height, sizeof(*num_accepted));
+        if (!value_stats || !num_accepted)
+            FAIL(SKRY_OUT_OF_MEMORY);
+
+        num_passes = 2;
+    }
 
-        SKRY_Image *float_img = img;
-        if (SKRY_get_img_pix_fmt(img) != SKRY_PIX_MONO32F)
+    size_t num_imgs = 0;
+    for (size_t pass = 0; pass < num_passes; pass++)
+    {
+        SKRY_seek_start(img_seq);
+        num_imgs = 0;
+
+        int more_imgs;
+        do
         {
-            float_img = SKRY_convert_pix_fmt(img, SKRY_PIX_MONO32F, SKRY_DEMOSAIC_HQLINEAR);
-            SKRY_free_image(img);
-        }
+            SKRY_Image *batch[MASTER_FRAME_BATCH_SIZE];
+            size_t batch_len;
+            if (SKRY_SUCCESS != (loc_result = read_master_frame_batch(img_seq, width, height, master_pix_fmt, keep_color,
+                                                                   batch, &batch_len, &more_imgs)))
+                FAIL(loc_result);
+
+            // Every pixel receives the batch's values in order, so the result
+            // does not depend on the number of threads
+            #pragma omp parallel for
+            for (unsigned y = 0; y < height; y++)
+            {
+                float *l_master = SKRY_get_line(master, y);
+                const float *l_subtr = subtracted ? SKRY_get_line(subtracted, y) : 0;
+                for (size_t i = 0; i < batch_len; i++)
+                {
+                    const float *l_img = SKRY_get_line(batch[i], y);
+                    for (size_t x = 0; x < line_len; x++)
+                    {
+                        float value = l_img[x] - (l_subtr ? l_subtr[x] : 0.0f);
+                        size_t pix_idx = x + (size_t)y*line_len;
+
+                        if (num_passes > 1 && 0 == pass)
+                        {
+                            // Update the running mean and sum of squared differences (Welford's algorithm)
+                            float *stats = value_stats + 2*pix_idx;
+                            float delta = value - stats[0];
+                            stats[0] += delta / (num_imgs + i + 1);
+                            stats[1] += delta * (value - stats[0]);
+                        }
+                        else if (num_passes > 1)
+                        {
+                            if (fabsf(value - value_stats[2*pix_idx]) <= value_stats[2*pix_idx + 1])
+                            {
+                                l_master[x] += value;
+                                num_accepted[pix_idx]++;
+                            }
+                        }
+                        else
+                            l_master[x] += value;
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < batch_len; i++)
+                SKRY_free_image(batch[i]);
+
+            num_imgs += batch_len;
+        } while (more_imgs);
+
+        if (num_passes > 1 && 0 == pass)
+            for (size_t i = 0; i < line_len * height; i++)
+                value_stats[2*i + 1] = rejection_kappa * sqrtf(value_stats[2*i + 1] / num_imgs);
+    }
 
-        for (unsigned y = 0; y < height; y++)
+    #pragma omp parallel for
+    for (unsigned y = 0; y < height; y++)
+    {
+        float *line = SKRY_get_line(master, y);
+        for (size_t x = 0; x < line_len; x++)
         {
-            float *l_flat = SKRY_get_line(flatfield, y);
-            float *l_img = SKRY_get_line(float_img, y);
-            for (unsigned x = 0; x < width; x++)
-                l_flat[x] += l_img[x];
+            size_t pix_idx = x + (size_t)y*line_len;
+            if (!num_accepted)
+                line[x] /= num_imgs;
+            else if (num_accepted[pix_idx] > 0)
+                line[x] /= num_accepted[pix_idx];
+            else
+                // All values have been rejected (possible for 'rejection_kappa' < 1), use their mean
+                line[x] = value_stats[2*pix_idx];
         }
-        SKRY_free_image(float_img);
-    } while (SKRY_SUCCESS == SKRY_seek_next(img_seq));
+    }
+
+    free(value_stats);
+    free(num_accepted);
+
+    if (result) *result = SKRY_SUCCESS;
+    return master;
+}
+
+#undef FAIL
+
+SKRY_Image *SKRY_create_master_frame(
+    SKRY_ImgSequence *img_seq,
+    float rejection_kappa,
+    const SKRY_Image *subtracted,
+    enum SKRY_result *result)
+{
+    return create_master_frame(img_seq, rejection_kappa, subtracted, 1, result);
+}
+
+SKRY_Image *SKRY_create_flatfield(
+    /// All images must have the same size
+    SKRY_ImgSequence *img_seq,
+    /// If not null, receives operation result
+    enum SKRY_result *result)
+{
+    SKRY_Image *flatfield = create_master_frame(img_seq, 0.0f, 0, 0, result);
+    if (!flatfield)
+        return 0;
+
+    unsigned width = SKRY_get_img_width(flatfield),
+             height = SKRY_get_img_height(flatfield);
 
     float max_val = FLT_MIN;
+    #pragma omp parallel for reduction(max:max_val)
     for (unsigned y = 0; y < height; y++)
     {
         float *line = SKRY_get_line(flatfield, y);
@@ -324,12 +653,11 @@ SKRY_Image *SKRY_create_flatfield(
                 max_val = line[x];
     }
 
+    #pragma omp parallel for
     for (unsigned y = 0; y < height; y++)
     {
         float *line = SKRY_get_line(flatfield, y);
         for (unsigned x = 0; x < width; x++)
-            // Store an inverted value, so that during stacking
-            // we can multiply instead of dividing
             line[x] *= 1.0f/max_val;
     }
 
@@ -337,14 +665,47 @@ SKRY_Image *SKRY_create_flatfield(
     return flatfield;
 }
 
-#undef FAIL
+/// Reads the current image (or takes it from the prefetcher) and converts it to 'pix_fmt'
+static
+SKRY_Image *get_curr_img_in_fmt(const SKRY_ImgSequence *img_seq,
+                                enum SKRY_pixel_format pix_fmt,
+                                enum SKRY_demosaic_method demosaic_method,
+                                enum SKRY_result *result)
+{
+    SKRY_Image *img;
+    if (img_seq->prefetcher)
+    {
+        double start_time = PERF_TIME();
+        img = take_prefetched_img(img_seq->prefetcher, img_seq->curr_image_idx, pix_fmt, result);
+        count_read_img(img, start_time);
+    }
+    else
+        img = SKRY_get_curr_img(img_seq, result);
+
+    if (!img)
+        return 0;
+
+    if (SKRY_get_img_pix_fmt(img) != pix_fmt)
+    {
+        SKRY_Image *img_conv = SKRY_convert_pix_fmt(img, pix_fmt, demosaic_method);
+        SKRY_free_image(img);
+        if (!img_conv)
+        {
+            if (result) *result = SKRY_OUT_OF_MEMORY;
+            return 0;
+        }
+        else
+            img = img_conv;
+    }
+
+    return img;
+}
 
 /// Returns the current image in specified format
 /** If 'img_seq' is connected to an image pool, the image is taken from the pool
-    if it exists there (and has 'pix_fmt'). If the image is not yet in the pool,
-    it will be converted to 'pix_fmt' and stored there, if the pool's capacity
-    is not yet exhausted. Otherwise, the image is read as usual and converted
-    without being added to the pool.
+    if it exists there in 'pix_fmt'. If not, it will be read, converted to 'pix_fmt'
+    and stored there (evicting other images if needed and possible).
+    The same image can be stored in several pixel formats.
     In any case, once the caller is done with the image, it *has to* call
     'SKRY_release_img_to_pool' and must not attempt to free the returned image. */
 SKRY_Image *SKRY_get_curr_img_from_pool(
@@ -361,68 +722,25 @@ SKRY_Image *SKRY_get_curr_img_from_pool(
     {
         SKRY_Image *img = get_image_from_pool(img_seq->img_pool,
                                               img_seq->pool_node,
-                                              img_seq->curr_image_idx);
+                                              img_seq->curr_image_idx,
+                                              pix_fmt, POOLED_IMG_ORIGINAL, 0);
+        if (img)
+            return img;
 
+        double t_start = get_precise_time_sec();
+        img = get_curr_img_in_fmt(img_seq, pix_fmt, demosaic_method, result);
         if (!img)
-        {
-            img = SKRY_get_curr_img(img_seq, result);
-            if (!img)
-                return 0;
+            return 0;
 
-            if (SKRY_get_img_pix_fmt(img) != pix_fmt)
-            {
-                SKRY_Image *img_conv = SKRY_convert_pix_fmt(img, pix_fmt, demosaic_method);
-                SKRY_free_image(img);
-                if (!img_conv)
-                {
-                    if (result) *result = SKRY_OUT_OF_MEMORY;
-                    return 0;
-                }
-                else
-                    img = img_conv;
-            }
-
-            put_image_in_pool(img_seq->img_pool, img_seq->pool_node,
-                              img_seq->curr_image_idx, img);
-
-            return img;
-
-        }
-        else
-        {
-            if (SKRY_get_img_pix_fmt(img) != pix_fmt)
-            {
-                img = SKRY_convert_pix_fmt(img, pix_fmt, demosaic_method);
-                if (!img)
-                {
-                    if (result) *result = SKRY_OUT_OF_MEMORY;
-                    return 0;
-                }
-                else
-                    put_image_in_pool(img_seq->img_pool, img_seq->pool_node,
-                                      img_seq->curr_image_idx, img);
-            }
+        put_image_in_pool(img_seq->img_pool, img_seq->pool_node,
+                          img_seq->curr_image_idx, img, POOLED_IMG_ORIGINAL, 0,
+                          get_precise_time_sec() - t_start);
 
-            return img;
-        }
+        return img;
     }
     else
     {
-        SKRY_Image *img = SKRY_get_curr_img(img_seq, result);
-        if (SKRY_get_img_pix_fmt(img) != pix_fmt)
-        {
-            SKRY_Image *img_conv = SKRY_convert_pix_fmt(img, pix_fmt, demosaic_method);
-            SKRY_free_image(img);
-            if (!img_conv)
-            {
-                if (result) *result = SKRY_OUT_OF_MEMORY;
-                return 0;
-            }
-            else
-                img = img_conv;
-        }
-
-        return img;
+        return get_curr_img_in_fmt(img_seq, pix_fmt, demosaic_method, result);
     }
 }
 
@@ -430,13 +748,11 @@ SKRY_Image *SKRY_get_curr_img_from_pool(
     when the image is no longer needed by the caller. */
 void SKRY_release_img_to_pool(const SKRY_ImgSequence *img_seq, size_t img_idx, SKRY_Image *image)
 {
-    if (img_seq->img_pool &&
-        get_image_from_pool(img_seq->img_pool, img_seq->pool_node, img_idx) == image)
+    if (!img_seq->img_pool ||
+        !release_image_to_pool(img_seq->img_pool, img_seq->pool_node, img_idx, image))
     {
-        // do nothing
-    }
-    else
         SKRY_free_image(image);
+    }
 }
 
 /// Treat mono images in 'img_seq' as containing raw color data
@@ -451,6 +767,8 @@ void SKRY_reinterpret_img_seq_as_CFA(
          enum SKRY_CFA_pattern CFA_pattern)
 {
     img_seq->CFA_pattern = CFA_pattern;
+    if (img_seq->prefetcher)
+        reset_prefetching(img_seq->prefetcher);
 }
 
 /// Translates index in the active images' subset into absolute index
@@ -471,3 +789,35 @@ size_t SKRY_get_absolute_img_idx(const SKRY_ImgSequence *img_seq, size_t active_
 
     return abs_idx;
 }
+
+/// Enables reading of images in a background thread, ahead of their use
+/** Images are read following the active images' subset, starting from
+    the current image. When a processing phase requests the current image,
+    it is usually already available. Calling this function again replaces
+    the previous prefetching settings. */
+enum SKRY_result SKRY_enable_prefetching(
+    SKRY_ImgSequence *img_seq,
+    /// Max. number of images read ahead
+    size_t queue_len,
+    /** If not SKRY_PIX_INVALID, the images are additionally converted
+        to this format in the background; the converted images are used
+        by SKRY_get_curr_img_from_pool() if the requested format matches.
+        Image alignment (using anchors), quality estimation and ref. point
+        alignment use SKRY_PIX_MONO8 and SKRY_DEMOSAIC_SIMPLE. */
+    enum SKRY_pixel_format pix_fmt,
+    /// Used if 'pix_fmt' is not SKRY_PIX_INVALID and images contain raw color data
+    enum SKRY_demosaic_method demosaic_method)
+{
+    img_seq->prefetcher = stop_prefetching(img_seq->prefetcher);
+
+    enum SKRY_result result;
+    img_seq->prefetcher = start_prefetching(img_seq, queue_len, pix_fmt, demosaic_method, &result);
+
+    return result;
+}
+
+/// Stops the background reading and frees all images read ahead
+void SKRY_disable_prefetching(SKRY_ImgSequence *img_seq)
+{
+    img_seq->prefetcher = stop_prefetching(img_seq->prefetcher);
+}
@@ -25,6 +25,7 @@ File description:
 #define LIB_STACKISTRY_IMG_SEQ_INTERNAL_HEADER
 
 #include <skry/imgseq.h>
+#include "prefetch.h"
 #include "../utils/img_pool.h"
 
 
@@ -33,7 +34,14 @@ typedef                               void fn_free(struct SKRY_img_sequence *);
 typedef         struct SKRY_image *fn_get_curr_img(const struct SKRY_img_sequence *, enum SKRY_result *);
 typedef  enum SKRY_result fn_get_curr_img_metadata(const struct SKRY_img_sequence *, unsigned *, unsigned *, enum SKRY_pixel_format *);
 typedef     struct SKRY_image *fn_get_img_by_index(const struct SKRY_img_sequence *, size_t, enum SKRY_result *);
+/// Reads only the pixels within the specified rectangle
+/** The rectangle lies within the image and has even coordinates of origin (so that
+    the CFA pattern, if any, is preserved). It receives the area actually covered
+    by the returned image, which contains the requested one (e.g. it may be the whole image). */
+typedef     struct SKRY_image *fn_get_img_fragment_by_index(const struct SKRY_img_sequence *, size_t, struct SKRY_rect *, enum SKRY_result *);
 typedef                 void fn_deactivate_img_seq(struct SKRY_img_sequence *);
+/// Loads the specified images in advance, so that subsequent 'get_img_by_index' calls for them are fast
+typedef                 void fn_preload_imgs(const struct SKRY_img_sequence *, const size_t *indices, size_t count);
 
 struct SKRY_img_sequence
 {
@@ -52,11 +60,15 @@ struct SKRY_img_sequence
         of returned 8- and 16-bit mono images. */
     enum SKRY_CFA_pattern CFA_pattern;
 
+    struct img_prefetcher *prefetcher; ///< May be null
+
     fn_free                  *free;
     fn_get_curr_img          *get_curr_img;
     fn_get_curr_img_metadata *get_curr_img_metadata;
     fn_get_img_by_index      *get_img_by_index;
+    fn_get_img_fragment_by_index *get_img_fragment_by_index; ///< May be null
     fn_deactivate_img_seq    *deactivate_img_seq;
+    fn_preload_imgs          *preload_imgs; ///< May be null
 };
 
 /// Must be called after img_seq->num_images has been set
@@ -64,4 +76,7 @@ void base_init(struct SKRY_img_sequence *img_seq,
                /// May be null
                SKRY_ImagePool *img_pool);
 
+/// Applies 'img_seq->CFA_pattern' (if any) to 'img' freshly read from 'img_seq'
+void apply_CFA_override(const struct SKRY_img_sequence *img_seq, SKRY_Image *img);
+
 #endif // LIB_STACKISTRY_IMG_SEQ_INTERNAL_HEADER
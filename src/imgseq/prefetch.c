@@ -0,0 +1,402 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Image sequence read-ahead implementation.
+
+    The prefetcher's thread reads images with increasing indices (skipping
+    non-active ones) into a bounded queue. The consumer takes images from
+    the queue's head; entries preceding the requested index are discarded.
+    If the requested image is neither queued nor being read, reading is
+    restarted at the requested index (e.g. after SKRY_seek_start()).
+    Every restart increments 'generation', so that an image read
+    in the meantime is recognized as stale and discarded.
+    If the sequence supports preloading (e.g. an image list, whose files
+    can be decoded in parallel), images are preloaded in batches
+    of the queue's length before being read one by one.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <skry/imgseq.h>
+
+#include "imgseq_internal.h"
+#include "prefetch.h"
+#include "../utils/logging.h"
+#include "../utils/threads.h"
+
+
+#define NO_IDX SIZE_MAX
+
+struct prefetch_entry
+{
+    size_t idx;
+    SKRY_Image *img;      ///< Image as read from the sequence; may be null (see 'result')
+    SKRY_Image *conv_img; ///< Converted to 'img_prefetcher::pix_fmt'; may be null
+    enum SKRY_result result;
+};
+
+struct img_prefetcher
+{
+    struct SKRY_img_sequence *img_seq;
+
+    enum SKRY_pixel_format pix_fmt; ///< SKRY_PIX_INVALID if not converting
+    enum SKRY_demosaic_method demosaic_method;
+
+    struct mutex *io_mutex; ///< Guards calls to 'img_seq's backend
+
+    /// Guards all fields below
+    struct mutex *mutex;
+    /// Signalled on every change of queue or reading state
+    struct cond_var *state_changed;
+
+    struct thread *thread;
+
+    /// Copy of the sequence's active images' flags; updated by 'reset_prefetching()'
+    uint8_t *is_img_active;
+
+    struct prefetch_entry *queue; ///< Circular buffer
+    size_t queue_len; ///< Capacity of 'queue'
+    size_t head;
+    size_t count;
+
+    size_t next_idx;      ///< Next image to read; NO_IDX if reading is paused
+    size_t in_flight_idx; ///< Image being read; NO_IDX if none
+    unsigned generation;
+    int stop;
+
+    /// Used if the sequence supports preloading (batch reading) of images
+    struct
+    {
+        size_t *indices; ///< Contains 'queue_len' elements
+        size_t end; ///< Images preceding 'end' have been already preloaded (in 'generation')
+        unsigned generation;
+    } preload;
+};
+
+static
+size_t next_active_idx(const struct img_prefetcher *prefetcher, size_t idx)
+{
+    size_t num_images = prefetcher->img_seq->num_images;
+    do
+    {
+        idx++;
+    } while (idx < num_images && !prefetcher->is_img_active[idx]);
+
+    return (idx < num_images ? idx : NO_IDX);
+}
+
+static
+void free_entry(struct prefetch_entry *entry)
+{
+    SKRY_free_image(entry->img);
+    SKRY_free_image(entry->conv_img);
+    *entry = (struct prefetch_entry) { 0 };
+}
+
+static
+void clear_queue(struct img_prefetcher *prefetcher)
+{
+    while (prefetcher->count)
+    {
+        free_entry(&prefetcher->queue[prefetcher->head]);
+        prefetcher->head = (prefetcher->head + 1) % prefetcher->queue_len;
+        prefetcher->count--;
+    }
+}
+
+static
+void prefetcher_thread_func(void *arg)
+{
+    struct img_prefetcher *prefetcher = arg;
+    struct SKRY_img_sequence *img_seq = prefetcher->img_seq;
+
+    lock_mutex(prefetcher->mutex);
+    while (!prefetcher->stop)
+    {
+        if (NO_IDX == prefetcher->next_idx || prefetcher->count == prefetcher->queue_len)
+        {
+            wait_cond_var(prefetcher->state_changed, prefetcher->mutex);
+            continue;
+        }
+
+        struct prefetch_entry entry = { .idx = prefetcher->next_idx };
+        unsigned generation = prefetcher->generation;
+        prefetcher->in_flight_idx = entry.idx;
+
+        size_t num_to_preload = 0;
+        if (img_seq->preload_imgs
+            && (prefetcher->preload.generation != generation || entry.idx >= prefetcher->preload.end))
+        {
+            // Preload the next batch of images; with the batch as long as the queue,
+            // all of them will be consumed before they are discarded by the sequence
+            for (size_t idx = entry.idx; idx != NO_IDX && num_to_preload < prefetcher->queue_len;
+                 idx = next_active_idx(prefetcher, idx))
+            {
+                prefetcher->preload.indices[num_to_preload++] = idx;
+            }
+
+            prefetcher->preload.end = prefetcher->preload.indices[num_to_preload - 1] + 1;
+            prefetcher->preload.generation = generation;
+        }
+        unlock_mutex(prefetcher->mutex);
+
+        lock_mutex(prefetcher->io_mutex);
+        if (num_to_preload)
+            img_seq->preload_imgs(img_seq, prefetcher->preload.indices, num_to_preload);
+        entry.img = img_seq->get_img_by_index(img_seq, entry.idx, &entry.result);
+        unlock_mutex(prefetcher->io_mutex);
+
+        if (entry.img)
+        {
+            apply_CFA_override(img_seq, entry.img);
+            if (prefetcher->pix_fmt != SKRY_PIX_INVALID
+                && SKRY_get_img_pix_fmt(entry.img) != prefetcher->pix_fmt)
+            {
+                // If conversion fails, the consumer will retry it
+                entry.conv_img = SKRY_convert_pix_fmt(entry.img, prefetcher->pix_fmt,
+                                                      prefetcher->demosaic_method);
+            }
+        }
+
+        lock_mutex(prefetcher->mutex);
+        prefetcher->in_flight_idx = NO_IDX;
+        if (generation == prefetcher->generation)
+        {
+            prefetcher->queue[(prefetcher->head + prefetcher->count) % prefetcher->queue_len] = entry;
+            prefetcher->count++;
+            prefetcher->next_idx = next_active_idx(prefetcher, entry.idx);
+        }
+        else
+            free_entry(&entry);
+
+        broadcast_cond_var(prefetcher->state_changed);
+    }
+    unlock_mutex(prefetcher->mutex);
+}
+
+/// Returns null
+struct img_prefetcher *stop_prefetching(struct img_prefetcher *prefetcher)
+{
+    if (prefetcher)
+    {
+        if (prefetcher->thread)
+        {
+            lock_mutex(prefetcher->mutex);
+            prefetcher->stop = 1;
+            broadcast_cond_var(prefetcher->state_changed);
+            unlock_mutex(prefetcher->mutex);
+
+            join_thread(prefetcher->thread);
+        }
+
+        if (prefetcher->queue)
+            clear_queue(prefetcher);
+
+        free(prefetcher->queue);
+        free(prefetcher->preload.indices);
+        free(prefetcher->is_img_active);
+        free_cond_var(prefetcher->state_changed);
+        free_mutex(prefetcher->mutex);
+        free_mutex(prefetcher->io_mutex);
+
+        LOG_MSG(SKRY_LOG_IMG_PREFETCH, "Stopped prefetching of img. seq. %p.", (void *)prefetcher->img_seq);
+
+        free(prefetcher);
+    }
+    return 0;
+}
+
+#define FAIL(error_code)                              \
+    do {                                              \
+        stop_prefetching(prefetcher);                 \
+        if (result) *result = error_code;             \
+        return 0;                                     \
+    } while (0)
+
+#define FAIL_ON_NULL(ptr)                             \
+    if (!(ptr))                                       \
+        FAIL(SKRY_OUT_OF_MEMORY)
+
+/// Returns null on failure
+struct img_prefetcher *start_prefetching(
+    struct SKRY_img_sequence *img_seq,
+    size_t queue_len, ///< Max. number of images read ahead
+    /// If not SKRY_PIX_INVALID, images are additionally converted to this format
+    enum SKRY_pixel_format pix_fmt,
+    enum SKRY_demosaic_method demosaic_method,
+    enum SKRY_result *result ///< If not null, receives operation result
+)
+{
+    if (0 == queue_len || pix_fmt >= SKRY_NUM_PIX_FORMATS
+        || pix_fmt > SKRY_PIX_CFA_MIN && pix_fmt < SKRY_PIX_CFA_MAX)
+    {
+        if (result) *result = SKRY_INVALID_PARAMETERS;
+        return 0;
+    }
+
+    struct img_prefetcher *prefetcher = malloc(sizeof(*prefetcher));
+    if (!prefetcher)
+    {
+        if (result) *result = SKRY_OUT_OF_MEMORY;
+        return 0;
+    }
+
+    *prefetcher = (struct img_prefetcher) { 0 };
+    prefetcher->img_seq = img_seq;
+    prefetcher->pix_fmt = pix_fmt;
+    prefetcher->demosaic_method = demosaic_method;
+    prefetcher->queue_len = queue_len;
+    prefetcher->next_idx = img_seq->curr_image_idx;
+    prefetcher->in_flight_idx = NO_IDX;
+
+    prefetcher->queue = malloc(queue_len * sizeof(*prefetcher->queue));
+    FAIL_ON_NULL(prefetcher->queue);
+
+    if (img_seq->preload_imgs)
+    {
+        prefetcher->preload.indices = malloc(queue_len * sizeof(*prefetcher->preload.indices));
+        FAIL_ON_NULL(prefetcher->preload.indices);
+        prefetcher->preload.generation = prefetcher->generation - 1; // nothing preloaded yet
+    }
+
+    prefetcher->is_img_active = malloc(img_seq->num_images);
+    FAIL_ON_NULL(prefetcher->is_img_active);
+    memcpy(prefetcher->is_img_active, img_seq->is_img_active, img_seq->num_images);
+
+    prefetcher->io_mutex = create_mutex();
+    FAIL_ON_NULL(prefetcher->io_mutex);
+    prefetcher->mutex = create_mutex();
+    FAIL_ON_NULL(prefetcher->mutex);
+    prefetcher->state_changed = create_cond_var();
+    FAIL_ON_NULL(prefetcher->state_changed);
+
+    prefetcher->thread = start_thread(prefetcher_thread_func, prefetcher);
+    if (!prefetcher->thread)
+        FAIL(SKRY_CANNOT_START_THREAD);
+
+    LOG_MSG(SKRY_LOG_IMG_PREFETCH, "Started prefetching of img. seq. %p (queue length: %zu, conversion to: %s).",
+            (void *)img_seq, queue_len, pix_fmt_str[pix_fmt]);
+
+    if (result) *result = SKRY_SUCCESS;
+    return prefetcher;
+}
+
+#undef FAIL
+#undef FAIL_ON_NULL
+
+/// Discards all queued images and pauses reading until the next 'take_prefetched_img()'
+void reset_prefetching(struct img_prefetcher *prefetcher)
+{
+    lock_mutex(prefetcher->mutex);
+
+    clear_queue(prefetcher);
+    prefetcher->generation++;
+    prefetcher->next_idx = NO_IDX;
+    memcpy(prefetcher->is_img_active, prefetcher->img_seq->is_img_active,
+           prefetcher->img_seq->num_images);
+
+    broadcast_cond_var(prefetcher->state_changed);
+    unlock_mutex(prefetcher->mutex);
+}
+
+/// Returns image 'index' (waiting for it if necessary), or null on failure
+SKRY_Image *take_prefetched_img(struct img_prefetcher *prefetcher,
+                                size_t index,
+                                enum SKRY_pixel_format pix_fmt,
+                                enum SKRY_result *result ///< If not null, receives operation result
+)
+{
+    struct prefetch_entry entry;
+
+    lock_mutex(prefetcher->mutex);
+    for (;;)
+    {
+        while (prefetcher->count && prefetcher->queue[prefetcher->head].idx != index)
+        {
+            if (prefetcher->queue[prefetcher->head].idx > index)
+            {
+                // Consumer went back; all queued images are useless
+                clear_queue(prefetcher);
+                prefetcher->generation++;
+                break;
+            }
+
+            free_entry(&prefetcher->queue[prefetcher->head]);
+            prefetcher->head = (prefetcher->head + 1) % prefetcher->queue_len;
+            prefetcher->count--;
+        }
+
+        if (prefetcher->count)
+        {
+            entry = prefetcher->queue[prefetcher->head];
+            prefetcher->head = (prefetcher->head + 1) % prefetcher->queue_len;
+            prefetcher->count--;
+            break;
+        }
+
+        if (prefetcher->in_flight_idx != index && prefetcher->next_idx != index)
+        {
+            LOG_MSG(SKRY_LOG_IMG_PREFETCH, "Restarting prefetching of img. seq. %p at image %zu.",
+                    (void *)prefetcher->img_seq, index);
+
+            prefetcher->generation++;
+            prefetcher->next_idx = index;
+        }
+
+        broadcast_cond_var(prefetcher->state_changed);
+        wait_cond_var(prefetcher->state_changed, prefetcher->mutex);
+    }
+    broadcast_cond_var(prefetcher->state_changed); // there is room in the queue now
+    unlock_mutex(prefetcher->mutex);
+
+    if (!entry.img)
+    {
+        if (result) *result = entry.result;
+        return 0;
+    }
+
+    if (result) *result = SKRY_SUCCESS;
+
+    if (pix_fmt != SKRY_PIX_INVALID && entry.conv_img
+        && SKRY_get_img_pix_fmt(entry.conv_img) == pix_fmt)
+    {
+        SKRY_free_image(entry.img);
+        return entry.conv_img;
+    }
+    else
+    {
+        SKRY_free_image(entry.conv_img);
+        return entry.img;
+    }
+}
+
+void lock_img_seq_io(const struct SKRY_img_sequence *img_seq)
+{
+    if (img_seq->prefetcher)
+        lock_mutex(img_seq->prefetcher->io_mutex);
+}
+
+void unlock_img_seq_io(const struct SKRY_img_sequence *img_seq)
+{
+    if (img_seq->prefetcher)
+        unlock_mutex(img_seq->prefetcher->io_mutex);
+}
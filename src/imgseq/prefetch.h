@@ -0,0 +1,74 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Image sequence read-ahead header.
+*/
+
+#ifndef LIB_STACKISTRY_IMG_SEQ_PREFETCH_HEADER
+#define LIB_STACKISTRY_IMG_SEQ_PREFETCH_HEADER
+
+#include <stddef.h>
+
+#include <skry/defs.h>
+#include <skry/image.h>
+
+
+struct SKRY_img_sequence;
+
+/** Reads images of a sequence in a background thread, following the sequence's
+    active images. All calls to the sequence's backend (functions in
+    'struct SKRY_img_sequence') have to be performed between 'lock_img_seq_io()'
+    and 'unlock_img_seq_io()', as they may be concurrently called by the prefetcher. */
+struct img_prefetcher;
+
+/// Returns null on failure
+struct img_prefetcher *start_prefetching(
+    struct SKRY_img_sequence *img_seq,
+    size_t queue_len, ///< Max. number of images read ahead
+    /// If not SKRY_PIX_INVALID, images are additionally converted to this format
+    enum SKRY_pixel_format pix_fmt,
+    enum SKRY_demosaic_method demosaic_method,
+    enum SKRY_result *result ///< If not null, receives operation result
+);
+
+/// Stops the background thread and frees all queued images; returns null
+struct img_prefetcher *stop_prefetching(struct img_prefetcher *prefetcher);
+
+/// Discards all queued images and pauses reading until the next 'take_prefetched_img()'
+/** Has to be called after a change of the sequence's active images or CFA pattern. */
+void reset_prefetching(struct img_prefetcher *prefetcher);
+
+/// Returns image 'index' (waiting for it if necessary), or null on failure
+/** If 'pix_fmt' is other than SKRY_PIX_INVALID and the prefetcher converts images
+    to 'pix_fmt', the converted image is returned. Otherwise, the image is returned
+    as read from the sequence (with the CFA pattern override applied). */
+SKRY_Image *take_prefetched_img(struct img_prefetcher *prefetcher,
+                                size_t index,
+                                enum SKRY_pixel_format pix_fmt,
+                                enum SKRY_result *result ///< If not null, receives operation result
+);
+
+/// Has no effect if 'img_seq' is not being prefetched
+void lock_img_seq_io(const struct SKRY_img_sequence *img_seq);
+
+/// Has no effect if 'img_seq' is not being prefetched
+void unlock_img_seq_io(const struct SKRY_img_sequence *img_seq);
+
+#endif // LIB_STACKISTRY_IMG_SEQ_PREFETCH_HEADER
@@ -0,0 +1,261 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Image sequence index files implementation.
+*/
+
+#if !defined(_WIN32)
+  #define _POSIX_C_SOURCE 200809L
+  #define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <skry/defs.h>
+#include <skry/imgseq.h>
+
+#include "seq_index.h"
+#include "../utils/logging.h"
+
+
+#define INDEX_FILE_EXT ".skryidx"
+#define INDEX_MAGIC "SKRYIDX"
+#define INDEX_VERSION 1
+#define BYTE_ORDER_MARK 0x01020304U
+
+/// Fields are ordered so that the structure contains no padding
+struct index_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; ///< BYTE_ORDER_MARK as written by the creator
+    uint32_t type;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pix_fmt;
+    uint32_t CFA_pattern;
+    uint32_t extra_size;
+    uint32_t entry_size;
+    uint32_t reserved;
+    uint64_t num_entries;
+    uint64_t src_size;
+    int64_t src_mtime;
+};
+
+static int index_files_enabled = 0;
+
+void SKRY_set_img_seq_index_files(int enabled)
+{
+    index_files_enabled = enabled;
+}
+
+int are_seq_index_files_enabled(void)
+{
+    return index_files_enabled;
+}
+
+int get_file_stamp(const char *file_name, struct file_stamp *stamp)
+{
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(file_name, &st))
+        return 0;
+#else
+    struct stat st;
+    if (stat(file_name, &st))
+        return 0;
+#endif
+
+    stamp->size = (uint64_t)st.st_size;
+#if defined(_WIN32)
+    stamp->mtime = (int64_t)st.st_mtime * 1000000000;
+#else
+    stamp->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return 1;
+}
+
+/// Returns a new string (to be freed by the caller) or null if out of memory
+static
+char *get_index_file_name(const char *src_file_name, const char *suffix)
+{
+    size_t len = strlen(src_file_name);
+    char *result = malloc(len + strlen(INDEX_FILE_EXT) + strlen(suffix) + 1);
+    if (result)
+    {
+        strcpy(result, src_file_name);
+        strcpy(result + len, INDEX_FILE_EXT);
+        strcat(result, suffix);
+    }
+    return result;
+}
+
+/// Reads an index file's contents following 'header'; returns 0 on failure
+static
+int read_index_data(FILE *file, const struct index_file_header *header, struct seq_index *index)
+{
+    void *extra = 0, *entries = 0;
+    size_t entries_size = header->num_entries * index->entry_size;
+
+    if (index->extra_size)
+    {
+        extra = malloc(index->extra_size);
+        if (!extra || 1 != fread(extra, index->extra_size, 1, file))
+        {
+            free(extra);
+            return 0;
+        }
+    }
+
+    if (entries_size)
+    {
+        entries = malloc(entries_size);
+        if (!entries || 1 != fread(entries, entries_size, 1, file))
+        {
+            free(entries);
+            free(extra);
+            return 0;
+        }
+    }
+
+    index->width = header->width;
+    index->height = header->height;
+    index->pix_fmt = header->pix_fmt;
+    index->CFA_pattern = header->CFA_pattern;
+    index->extra = extra;
+    index->entries = entries;
+    index->num_entries = header->num_entries;
+
+    return 1;
+}
+
+int load_seq_index(const char *src_file_name, struct seq_index *index)
+{
+    struct file_stamp stamp;
+    if (!get_file_stamp(src_file_name, &stamp))
+        return 0;
+
+    char *idx_file_name = get_index_file_name(src_file_name, "");
+    if (!idx_file_name)
+        return 0;
+
+    FILE *file = fopen(idx_file_name, "rb");
+    if (!file)
+    {
+        free(idx_file_name);
+        return 0;
+    }
+
+    int success = 0;
+    struct index_file_header header;
+
+    if (1 != fread(&header, sizeof(header), 1, file)
+        || memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC))
+        || header.version != INDEX_VERSION
+        || header.byte_order != BYTE_ORDER_MARK
+        || header.type != (uint32_t)index->type
+        || header.extra_size != index->extra_size
+        || header.entry_size != index->entry_size
+        || header.pix_fmt >= SKRY_NUM_PIX_FORMATS
+        || header.CFA_pattern >= SKRY_NUM_CFA_PATTERNS
+        || header.num_entries > SIZE_MAX / (index->entry_size ? index->entry_size : 1))
+    {
+        LOG_MSG(SKRY_LOG_IMG_SEQ_INDEX, "Ignoring invalid index file %s.", idx_file_name);
+    }
+    else if (header.src_size != stamp.size || header.src_mtime != stamp.mtime)
+    {
+        LOG_MSG(SKRY_LOG_IMG_SEQ_INDEX, "Ignoring outdated index file %s.", idx_file_name);
+    }
+    else if (!(success = read_index_data(file, &header, index)))
+    {
+        LOG_MSG(SKRY_LOG_IMG_SEQ_INDEX, "Could not read index file %s.", idx_file_name);
+    }
+    else
+        LOG_MSG(SKRY_LOG_IMG_SEQ_INDEX, "Loaded index file %s (%zu entries).",
+                idx_file_name, index->num_entries);
+
+    fclose(file);
+    free(idx_file_name);
+    return success;
+}
+
+int save_seq_index(const char *src_file_name, const struct seq_index *index)
+{
+    struct file_stamp stamp;
+    if (!get_file_stamp(src_file_name, &stamp))
+        return 0;
+
+    struct index_file_header header = {
+        .magic = INDEX_MAGIC,
+        .version = INDEX_VERSION,
+        .byte_order = BYTE_ORDER_MARK,
+        .type = index->type,
+        .width = index->width,
+        .height = index->height,
+        .pix_fmt = index->pix_fmt,
+        .CFA_pattern = index->CFA_pattern,
+        .extra_size = index->extra_size,
+        .entry_size = index->entry_size,
+        .num_entries = index->num_entries,
+        .src_size = stamp.size,
+        .src_mtime = stamp.mtime
+    };
+
+    char *idx_file_name = get_index_file_name(src_file_name, "");
+    // The index is written to a temporary file first, so that
+    // an interrupted write does not leave a truncated index behind
+    char *tmp_file_name = get_index_file_name(src_file_name, ".tmp");
+
+    int success = 0;
+    FILE *file = 0;
+    if (idx_file_name && tmp_file_name && (file = fopen(tmp_file_name, "wb")))
+    {
+        success = (1 == fwrite(&header, sizeof(header), 1, file));
+        if (success && index->extra_size)
+            success = (1 == fwrite(index->extra, index->extra_size, 1, file));
+        if (success && index->num_entries > 0 && index->entry_size > 0)
+            success = (1 == fwrite(index->entries, index->num_entries * index->entry_size, 1, file));
+
+        success = (0 == fclose(file)) && success;
+
+        if (success)
+        {
+            remove(idx_file_name); // needed on Windows, where rename() does not replace existing files
+            success = (0 == rename(tmp_file_name, idx_file_name));
+        }
+
+        if (!success)
+            remove(tmp_file_name);
+    }
+
+    if (success)
+        LOG_MSG(SKRY_LOG_IMG_SEQ_INDEX, "Saved index file %s.", idx_file_name);
+    else
+        LOG_MSG(SKRY_LOG_IMG_SEQ_INDEX, "Could not save index for %s.", src_file_name);
+
+    free(tmp_file_name);
+    free(idx_file_name);
+    return success;
+}
@@ -0,0 +1,78 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Image sequence index files header.
+*/
+
+#ifndef LIB_STACKISTRY_IMG_SEQ_INDEX_HEADER
+#define LIB_STACKISTRY_IMG_SEQ_INDEX_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <skry/defs.h>
+
+
+/** An index file ("<source file name>.skryidx") stores the results of parsing
+    a source file (e.g. frame offsets of a video), so that subsequent opening
+    of the same file does not need to parse it again. The index is ignored if
+    the source file's size or modification time has changed, or if it has been
+    created on a machine with different endianness or data layout. */
+struct seq_index
+{
+    enum SKRY_img_sequence_type type;
+
+    unsigned width, height;
+    enum SKRY_pixel_format pix_fmt;
+    enum SKRY_CFA_pattern CFA_pattern;
+
+    /// Sequence type-specific data
+    void *extra;
+    size_t extra_size;
+
+    /// Sequence type-specific array (e.g. frame offsets)
+    void *entries;
+    size_t num_entries;
+    size_t entry_size;
+};
+
+/// Size and modification time of a file
+struct file_stamp
+{
+    uint64_t size;
+    int64_t mtime; ///< In nanoseconds (but the resolution may be lower)
+};
+
+/// Returns non-zero if index files are to be used
+int are_seq_index_files_enabled(void);
+
+/// Returns 0 if 'file_name' does not exist
+int get_file_stamp(const char *file_name, struct file_stamp *stamp);
+
+/// Loads the index of 'src_file_name'; returns 0 if it is missing or stale
+/** On entry, 'index->type', 'extra_size' and 'entry_size' must be set to the expected
+    values. On success, 'index->extra' and 'entries' are allocated with malloc()
+    and have to be freed by the caller. */
+int load_seq_index(const char *src_file_name, struct seq_index *index);
+
+/// Creates (or replaces) the index of 'src_file_name'; returns 0 on failure
+int save_seq_index(const char *src_file_name, const struct seq_index *index);
+
+#endif // LIB_STACKISTRY_IMG_SEQ_INDEX_HEADER
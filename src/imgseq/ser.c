@@ -32,21 +32,12 @@ File description:
 #include <skry/image.h>
 
 #include "imgseq_internal.h"
+#include "../image/external_img.h"
 #include "../utils/logging.h"
+#include "../utils/mapped_file.h"
 #include "../utils/misc.h"
 #include "video.h"
 
-/* We need a 64-bit offset-capable file seek function;
-   'fseek' is fine only if sizeof(long)==8, e.g. on 64-bit
-   Linux, but not on Windows (32- or 64-bit) */
-
-#if defined (_MSC_VER) || defined(__MINGW32__)
-  #define FSEEK64 _fseeki64
-
-  // TODO: add more cases (OS X)
-#else
-  #define FSEEK64 fseek
-#endif
 
 enum SER_color_format
 {
@@ -115,6 +106,12 @@ struct SER_data
     enum SER_color_format SER_color_fmt;
     enum SKRY_pixel_format pix_fmt;
     unsigned width, height;
+
+    /// If 1, frames are returned as images pointing directly into 'mapping'
+    /** Set only if the pixel data can be used as-is (no RGB reversal
+        and no byte swapping required). */
+    int use_mapping;
+    struct mapped_file *mapping; ///< Created on first access
 };
 
 static
@@ -128,6 +125,7 @@ void SER_free(struct SKRY_img_sequence *img_seq)
             if (data)
             {
                 free(data->file_name);
+                release_mapped_file(data->mapping);
                 if (data->file)
                 {
                     fclose(data->file);
@@ -170,12 +168,73 @@ enum SKRY_result SER_get_curr_img_metadata(const struct SKRY_img_sequence *img_s
     }
 
 static
-struct SKRY_image *SER_get_img_by_index(const struct SKRY_img_sequence *img_seq,
-                                        size_t index, enum SKRY_result *result)
+void release_SER_mapping(void *mapping)
+{
+    release_mapped_file(mapping);
+}
+
+/// Returns an image pointing into the file mapping, or null if mapping is not possible
+/** On failure, 'data->use_mapping' is cleared (so that the caller can use regular reading). */
+static
+struct SKRY_image *get_mapped_SER_img(struct SER_data *data, size_t index,
+                                      struct SKRY_rect rect,
+                                      enum SKRY_result *result)
+{
+    if (!data->mapping)
+    {
+        data->mapping = map_file(data->file_name);
+        if (!data->mapping)
+        {
+            LOG_MSG(SKRY_LOG_SER, "Cannot map %s; falling back to regular reading.", data->file_name);
+            data->use_mapping = 0;
+            return 0;
+        }
+    }
+
+    uint64_t frame_size = (uint64_t)data->width * data->height * BYTES_PER_PIXEL[data->pix_fmt];
+    uint64_t frame_ofs = sizeof(struct SER_header) + (uint64_t)index * frame_size;
+    if (frame_ofs + frame_size > get_mapped_size(data->mapping))
+    {
+        LOG_MSG(SKRY_LOG_SER, "Frame %zu lies beyond the end of file.", index);
+        if (result) *result = SKRY_FILE_IO_ERROR;
+        return 0;
+    }
+
+    ptrdiff_t line_stride = (ptrdiff_t)data->width * BYTES_PER_PIXEL[data->pix_fmt];
+    SKRY_Image *img = create_external_buf_img(
+                            rect.width, rect.height, data->pix_fmt,
+                            get_mapped_data(data->mapping) + frame_ofs
+                                + rect.y * line_stride + rect.x * BYTES_PER_PIXEL[data->pix_fmt],
+                            line_stride,
+                            acquire_mapped_file(data->mapping),
+                            release_SER_mapping);
+    if (!img)
+    {
+        release_mapped_file(data->mapping);
+        if (result) *result = SKRY_OUT_OF_MEMORY;
+        return 0;
+    }
+
+    if (result) *result = SKRY_SUCCESS;
+    return img;
+}
+
+static
+struct SKRY_image *SER_get_img_fragment_by_index(const struct SKRY_img_sequence *img_seq,
+                                                 size_t index, struct SKRY_rect *rect,
+                                                 enum SKRY_result *result)
 {
     assert(index < img_seq->num_images);
 
     struct SER_data *data = (struct SER_data *)img_seq->data;
+
+    if (data->use_mapping)
+    {
+        SKRY_Image *img = get_mapped_SER_img(data, index, *rect, result);
+        if (img || data->use_mapping)
+            return img;
+    }
+
     if (!data->file)
         data->file = fopen(data->file_name, "rb");
 
@@ -183,9 +242,10 @@ struct SKRY_image *SER_get_img_by_index(const struct SKRY_img_sequence *img_seq,
     {
         LOG_MSG(SKRY_LOG_SER, "Cannot open %s.", data->file_name);
         if (result) *result = SKRY_CANNOT_OPEN_FILE;
+        return 0;
     }
 
-    SKRY_Image *img = SKRY_new_image(data->width, data->height, data->pix_fmt,
+    SKRY_Image *img = SKRY_new_image(rect->width, rect->height, data->pix_fmt,
                                      0, 0);
 
     if (!img)
@@ -194,26 +254,34 @@ struct SKRY_image *SER_get_img_by_index(const struct SKRY_img_sequence *img_seq,
         return 0;
     }
 
-    size_t frame_size = data->width * data->height * BYTES_PER_PIXEL[data->pix_fmt];
-    if (FSEEK64(data->file, sizeof(struct SER_header) + (int64_t)index * frame_size, SEEK_SET))
+    size_t line_byte_count = data->width * BYTES_PER_PIXEL[data->pix_fmt];
+    size_t frame_size = line_byte_count * data->height;
+    int64_t frag_ofs = (int64_t)rect->y * line_byte_count + rect->x * BYTES_PER_PIXEL[data->pix_fmt];
+    if (FSEEK64(data->file, sizeof(struct SER_header) + (int64_t)index * frame_size + frag_ofs, SEEK_SET))
     {
         LOG_MSG(SKRY_LOG_AVI, "Cannot seek to frame %zu.", index);
         FRAME_FAIL(SKRY_FILE_IO_ERROR);
     }
 
-    size_t line_byte_count = data->width * BYTES_PER_PIXEL[data->pix_fmt];
-    for (unsigned y = 0; y < data->height; y++)
+    size_t frag_line_byte_count = rect->width * BYTES_PER_PIXEL[data->pix_fmt];
+    for (unsigned y = 0; y < rect->height; y++)
     {
+        if (y > 0 && frag_line_byte_count < line_byte_count &&
+            FSEEK64(data->file, (int64_t)(line_byte_count - frag_line_byte_count), SEEK_CUR))
+        {
+            FRAME_FAIL(SKRY_FILE_IO_ERROR);
+        }
+
         void *line = SKRY_get_line(img, y);
-        if (1 != fread(line, line_byte_count, 1, data->file))
+        if (1 != fread(line, frag_line_byte_count, 1, data->file))
             FRAME_FAIL(SKRY_FILE_IO_ERROR);
 
         if (SER_BGR == data->SER_color_fmt)
         {
             if (SKRY_PIX_RGB8 == data->pix_fmt)
-                REVERSE_RGB(uint8_t, ((uint8_t *)line), data->width);
+                REVERSE_RGB(uint8_t, ((uint8_t *)line), rect->width);
             else
-                REVERSE_RGB(uint16_t, ((uint16_t *)line), data->width);
+                REVERSE_RGB(uint16_t, ((uint16_t *)line), rect->width);
         }
     }
 
@@ -225,6 +293,15 @@ struct SKRY_image *SER_get_img_by_index(const struct SKRY_img_sequence *img_seq,
     return img;
 }
 
+static
+struct SKRY_image *SER_get_img_by_index(const struct SKRY_img_sequence *img_seq,
+                                        size_t index, enum SKRY_result *result)
+{
+    struct SER_data *data = (struct SER_data *)img_seq->data;
+    struct SKRY_rect whole_img = { .x = 0, .y = 0, .width = data->width, .height = data->height };
+    return SER_get_img_fragment_by_index(img_seq, index, &whole_img, result);
+}
+
 static
 struct SKRY_image *SER_get_current_img(const struct SKRY_img_sequence *img_seq,
                                        enum SKRY_result *result)
@@ -241,6 +318,8 @@ void SER_deactivate_img_seq(struct SKRY_img_sequence *img_seq)
         fclose(data->file);
         data->file = 0;
     }
+    // Images still in use keep their own references to the mapping
+    data->mapping = release_mapped_file(data->mapping);
 }
 
 #define FAIL_ON_NULL(ptr)                         \
@@ -276,6 +355,7 @@ struct SKRY_img_sequence *init_SER(const char *file_name,
     img_seq->get_curr_img = SER_get_current_img;
     img_seq->get_curr_img_metadata = SER_get_curr_img_metadata;
     img_seq->get_img_by_index = SER_get_img_by_index;
+    img_seq->get_img_fragment_by_index = SER_get_img_fragment_by_index;
     img_seq->deactivate_img_seq = SER_deactivate_img_seq;
 
     struct SER_data *data = (struct SER_data *)img_seq->data;
@@ -360,6 +440,10 @@ struct SKRY_img_sequence *init_SER(const char *file_name,
     data->height = cnd_swap_32(fheader.img_height, is_machine_b_e);
     img_seq->num_images = cnd_swap_32(fheader.frame_count, is_machine_b_e);
 
+    data->use_mapping = (SER_BGR != data->SER_color_fmt
+                         && (BITS_PER_CHANNEL[data->pix_fmt] <= 8
+                             || is_machine_b_e != data->little_endian_data));
+
     LOG_MSG(SKRY_LOG_SER, "Video size: %ux%u (%s), %zu frames",
             data->width, data->height,
             SER_color_format_str[color_id],
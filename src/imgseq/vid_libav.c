@@ -21,16 +21,25 @@ File description:
     Video support via libav
 */
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <libavformat/avformat.h>
 #include <libavutil/imgutils.h>
 #include <skry/image.h>
 #include <skry/imgseq.h>
 
 #include "imgseq_internal.h"
+#include "../image/external_img.h"
 #include "../utils/logging.h"
 #include "video.h"
 
 
+/// Value of 'libav_data::next_frame_idx' meaning that the decoder's position is unknown
+#define UNKNOWN_FRAME_IDX SIZE_MAX
+
+
 struct libav_data
 {
     char *file_name;
@@ -41,9 +50,9 @@ struct libav_data
     AVCodecContext *video_dec_ctx;
     int video_stream_idx;
 
-    // Buffer for decoded frame
-    uint8_t *video_dst_data[4];
-    int video_dst_line_size[4];
+    /// Index of the frame that the decoder will return next without seeking
+    /** Equals UNKNOWN_FRAME_IDX if not known (e.g. after an error). */
+    size_t next_frame_idx;
 
     AVFrame *frame;
     AVPacket packet;
@@ -64,7 +73,6 @@ void vid_libav_free(SKRY_ImgSequence *img_seq)
         {
             struct libav_data *data = (struct libav_data *)img_seq->data;
             free(data->file_name);
-            av_free(data->video_dst_data[0]);
             av_frame_free(&data->frame);
             avcodec_free_context(&data->video_dec_ctx);
             avformat_close_input(&data->fmt_ctx);
@@ -92,44 +100,57 @@ enum SKRY_result vid_libav_get_curr_img_metadata(
     return SKRY_SUCCESS;
 }
 
-/** Decodes frame contents into data->video_dst_data;
-    returns number of bytes used or <0 on error. */
+/// Reads packets and decodes them until a video frame is obtained in 'data->frame'
+/** At the end of stream, frames still buffered by the decoder are returned. */
 static
-int decode_packet(struct libav_data *data, int *got_frame, enum SKRY_result *result)
+enum SKRY_result decode_next_frame(struct libav_data *data)
 {
-    int decoded = data->packet.size;
-
-    *got_frame = 0;
+    int got_frame = 0;
 
-    if (data->packet.stream_index == data->video_stream_idx)
+    while (!got_frame)
     {
-        if (avcodec_decode_video2(data->video_dec_ctx, data->frame, got_frame, &data->packet) < 0)
+        if (av_read_frame(data->fmt_ctx, &data->packet) < 0)
         {
-            if (result)
-                *result = SKRY_LIBAV_DECODING_ERROR;
-            return -1;
+            // End of stream (or read error); drain the decoder
+            data->packet.data = NULL;
+            data->packet.size = 0;
+            if (avcodec_decode_video2(data->video_dec_ctx, data->frame, &got_frame, &data->packet) < 0)
+                return SKRY_LIBAV_DECODING_ERROR;
+
+            return (got_frame ? SKRY_SUCCESS : SKRY_FILE_IO_ERROR);
         }
 
-        if (*got_frame)
+        if (data->packet.stream_index != data->video_stream_idx)
         {
-            // TODO: react to a changed frame width or height
-
-            av_image_copy(data->video_dst_data, data->video_dst_line_size,
-                          (const uint8_t **)data->frame->data,
-                          data->frame->linesize,
-                          data->video_dec_ctx->pix_fmt,
-                          data->video_dec_ctx->width,
-                          data->video_dec_ctx->height);
+            av_packet_unref(&data->packet);
+            continue;
         }
-    }
 
-    if (*got_frame)
-        av_frame_unref(data->frame);
+        AVPacket orig_pkt = data->packet;
+        do
+        {
+            int decoded = avcodec_decode_video2(data->video_dec_ctx, data->frame, &got_frame, &data->packet);
+            if (decoded < 0)
+            {
+                av_packet_unref(&orig_pkt);
+                return SKRY_LIBAV_DECODING_ERROR;
+            }
+
+            data->packet.data += decoded;
+            data->packet.size -= decoded;
+        } while (data->packet.size > 0 && !got_frame);
+
+        av_packet_unref(&orig_pkt);
+    }
 
-    if (result)
-        *result = SKRY_SUCCESS;
+    return SKRY_SUCCESS;
+}
 
-    return decoded;
+static
+void free_frame(void *frame)
+{
+    AVFrame *avframe = frame;
+    av_frame_free(&avframe);
 }
 
 static
@@ -137,74 +158,62 @@ SKRY_Image *vid_libav_get_img_by_index(const SKRY_ImgSequence *img_seq,
                                        size_t index, enum SKRY_result *result)
 {
     struct libav_data *data = img_seq->data;
-    if (avformat_seek_file(data->fmt_ctx, data->video_stream_idx,
-                           index, index, index,
-                           AVSEEK_FLAG_FRAME | AVSEEK_FLAG_ANY) < 0)
-    {
-        if (result)
-            *result = SKRY_FILE_IO_ERROR;
-        return NULL;
-    }
-
-    data->packet.data = NULL;
-    data->packet.size = 0;
 
-    if (av_read_frame(data->fmt_ctx, &data->packet) < 0)
+    // When reading consecutive frames, just keep decoding; seek only on random access
+    if (index != data->next_frame_idx)
     {
-        if (result)
-            *result = SKRY_FILE_IO_ERROR;
-        return NULL;
-    }
+        LOG_MSG(SKRY_LOG_LIBAV_VIDEO, "Seeking to frame %zu.", index);
 
-    int got_frame;
-    AVPacket orig_pkt = data->packet;
-
-    do
-    {
-        int ret;
-        if ((ret = decode_packet(data, &got_frame, result)) < 0)
+        if (avformat_seek_file(data->fmt_ctx, data->video_stream_idx,
+                               index, index, index,
+                               AVSEEK_FLAG_FRAME | AVSEEK_FLAG_ANY) < 0)
         {
-            av_packet_unref(&orig_pkt);
+            data->next_frame_idx = UNKNOWN_FRAME_IDX;
             if (result)
-                *result = SKRY_LIBAV_DECODING_ERROR;
+                *result = SKRY_FILE_IO_ERROR;
             return NULL;
         }
+        avcodec_flush_buffers(data->video_dec_ctx);
+    }
 
-        data->packet.data += ret;
-        data->packet.size -= ret;
-    } while (data->packet.size > 0);
-
-    SKRY_Image *img = NULL;
-
-    if (got_frame)
+    enum SKRY_result dec_result = decode_next_frame(data);
+    if (SKRY_SUCCESS != dec_result)
     {
-        img = SKRY_new_image(data->video_dec_ctx->width,
-                             data->video_dec_ctx->height,
-                             data->pix_fmt, NULL, 0);
-
-        if (!img)
-        {
-            if (result)
-                *result = SKRY_OUT_OF_MEMORY;
-            av_packet_unref(&orig_pkt);
-            return NULL;
-        }
+        data->next_frame_idx = UNKNOWN_FRAME_IDX;
+        if (result)
+            *result = dec_result;
+        return NULL;
+    }
+    data->next_frame_idx = index + 1;
 
-        const size_t dest_BPP = SKRY_get_bytes_per_pixel(img);
-        uint8_t *dest = SKRY_get_line(img, 0);
-        const ptrdiff_t step = SKRY_get_line_stride_in_bytes(img);
+    // TODO: react to a changed frame width or height
 
-        const uint8_t *src = data->video_dst_data[0];
+    // The returned image refers directly to the decoded (reference-counted) frame buffer
+    AVFrame *frame_ref = av_frame_clone(data->frame);
+    av_frame_unref(data->frame);
+    if (!frame_ref)
+    {
+        if (result)
+            *result = SKRY_OUT_OF_MEMORY;
+        return NULL;
+    }
 
-        for (int line = 0; line < data->video_dec_ctx->height; line++)
-        {
-            memcpy(dest, src, data->video_dec_ctx->width * dest_BPP);
-            dest += step;
-            src += data->video_dst_line_size[0];
-        }
+    SKRY_Image *img = create_external_buf_img(data->video_dec_ctx->width,
+                                              data->video_dec_ctx->height,
+                                              data->pix_fmt,
+                                              frame_ref->data[0],
+                                              frame_ref->linesize[0],
+                                              frame_ref, free_frame);
+    if (!img)
+    {
+        av_frame_free(&frame_ref);
+        if (result)
+            *result = SKRY_OUT_OF_MEMORY;
+        return NULL;
     }
 
-    av_packet_unref(&orig_pkt);
+    if (result)
+        *result = SKRY_SUCCESS;
 
     return img;
 }
@@ -283,16 +292,6 @@ SKRY_ImgSequence *init_libav_video_file(const char *file_name,
     if (avcodec_open2(data->video_dec_ctx, decoder, &opts) < 0)
         FAIL(SKRY_LIBAV_UNSUPPORTED_FORMAT);
 
-    if (av_image_alloc(data->video_dst_data, data->video_dst_line_size,
-                       data->video_dec_ctx->width,
-                       data->video_dec_ctx->height,
-                       data->video_dec_ctx->pix_fmt,
-                       4 // required for formats with palette
-                       ) < 0)
-    {
-        FAIL(SKRY_OUT_OF_MEMORY);
-    }
-
     data->frame = av_frame_alloc();
     if (!data->frame)
         FAIL(SKRY_OUT_OF_MEMORY);
@@ -313,6 +312,9 @@ SKRY_ImgSequence *init_libav_video_file(const char *file_name,
 
     av_init_packet(&data->packet);
 
+    // The demuxer is positioned at the start, so the first frame can be decoded without seeking
+    data->next_frame_idx = 0;
+
     img_seq->num_images = data->fmt_ctx->streams[data->video_stream_idx]->nb_frames;
 
     LOG_MSG(SKRY_LOG_LIBAV_VIDEO, "Video size: %dx%d, %zu frames, pixel format: %s",
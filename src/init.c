@@ -26,19 +26,31 @@ File description:
 #endif
 #include <skry/skry.h>
 
+#include "utils/accel.h"
+#include "utils/logging.h"
+#include "utils/match.h"
+
 /// Must be called before using libskry
 enum SKRY_result SKRY_initialize(void)
 {
 #if USE_LIBAV
     av_register_all();
 #endif
-    return SKRY_SUCCESS;
+    init_block_matching();
+    return init_logging();
 }
 
 /// Must be called after finished using libskry
 void SKRY_deinitialize(void)
 {
+    free_accel();
+    free_logging();
 #if USE_LIBAV
     //
 #endif
 }
+
+enum SKRY_result SKRY_set_accelerator(enum SKRY_accelerator accel)
+{
+    return init_accel(accel);
+}
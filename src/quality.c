@@ -32,11 +32,15 @@ File description:
 #include <skry/imgseq.h>
 #include <skry/quality.h>
 
+#include "checkpoint_internal.h"
+#include "imgseq/derived_img.h"
+#include "quality_internal.h"
 #include "utils/dnarray.h"
 #include "utils/filters.h"
 #include "utils/logging.h"
 #include "utils/match.h"
 #include "utils/misc.h"
+#include "utils/perf.h"
 
 
 struct qual_est_area
@@ -106,6 +110,20 @@ struct SKRY_quality_estimation
 
     unsigned box_blur_radius;
 
+    /// If nonzero, the whole intersection is blurred at once (see 'estimate_grid_quality()')
+    int whole_intersection_blur;
+
+    enum SKRY_quality_metric metric;
+
+    /// If greater than 0, quality is estimated using images downsampled 2^'decimation_level' times
+    unsigned decimation_level;
+
+    /// If nonzero, areas' quality has been interpolated from quality estimated during image alignment
+    int uses_provisional_quality;
+
+    /// Used by 'estimate_quality()' and 'estimate_grid_quality()' in SKRY_quality_est_step()
+    struct thread_filter_buffers filter_buffers;
+
     int first_step_complete;
 
     struct
@@ -121,6 +139,8 @@ struct SKRY_quality_estimation
             uint8_t min, max;
         } ref_block_brightness; ///< Brightness of quality estimation areas' reference blocks
     } statistics;
+
+    struct SKRY_perf_stats perf_stats; ///< Counters of all steps (see SKRY_get_quality_est_perf_stats())
 };
 
 int SKRY_is_qual_est_complete(const SKRY_QualityEstimation *qual_est)
@@ -271,19 +291,9 @@ enum SKRY_result create_reference_blocks(SKRY_QualityEstimation *qual_est)
             {
                 if (!curr_img)
                 {
-                    curr_img = SKRY_get_curr_img(img_seq, &result);
+                    curr_img = SKRY_get_curr_img_from_pool(img_seq, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE, &result);
                     if (!curr_img)
                         return result;
-
-                    SKRY_Image *img8 = SKRY_convert_pix_fmt(curr_img, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE);
-                    if (!img8)
-                    {
-                        SKRY_free_image(curr_img);
-                        return SKRY_OUT_OF_MEMORY;
-                    }
-
-                    SKRY_free_image(curr_img);
-                    curr_img = img8;
                 }
                 struct SKRY_point curr_img_ofs = SKRY_get_image_ofs(img_algn, curr_img_idx);
                 struct qual_est_area *area = &qual_est->area_defs[i];
@@ -308,7 +318,10 @@ enum SKRY_result create_reference_blocks(SKRY_QualityEstimation *qual_est)
                       .y = img_fragment.y - intrs_ofs.y - curr_img_ofs.y };
                 area->ref_block = SKRY_new_image(img_fragment.width, img_fragment.height, SKRY_PIX_MONO8, 0, 0);
                 if (!area->ref_block)
+                {
+                    SKRY_release_img_to_pool(img_seq, SKRY_get_curr_img_idx(img_seq), curr_img);
                     return SKRY_OUT_OF_MEMORY;
+                }
 
                 SKRY_resize_and_translate(curr_img, area->ref_block,
                                           img_fragment.x, img_fragment.y,
@@ -318,7 +331,8 @@ enum SKRY_result create_reference_blocks(SKRY_QualityEstimation *qual_est)
             }
         }
 
-        curr_img = SKRY_free_image(curr_img);
+        if (curr_img)
+            SKRY_release_img_to_pool(img_seq, SKRY_get_curr_img_idx(img_seq), curr_img);
     } while (SKRY_seek_next(img_seq) == SKRY_SUCCESS);
 
     return result;
@@ -340,6 +354,7 @@ SKRY_QualityEstimation *SKRY_free_quality_est(SKRY_QualityEstimation *qual_est)
             }
             free(qual_est->area_defs);
         }
+        free_thread_filter_buffers(&qual_est->filter_buffers);
         free(qual_est);
     }
     return 0;
@@ -400,8 +415,167 @@ enum SKRY_result on_final_step(SKRY_QualityEstimation *qual_est)
     return SKRY_LAST_STEP;
 }
 
-/// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
-enum SKRY_result SKRY_quality_est_step(SKRY_QualityEstimation *qual_est)
+/// Updates quality summaries with the already determined quality of image 'img_idx's areas
+static
+void update_img_quality_summary(SKRY_QualityEstimation *qual_est, size_t img_idx)
+{
+    const SKRY_quality_t *img_area_quality = &qual_est->area_quality[img_idx * qual_est->num_areas];
+    SKRY_quality_t img_qual = 0;
+
+    for (size_t i = 0; i < qual_est->num_areas; i++)
+    {
+        SKRY_quality_t aqual = img_area_quality[i];
+
+        img_qual += aqual;
+        if (aqual > qual_est->qual_summary[i].max)
+        {
+            qual_est->qual_summary[i].max = aqual;
+            qual_est->qual_summary[i].best_img_idx = img_idx;
+        }
+        if (aqual < qual_est->qual_summary[i].min)
+        {
+            qual_est->qual_summary[i].min = aqual;
+        }
+    }
+
+    qual_est->img_quality[img_idx] = img_qual;
+
+    if (img_qual > qual_est->overall_quality.image.best_quality)
+    {
+        qual_est->overall_quality.image.best_quality = img_qual;
+        qual_est->overall_quality.image.best_img_idx = img_idx;
+    }
+}
+
+enum SKRY_result alloc_provisional_quality(struct provisional_quality *pq,
+                                           unsigned first_img_width, unsigned first_img_height,
+                                           size_t num_imgs)
+{
+    assert(pq->area_size > 0);
+
+    pq->num_areas_horz = DIV_CEIL(first_img_width, pq->area_size);
+    pq->num_areas_vert = DIV_CEIL(first_img_height, pq->area_size);
+    pq->num_imgs = num_imgs;
+
+    free(pq->area_quality);
+    pq->area_quality = malloc(num_imgs * pq->num_areas_horz * pq->num_areas_vert * sizeof(*pq->area_quality));
+    if (!pq->area_quality)
+        return SKRY_OUT_OF_MEMORY;
+
+    return SKRY_SUCCESS;
+}
+
+void free_provisional_quality(struct provisional_quality *pq)
+{
+    free(pq->area_quality);
+    free_thread_filter_buffers(&pq->filter_buffers);
+    *pq = (struct provisional_quality) { 0 };
+}
+
+void estimate_provisional_quality(struct provisional_quality *pq,
+                                  const SKRY_Image *img,
+                                  size_t img_idx,
+                                  struct SKRY_point img_ofs)
+{
+    assert(SKRY_get_img_pix_fmt(img) == SKRY_PIX_MONO8);
+    assert(img_idx < pq->num_imgs);
+
+    size_t num_areas = (size_t)pq->num_areas_horz * pq->num_areas_vert;
+    SKRY_quality_t *img_area_quality = &pq->area_quality[img_idx * num_areas];
+
+    int img_width = SKRY_get_img_width(img),
+        img_height = SKRY_get_img_height(img);
+    ptrdiff_t line_stride = SKRY_get_line_stride_in_bytes(img);
+    int asize = pq->area_size;
+
+    // If out of memory, 'estimate_quality()' allocates temporary buffers instead
+    reserve_thread_filter_buffers(&pq->filter_buffers);
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < num_areas; i++)
+    {
+        // Area's boundaries in 'img', clipped to its visible part (the rest lies outside the final intersection anyway)
+        int x0 = SKRY_MAX(0, (int)(i % pq->num_areas_horz) * asize + img_ofs.x),
+            y0 = SKRY_MAX(0, (int)(i / pq->num_areas_horz) * asize + img_ofs.y);
+        int x1 = SKRY_MIN(img_width, (int)(i % pq->num_areas_horz + 1) * asize + img_ofs.x),
+            y1 = SKRY_MIN(img_height, (int)(i / pq->num_areas_horz + 1) * asize + img_ofs.y);
+
+        if (x1 <= x0 || y1 <= y0)
+            img_area_quality[i] = 0;
+        else
+            img_area_quality[i] = estimate_quality(
+                (uint8_t *)SKRY_get_line(img, 0) + x0 + line_stride * y0,
+                x1 - x0, y1 - y0, line_stride, pq->box_blur_radius,
+                get_thread_filter_buffers(&pq->filter_buffers));
+    }
+}
+
+/// Fills areas' quality in all images by interpolating the provisional quality estimated during image alignment
+static
+void use_provisional_quality(SKRY_QualityEstimation *qual_est, const struct provisional_quality *pq)
+{
+    size_t num_imgs = SKRY_get_active_img_count(SKRY_get_img_seq(qual_est->img_algn));
+    assert(num_imgs == pq->num_imgs);
+
+    size_t num_prov_areas = (size_t)pq->num_areas_horz * pq->num_areas_vert;
+    struct SKRY_point intrs_ofs = SKRY_get_intersection_ofs(qual_est->img_algn);
+    int psize = pq->area_size;
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < qual_est->num_areas; i++)
+    {
+        // Area's boundaries relative to the first image's origin (i.e. in the provisional grid's coordinates)
+        const struct SKRY_rect *rect = &qual_est->area_defs[i].rect;
+        int x0 = rect->x + intrs_ofs.x,
+            y0 = rect->y + intrs_ofs.y;
+        int x1 = x0 + (int)rect->width,
+            y1 = y0 + (int)rect->height;
+
+        for (size_t img_idx = 0; img_idx < num_imgs; img_idx++)
+        {
+            const SKRY_quality_t *prov_quality = &pq->area_quality[img_idx * num_prov_areas];
+
+            // Average of the overlapped provisional areas' quality, weighted by the overlap
+            double qsum = 0;
+            for (int row = y0 / psize; row <= (y1 - 1) / psize; row++)
+                for (int col = x0 / psize; col <= (x1 - 1) / psize; col++)
+                {
+                    int overlap = (SKRY_MIN(x1, (col + 1) * psize) - SKRY_MAX(x0, col * psize))
+                                * (SKRY_MIN(y1, (row + 1) * psize) - SKRY_MAX(y0, row * psize));
+
+                    qsum += (double)overlap * prov_quality[col + row * pq->num_areas_horz];
+                }
+
+            qual_est->area_quality[img_idx * qual_est->num_areas + i] = qsum / ((x1 - x0) * (y1 - y0));
+        }
+    }
+
+    for (size_t img_idx = 0; img_idx < num_imgs; img_idx++)
+        update_img_quality_summary(qual_est, img_idx);
+
+    qual_est->uses_provisional_quality = 1;
+}
+
+/// Returns position of an estimation area in the current image downsampled 2^'level' times
+static
+struct SKRY_rect get_area_in_curr_img(
+    struct SKRY_rect area, ///< Area within the images' intersection
+    struct SKRY_point ofs, ///< Offset of the intersection in the (not downsampled) current image
+    unsigned level,
+    unsigned img_width, unsigned img_height ///< Size of the downsampled image
+)
+{
+    // Downsampled areas may contain fractions of border pixels; ensure they have at least one pixel
+    unsigned x0 = SKRY_MIN((unsigned)(area.x + ofs.x) >> level, img_width - 1),
+             y0 = SKRY_MIN((unsigned)(area.y + ofs.y) >> level, img_height - 1);
+    unsigned x1 = SKRY_MAX(x0 + 1, SKRY_MIN((unsigned)(area.x + ofs.x + area.width) >> level, img_width)),
+             y1 = SKRY_MAX(y0 + 1, SKRY_MIN((unsigned)(area.y + ofs.y + area.height) >> level, img_height));
+
+    return (struct SKRY_rect) { .x = x0, .y = y0, .width = x1 - x0, .height = y1 - y0 };
+}
+
+static
+enum SKRY_result quality_est_step(SKRY_QualityEstimation *qual_est)
 {
     enum SKRY_result result;
 
@@ -416,60 +590,88 @@ enum SKRY_result SKRY_quality_est_step(SKRY_QualityEstimation *qual_est)
         else if (result != SKRY_SUCCESS)
             return result;
     }
+    else
+    {
+        const struct provisional_quality *pq = get_provisional_quality(qual_est->img_algn);
+        if (pq && pq->area_size == qual_est->area_size
+               && pq->box_blur_radius == qual_est->box_blur_radius
+               && SKRY_QUALITY_METRIC_HIGH_PASS == qual_est->metric
+               && 0 == qual_est->decimation_level)
+        {
+            // Quality has been estimated during image alignment; no need to read all images again
+            use_provisional_quality(qual_est, pq);
+            qual_est->first_step_complete = 1;
+            return on_final_step(qual_est);
+        }
+    }
 
     size_t curr_img_idx = SKRY_get_curr_img_idx_within_active_subset(img_seq);
-    SKRY_Image *curr_img = SKRY_get_curr_img(img_seq, &result);
-    if (result != SKRY_SUCCESS)
-        return result;
-
-    if (SKRY_get_img_pix_fmt(curr_img) != SKRY_PIX_MONO8)
+    unsigned level = qual_est->decimation_level;
+    SKRY_Image *curr_img;
+    if (level > 0)
+    {
+        curr_img = get_curr_img_downsampled(img_seq, level, &result);
+        if (!curr_img)
+            return result;
+    }
+    else
     {
-        SKRY_Image *img_mono8 = SKRY_convert_pix_fmt(curr_img, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE);
-        SKRY_free_image(curr_img);
-        curr_img = img_mono8;
+        curr_img = SKRY_get_curr_img_from_pool(img_seq, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE, &result);
+        if (result != SKRY_SUCCESS)
+            return result;
     }
 
     // Ptr to the row containing qualities of the current image's quality estimation areas
     SKRY_quality_t *curr_img_area_quality = &qual_est->area_quality[curr_img_idx * qual_est->num_areas];
-    SKRY_quality_t curr_img_qual = 0;
 
     struct SKRY_point alignment_ofs = SKRY_get_image_ofs(qual_est->img_algn, curr_img_idx);
     struct SKRY_point intrs_ofs = SKRY_get_intersection_ofs(qual_est->img_algn);
     ptrdiff_t line_stride = SKRY_get_line_stride_in_bytes(curr_img);
 
-    #pragma omp parallel for \
-     reduction(+:curr_img_qual)
-    for (size_t i = 0; i < qual_est->num_areas; i++)
+    if (qual_est->whole_intersection_blur && level == 0 && qual_est->metric == SKRY_QUALITY_METRIC_HIGH_PASS)
     {
-        struct SKRY_rect *area = &qual_est->area_defs[i].rect;
-
-        SKRY_quality_t aqual = estimate_quality(
-            (uint8_t *)SKRY_get_line(curr_img, 0) + area->x + intrs_ofs.x + alignment_ofs.x +
-              line_stride * (area->y + intrs_ofs.y + alignment_ofs.y),
-            area->width, area->height, line_stride, qual_est->box_blur_radius);
-
-        curr_img_qual += aqual;
-        curr_img_area_quality[i] = aqual;
-        if (aqual > qual_est->qual_summary[i].max)
+        unsigned i_width, i_height;
+        SKRY_get_intersection_size(qual_est->img_algn, &i_width, &i_height);
+
+        if (!estimate_grid_quality(
+                (uint8_t *)SKRY_get_line(curr_img, 0) + intrs_ofs.x + alignment_ofs.x +
+                  line_stride * (intrs_ofs.y + alignment_ofs.y),
+                i_width, i_height, line_stride, qual_est->box_blur_radius, qual_est->area_size,
+                &qual_est->filter_buffers, curr_img_area_quality))
         {
-            qual_est->qual_summary[i].max = aqual;
-            qual_est->qual_summary[i].best_img_idx = curr_img_idx;
-        }
-        if (aqual < qual_est->qual_summary[i].min)
-        {
-            qual_est->qual_summary[i].min = aqual;
+            SKRY_release_img_to_pool(img_seq, SKRY_get_curr_img_idx(img_seq), curr_img);
+            return SKRY_OUT_OF_MEMORY;
         }
     }
+    else
+    {
+        struct SKRY_point ofs = { .x = intrs_ofs.x + alignment_ofs.x, .y = intrs_ofs.y + alignment_ofs.y };
+        unsigned box_blur_radius = SKRY_MAX(1U, qual_est->box_blur_radius >> level);
 
-    qual_est->img_quality[curr_img_idx] = curr_img_qual;
+        // If out of memory, 'estimate_quality()' allocates temporary buffers instead
+        reserve_thread_filter_buffers(&qual_est->filter_buffers);
 
-    if (curr_img_qual > qual_est->overall_quality.image.best_quality)
-    {
-        qual_est->overall_quality.image.best_quality = curr_img_qual;
-        qual_est->overall_quality.image.best_img_idx = curr_img_idx;
+        #pragma omp parallel for
+        for (size_t i = 0; i < qual_est->num_areas; i++)
+        {
+            struct SKRY_rect area = get_area_in_curr_img(qual_est->area_defs[i].rect, ofs, level,
+                                                         SKRY_get_img_width(curr_img),
+                                                         SKRY_get_img_height(curr_img));
+
+            uint8_t *area_pixels = (uint8_t *)SKRY_get_line(curr_img, 0) + area.x + line_stride * area.y;
+
+            if (qual_est->metric == SKRY_QUALITY_METRIC_LAPLACIAN_VARIANCE)
+                curr_img_area_quality[i] = get_laplacian_variance(area_pixels, area.width, area.height, line_stride);
+            else
+                curr_img_area_quality[i] = estimate_quality(
+                    area_pixels, area.width, area.height, line_stride, box_blur_radius,
+                    get_thread_filter_buffers(&qual_est->filter_buffers));
+        }
     }
 
-    SKRY_free_image(curr_img);
+    update_img_quality_summary(qual_est, curr_img_idx);
+
+    SKRY_release_img_to_pool(img_seq, SKRY_get_curr_img_idx(img_seq), curr_img);
 
     if (!qual_est->first_step_complete)
         qual_est->first_step_complete = 1;
@@ -477,6 +679,80 @@ enum SKRY_result SKRY_quality_est_step(SKRY_QualityEstimation *qual_est)
     return SKRY_SUCCESS;
 }
 
+/// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
+enum SKRY_result SKRY_quality_est_step(SKRY_QualityEstimation *qual_est)
+{
+    struct perf_step perf_step;
+    begin_perf_step(&perf_step);
+
+    enum SKRY_result result = quality_est_step(qual_est);
+
+    const SKRY_ImgSequence *img_seq = SKRY_get_img_seq(qual_est->img_algn);
+    end_perf_step(&perf_step, &qual_est->perf_stats, "Quality estimation", img_seq,
+                  SKRY_get_curr_img_idx_within_active_subset(img_seq));
+    return result;
+}
+
+static
+enum SKRY_result quality_est_step_func(void *qual_est) { return SKRY_quality_est_step(qual_est); }
+
+enum SKRY_result SKRY_quality_est_run(SKRY_QualityEstimation *qual_est, size_t max_steps,
+                                      SKRY_progress_callback_fn progress_callback, void *callback_data,
+                                      const int *cancel_flag)
+{
+    if (SKRY_is_qual_est_complete(qual_est))
+        return SKRY_LAST_STEP;
+
+    return run_phase_steps(quality_est_step_func, qual_est, SKRY_get_img_seq(qual_est->img_algn), 0, max_steps,
+                           progress_callback, callback_data, cancel_flag);
+}
+
+void SKRY_get_quality_est_perf_stats(const SKRY_QualityEstimation *qual_est, struct SKRY_perf_stats *stats)
+{
+    *stats = qual_est->perf_stats;
+}
+
+enum SKRY_result SKRY_set_quality_est_whole_intersection_blur(SKRY_QualityEstimation *qual_est, int enabled)
+{
+    // Areas' quality values obtained in different modes are not comparable
+    if (qual_est->first_step_complete)
+        return SKRY_INVALID_PARAMETERS;
+
+    qual_est->whole_intersection_blur = enabled;
+    return SKRY_SUCCESS;
+}
+
+enum SKRY_result SKRY_set_quality_est_decimation(SKRY_QualityEstimation *qual_est, unsigned level)
+{
+    if (qual_est->first_step_complete || level > SKRY_QUALITY_EST_MAX_DECIMATION)
+        return SKRY_INVALID_PARAMETERS;
+
+    qual_est->decimation_level = level;
+    return SKRY_SUCCESS;
+}
+
+enum SKRY_result SKRY_set_quality_est_metric(SKRY_QualityEstimation *qual_est, enum SKRY_quality_metric metric)
+{
+    // Areas' quality values obtained with different metrics are not comparable
+    if (qual_est->first_step_complete)
+        return SKRY_INVALID_PARAMETERS;
+
+    switch (metric)
+    {
+    case SKRY_QUALITY_METRIC_HIGH_PASS:
+    case SKRY_QUALITY_METRIC_LAPLACIAN_VARIANCE:
+        qual_est->metric = metric;
+        return SKRY_SUCCESS;
+
+    default: return SKRY_INVALID_PARAMETERS;
+    }
+}
+
+int SKRY_is_qual_est_approximate(const SKRY_QualityEstimation *qual_est)
+{
+    return qual_est->decimation_level > 0 || qual_est->uses_provisional_quality;
+}
+
 size_t SKRY_get_qual_est_num_areas(const SKRY_QualityEstimation *qual_est)
 {
     return qual_est->num_areas;
@@ -781,7 +1057,9 @@ double assess_ref_pt_location(const SKRY_QualityEstimation *qual_est,
                            unsigned structure_scale,
                            /// Min. image brightness that a ref. point can be placed at (values: [0; 1])
                            /** Value is relative to the darkest (0.0) and brightest (1.0) pixels. */
-                           float brightness_threshold
+                           float brightness_threshold,
+                           /// Gradient directions of the best fragments image (see 'get_gradient_dirs()')
+                           const uint16_t grad_dirs[]
 )
 {
     assert(qual_est->is_estimation_complete);
@@ -792,10 +1070,9 @@ double assess_ref_pt_location(const SKRY_QualityEstimation *qual_est,
         return 0.0;
 
     // See the function's header comment for details on this check
-    if (!assess_gradients_for_block_matching(
-             qarea->ref_block,
-             (struct SKRY_point) { .x = pos.x - qarea->ref_block_pos.x,
-                                   .y = pos.y - qarea->ref_block_pos.y },
+    const struct SKRY_rect intersection = SKRY_get_intersection(qual_est->img_algn);
+    if (!assess_gradient_dirs_for_block_matching(
+             grad_dirs, intersection.width, intersection.height, pos,
              32 // This cannot be too small (histogram would be too sparse),
                 // perhaps should depend on 'spacing'
         ))
@@ -825,9 +1102,7 @@ double assess_ref_pt_location(const SKRY_QualityEstimation *qual_est,
 
     SKRY_free_image(ref_block);
 
-    double result = sum_diffs_1 > 0.0 ? (double)sum_diffs_2/sum_diffs_1 : 0.0;
-    LOG_MSG(SKRY_LOG_QUALITY, "Average sum of differences ratio = %.2f", result);
-    return result;
+    return sum_diffs_1 > 0.0 ? (double)sum_diffs_2/sum_diffs_1 : 0.0;
 }
 
 
@@ -866,14 +1141,37 @@ struct SKRY_point *SKRY_suggest_ref_point_positions(
     const int num_grid_cols = intersection.width / grid_step;
     const int num_grid_rows = intersection.height / grid_step;
 
-    DA_DECLARE(struct SKRY_point) result;
-    DA_ALLOC(result, 0);
+    const int search_step = ref_block_size/2;
+
+    // Gradient directions are determined once for the whole intersection
+    // (instead of separately for each location's neighborhood in its area's
+    // reference block); it makes the assessment near the neighborhood's border
+    // differ, so the chosen points are not the same as with per-block assessment
+    uint16_t *grad_dirs = 0;
+    SKRY_Image *best_fragments = SKRY_get_best_fragments_img(qual_est);
+    if (best_fragments)
+    {
+        grad_dirs = get_gradient_dirs(best_fragments);
+        SKRY_free_image(best_fragments);
+    }
+    if (!grad_dirs)
+        return 0;
 
     struct
     {
         int contains_ref_pt;
         struct SKRY_point ref_pt_pos;
+
+        /// Range of assessed locations (relative to the cell's origin)
+        int xstart, xend, ystart, yend;
+
+        size_t fitness_idx; ///< Index of the cell's first location in 'fitness'
     } *grid = malloc(num_grid_cols * num_grid_rows * sizeof(*grid));
+    if (!grid && num_grid_cols * num_grid_rows > 0)
+    {
+        free(grad_dirs);
+        return 0;
+    }
     memset(grid, 0, num_grid_cols * num_grid_rows * sizeof(*grid));
 
 #define CONTAINS_REF_PT(row, col) \
@@ -881,9 +1179,61 @@ struct SKRY_point *SKRY_suggest_ref_point_positions(
 
 #define CELL_IDX(row, col) ((col) + (row)*num_grid_cols)
 
+#define NUM_STEPS(start, end) (((end) > (start)) ? ((end) - (start) + search_step - 1) / search_step : 0)
+
+    size_t num_locations = 0;
     for (int grid_row = 0; grid_row < num_grid_rows; grid_row++)
         for (int grid_col = 0; grid_col < num_grid_cols; grid_col++)
         {
+            int cell = CELL_IDX(grid_row, grid_col);
+
+            // Do not try to place ref. points too close to images' intersection border
+            grid[cell].ystart = (grid_row > 0) ? 0 : ref_block_size/2;
+            grid[cell].yend = (grid_row <= num_grid_rows-2) ? grid_step
+                                                            : intersection.height - (num_grid_rows-1) * grid_step - ref_block_size/2;
+
+            grid[cell].xstart = (grid_col > 0) ? 0 : ref_block_size/2;
+            grid[cell].xend = (grid_col <= num_grid_cols-2) ? grid_step
+                                                            : intersection.width - (num_grid_cols-1) * grid_step - ref_block_size/2;
+
+            grid[cell].fitness_idx = num_locations;
+            num_locations += NUM_STEPS(grid[cell].ystart, grid[cell].yend) * NUM_STEPS(grid[cell].xstart, grid[cell].xend);
+        }
+
+    double *fitness = malloc(num_locations * sizeof(*fitness));
+    if (!fitness && num_locations > 0)
+    {
+        free(grid);
+        free(grad_dirs);
+        return 0;
+    }
+
+    // Assess all locations first; they do not depend on each other
+    #pragma omp parallel for schedule(dynamic)
+    for (int cell = 0; cell < num_grid_cols * num_grid_rows; cell++)
+    {
+        size_t loc_idx = grid[cell].fitness_idx;
+        for (int y = grid[cell].ystart; y < grid[cell].yend; y += search_step)
+            for (int x = grid[cell].xstart; x < grid[cell].xend; x += search_step)
+            {
+                const struct SKRY_point pos = { (cell % num_grid_cols) * grid_step + x,
+                                                (cell / num_grid_cols) * grid_step + y };
+
+                fitness[loc_idx++] = assess_ref_pt_location(qual_est, pos, ref_block_size, structure_scale,
+                                                            brightness_threshold, grad_dirs);
+            }
+    }
+
+    free(grad_dirs);
+
+    DA_DECLARE(struct SKRY_point) result;
+    DA_ALLOC(result, 0);
+
+    for (int grid_row = 0; grid_row < num_grid_rows; grid_row++)
+        for (int grid_col = 0; grid_col < num_grid_cols; grid_col++)
+        {
+            int cell = CELL_IDX(grid_row, grid_col);
+
             size_t num_neighb_points = 0;
             const struct SKRY_point *neighbor_cell_points[8];
 
@@ -894,26 +1244,17 @@ struct SKRY_point *SKRY_suggest_ref_point_positions(
                         if (CONTAINS_REF_PT(grid_row + d_row, grid_col + d_col))
                             neighbor_cell_points[num_neighb_points++] = &grid[CELL_IDX(grid_row + d_row, grid_col + d_col)].ref_pt_pos;
 
-
-            const int search_step = ref_block_size/2;
             double best_fitness = 0;
             struct SKRY_point best_pos;
 
-            // Do not try to place ref. points too close to images' intersection border
-            int ystart = (grid_row > 0) ? 0 : ref_block_size/2;
-            int yend = (grid_row <= num_grid_rows-2) ? grid_step
-                                                     : intersection.height - (num_grid_rows-1) * grid_step - ref_block_size/2;
-
-            int xstart = (grid_col > 0) ? 0 : ref_block_size/2;
-            int xend = (grid_col <= num_grid_cols-2) ? grid_step
-                                                     : intersection.width - (num_grid_cols-1) * grid_step - ref_block_size/2;
-
-            for (int y = ystart; y < yend; y += search_step)
-                for (int x = xstart; x < xend; x += search_step)
+            size_t loc_idx = grid[cell].fitness_idx;
+            for (int y = grid[cell].ystart; y < grid[cell].yend; y += search_step)
+                for (int x = grid[cell].xstart; x < grid[cell].xend; x += search_step)
                 {
                     const struct SKRY_point curr_pos = { grid_col * grid_step + x, grid_row * grid_step + y };
+                    const double curr_fitness = fitness[loc_idx++];
 
-                    // Do not assess a location if there are already reference points
+                    // Do not use a location if there are already reference points
                     // in neighboring grid cells closer than 'spacing'
                     int too_close_to_neighbor = 0;
                     for (size_t i = 0; i < num_neighb_points; i++)
@@ -926,32 +1267,107 @@ struct SKRY_point *SKRY_suggest_ref_point_positions(
                         }
                     }
 
-                    if (!too_close_to_neighbor)
+                    if (!too_close_to_neighbor && curr_fitness > best_fitness)
                     {
-                        double fitness = assess_ref_pt_location(qual_est, curr_pos, ref_block_size, structure_scale, brightness_threshold);
-                        if (fitness > best_fitness)
-                        {
-                            best_fitness = fitness;
-                            best_pos = curr_pos;
-                        }
+                        best_fitness = curr_fitness;
+                        best_pos = curr_pos;
                     }
                 }
 
             if (best_fitness >= structure_threshold)
             {
-                grid[CELL_IDX(grid_row, grid_col)].contains_ref_pt = 1;
-                grid[CELL_IDX(grid_row, grid_col)].ref_pt_pos = best_pos;
+                grid[cell].contains_ref_pt = 1;
+                grid[cell].ref_pt_pos = best_pos;
                 DA_APPEND(result, best_pos);
             }
         }
 
+    LOG_MSG(SKRY_LOG_QUALITY, "Assessed %zu ref. point locations, placed %zu ref. points",
+            num_locations, DA_SIZE(result));
 
-
+#undef NUM_STEPS
+#undef CELL_IDX
 #undef CONTAINS_REF_PT
 
+    free(fitness);
     free(grid);
     *num_points = DA_SIZE(result);
 
     // The caller will eventually call free() on it
     return result.data;
 }
+
+void write_quality_checkpoint(struct checkpoint_file *ckpt, const SKRY_QualityEstimation *qual_est)
+{
+    ckpt_write_u32(ckpt, qual_est->area_size);
+    ckpt_write_u32(ckpt, qual_est->box_blur_radius);
+    ckpt_write_u32(ckpt, qual_est->metric);
+    ckpt_write_u32(ckpt, qual_est->decimation_level);
+    ckpt_write_u8(ckpt, 0 != qual_est->whole_intersection_blur);
+    ckpt_write_u8(ckpt, 0 != qual_est->uses_provisional_quality);
+    ckpt_write_u32(ckpt, qual_est->num_areas);
+
+    size_t num_active_imgs = SKRY_get_active_img_count(SKRY_get_img_seq(qual_est->img_algn));
+    for (size_t i = 0; i < num_active_imgs * qual_est->num_areas; i++)
+        ckpt_write_flt(ckpt, qual_est->area_quality[i]);
+}
+
+/** The areas' reference blocks are not stored; they are recreated by reading the images
+    where the areas have the best quality. */
+SKRY_QualityEstimation *read_quality_checkpoint(struct checkpoint_file *ckpt, const SKRY_ImgAlignment *img_algn)
+{
+    unsigned area_size = ckpt_read_u32(ckpt);
+    unsigned box_blur_radius = ckpt_read_u32(ckpt);
+    enum SKRY_quality_metric metric = ckpt_read_u32(ckpt);
+    unsigned decimation_level = ckpt_read_u32(ckpt);
+    int whole_intersection_blur = ckpt_read_u8(ckpt);
+    int uses_provisional_quality = ckpt_read_u8(ckpt);
+    size_t num_areas = ckpt_read_u32(ckpt);
+
+    if (SKRY_SUCCESS == ckpt->result
+        && (0 == area_size || 0 == box_blur_radius
+            || metric > SKRY_QUALITY_METRIC_LAPLACIAN_VARIANCE
+            || decimation_level > SKRY_QUALITY_EST_MAX_DECIMATION))
+    {
+        ckpt_set_error(ckpt, SKRY_UNSUPPORTED_FILE_FORMAT);
+    }
+    if (SKRY_SUCCESS != ckpt->result)
+        return 0;
+
+    SKRY_QualityEstimation *qual_est = SKRY_init_quality_est(img_algn, area_size, box_blur_radius);
+    if (!qual_est)
+    {
+        ckpt_set_error(ckpt, SKRY_OUT_OF_MEMORY);
+        return 0;
+    }
+    if (qual_est->num_areas != num_areas)
+    {
+        ckpt_set_error(ckpt, SKRY_UNSUPPORTED_FILE_FORMAT);
+        return SKRY_free_quality_est(qual_est);
+    }
+
+    qual_est->metric = metric;
+    qual_est->decimation_level = decimation_level;
+    qual_est->whole_intersection_blur = whole_intersection_blur;
+    qual_est->uses_provisional_quality = uses_provisional_quality;
+
+    size_t num_active_imgs = SKRY_get_active_img_count(SKRY_get_img_seq(img_algn));
+    for (size_t i = 0; i < num_active_imgs * qual_est->num_areas; i++)
+        qual_est->area_quality[i] = ckpt_read_flt(ckpt);
+
+    if (SKRY_SUCCESS != ckpt->result)
+        return SKRY_free_quality_est(qual_est);
+
+    for (size_t img_idx = 0; img_idx < num_active_imgs; img_idx++)
+        update_img_quality_summary(qual_est, img_idx);
+
+    qual_est->first_step_complete = 1;
+    enum SKRY_result result = on_final_step(qual_est);
+    if (SKRY_LAST_STEP != result)
+    {
+        ckpt_set_error(ckpt, result);
+        return SKRY_free_quality_est(qual_est);
+    }
+
+    return qual_est;
+}
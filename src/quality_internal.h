@@ -21,6 +21,18 @@ File description:
     Quality estimation non-public header.
 */
 
+#ifndef LIB_STACKISTRY_QUALITY_INTERNAL_HEADER
+#define LIB_STACKISTRY_QUALITY_INTERNAL_HEADER
+
+#include <stddef.h>
+
+#include <skry/defs.h>
+#include <skry/image.h>
+#include <skry/img_align.h>
+#include <skry/quality.h>
+
+#include "utils/filters.h"
+
 
 /// Returns a square image to be used as reference block; returns null if out of memory
 SKRY_Image *SKRY_create_reference_block(
@@ -29,3 +41,41 @@ SKRY_Image *SKRY_create_reference_block(
     struct SKRY_point pos,
     /// Desired width & height; the result may be smaller than this (but always a square)
     unsigned blk_size);
+
+/// Quality of a provisional grid of areas, estimated during image alignment
+/** The grid is fixed relative to the first image's origin (the final images' intersection
+    is not known yet); SKRY_quality_est_step() remaps it onto the actual estimation areas.
+    Initialize with all fields zeroed. See SKRY_set_img_align_quality_est(). */
+struct provisional_quality
+{
+    unsigned area_size; ///< If 0, provisional quality is not estimated
+    unsigned box_blur_radius;
+
+    unsigned num_areas_horz, num_areas_vert; ///< Grid covers the whole first image
+    size_t num_imgs;
+
+    /// Element [img_idx * num_areas_horz * num_areas_vert + area_idx] is the quality of area 'area_idx' in image 'img_idx'
+    SKRY_quality_t *area_quality;
+
+    struct thread_filter_buffers filter_buffers;
+};
+
+/// Allocates the grid for images of the specified size; returns SKRY_SUCCESS or SKRY_OUT_OF_MEMORY
+/** 'pq->area_size' and 'pq->box_blur_radius' have to be set. */
+enum SKRY_result alloc_provisional_quality(struct provisional_quality *pq,
+                                           unsigned first_img_width, unsigned first_img_height,
+                                           size_t num_imgs);
+
+void free_provisional_quality(struct provisional_quality *pq);
+
+/// Estimates quality of the grid's areas in 'img' (SKRY_PIX_MONO8)
+void estimate_provisional_quality(struct provisional_quality *pq,
+                                  const SKRY_Image *img,
+                                  size_t img_idx, ///< Index within the active images
+                                  struct SKRY_point img_ofs ///< Offset of 'img' relative to the first image
+);
+
+/// Returns null if provisional quality has not been estimated during alignment
+const struct provisional_quality *get_provisional_quality(const SKRY_ImgAlignment *img_algn);
+
+#endif // LIB_STACKISTRY_QUALITY_INTERNAL_HEADER
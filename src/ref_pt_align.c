@@ -36,34 +36,59 @@ File description:
 #include <skry/skry.h>
 #include <skry/triangulation.h>
 
+#include "checkpoint_internal.h"
 #include "quality_internal.h"
+#include "imgseq/derived_img.h"
+#include "utils/accel.h"
 #include "utils/dnarray.h"
 #include "utils/logging.h"
 #include "utils/match.h"
 #include "utils/misc.h"
+#include "utils/perf.h"
 
 
 // Values in pixels
 #define BLOCK_MATCHING_INITIAL_SEARCH_STEP 2
+#define ADAPTIVE_SEARCH_MIN_RADIUS 4
 
-enum { NOT_UPDATED = 0, UPDATED = 1};
+/// Adaptive search radius, as a multiple of the mean length of recent translation vectors
+#define ADAPTIVE_SEARCH_RADIUS_FACTOR 3
+
+/// Min. number of recent translation vectors needed to use the adaptive search radius
+#define ADAPTIVE_SEARCH_MIN_TVECS 50
 
 struct reference_point
 {
     size_t qual_est_area;  ///< Index of the associated quality estimation area; may be SKRY_EMPTY
     SKRY_Image *ref_block; ///< Reference block used for block matching
+    /// Downsampled 'ref_block' for pyramid matching (see SKRY_enable_pyramid_matching())
+    struct image_pyramid ref_block_pyramid;
 
-    struct
-    {
-        struct SKRY_point pos;
-        int is_valid; ///< True if the quality criteria for the image are met
-    } *positions; ///< Array of positions in every active image
+    /// Position in the first image; positions in all images are stored in 'SKRY_ref_pt_alignment::displacements'
+    struct SKRY_point initial_pos;
+
+    int is_fixed; ///< True if the point is not aligned (its position is always the same and valid)
 
     size_t last_valid_pos_idx; ///< Initially equals SKRY_EMPTY
     struct
     {
         double sq_len, len;
     } last_transl_vec;
+
+    /// Block matching state in the current step
+    struct
+    {
+        int is_needed; ///< True if the point's triangle meets the quality criteria
+        int is_first_update;
+        struct SKRY_point predicted_pos_in_img;
+        struct SKRY_point new_pos_in_img; ///< Best matching position found
+        int has_new_transl_vec; ///< True if 'last_transl_vec' has been updated in the current step
+    } match;
+
+    /// Index of the first triangle containing the point; may be SKRY_EMPTY
+    /** The point is updated according to this triangle's quality criterion
+        (where triangles share a point, the first one has precedence). */
+    size_t owner_tri;
 };
 
 /// Sum of reference points translation vector lengths in an image
@@ -88,6 +113,21 @@ struct SKRY_ref_pt_alignment
 
     DA_DECLARE(struct reference_point) reference_pts;
 
+    /** Positions of all reference points in every active image, stored image by image
+        (element [img_idx * number of points + point_idx]), as displacements from the points'
+        initial positions. Allocated once all points have been added (see 'alloc_ref_pt_positions()'). */
+    struct ref_pt_displacement
+    {
+        int16_t dx, dy;
+    } *displacements;
+
+    size_t valid_words_per_img; ///< Number of elements of 'valid_flags' per image
+
+    /** Bit (point_idx % 64) of element [img_idx * valid_words_per_img + point_idx / 64]
+        is set if the point's position in the image is valid (i.e. the quality criteria
+        for the image are met). */
+    uint64_t *valid_flags;
+
     /// Delaunay triangulation of the reference points
     struct SKRY_triangulation *triangulation;
 
@@ -98,8 +138,12 @@ struct SKRY_ref_pt_alignment
     /// Search radius used during block matching
     unsigned search_radius;
 
-    /// Array of boolean flags indicating if a ref. point has been updated during the current step
-    uint8_t *update_flags;
+    /// If true, 'search_radius' is used only if a search with a smaller radius fails
+    /** See SKRY_set_ref_pt_adaptive_search(). */
+    int adaptive_search;
+
+    /// Array of boolean flags indicating if a triangle meets the quality criteria in the current step
+    uint8_t *tri_quality_sufficient;
 
     struct triangle_quality
     {
@@ -126,14 +170,89 @@ struct SKRY_ref_pt_alignment
     {
         uint64_t num_valid_positions;
         uint64_t num_rejected_positions;
+        uint64_t num_adaptive_searches; ///< Searches performed with a reduced radius
+        uint64_t num_adaptive_fallbacks; ///< Searches repeated with the full radius
         struct
         {
             double start; ///< Stored at the beginning of SKRY_init_ref_pt_alignment()
             double total_sec; ///< Difference between end of the last step and 'start'
         } time;
     } statistics;
+
+    struct SKRY_perf_stats perf_stats; ///< Counters of all steps (see SKRY_get_ref_pt_perf_stats())
 };
 
+static inline
+struct SKRY_point get_ref_pt_position(const SKRY_RefPtAlignment *ref_pt_align, size_t point_idx, size_t img_idx)
+{
+    struct SKRY_point initial_pos = ref_pt_align->reference_pts.data[point_idx].initial_pos;
+    const struct ref_pt_displacement *d = &ref_pt_align->displacements[img_idx * DA_SIZE(ref_pt_align->reference_pts) + point_idx];
+    return (struct SKRY_point) { .x = initial_pos.x + d->dx, .y = initial_pos.y + d->dy };
+}
+
+/// Can be called concurrently for different points
+static inline
+void set_ref_pt_position(SKRY_RefPtAlignment *ref_pt_align, size_t point_idx, size_t img_idx, struct SKRY_point pos)
+{
+    struct SKRY_point initial_pos = ref_pt_align->reference_pts.data[point_idx].initial_pos;
+
+    // Points move by at most the search radius between images, so the displacement
+    // is bounded by the images' size
+    assert(abs(pos.x - initial_pos.x) <= INT16_MAX && abs(pos.y - initial_pos.y) <= INT16_MAX);
+
+    struct ref_pt_displacement *d = &ref_pt_align->displacements[img_idx * DA_SIZE(ref_pt_align->reference_pts) + point_idx];
+    d->dx = pos.x - initial_pos.x;
+    d->dy = pos.y - initial_pos.y;
+}
+
+static inline
+int is_ref_pt_pos_valid(const SKRY_RefPtAlignment *ref_pt_align, size_t point_idx, size_t img_idx)
+{
+    return (ref_pt_align->valid_flags[img_idx * ref_pt_align->valid_words_per_img + point_idx / 64] >> (point_idx % 64)) & 1;
+}
+
+/// Can be called concurrently for different points
+static inline
+void set_ref_pt_pos_valid(SKRY_RefPtAlignment *ref_pt_align, size_t point_idx, size_t img_idx, int is_valid)
+{
+    uint64_t *flags = &ref_pt_align->valid_flags[img_idx * ref_pt_align->valid_words_per_img + point_idx / 64];
+    uint64_t mask = (uint64_t)1 << (point_idx % 64);
+
+    // Neighboring points share the flags' element
+    if (is_valid)
+    {
+        #pragma omp atomic
+        *flags |= mask;
+    }
+    else
+    {
+        #pragma omp atomic
+        *flags &= ~mask;
+    }
+}
+
+/// Allocates storage of positions of all reference points in every image; returns 0 if out of memory
+/** Has to be called once all points have been added. Fixed points are marked valid
+    in all images. */
+static
+int alloc_ref_pt_positions(SKRY_RefPtAlignment *ref_pt_align, size_t num_active_imgs)
+{
+    size_t num_points = DA_SIZE(ref_pt_align->reference_pts);
+
+    ref_pt_align->displacements = calloc(num_active_imgs * num_points, sizeof(*ref_pt_align->displacements));
+    ref_pt_align->valid_words_per_img = (num_points + 63) / 64;
+    ref_pt_align->valid_flags = calloc(num_active_imgs * ref_pt_align->valid_words_per_img, sizeof(*ref_pt_align->valid_flags));
+    if (!ref_pt_align->displacements || !ref_pt_align->valid_flags)
+        return 0;
+
+    for (size_t i = 0; i < num_points; i++)
+        if (ref_pt_align->reference_pts.data[i].is_fixed)
+            for (size_t img_idx = 0; img_idx < num_active_imgs; img_idx++)
+                set_ref_pt_pos_valid(ref_pt_align, i, img_idx, 1);
+
+    return 1;
+}
+
 /** Makes sure that for every triangle there is at least 1 image
     where all 3 vertices are "valid". */
 static
@@ -145,10 +264,11 @@ void ensure_tris_are_valid(SKRY_RefPtAlignment *ref_pt_align)
 
     for (size_t tri_idx = 0; tri_idx < SKRY_get_num_triangles(ref_pt_align->triangulation); tri_idx++)
     {
+        const size_t vertices[3] = { triangles[tri_idx].v0, triangles[tri_idx].v1, triangles[tri_idx].v2 };
         struct reference_point *refp[3] =
-            { &ref_pt_align->reference_pts.data[triangles[tri_idx].v0],
-              &ref_pt_align->reference_pts.data[triangles[tri_idx].v1],
-              &ref_pt_align->reference_pts.data[triangles[tri_idx].v2] };
+            { &ref_pt_align->reference_pts.data[vertices[0]],
+              &ref_pt_align->reference_pts.data[vertices[1]],
+              &ref_pt_align->reference_pts.data[vertices[2]] };
 
         // Best quality and associated img index where the triangle's vertices are not all "valid"
         SKRY_quality_t best_tri_qual = 0;
@@ -156,9 +276,9 @@ void ensure_tris_are_valid(SKRY_RefPtAlignment *ref_pt_align)
 
         for (unsigned img_idx = 0; img_idx < num_active_imgs; img_idx++)
         {
-            if (refp[0]->positions[img_idx].is_valid &&
-                refp[1]->positions[img_idx].is_valid &&
-                refp[2]->positions[img_idx].is_valid)
+            if (is_ref_pt_pos_valid(ref_pt_align, vertices[0], img_idx) &&
+                is_ref_pt_pos_valid(ref_pt_align, vertices[1], img_idx) &&
+                is_ref_pt_pos_valid(ref_pt_align, vertices[2], img_idx))
             {
                 best_tri_qual_img_idx = SKRY_EMPTY;
                 break;
@@ -185,7 +305,7 @@ void ensure_tris_are_valid(SKRY_RefPtAlignment *ref_pt_align)
             //
             // Mark them "valid" anyway in the image where their quality sum is highest.
             for (int i = 0; i < 3; i++)
-                refp[i]->positions[best_tri_qual_img_idx].is_valid = 1;
+                set_ref_pt_pos_valid(ref_pt_align, vertices[i], best_tri_qual_img_idx, 1);
 
             LOG_MSG(SKRY_LOG_REF_PT_ALIGNMENT,
                 "Triangle %zu not valid in any image, forcing to valid in image %zu.",
@@ -274,10 +394,123 @@ void *calc_triangle_quality(SKRY_RefPtAlignment *ref_pt_align)
     return ref_pt_align; // non-null result is not used by caller
 }
 
+/// Returns the reduced search radius to use in the current step, or 0 if the full radius has to be used
+static
+unsigned get_adaptive_search_radius(const SKRY_RefPtAlignment *ref_pt_align)
+{
+    if (!ref_pt_align->adaptive_search)
+        return 0;
+
+    // Only the mean length is used: the squared lengths of translations
+    // rejected as outliers remain in 'sum_sq_len', inflating the std. deviation
+    size_t num_terms = 0;
+    double sum_len   = 0;
+    for (size_t i = 0; i < TVEC_SUM_NUM_IMAGES; i++)
+    {
+        num_terms += ref_pt_align->t_vectors.tvec_img_sum[i].num_terms;
+        sum_len   += ref_pt_align->t_vectors.tvec_img_sum[i].sum_len;
+    }
+
+    if (num_terms < ADAPTIVE_SEARCH_MIN_TVECS)
+        return 0;
+
+    unsigned radius = SKRY_MAX((unsigned)ceil(ADAPTIVE_SEARCH_RADIUS_FACTOR * sum_len / num_terms),
+                               ADAPTIVE_SEARCH_MIN_RADIUS);
+
+    return (radius < ref_pt_align->search_radius) ? radius : 0;
+}
+
+static
+unsigned get_num_matching_pyramid_levels(const SKRY_RefPtAlignment *ref_pt_align)
+{
+    return get_num_pyramid_levels_for_matching(ref_pt_align->ref_block_size,
+                                               ref_pt_align->ref_block_size,
+                                               ref_pt_align->search_radius);
+}
+
+/// Fills 'match.new_pos_in_img' of all points that need matching; returns SKRY_SUCCESS or an error code
+/** As in the CPU path, if 'adaptive_radius' is not zero, the points are first matched within it,
+    and those whose best match lies at its edge are matched again within the full search radius. */
+static
+enum SKRY_result match_ref_pts_using_accel(SKRY_RefPtAlignment *ref_pt_align, const SKRY_Image *img,
+                                           unsigned adaptive_radius,
+                                           uint64_t *num_adaptive_searches, uint64_t *num_adaptive_fallbacks)
+{
+    size_t num_pts = DA_SIZE(ref_pt_align->reference_pts);
+    struct accel_match_block *blocks = malloc(num_pts * sizeof(*blocks));
+    struct SKRY_point *new_pos = malloc(num_pts * sizeof(*new_pos));
+    size_t *pt_indices = malloc(num_pts * sizeof(*pt_indices)); // Element [i] = point matched with 'blocks[i]'
+    if (!blocks || !new_pos || !pt_indices)
+    {
+        free(blocks);
+        free(new_pos);
+        free(pt_indices);
+        return SKRY_OUT_OF_MEMORY;
+    }
+
+    size_t num_blocks = 0;
+    for (size_t i = 0; i < num_pts; i++)
+    {
+        const struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[i];
+        if (ref_pt->match.is_needed)
+        {
+            pt_indices[num_blocks] = i;
+            blocks[num_blocks++] = (struct accel_match_block) { .ref_pos = ref_pt->match.predicted_pos_in_img,
+                                                                .ref_block = ref_pt->ref_block };
+        }
+    }
+
+    enum SKRY_result result = SKRY_SUCCESS;
+    size_t num_searches = 0, num_fallbacks = 0;
+    if (adaptive_radius)
+    {
+        result = accel_find_matching_positions(img, num_blocks, blocks, adaptive_radius, new_pos);
+
+        // Keep only the blocks which have to be matched again within the full search radius
+        size_t num_full_search = 0;
+        for (size_t b = 0; b < num_blocks && SKRY_SUCCESS == result; b++)
+        {
+            if (abs(new_pos[b].x - blocks[b].ref_pos.x) >= (int)adaptive_radius - 1
+                || abs(new_pos[b].y - blocks[b].ref_pos.y) >= (int)adaptive_radius - 1)
+            {
+                blocks[num_full_search] = blocks[b];
+                pt_indices[num_full_search] = pt_indices[b];
+                num_full_search++;
+            }
+            else
+                ref_pt_align->reference_pts.data[pt_indices[b]].match.new_pos_in_img = new_pos[b];
+        }
+
+        num_searches = num_blocks;
+        num_fallbacks = num_full_search;
+        num_blocks = num_full_search;
+    }
+
+    if (SKRY_SUCCESS == result)
+        result = accel_find_matching_positions(img, num_blocks, blocks, ref_pt_align->search_radius, new_pos);
+
+    // On failure, all points are matched again by the CPU
+    if (SKRY_SUCCESS == result)
+    {
+        for (size_t b = 0; b < num_blocks; b++)
+            ref_pt_align->reference_pts.data[pt_indices[b]].match.new_pos_in_img = new_pos[b];
+
+        *num_adaptive_searches += num_searches;
+        *num_adaptive_fallbacks += num_fallbacks;
+    }
+
+    free(blocks);
+    free(new_pos);
+    free(pt_indices);
+    return result;
+}
+
 static
 void update_ref_pt_positions(
     SKRY_RefPtAlignment *ref_pt_align,
     const SKRY_Image *img, size_t img_idx,
+    /// Downsampled versions of 'img' shared by all reference points; may be null
+    const struct image_pyramid *pyramid,
     size_t num_active_imgs,
     enum SKRY_quality_criterion quality_criterion,
     unsigned quality_threshold,
@@ -289,14 +522,12 @@ void update_ref_pt_positions(
                to the current image 'img' have to take it into account and use 'intersection'
                and 'img_alignment_ofs' to apply proper offsets. */
 
-    memset(ref_pt_align->update_flags, NOT_UPDATED, DA_SIZE(ref_pt_align->reference_pts) * sizeof(*ref_pt_align->update_flags));
-
-    struct tvec_sum curr_step_tvec = { 0 };
+    unsigned adaptive_radius = get_adaptive_search_radius(ref_pt_align);
 
     #pragma omp parallel for
     for (size_t tri_idx = 0; tri_idx < SKRY_get_num_triangles(ref_pt_align->triangulation); tri_idx++)
     {
-        // Update positions of reference points belonging to triangle [i] iff the sum
+        // Positions of reference points belonging to triangle [i] are updated iff the sum
         // of their quality est. areas is at least the specified threshold
         // (relative to the min and max sum).
 
@@ -304,18 +535,13 @@ void update_ref_pt_positions(
 
         SKRY_quality_t qsum = 0;
 
-        struct
-        {
-            size_t p_idx;
-            struct reference_point *ref_pt;
-        } tri_pts[3] =
-            { { .p_idx = tri->v0, .ref_pt = &ref_pt_align->reference_pts.data[tri->v0] },
-              { .p_idx = tri->v1, .ref_pt = &ref_pt_align->reference_pts.data[tri->v1] },
-              { .p_idx = tri->v2, .ref_pt = &ref_pt_align->reference_pts.data[tri->v2] } };
+        const struct reference_point *tri_pts[3] = { &ref_pt_align->reference_pts.data[tri->v0],
+                                                     &ref_pt_align->reference_pts.data[tri->v1],
+                                                     &ref_pt_align->reference_pts.data[tri->v2] };
 
         for (int i = 0; i < 3; i++)
-            if (tri_pts[i].ref_pt->qual_est_area != SKRY_EMPTY)
-                qsum += SKRY_get_area_quality(ref_pt_align->qual_est, tri_pts[i].ref_pt->qual_est_area, img_idx);
+            if (tri_pts[i]->qual_est_area != SKRY_EMPTY)
+                qsum += SKRY_get_area_quality(ref_pt_align->qual_est, tri_pts[i]->qual_est_area, img_idx);
 
         const struct triangle_quality *tri_q = &ref_pt_align->tri_quality[tri_idx];
 
@@ -336,89 +562,170 @@ void update_ref_pt_positions(
                 break;
         }
 
-        for (int i = 0; i < 3; i++)
-        {
-            struct reference_point *ref_pt = tri_pts[i].ref_pt;
-            if (SKRY_EMPTY == ref_pt->qual_est_area || UPDATED == ref_pt_align->update_flags[tri_pts[i].p_idx])
-                continue;
+        ref_pt_align->tri_quality_sufficient[tri_idx] = is_quality_sufficient;
+    }
+
+    // Each point is matched exactly once, according to the quality of its owning triangle (see 'owner_tri')
+
+    #pragma omp parallel for
+    for (size_t p_idx = 0; p_idx < DA_SIZE(ref_pt_align->reference_pts); p_idx++)
+    {
+        struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[p_idx];
 
-            int found_new_valid_pos = 0;
+        ref_pt->match.is_needed = SKRY_EMPTY != ref_pt->qual_est_area
+                                  && SKRY_EMPTY != ref_pt->owner_tri
+                                  && ref_pt_align->tri_quality_sufficient[ref_pt->owner_tri];
+        if (!ref_pt->match.is_needed)
+            continue;
 
-            if (is_quality_sufficient)
+        ref_pt->match.is_first_update = 0;
+
+        if (0 == ref_pt->ref_block)
+        {
+            // This is the first time this point meets the quality criteria.
+            // Initialize its reference block.
+            if (img_idx > 0)
             {
-                int is_first_update = 0;
+                // Point's position in the current image has not been filled in yet, do it now
+                set_ref_pt_position(ref_pt_align, p_idx, img_idx, get_ref_pt_position(ref_pt_align, p_idx, img_idx-1));
+            }
 
-                if (0 == ref_pt->ref_block)
-                {
-                    // This is the first time this point meets the quality criteria.
-                    // Initialize its reference block.
-                    if (img_idx > 0)
-                    {
-                        // Point's position in the current image has not been filled in yet, do it now
-                        ref_pt->positions[img_idx].pos = ref_pt->positions[img_idx-1].pos;
-                    }
+            ref_pt->ref_block = SKRY_create_reference_block(ref_pt_align->qual_est,
+                                                            get_ref_pt_position(ref_pt_align, p_idx, img_idx),
+                                                            ref_pt_align->ref_block_size);
 
-                    ref_pt->ref_block = SKRY_create_reference_block(ref_pt_align->qual_est,
-                                                                    ref_pt->positions[img_idx].pos,
-                                                                    ref_pt_align->ref_block_size);
+            // The block does not change, so its downsampled versions are created only once;
+            // if out of memory, the point is matched at full resolution
+            if (g_pyramid_matching_enabled && ref_pt->ref_block)
+                create_image_pyramid(ref_pt->ref_block, get_num_matching_pyramid_levels(ref_pt_align),
+                                     &ref_pt->ref_block_pyramid);
 
+            ref_pt->match.is_first_update = 1;
+        }
 
-                    is_first_update = 1;
-                }
+        struct SKRY_point current_ref_pos = get_ref_pt_position(ref_pt_align, p_idx, (0 == img_idx) ? 0 : (img_idx-1));
 
-                struct SKRY_point new_pos_in_img;
-                struct SKRY_point current_ref_pos;
-                current_ref_pos = ref_pt->positions[(0 == img_idx) ? 0 : (img_idx-1)].pos;
-
-                find_matching_position(
-                    (struct SKRY_point) { .x = current_ref_pos.x + intersection.x + img_alignment_ofs.x,
-                                          .y = current_ref_pos.y + intersection.y + img_alignment_ofs.y },
-                    ref_pt->ref_block, img,
-                    ref_pt_align->search_radius,
-                    BLOCK_MATCHING_INITIAL_SEARCH_STEP, &new_pos_in_img);
-
-                struct SKRY_point new_pos = { .x = new_pos_in_img.x - intersection.x - img_alignment_ofs.x,
-                                              .y = new_pos_in_img.y - intersection.y - img_alignment_ofs.y };
-
-                // Additional rejection criterion: ignore the first position update if the new pos. is too distant.
-                // Otherwise the point would be moved too far at the very start of the ref. point alignment
-                // phase and might not recover, i.e. its subsequent position updates might be getting rejected
-                // by the additional check after the current outermost 'for' loop.
-                if (!is_first_update
-                    || SKRY_SQR(new_pos.x - current_ref_pos.x) + SKRY_SQR(new_pos.y - current_ref_pos.y) <= SKRY_SQR((int)ref_pt_align->ref_block_size/3 /*TODO: make it adaptive somehow? or use the current avg. deviation*/))
-                {
-                    ref_pt->positions[img_idx].pos =
-                        (struct SKRY_point) { .x = new_pos_in_img.x - intersection.x - img_alignment_ofs.x,
-                                              .y = new_pos_in_img.y - intersection.y - img_alignment_ofs.y };
+        // Global motion has been already compensated by image alignment, so the point
+        // is expected to remain near its previous position
+        ref_pt->match.predicted_pos_in_img =
+            (struct SKRY_point) { .x = current_ref_pos.x + intersection.x + img_alignment_ofs.x,
+                                  .y = current_ref_pos.y + intersection.y + img_alignment_ofs.y };
+    }
 
-                    ref_pt->positions[img_idx].is_valid = 1;
+    uint64_t num_adaptive_searches = 0, num_adaptive_fallbacks = 0;
 
-                    if (ref_pt->last_valid_pos_idx != SKRY_EMPTY)
-                    {
-                        ref_pt->last_transl_vec.sq_len = SKRY_SQR(ref_pt->positions[img_idx].pos.x - ref_pt->positions[ref_pt->last_valid_pos_idx].pos.x) +
-                                                         SKRY_SQR(ref_pt->positions[img_idx].pos.y - ref_pt->positions[ref_pt->last_valid_pos_idx].pos.y);
-                        ref_pt->last_transl_vec.len = sqrt(ref_pt->last_transl_vec.sq_len);
+    int are_points_matched = is_accel_matching_enabled()
+                             && SKRY_SUCCESS == match_ref_pts_using_accel(ref_pt_align, img, adaptive_radius,
+                                                                          &num_adaptive_searches,
+                                                                          &num_adaptive_fallbacks);
 
-                        curr_step_tvec.sum_len    += ref_pt->last_transl_vec.len;
-                        curr_step_tvec.sum_sq_len += ref_pt->last_transl_vec.sq_len;
-                        curr_step_tvec.num_terms++;
-                    }
+    if (!are_points_matched)
+    {
+        #pragma omp parallel for schedule(dynamic) reduction(+:num_adaptive_searches, num_adaptive_fallbacks)
+        for (size_t p_idx = 0; p_idx < DA_SIZE(ref_pt_align->reference_pts); p_idx++)
+        {
+            struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[p_idx];
+            if (!ref_pt->match.is_needed)
+                continue;
 
-                    found_new_valid_pos = 1;
-                }
+            struct SKRY_point predicted_pos_in_img = ref_pt->match.predicted_pos_in_img;
+            struct SKRY_point new_pos_in_img;
+
+            int needs_full_search = 1;
+            if (adaptive_radius)
+            {
+                find_matching_position(predicted_pos_in_img, ref_pt->ref_block, &ref_pt->ref_block_pyramid, img, pyramid,
+                                       adaptive_radius, BLOCK_MATCHING_INITIAL_SEARCH_STEP, &new_pos_in_img);
+
+                // If the best match lies at the edge of the reduced search area,
+                // the actual best one may lie outside it
+                needs_full_search =
+                    abs(new_pos_in_img.x - predicted_pos_in_img.x) >= (int)adaptive_radius - 1
+                    || abs(new_pos_in_img.y - predicted_pos_in_img.y) >= (int)adaptive_radius - 1;
+
+                num_adaptive_searches++;
+                if (needs_full_search)
+                    num_adaptive_fallbacks++;
             }
 
-            if (!found_new_valid_pos)
+            if (needs_full_search)
+                find_matching_position(predicted_pos_in_img, ref_pt->ref_block, &ref_pt->ref_block_pyramid, img, pyramid,
+                                       ref_pt_align->search_radius,
+                                       BLOCK_MATCHING_INITIAL_SEARCH_STEP, &new_pos_in_img);
+
+            ref_pt->match.new_pos_in_img = new_pos_in_img;
+        }
+    }
+
+    #pragma omp parallel for
+    for (size_t p_idx = 0; p_idx < DA_SIZE(ref_pt_align->reference_pts); p_idx++)
+    {
+        struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[p_idx];
+        ref_pt->match.has_new_transl_vec = 0;
+        if (SKRY_EMPTY == ref_pt->qual_est_area || SKRY_EMPTY == ref_pt->owner_tri)
+            continue;
+
+        int found_new_valid_pos = 0;
+
+        if (ref_pt->match.is_needed)
+        {
+            struct SKRY_point new_pos_in_img = ref_pt->match.new_pos_in_img;
+            struct SKRY_point current_ref_pos = get_ref_pt_position(ref_pt_align, p_idx, (0 == img_idx) ? 0 : (img_idx-1));
+
+            struct SKRY_point new_pos = { .x = new_pos_in_img.x - intersection.x - img_alignment_ofs.x,
+                                          .y = new_pos_in_img.y - intersection.y - img_alignment_ofs.y };
+
+            // Additional rejection criterion: ignore the first position update if the new pos. is too distant.
+            // Otherwise the point would be moved too far at the very start of the ref. point alignment
+            // phase and might not recover, i.e. its subsequent position updates might be getting rejected
+            // by the additional check after the current 'for' loop.
+            if (!ref_pt->match.is_first_update
+                || SKRY_SQR(new_pos.x - current_ref_pos.x) + SKRY_SQR(new_pos.y - current_ref_pos.y) <= SKRY_SQR((int)ref_pt_align->ref_block_size/3 /*TODO: make it adaptive somehow? or use the current avg. deviation*/))
             {
-                ref_pt->positions[img_idx].is_valid = 0;
-                if (img_idx > 0)
-                    ref_pt->positions[img_idx].pos = ref_pt->positions[img_idx-1].pos;
+                set_ref_pt_position(ref_pt_align, p_idx, img_idx, new_pos);
+
+                set_ref_pt_pos_valid(ref_pt_align, p_idx, img_idx, 1);
+
+                if (ref_pt->last_valid_pos_idx != SKRY_EMPTY)
+                {
+                    struct SKRY_point last_valid_pos = get_ref_pt_position(ref_pt_align, p_idx, ref_pt->last_valid_pos_idx);
+                    ref_pt->last_transl_vec.sq_len = SKRY_SQR(new_pos.x - last_valid_pos.x) +
+                                                     SKRY_SQR(new_pos.y - last_valid_pos.y);
+                    ref_pt->last_transl_vec.len = sqrt(ref_pt->last_transl_vec.sq_len);
+                    ref_pt->match.has_new_transl_vec = 1;
+                }
+
+                found_new_valid_pos = 1;
             }
+        }
+
+        if (!found_new_valid_pos)
+        {
+            set_ref_pt_pos_valid(ref_pt_align, p_idx, img_idx, 0);
+            if (img_idx > 0)
+                set_ref_pt_position(ref_pt_align, p_idx, img_idx, get_ref_pt_position(ref_pt_align, p_idx, img_idx-1));
+        }
+    }
 
-            ref_pt_align->update_flags[tri_pts[i].p_idx] = UPDATED;
+    // Summed up serially in point order, so that the result does not depend on the number of threads
+    double sum_len = 0, sum_sq_len = 0;
+    size_t num_terms = 0;
+    for (size_t p_idx = 0; p_idx < DA_SIZE(ref_pt_align->reference_pts); p_idx++)
+    {
+        const struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[p_idx];
+        if (ref_pt->match.has_new_transl_vec)
+        {
+            sum_len    += ref_pt->last_transl_vec.len;
+            sum_sq_len += ref_pt->last_transl_vec.sq_len;
+            num_terms++;
         }
     }
 
+    ref_pt_align->statistics.num_adaptive_searches  += num_adaptive_searches;
+    ref_pt_align->statistics.num_adaptive_fallbacks += num_adaptive_fallbacks;
+
+    struct tvec_sum curr_step_tvec = { .sum_len = sum_len, .sum_sq_len = sum_sq_len, .num_terms = num_terms };
+
     size_t prev_num_terms  = 0;
     double prev_sum_len    = 0;
     double prev_sum_sq_len = 0;
@@ -443,12 +750,12 @@ void update_ref_pt_positions(
         for (size_t i = 0; i < DA_SIZE(ref_pt_align->reference_pts); i++)
         {
             struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[i];
-            if (ref_pt->qual_est_area != SKRY_EMPTY && ref_pt->positions[img_idx].is_valid
+            if (ref_pt->qual_est_area != SKRY_EMPTY && is_ref_pt_pos_valid(ref_pt_align, i, img_idx)
                 && ref_pt->last_transl_vec.len > sum_len_avg + 1.5* std_deviation)
             {
                 assert(img_idx); // Cannot happen for img_idx==0, because then the point's last translation vector must be zero
-                ref_pt->positions[img_idx].is_valid = 0;
-                ref_pt->positions[img_idx].pos = ref_pt->positions[img_idx-1].pos;
+                set_ref_pt_pos_valid(ref_pt_align, i, img_idx, 0);
+                set_ref_pt_position(ref_pt_align, i, img_idx, get_ref_pt_position(ref_pt_align, i, img_idx-1));
 
                 curr_step_tvec.sum_len -= ref_pt->last_transl_vec.len;
                 curr_step_tvec.num_terms--;
@@ -475,7 +782,7 @@ void update_ref_pt_positions(
         for (size_t i = 0; i < DA_SIZE(ref_pt_align->reference_pts); i++)
         {
             struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[i];
-            if (ref_pt->positions[img_idx].is_valid)
+            if (is_ref_pt_pos_valid(ref_pt_align, i, img_idx))
             {
                 ref_pt->last_valid_pos_idx = img_idx;
                 ref_pt_align->statistics.num_valid_positions++;
@@ -484,41 +791,39 @@ void update_ref_pt_positions(
 
 }
 
-/// Returns pointer to the added point or null if out of memory
 static
-void *append_fixed_point(SKRY_RefPtAlignment *ref_pt_align, struct SKRY_point pos, const SKRY_ImgSequence *img_seq)
+void append_fixed_point(SKRY_RefPtAlignment *ref_pt_align, struct SKRY_point pos)
 {
     DA_APPEND(ref_pt_align->reference_pts,
         ((struct reference_point) { .qual_est_area = SKRY_EMPTY,
                                     .ref_block = 0,
+                                    .initial_pos = pos,
+                                    .is_fixed = 1,
                                     .last_valid_pos_idx = 0,
                                     .last_transl_vec = { 0 }
                                   }));
+}
 
-    if (0 == (DA_LAST(ref_pt_align->reference_pts).positions =
-                 malloc(SKRY_get_active_img_count(img_seq) * sizeof(*DA_LAST(ref_pt_align->reference_pts).positions))))
-    {
-        return 0;
-    }
+static
+void assign_owner_triangles(SKRY_RefPtAlignment *ref_pt_align)
+{
+    for (size_t i = 0; i < DA_SIZE(ref_pt_align->reference_pts); i++)
+        ref_pt_align->reference_pts.data[i].owner_tri = SKRY_EMPTY;
 
-    for (unsigned j = 0; j < SKRY_get_active_img_count(img_seq); j++)
+    const struct SKRY_triangle *triangles = SKRY_get_triangles(ref_pt_align->triangulation);
+    for (size_t tri_idx = SKRY_get_num_triangles(ref_pt_align->triangulation); tri_idx-- > 0; )
     {
-        struct reference_point *ref_pt = &DA_LAST(ref_pt_align->reference_pts);
-        ref_pt->positions[j].pos = pos;
-        ref_pt->positions[j].is_valid = 1;
+        ref_pt_align->reference_pts.data[triangles[tri_idx].v0].owner_tri = tri_idx;
+        ref_pt_align->reference_pts.data[triangles[tri_idx].v1].owner_tri = tri_idx;
+        ref_pt_align->reference_pts.data[triangles[tri_idx].v2].owner_tri = tri_idx;
     }
-
-    return &DA_LAST(ref_pt_align->reference_pts);
 }
 
 #define ADDITIONAL_FIXED_PTS_PER_BORDER   4
 #define ADDITIONAL_FIXED_PT_OFFSET_DIV    4
 
-/// Returns 'ref_pt_align' or null if out of memory
 static
-void *create_surrounding_fixed_points(SKRY_RefPtAlignment *ref_pt_align,
-                                      struct SKRY_rect intersection,
-                                      const SKRY_ImgSequence *img_seq)
+void create_surrounding_fixed_points(SKRY_RefPtAlignment *ref_pt_align, struct SKRY_rect intersection)
 {
     /* Add a few fixed points along and just outside intersection's borders. This way after triangulation
        the near-border points will not generate skinny triangles, which would result in locally degraded
@@ -558,47 +863,80 @@ void *create_surrounding_fixed_points(SKRY_RefPtAlignment *ref_pt_align,
     for (size_t i = 1; i <= ADDITIONAL_FIXED_PTS_PER_BORDER; i++)
     {
         // along top border
-        if (!append_fixed_point(ref_pt_align,
+        append_fixed_point(ref_pt_align,
                            (struct SKRY_point)
                                { .x = i * intersection.width / (ADDITIONAL_FIXED_PTS_PER_BORDER+1),
-                                 .y = -(int)intersection.height / ADDITIONAL_FIXED_PT_OFFSET_DIV },
-                           img_seq))
-        {
-            return 0;
-        }
+                                 .y = -(int)intersection.height / ADDITIONAL_FIXED_PT_OFFSET_DIV });
 
         // along bottom border
-        if (!append_fixed_point(ref_pt_align,
+        append_fixed_point(ref_pt_align,
                            (struct SKRY_point)
                                { .x = i * intersection.width / (ADDITIONAL_FIXED_PTS_PER_BORDER+1),
-                                 .y = intersection.height + intersection.height / ADDITIONAL_FIXED_PT_OFFSET_DIV },
-                           img_seq))
-        {
-            return 0;
-        }
+                                 .y = intersection.height + intersection.height / ADDITIONAL_FIXED_PT_OFFSET_DIV });
 
         // along left border
-        if (!append_fixed_point(ref_pt_align,
+        append_fixed_point(ref_pt_align,
                            (struct SKRY_point)
                                { .x = -(int)intersection.width / ADDITIONAL_FIXED_PT_OFFSET_DIV,
-                                 .y = i * intersection.height / (ADDITIONAL_FIXED_PTS_PER_BORDER+1) },
-                           img_seq))
-        {
-            return 0;
-        }
+                                 .y = i * intersection.height / (ADDITIONAL_FIXED_PTS_PER_BORDER+1) });
 
         // along right border
-        if (!append_fixed_point(ref_pt_align,
+        append_fixed_point(ref_pt_align,
                            (struct SKRY_point)
                                { .x = intersection.width + intersection.width / ADDITIONAL_FIXED_PT_OFFSET_DIV,
-                                 .y = i * intersection.height / (ADDITIONAL_FIXED_PTS_PER_BORDER+1) },
-                           img_seq))
-        {
-            return 0;
-        }
+                                 .y = i * intersection.height / (ADDITIONAL_FIXED_PTS_PER_BORDER+1) });
     }
+}
 
-    return ref_pt_align;
+/// Finds the Delaunay triangulation of the reference points; returns 0 if out of memory
+/** Appends the 3 additional fixed points of the triangulation to 'reference_pts'. */
+static
+int triangulate_ref_pts(SKRY_RefPtAlignment *ref_pt_align, struct SKRY_rect intersection)
+{
+    // Envelope of all reference points (including the fixed ones)
+    struct SKRY_rect envelope =
+        { .x = -(int)intersection.width/ADDITIONAL_FIXED_PT_OFFSET_DIV,
+          .y = -(int)intersection.height/ADDITIONAL_FIXED_PT_OFFSET_DIV,
+          .width = intersection.width + 2*intersection.width/ADDITIONAL_FIXED_PT_OFFSET_DIV,
+          .height = intersection.height + 2*intersection.height/ADDITIONAL_FIXED_PT_OFFSET_DIV };
+
+    struct SKRY_point *initial_positions = malloc(DA_SIZE(ref_pt_align->reference_pts) * sizeof(*initial_positions));
+    if (!initial_positions)
+        return 0;
+    for (size_t i = 0; i < DA_SIZE(ref_pt_align->reference_pts); i++)
+        initial_positions[i] = ref_pt_align->reference_pts.data[i].initial_pos;
+
+    ref_pt_align->triangulation = SKRY_find_delaunay_triangulation(DA_SIZE(ref_pt_align->reference_pts),
+        initial_positions, envelope);
+    free(initial_positions);
+    if (!ref_pt_align->triangulation)
+        return 0;
+
+    // The triangulation object contains 3 additional points comprising a triangle that covers all the other points.
+    // These 3 points shall have fixed position and are not associated with any quality estimation area. Add them
+    // to the list now and fill their position for all images.
+    for (size_t i = SKRY_get_num_vertices(ref_pt_align->triangulation) - 3; i < SKRY_get_num_vertices(ref_pt_align->triangulation); i++)
+    {
+        append_fixed_point(ref_pt_align, SKRY_get_vertices(ref_pt_align->triangulation)[i]);
+    }
+
+    return 1;
+}
+
+/// Assigns owner triangles and determines triangles' quality; returns 0 if out of memory
+static
+int init_triangles(SKRY_RefPtAlignment *ref_pt_align)
+{
+    assign_owner_triangles(ref_pt_align);
+
+    size_t num_triangles = SKRY_get_num_triangles(ref_pt_align->triangulation);
+    ref_pt_align->tri_quality_sufficient = malloc(num_triangles * sizeof(*ref_pt_align->tri_quality_sufficient));
+    // Zero-filled, so that SKRY_free_ref_pt_alignment() can be called if any allocation fails
+    ref_pt_align->tri_quality = calloc(num_triangles, sizeof(*ref_pt_align->tri_quality));
+    if (!ref_pt_align->tri_quality_sufficient || !ref_pt_align->tri_quality)
+        return 0;
+
+    return 0 != calc_triangle_quality(ref_pt_align);
 }
 
 #define FAIL_ON_NULL(ptr)                          \
@@ -725,62 +1063,28 @@ SKRY_RefPtAlignment *SKRY_init_ref_pt_alignment(
             ((struct reference_point)
                 { .qual_est_area = SKRY_get_area_idx_at_pos(qual_est, (struct SKRY_point) { .x = points[i].x, .y = points[i].y }),
                   .ref_block = 0,
+                  .initial_pos = { .x = points[i].x, .y = points[i].y },
                   .last_valid_pos_idx = SKRY_EMPTY,
                   .last_transl_vec = { 0 } }));
 
-        struct reference_point *new_ref_pt = &DA_LAST(ref_pt_align->reference_pts);
-        new_ref_pt->positions = malloc(SKRY_get_active_img_count(img_seq) * sizeof(*new_ref_pt->positions));
-        FAIL_ON_NULL(new_ref_pt->positions);
-        new_ref_pt->positions[0].pos = (struct SKRY_point) { .x = points[i].x,
-                                                             .y = points[i].y };
-
-        LOG_MSG(SKRY_LOG_REF_PT_ALIGNMENT, "Added reference point at (%d, %d).",
-                new_ref_pt->positions[0].pos.x,
-                new_ref_pt->positions[0].pos.y);
+        LOG_MSG(SKRY_LOG_REF_PT_ALIGNMENT, "Added reference point at (%d, %d).", points[i].x, points[i].y);
     }
     if (automatic_points)
         free((struct SKRY_point *)points);
 
-    FAIL_ON_NULL(create_surrounding_fixed_points(ref_pt_align,
-                 intersection, img_seq));
-
-    // Envelope of all reference points (including the fixed ones)
-    struct SKRY_rect envelope =
-        { .x = -(int)intersection.width/ADDITIONAL_FIXED_PT_OFFSET_DIV,
-          .y = -(int)intersection.height/ADDITIONAL_FIXED_PT_OFFSET_DIV,
-          .width = intersection.width + 2*intersection.width/ADDITIONAL_FIXED_PT_OFFSET_DIV,
-          .height = intersection.height + 2*intersection.height/ADDITIONAL_FIXED_PT_OFFSET_DIV };
-
-    // Find the Delaunay triangulation of the reference points
-
-    struct SKRY_point *initial_positions = malloc(DA_SIZE(ref_pt_align->reference_pts) * sizeof(*initial_positions));
-    FAIL_ON_NULL(initial_positions);
-    for (size_t i = 0; i < DA_SIZE(ref_pt_align->reference_pts); i++)
-        initial_positions[i] = ref_pt_align->reference_pts.data[i].positions[0].pos;
-
-    ref_pt_align->triangulation = SKRY_find_delaunay_triangulation(DA_SIZE(ref_pt_align->reference_pts),
-        initial_positions, envelope);
-    free(initial_positions);
-    FAIL_ON_NULL(ref_pt_align->triangulation);
-
-    // The triangulation object contains 3 additional points comprising a triangle that covers all the other points.
-    // These 3 points shall have fixed position and are not associated with any quality estimation area. Add them
-    // to the list now and fill their position for all images.
-    for (size_t i = SKRY_get_num_vertices(ref_pt_align->triangulation) - 3; i < SKRY_get_num_vertices(ref_pt_align->triangulation); i++)
-    {
-        append_fixed_point(ref_pt_align, SKRY_get_vertices(ref_pt_align->triangulation)[i], img_seq);
-    }
+    create_surrounding_fixed_points(ref_pt_align, intersection);
 
-    ref_pt_align->update_flags = malloc(DA_SIZE(ref_pt_align->reference_pts) * sizeof(*ref_pt_align->update_flags));
-    FAIL_ON_NULL(ref_pt_align->update_flags);
-    ref_pt_align->tri_quality = malloc(SKRY_get_num_triangles(ref_pt_align->triangulation) * sizeof(*ref_pt_align->tri_quality));
-    FAIL_ON_NULL(ref_pt_align->tri_quality);
-    for (size_t i = 0; i < SKRY_get_num_triangles(ref_pt_align->triangulation); i++)
-        ref_pt_align->tri_quality[i].sorted_idx = 0;
+    FAIL_ON_NULL(triangulate_ref_pts(ref_pt_align, intersection));
+    FAIL_ON_NULL(alloc_ref_pt_positions(ref_pt_align, SKRY_get_active_img_count(img_seq)));
+    FAIL_ON_NULL(init_triangles(ref_pt_align));
 
-    FAIL_ON_NULL(calc_triangle_quality(ref_pt_align));
+    // 'first_img' is a fragment of the image, so its downsampled versions are not shared with other phases
+    struct image_pyramid pyramid;
+    int has_pyramid = g_pyramid_matching_enabled
+                      && (SKRY_SUCCESS == create_image_pyramid(first_img, get_num_matching_pyramid_levels(ref_pt_align), &pyramid));
 
     update_ref_pt_positions(ref_pt_align, first_img, 0,
+                            has_pyramid ? &pyramid : 0,
                             SKRY_get_active_img_count(img_seq),
                             ref_pt_align->quality_criterion,
                             ref_pt_align->quality_threshold,
@@ -788,6 +1092,8 @@ SKRY_RefPtAlignment *SKRY_init_ref_pt_alignment(
                             // so pass a full-image "intersection" and a zero offset
                             SKRY_get_img_rect(first_img), (struct SKRY_point) { 0, 0 });
 
+    if (has_pyramid)
+        free_image_pyramid(&pyramid);
     SKRY_free_image(first_img);
 
     if (result) *result = SKRY_SUCCESS;
@@ -802,19 +1108,22 @@ SKRY_RefPtAlignment *SKRY_free_ref_pt_alignment(SKRY_RefPtAlignment *ref_pt_alig
         for (size_t i = 0; i < DA_SIZE(ref_pt_align->reference_pts); i++)
         {
             struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[i];
-            free(ref_pt->positions);
             SKRY_free_image(ref_pt->ref_block);
+            free_image_pyramid(&ref_pt->ref_block_pyramid);
         }
 
         DA_FREE(ref_pt_align->reference_pts);
+        free(ref_pt_align->displacements);
+        free(ref_pt_align->valid_flags);
 
-        for (size_t i = 0; i < SKRY_get_num_triangles(ref_pt_align->triangulation); i++)
-            free(ref_pt_align->tri_quality[i].sorted_idx);
+        if (ref_pt_align->tri_quality)
+            for (size_t i = 0; i < SKRY_get_num_triangles(ref_pt_align->triangulation); i++)
+                free(ref_pt_align->tri_quality[i].sorted_idx);
 
         free(ref_pt_align->tri_quality);
 
         SKRY_free_triangulation(ref_pt_align->triangulation);
-        free(ref_pt_align->update_flags);
+        free(ref_pt_align->tri_quality_sufficient);
         free(ref_pt_align);
     }
     return 0;
@@ -830,13 +1139,32 @@ struct SKRY_point SKRY_get_ref_pt_pos(const SKRY_RefPtAlignment *ref_pt_align,
                                       /// If not null, receives 1 if the point is valid in specified image
                                       int *is_valid)
 {
-    const struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[point_idx];
-    if (is_valid) *is_valid = ref_pt->positions[img_idx].is_valid;
-    return ref_pt->positions[img_idx].pos;
+    if (is_valid) *is_valid = is_ref_pt_pos_valid(ref_pt_align, point_idx, img_idx);
+    return get_ref_pt_position(ref_pt_align, point_idx, img_idx);
 }
 
-/// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
-enum SKRY_result SKRY_ref_pt_alignment_step(SKRY_RefPtAlignment *ref_pt_align)
+/// Fills 'positions' and 'is_valid' (if not null) with positions of all reference points in the specified image
+void SKRY_get_ref_pt_positions_in_img(const SKRY_RefPtAlignment *ref_pt_align, size_t img_idx,
+                                      struct SKRY_point positions[],
+                                      uint8_t is_valid[])
+{
+    size_t num_points = DA_SIZE(ref_pt_align->reference_pts);
+    const struct ref_pt_displacement *img_displacements = ref_pt_align->displacements + img_idx * num_points;
+
+    for (size_t i = 0; i < num_points; i++)
+    {
+        struct SKRY_point initial_pos = ref_pt_align->reference_pts.data[i].initial_pos;
+        positions[i] = (struct SKRY_point) { .x = initial_pos.x + img_displacements[i].dx,
+                                             .y = initial_pos.y + img_displacements[i].dy };
+    }
+
+    if (is_valid)
+        for (size_t i = 0; i < num_points; i++)
+            is_valid[i] = is_ref_pt_pos_valid(ref_pt_align, i, img_idx);
+}
+
+static
+enum SKRY_result ref_pt_alignment_step(SKRY_RefPtAlignment *ref_pt_align)
 {
     SKRY_ImgSequence *img_seq = SKRY_get_img_seq(SKRY_get_img_align(ref_pt_align->qual_est));
 
@@ -854,6 +1182,11 @@ enum SKRY_result SKRY_ref_pt_alignment_step(SKRY_RefPtAlignment *ref_pt_align)
                                / (ref_pt_align->statistics.num_valid_positions
                                 + ref_pt_align->statistics.num_rejected_positions));
 
+        if (ref_pt_align->statistics.num_adaptive_searches > 0)
+            LOG_MSG(SKRY_LOG_REF_PT_ALIGNMENT, "Searches with adaptive radius: %"PRIu64", repeated with full radius: %"PRIu64,
+                    ref_pt_align->statistics.num_adaptive_searches,
+                    ref_pt_align->statistics.num_adaptive_fallbacks);
+
         LOG_MSG(SKRY_LOG_REF_PT_ALIGNMENT, "Processing time: %.3f s", ref_pt_align->statistics.time.total_sec);
 
         return SKRY_LAST_STEP;
@@ -867,7 +1200,7 @@ enum SKRY_result SKRY_ref_pt_alignment_step(SKRY_RefPtAlignment *ref_pt_align)
 
     size_t img_idx = SKRY_get_curr_img_idx_within_active_subset(img_seq);
 
-    SKRY_Image *img = SKRY_get_curr_img(img_seq, &result);
+    SKRY_Image *img = SKRY_get_curr_img_from_pool(img_seq, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE, &result);
     if (SKRY_SUCCESS != result)
     {
         LOG_MSG(SKRY_LOG_REF_PT_ALIGNMENT, "Could not load image %zu from image sequence %p (error: %d).",
@@ -875,25 +1208,60 @@ enum SKRY_result SKRY_ref_pt_alignment_step(SKRY_RefPtAlignment *ref_pt_align)
         return result;
     }
 
-    if (SKRY_get_img_pix_fmt(img) != SKRY_PIX_MONO8)
-    {
-        SKRY_Image *img8 = SKRY_convert_pix_fmt(img, SKRY_PIX_MONO8, SKRY_DEMOSAIC_SIMPLE);
-        SKRY_free_image(img);
-        img = img8;
-    }
+    // Downsampled images may have been already created (and stored in the image pool) by image alignment;
+    // without them (when disabled or out of memory), matching is performed at full resolution only
+    struct image_pyramid pyramid;
+    int has_pyramid = g_pyramid_matching_enabled
+                      && (SKRY_SUCCESS == get_curr_img_pyramid(img_seq, img, get_num_matching_pyramid_levels(ref_pt_align), &pyramid));
 
     update_ref_pt_positions(ref_pt_align, img, img_idx,
+                            has_pyramid ? &pyramid : 0,
                             SKRY_get_active_img_count(img_seq),
                             ref_pt_align->quality_criterion,
                             ref_pt_align->quality_threshold,
                             SKRY_get_intersection(SKRY_get_img_align(ref_pt_align->qual_est)),
                             SKRY_get_image_ofs(SKRY_get_img_align(ref_pt_align->qual_est), img_idx));
 
-    img = SKRY_free_image(img);
+    if (has_pyramid)
+        release_curr_img_pyramid(img_seq, &pyramid);
+    SKRY_release_img_to_pool(img_seq, SKRY_get_curr_img_idx(img_seq), img);
 
     return SKRY_SUCCESS;
 }
 
+/// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
+enum SKRY_result SKRY_ref_pt_alignment_step(SKRY_RefPtAlignment *ref_pt_align)
+{
+    struct perf_step perf_step;
+    begin_perf_step(&perf_step);
+
+    enum SKRY_result result = ref_pt_alignment_step(ref_pt_align);
+
+    const SKRY_ImgSequence *img_seq = SKRY_get_img_seq(SKRY_get_img_align(ref_pt_align->qual_est));
+    end_perf_step(&perf_step, &ref_pt_align->perf_stats, "Reference point alignment", img_seq,
+                  SKRY_get_curr_img_idx_within_active_subset(img_seq));
+    return result;
+}
+
+static
+enum SKRY_result ref_pt_alignment_step_func(void *ref_pt_align) { return SKRY_ref_pt_alignment_step(ref_pt_align); }
+
+enum SKRY_result SKRY_ref_pt_alignment_run(SKRY_RefPtAlignment *ref_pt_align, size_t max_steps,
+                                           SKRY_progress_callback_fn progress_callback, void *callback_data,
+                                           const int *cancel_flag)
+{
+    if (SKRY_is_ref_pt_alignment_complete(ref_pt_align))
+        return SKRY_LAST_STEP;
+
+    return run_phase_steps(ref_pt_alignment_step_func, ref_pt_align, SKRY_get_img_seq(SKRY_get_img_align(ref_pt_align->qual_est)), 0, max_steps,
+                           progress_callback, callback_data, cancel_flag);
+}
+
+void SKRY_get_ref_pt_perf_stats(const SKRY_RefPtAlignment *ref_pt_align, struct SKRY_perf_stats *stats)
+{
+    *stats = ref_pt_align->perf_stats;
+}
+
 int SKRY_is_ref_pt_alignment_complete(const SKRY_RefPtAlignment *ref_pt_align)
 {
     return ref_pt_align->is_complete;
@@ -920,32 +1288,43 @@ struct SKRY_point_flt *SKRY_get_final_positions(const SKRY_RefPtAlignment *ref_p
     if (!result)
         return 0;
 
-    for (size_t pt_idx = 0; pt_idx < DA_SIZE(ref_pt_align->reference_pts); pt_idx++)
+    size_t *valid_pos_count = calloc(*num_points, sizeof(*valid_pos_count));
+    if (!valid_pos_count)
     {
-        const struct reference_point *ref_pt = &ref_pt_align->reference_pts.data[pt_idx];
-        size_t valid_pos_count = 0;
+        free(result);
+        return 0;
+    }
+
+    for (size_t pt_idx = 0; pt_idx < *num_points; pt_idx++)
         result[pt_idx] = (struct SKRY_point_flt) { .x = 0, .y = 0 };
-        for (unsigned img_idx = 0; img_idx < SKRY_get_active_img_count(SKRY_get_img_seq(SKRY_get_img_align(ref_pt_align->qual_est))); img_idx++)
+
+    // Positions are stored image by image, so sum them in this order
+    for (unsigned img_idx = 0; img_idx < SKRY_get_active_img_count(SKRY_get_img_seq(SKRY_get_img_align(ref_pt_align->qual_est))); img_idx++)
+        for (size_t pt_idx = 0; pt_idx < *num_points; pt_idx++)
         {
-            // Due to how 'update_ref_pt_positions()' works, it is guaranteed that at least one element "is valid"
-            if (ref_pt->positions[img_idx].is_valid)
+            if (is_ref_pt_pos_valid(ref_pt_align, pt_idx, img_idx))
             {
-                result[pt_idx].x += ref_pt->positions[img_idx].pos.x;
-                result[pt_idx].y += ref_pt->positions[img_idx].pos.y;
-                valid_pos_count++;
+                struct SKRY_point pos = get_ref_pt_position(ref_pt_align, pt_idx, img_idx);
+                result[pt_idx].x += pos.x;
+                result[pt_idx].y += pos.y;
+                valid_pos_count[pt_idx]++;
             }
         }
 
-        result[pt_idx].x /= valid_pos_count;
-        result[pt_idx].y /= valid_pos_count;
+    // Due to how 'update_ref_pt_positions()' works, it is guaranteed that at least one element "is valid"
+    for (size_t pt_idx = 0; pt_idx < *num_points; pt_idx++)
+    {
+        result[pt_idx].x /= valid_pos_count[pt_idx];
+        result[pt_idx].y /= valid_pos_count[pt_idx];
     }
 
+    free(valid_pos_count);
     return result;
 }
 
 int SKRY_is_ref_pt_valid(const SKRY_RefPtAlignment *ref_pt_align, size_t pt_idx, size_t img_idx)
 {
-    return ref_pt_align->reference_pts.data[pt_idx].positions[img_idx].is_valid;
+    return is_ref_pt_pos_valid(ref_pt_align, pt_idx, img_idx);
 }
 
 /// Triangulation contains 3 additional points at the end of vertex list: a triangle that covers all the other points
@@ -953,3 +1332,114 @@ const struct SKRY_triangulation *SKRY_get_ref_pts_triangulation(const SKRY_RefPt
 {
     return ref_pt_align->triangulation;
 }
+
+/// Enables or disables the adaptive search radius (disabled by default)
+/** When enabled, each reference point is first searched for within a radius
+    derived from the recent translations of all points, and the full search radius
+    is used only if the best match lies at the edge of that area. */
+void SKRY_set_ref_pt_adaptive_search(SKRY_RefPtAlignment *ref_pt_align, int enabled)
+{
+    ref_pt_align->adaptive_search = enabled;
+}
+
+void write_ref_pt_checkpoint(struct checkpoint_file *ckpt, const SKRY_RefPtAlignment *ref_pt_align)
+{
+    ckpt_write_u32(ckpt, ref_pt_align->quality_criterion);
+    ckpt_write_u32(ckpt, ref_pt_align->quality_threshold);
+    ckpt_write_u32(ckpt, ref_pt_align->ref_block_size);
+    ckpt_write_u32(ckpt, ref_pt_align->search_radius);
+    ckpt_write_u8(ckpt, 0 != ref_pt_align->adaptive_search);
+
+    // The last 3 points belong to the triangulation, which is found again when restoring
+    size_t num_points = DA_SIZE(ref_pt_align->reference_pts);
+    ckpt_write_u32(ckpt, num_points - 3);
+    for (size_t i = 0; i < num_points - 3; i++)
+    {
+        ckpt_write_point(ckpt, ref_pt_align->reference_pts.data[i].initial_pos);
+        ckpt_write_u8(ckpt, 0 != ref_pt_align->reference_pts.data[i].is_fixed);
+    }
+
+    size_t num_active_imgs = SKRY_get_active_img_count(SKRY_get_img_seq(SKRY_get_img_align(ref_pt_align->qual_est)));
+    for (size_t i = 0; i < num_active_imgs * num_points; i++)
+    {
+        ckpt_write_u16(ckpt, (uint16_t)ref_pt_align->displacements[i].dx);
+        ckpt_write_u16(ckpt, (uint16_t)ref_pt_align->displacements[i].dy);
+    }
+    for (size_t i = 0; i < num_active_imgs * ref_pt_align->valid_words_per_img; i++)
+        ckpt_write_u64(ckpt, ref_pt_align->valid_flags[i]);
+}
+
+/** The points' reference blocks are not recreated, as they are not needed
+    once alignment is complete. */
+SKRY_RefPtAlignment *read_ref_pt_checkpoint(struct checkpoint_file *ckpt, const SKRY_QualityEstimation *qual_est)
+{
+    SKRY_RefPtAlignment *ref_pt_align = malloc(sizeof(*ref_pt_align));
+    if (!ref_pt_align)
+    {
+        ckpt_set_error(ckpt, SKRY_OUT_OF_MEMORY);
+        return 0;
+    }
+    *ref_pt_align = (SKRY_RefPtAlignment) { 0 };
+
+    ref_pt_align->statistics.time.start = SKRY_clock_sec();
+    ref_pt_align->qual_est = qual_est;
+    ref_pt_align->quality_criterion = ckpt_read_u32(ckpt);
+    ref_pt_align->quality_threshold = ckpt_read_u32(ckpt);
+    ref_pt_align->ref_block_size = ckpt_read_u32(ckpt);
+    ref_pt_align->search_radius = ckpt_read_u32(ckpt);
+    ref_pt_align->adaptive_search = ckpt_read_u8(ckpt);
+    DA_ALLOC(ref_pt_align->reference_pts, 0);
+
+    struct SKRY_rect intersection = SKRY_get_intersection(SKRY_get_img_align(qual_est));
+
+    uint32_t num_points = ckpt_read_u32(ckpt);
+    if (ref_pt_align->quality_criterion > SKRY_NUMBER_BEST
+        || num_points > (size_t)intersection.width * intersection.height)
+    {
+        ckpt_set_error(ckpt, SKRY_UNSUPPORTED_FILE_FORMAT);
+    }
+
+    for (size_t i = 0; i < num_points && SKRY_SUCCESS == ckpt->result; i++)
+    {
+        struct SKRY_point pos = ckpt_read_point(ckpt);
+        int is_fixed = ckpt_read_u8(ckpt);
+        if (is_fixed)
+            append_fixed_point(ref_pt_align, pos);
+        else if (pos.x >= 0 && pos.x < (int)intersection.width && pos.y >= 0 && pos.y < (int)intersection.height)
+            DA_APPEND(ref_pt_align->reference_pts,
+                ((struct reference_point)
+                    { .qual_est_area = SKRY_get_area_idx_at_pos(qual_est, pos),
+                      .ref_block = 0,
+                      .initial_pos = pos,
+                      .last_valid_pos_idx = SKRY_EMPTY,
+                      .last_transl_vec = { 0 } }));
+        else
+            ckpt_set_error(ckpt, SKRY_UNSUPPORTED_FILE_FORMAT);
+    }
+    if (SKRY_SUCCESS != ckpt->result)
+        return SKRY_free_ref_pt_alignment(ref_pt_align);
+
+    size_t num_active_imgs = SKRY_get_active_img_count(SKRY_get_img_seq(SKRY_get_img_align(qual_est)));
+    if (!triangulate_ref_pts(ref_pt_align, intersection)
+        || !alloc_ref_pt_positions(ref_pt_align, num_active_imgs)
+        || !init_triangles(ref_pt_align))
+    {
+        ckpt_set_error(ckpt, SKRY_OUT_OF_MEMORY);
+        return SKRY_free_ref_pt_alignment(ref_pt_align);
+    }
+
+    for (size_t i = 0; i < num_active_imgs * DA_SIZE(ref_pt_align->reference_pts); i++)
+    {
+        ref_pt_align->displacements[i].dx = (int16_t)ckpt_read_u16(ckpt);
+        ref_pt_align->displacements[i].dy = (int16_t)ckpt_read_u16(ckpt);
+    }
+    for (size_t i = 0; i < num_active_imgs * ref_pt_align->valid_words_per_img; i++)
+        ref_pt_align->valid_flags[i] = ckpt_read_u64(ckpt);
+
+    if (SKRY_SUCCESS != ckpt->result)
+        return SKRY_free_ref_pt_alignment(ref_pt_align);
+
+    ref_pt_align->is_complete = 1;
+
+    return ref_pt_align;
+}
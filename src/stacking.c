@@ -25,6 +25,7 @@ File description:
 #include <limits.h>
 #include <math.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -36,18 +37,88 @@ File description:
 #include <skry/stacking.h>
 #include <skry/triangulation.h>
 
+#include "utils/accel.h"
 #include "utils/dnarray.h"
 #include "utils/logging.h"
 #include "utils/misc.h"
+#include "utils/perf.h"
 
+/// Margin (in pixels) around the images' intersection read in each stacking step
+/** High-quality demosaicing replicates up to 3 pixels at image borders;
+    interpolation needs 1 more. */
+#define FRAGMENT_MARGIN 4
 
-struct stack_triangle_point
+
+/// Horizontal run of consecutive pixels belonging to a triangle
+struct stack_triangle_span
+{
+    int y, x_start, x_end; ///< The span consists of pixels [x_start; x_end) of row 'y'
+    float u, v; ///< Barycentric coordinates (in the parent triangle) of the first pixel
+};
+
+struct rasterized_triangle
+{
+    DA_DECLARE(struct stack_triangle_span) spans;
+
+    /// Change of barycentric coordinates between consecutive pixels of a span
+    float du_dx, dv_dx;
+};
+
+/// Side length of the square tiles, into which the images' intersection is divided for stacking
+#define STACKING_TILE_SIZE 64
+
+/// Part of a triangle's span lying within a single tile
+struct tile_span
+{
+    size_t tri_idx;
+    const struct stack_triangle_span *span;
+    int x_start, x_end; ///< Pixels [x_start; x_end) of the span's row
+};
+
+typedef DA_DECLARE(struct tile_span) tile_span_list_t;
+
+/// Placement of a triangle in the current image
+struct triangle_warp
+{
+    struct SKRY_point p0, p1, p2; ///< Positions of the triangle's vertices in the current image
+    int all_inside; ///< 1 if all vertices are inside the images' intersection
+    int is_stacked; ///< 1 if the triangle is stacked in the current step
+};
+
+/// Parameters of warping an image into the stack, common for all spans
+struct warp_params
 {
-    int x, y;
-    float u, v; // Barycentric coordinates in the parent triangle
+    const SKRY_Stacking *stacking;
+
+    const void *src_pixels; ///< Pixels of 'fragment'
+    ptrdiff_t src_stride;
+    struct SKRY_rect fragment; ///< Part of the image being stacked
+
+    struct SKRY_rect intersection;
+    struct SKRY_point alignment_ofs; ///< Offset of the image
+
+    float src_val_scale; ///< Multiplier of interpolated values
+
+    const float *flatf_pixels; ///< Null if there is no flat-field
+    ptrdiff_t flatf_stride;
+    unsigned ff_width, ff_height;
+
+    const float *dark_pixels; ///< Null if there is no dark frame
+    ptrdiff_t dark_stride;
+    unsigned dark_width, dark_height;
 };
 
-typedef DA_DECLARE(struct stack_triangle_point) triangle_point_list_t;
+/// Image stacked in the current step
+struct step_img
+{
+    /// Part of the image covering the stacked triangles; null if none of the triangles is stacked
+    SKRY_Image *img;
+
+    struct warp_params wp;
+
+    /// Element [i] = placement of the i-th triangle in the image
+    struct triangle_warp *tri_warps;
+};
 
 struct SKRY_stacking
 {
@@ -59,8 +130,8 @@ struct SKRY_stacking
     size_t num_triangles;
 
     /** For each triangle in 'ref_pt_align->triangulation', contains a list of
-        points comprising it. */
-    triangle_point_list_t *rasterized_tris;
+        pixel spans comprising it. */
+    struct rasterized_triangle *rasterized_tris;
 
     /** Final positions (within the images' intersection) of the reference points,
         i.e. the average over all images where the points are valid.
@@ -71,21 +142,111 @@ struct SKRY_stacking
 
     size_t num_ref_points;
 
-    /** Element [i] = number of images that were stacked to produce
-        the i-th pixel in 'image_stack'. */
-    unsigned *added_img_count;
+    /// Positions of the reference points in the currently read image (used by 'read_step_img()')
+    struct SKRY_point *img_ref_pt_pos;
+    uint8_t *img_ref_pt_valid; ///< Element [i] is 1 if 'img_ref_pt_pos[i]' is valid
+
+    /// Width and height of the stack (equal to those of the images' intersection)
+    unsigned width, height;
+
+    /// SKRY_PIX_MONO32F or SKRY_PIX_RGB32F
+    enum SKRY_pixel_format stack_pix_fmt;
+
+    /// Accumulator format requested with SKRY_set_stacking_accumulator()
+    enum SKRY_stacking_accumulator requested_accum;
+
+    /** Sums of stacked values of each pixel (channel by channel), each followed
+        by the number of images that were stacked to produce the pixel. Pixels are
+        stored row by row, like in 'image_stack'. Null if 'accum_fixed' is used. */
+    float *accumulator;
+
+    /** If not null, the accelerator (see SKRY_set_accelerator()) stacks the images into
+        a device-resident copy of 'accumulator', which is updated with 'sync_accumulator()'. */
+    struct accel_stack *accel_stack;
+
+    /// Triangle placements passed to 'accel_stack_image()' ('num_triangles' elements; used with 'accel_stack')
+    struct accel_tri_warp *accel_tri_warps;
+
+    /** Used instead of 'accumulator' for SKRY_STACK_ACCUM_FIXED_POINT: sums of stacked values
+        of each pixel (channel by channel, in units of the input images' native format
+        scaled by 'fixed_point_scale'); the pixel counts are stored in 'added_img_count'. */
+    uint32_t *accum_fixed;
 
-    /// Format: SKRY_PIX_MONO32F or SKRY_PIX_RGB32F
+    /// Element [i] = number of images stacked to produce the i-th pixel (used with 'accum_fixed')
+    uint16_t *added_img_count;
+
+    float fixed_point_scale; ///< Power of 2
+
+    /// Format of images passed to stacking with 'accum_fixed' (integer, the same number of channels as 'stack_pix_fmt')
+    enum SKRY_pixel_format native_pix_fmt;
+
+    /// Created from the accumulator when stacking completes
     SKRY_Image *image_stack;
 
+    /// Number of tiles in each row and column of tiles covering the images' intersection
+    unsigned num_tiles_x, num_tiles_y;
+
+    /// Element [i] = list of triangles' spans within the i-th tile (tiles are stored row by row)
+    tile_span_list_t *tiles;
+
+    /// Max. number of images stacked in one step (set with SKRY_set_stacking_images_per_step())
+    size_t max_step_imgs;
+
+    /// Images stacked in the current step ('max_step_imgs' elements, allocated at the first step)
+    struct step_img *step_imgs;
+
+    size_t num_step_imgs; ///< Number of images stacked in the current step
+
     int first_step_complete;
 
-    /// Triangle indices (from 'ref_pt_align->triangulation') stacked in the current step
+    /// Triangle indices (from 'ref_pt_align->triangulation') stacked in the current step (in any of its images)
     DA_DECLARE(size_t) curr_step_stacked_triangles;
 
     /// Contains inverted flat-field values (1/flat-field)
     SKRY_Image *flatfield;
 
+    /** Dark frame (of 'stack_pix_fmt') subtracted from images before applying the flat-field;
+        scaled to the range of values being stacked at the first step. May be null. */
+    SKRY_Image *dark;
+
+    enum SKRY_pixel_format img_seq_pix_fmt; ///< Pixel format of the image sequence's images
+
+    enum SKRY_stacking_method method;
+    float kappa; ///< Used by SKRY_STACK_KAPPA_SIGMA
+    size_t mem_budget; ///< Used by SKRY_STACK_MEDIAN
+
+    /// Number of passes over the image sequence; 0 until set up at the first step
+    size_t num_passes;
+
+    size_t curr_pass;
+
+    /** Used by SKRY_STACK_KAPPA_SIGMA. For each pixel and channel: mean and sum of squared
+        differences from the mean (updated in the first pass); the latter is replaced
+        by the max. accepted difference after the first pass. */
+    float *value_stats;
+
+    /** Used by SKRY_STACK_MEDIAN. For each pixel and channel of the rows stacked
+        in the current pass: values from subsequent images. */
+    float *band_samples;
+
+    unsigned band_height; ///< Number of rows stacked in each pass of SKRY_STACK_MEDIAN
+
+    size_t num_images; ///< Number of images stacked in each pass
+
+    /// Stacked range of active images (set with SKRY_set_stacking_img_range()); 'range_count' = 0 means all images
+    size_t range_first, range_count;
+
+    size_t curr_pass_num_stacked; ///< Number of images stacked so far in the current pass
+
+    /// Each pixel of the preview corresponds to (1 << 'preview_shift')^2 pixels of the stack; 0 if there is no preview
+    unsigned preview_shift;
+
+    unsigned preview_width, preview_height;
+
+    /** Sums of values stacked in each block of pixels corresponding to a pixel of the preview
+        (format as in 'accumulator'). Null if there is no preview. */
+    float *preview_accum;
+
     struct
     {
         struct
@@ -94,13 +255,40 @@ struct SKRY_stacking
             double total_sec; ///< Difference between end of the last step and 'start'
         } time;
     } statistics;
+
+    struct SKRY_perf_stats perf_stats; ///< Counters of all steps (see SKRY_get_stacking_perf_stats())
 };
 
 typedef DA_DECLARE(int) *int_list_array_t;
 
-/// Returns list of pixels belonging to triangle (v0, v1, v2)
+/// Splits the rasterized triangles' spans into 'stacking->tiles' (which must be allocated)
+static
+void distribute_spans_into_tiles(SKRY_Stacking *stacking)
+{
+    for (size_t i = 0; i < (size_t)stacking->num_tiles_x * stacking->num_tiles_y; i++)
+        DA_ALLOC(stacking->tiles[i], 0);
+
+    for (size_t tri_idx = 0; tri_idx < stacking->num_triangles; tri_idx++)
+        for (size_t s = 0; s < DA_SIZE(stacking->rasterized_tris[tri_idx].spans); s++)
+        {
+            const struct stack_triangle_span *span = &stacking->rasterized_tris[tri_idx].spans.data[s];
+            tile_span_list_t *tile_row = &stacking->tiles[(span->y / STACKING_TILE_SIZE) * stacking->num_tiles_x];
+
+            for (int x = span->x_start; x < span->x_end; )
+            {
+                int tile_x_end = (x / STACKING_TILE_SIZE + 1) * STACKING_TILE_SIZE;
+                int x_end = SKRY_MIN(span->x_end, tile_x_end);
+
+                DA_APPEND(tile_row[x / STACKING_TILE_SIZE],
+                          ((struct tile_span) { .tri_idx = tri_idx, .span = span, .x_start = x, .x_end = x_end }));
+                x = x_end;
+            }
+        }
+}
+
+/// Returns list of pixel spans belonging to triangle (v0, v1, v2)
 static
-triangle_point_list_t rasterize_triangle(
+struct rasterized_triangle rasterize_triangle(
     struct SKRY_point_flt v0,
     struct SKRY_point_flt v1,
     struct SKRY_point_flt v2,
@@ -113,11 +301,15 @@ triangle_point_list_t rasterize_triangle(
     /*
         Test every point of the rectangular axis-aligned bounding box of
         the triangle (v0, v1, v2) and if it is inside triangle, add it
-        to the returned list.
+        to the returned list (extending the last span if possible).
     */
 
-    triangle_point_list_t result;
-    DA_ALLOC(result, 0);
+    struct rasterized_triangle result;
+    DA_ALLOC(result.spans, 0);
+
+    float denominator = (v1.y - v2.y) * (v0.x - v2.x) + (v2.x - v1.x) * (v0.y - v2.y);
+    result.du_dx = (v1.y - v2.y) / denominator;
+    result.dv_dx = (v2.y - v0.y) / denominator;
 
     int xmin = INT_MAX, xmax = INT_MIN, ymin = INT_MAX, ymax = INT_MIN;
 
@@ -152,7 +344,14 @@ triangle_point_list_t rasterize_triangle(
                         v >= 0.0f && v <= 1.0f &&
                         u+v >= 0.0f && u+v <= 1.0f)
                     {
-                        DA_APPEND(result, ((struct stack_triangle_point) { .x = x, .y = y, .u = u, .v = v }));
+                        struct stack_triangle_span *last_span = DA_SIZE(result.spans) > 0 ?
+                            &result.spans.data[DA_SIZE(result.spans) - 1] : 0;
+
+                        if (last_span && last_span->y == y && last_span->x_end == x)
+                            last_span->x_end++;
+                        else
+                            DA_APPEND(result.spans, ((struct stack_triangle_span) { .y = y, .x_start = x, .x_end = x + 1,
+                                                                                   .u = u, .v = v }));
                         *is_pix_occupied = 1;
                     }
                 }
@@ -162,10 +361,78 @@ triangle_point_list_t rasterize_triangle(
     return result;
 }
 
+static
+void free_rasterized_triangles(SKRY_Stacking *stacking)
+{
+    if (stacking->rasterized_tris)
+    {
+        for (size_t i = 0; i < stacking->num_triangles; i++)
+            DA_FREE(stacking->rasterized_tris[i].spans);
+
+        free(stacking->rasterized_tris);
+        stacking->rasterized_tris = 0;
+    }
+
+    if (stacking->tiles)
+    {
+        for (size_t i = 0; i < (size_t)stacking->num_tiles_x * stacking->num_tiles_y; i++)
+            DA_FREE(stacking->tiles[i]);
+
+        free(stacking->tiles);
+        stacking->tiles = 0;
+    }
+}
+
+/// Rasterizes triangles of the triangulation with vertices at 'stacking->final_ref_pt_pos'
+/** Previous rasterization results (if any) are freed first. Returns 0 if out of memory. */
+static
+int rasterize_triangles(SKRY_Stacking *stacking)
+{
+    free_rasterized_triangles(stacking);
+
+    const struct SKRY_triangulation *triangulation = SKRY_get_ref_pts_triangulation(stacking->ref_pt_align);
+    stacking->rasterized_tris = malloc(stacking->num_triangles * sizeof(*stacking->rasterized_tris));
+    if (!stacking->rasterized_tris)
+        return 0;
+
+    const struct SKRY_triangle *triangulation_tris = SKRY_get_triangles(triangulation);
+    struct SKRY_rect intersection = SKRY_get_intersection(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)));
+    uint8_t *pixel_occupied = calloc((size_t)intersection.width * intersection.height, sizeof(*pixel_occupied));
+    if (!pixel_occupied)
+    {
+        free(stacking->rasterized_tris);
+        stacking->rasterized_tris = 0;
+        return 0;
+    }
+
+    for (size_t i = 0; i < stacking->num_triangles; i++)
+    {
+        stacking->rasterized_tris[i] =
+            rasterize_triangle(
+                stacking->final_ref_pt_pos[triangulation_tris[i].v0],
+                stacking->final_ref_pt_pos[triangulation_tris[i].v1],
+                stacking->final_ref_pt_pos[triangulation_tris[i].v2],
+                (struct SKRY_rect) { .x = 0, .y = 0, .width = intersection.width, .height = intersection.height },
+                pixel_occupied);
+    }
+    //TODO: see if after rasterization there are any pixels not belonging to any triangle and assign them
+
+    free(pixel_occupied);
+
+    stacking->num_tiles_x = (intersection.width + STACKING_TILE_SIZE - 1) / STACKING_TILE_SIZE;
+    stacking->num_tiles_y = (intersection.height + STACKING_TILE_SIZE - 1) / STACKING_TILE_SIZE;
+    stacking->tiles = malloc(stacking->num_tiles_x * stacking->num_tiles_y * sizeof(*stacking->tiles));
+    if (!stacking->tiles)
+        return 0;
+
+    distribute_spans_into_tiles(stacking);
+
+    return 1;
+}
+
 #define FAIL_ON_NULL(ptr)                         \
     if (!(ptr))                                   \
     {                                             \
-        free(pixel_occupied);                     \
         SKRY_free_stacking(stacking);             \
         if (result) *result = SKRY_OUT_OF_MEMORY; \
         return 0;                                 \
@@ -177,8 +444,6 @@ SKRY_Stacking *SKRY_init_stacking(const SKRY_RefPtAlignment *ref_pt_align,
                                   /// If not null, receives operation result
                                   enum SKRY_result *result)
 {
-    uint8_t *pixel_occupied = NULL;
-
     SKRY_ImgSequence *img_seq = SKRY_get_img_seq(SKRY_get_img_align(SKRY_get_qual_est(ref_pt_align)));
     SKRY_seek_start(img_seq);
 
@@ -190,32 +455,22 @@ SKRY_Stacking *SKRY_init_stacking(const SKRY_RefPtAlignment *ref_pt_align,
     *stacking = (SKRY_Stacking) { 0 };
 
     stacking->statistics.time.start = SKRY_clock_sec();
+    stacking->method = SKRY_STACK_MEAN;
+    stacking->mem_budget = SKRY_STACKING_DEFAULT_MEM_BUDGET;
+    stacking->max_step_imgs = 1;
     stacking->ref_pt_align = ref_pt_align;
     stacking->final_ref_pt_pos = SKRY_get_final_positions(ref_pt_align, &stacking->num_ref_points);
+    FAIL_ON_NULL(stacking->final_ref_pt_pos);
+    stacking->img_ref_pt_pos = malloc(stacking->num_ref_points * sizeof(*stacking->img_ref_pt_pos));
+    FAIL_ON_NULL(stacking->img_ref_pt_pos);
+    stacking->img_ref_pt_valid = malloc(stacking->num_ref_points * sizeof(*stacking->img_ref_pt_valid));
+    FAIL_ON_NULL(stacking->img_ref_pt_valid);
 
     DA_ALLOC(stacking->curr_step_stacked_triangles, 0);
 
-    const struct SKRY_triangulation *triangulation = SKRY_get_ref_pts_triangulation(stacking->ref_pt_align);
-    stacking->num_triangles = SKRY_get_num_triangles(triangulation);
-    stacking->rasterized_tris = malloc(stacking->num_triangles * sizeof(*stacking->rasterized_tris));
-    FAIL_ON_NULL(stacking->rasterized_tris);
-
-    const struct SKRY_triangle *triangulation_tris = SKRY_get_triangles(triangulation);
-    struct SKRY_rect intersection = SKRY_get_intersection(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)));
-    pixel_occupied = malloc(intersection.width * intersection.height * sizeof(*pixel_occupied));
-    FAIL_ON_NULL(pixel_occupied);
-    memset(pixel_occupied, 0, intersection.width * intersection.height);
-    for (size_t i = 0; i < stacking->num_triangles; i++)
-    {
-        stacking->rasterized_tris[i] =
-            rasterize_triangle(
-                stacking->final_ref_pt_pos[triangulation_tris[i].v0],
-                stacking->final_ref_pt_pos[triangulation_tris[i].v1],
-                stacking->final_ref_pt_pos[triangulation_tris[i].v2],
-                (struct SKRY_rect) { .x = 0, .y = 0, .width = intersection.width, .height = intersection.height },
-                pixel_occupied);
-    }
-    //TODO: see if after rasterization there are any pixels not belonging to any triangle and assign them
+    stacking->num_triangles = SKRY_get_num_triangles(SKRY_get_ref_pts_triangulation(stacking->ref_pt_align));
+    int rasterized = rasterize_triangles(stacking);
+    FAIL_ON_NULL(rasterized);
 
     enum SKRY_result loc_result;
     enum SKRY_pixel_format img_seq_pix_fmt;
@@ -226,16 +481,25 @@ SKRY_Stacking *SKRY_init_stacking(const SKRY_RefPtAlignment *ref_pt_align,
         return 0;
     }
 
-    enum SKRY_pixel_format stack_pix_fmt =
+    struct SKRY_rect intersection = SKRY_get_intersection(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)));
+    stacking->width = intersection.width;
+    stacking->height = intersection.height;
+    stacking->img_seq_pix_fmt = img_seq_pix_fmt;
+    stacking->stack_pix_fmt =
         (NUM_CHANNELS[img_seq_pix_fmt] == 1 && (img_seq_pix_fmt < SKRY_PIX_CFA_MIN || img_seq_pix_fmt > SKRY_PIX_CFA_MAX) ?
             SKRY_PIX_MONO32F :
             SKRY_PIX_RGB32F);
-    stacking->image_stack = SKRY_new_image(intersection.width, intersection.height, stack_pix_fmt, 0, 1);
-    FAIL_ON_NULL(stacking->image_stack);
 
-    stacking->added_img_count = malloc(intersection.width * intersection.height * sizeof(*stacking->added_img_count));
-    FAIL_ON_NULL(stacking->added_img_count);
-    memset(stacking->added_img_count, 0,  intersection.width * intersection.height * sizeof(*stacking->added_img_count));
+    if (img_seq_pix_fmt != SKRY_PIX_MONO32F && img_seq_pix_fmt != SKRY_PIX_RGB32F &&
+        img_seq_pix_fmt != SKRY_PIX_MONO64F && img_seq_pix_fmt != SKRY_PIX_RGB64F)
+    {
+        if (SKRY_PIX_MONO32F == stacking->stack_pix_fmt)
+            stacking->native_pix_fmt = (BITS_PER_CHANNEL[img_seq_pix_fmt] == 8 ? SKRY_PIX_MONO8 : SKRY_PIX_MONO16);
+        else
+            stacking->native_pix_fmt = (BITS_PER_CHANNEL[img_seq_pix_fmt] == 8 ? SKRY_PIX_RGB8 : SKRY_PIX_RGB16);
+    }
+    else
+        stacking->native_pix_fmt = SKRY_PIX_INVALID;
 
     if (flatfield)
     {
@@ -249,6 +513,7 @@ SKRY_Stacking *SKRY_init_stacking(const SKRY_RefPtAlignment *ref_pt_align,
         unsigned width = SKRY_get_img_width(stacking->flatfield),
                  height = SKRY_get_img_height(stacking->flatfield);
         float max_val = FLT_MIN;
+        #pragma omp parallel for reduction(max:max_val)
         for (unsigned y = 0; y < height; y++)
         {
             float *line = SKRY_get_line(stacking->flatfield, y);
@@ -257,6 +522,7 @@ SKRY_Stacking *SKRY_init_stacking(const SKRY_RefPtAlignment *ref_pt_align,
                     max_val = line[x];
         }
 
+        #pragma omp parallel for
         for (unsigned y = 0; y < height; y++)
         {
             float *line = SKRY_get_line(stacking->flatfield, y);
@@ -266,8 +532,6 @@ SKRY_Stacking *SKRY_init_stacking(const SKRY_RefPtAlignment *ref_pt_align,
         }
     }
 
-    free(pixel_occupied);
-
     if (result) *result = SKRY_SUCCESS;
     return stacking;
 }
@@ -277,265 +541,1009 @@ SKRY_Stacking *SKRY_free_stacking(SKRY_Stacking *stacking)
 {
     if (stacking)
     {
-        if (stacking->rasterized_tris)
-        {
-            for (size_t i = 0; i < stacking->num_triangles; i++)
-                DA_FREE(stacking->rasterized_tris[i]);
-
-            free(stacking->rasterized_tris);
-        }
-
+        free_rasterized_triangles(stacking);
+        if (stacking->step_imgs)
+            for (size_t i = 0; i < stacking->max_step_imgs; i++)
+            {
+                SKRY_free_image(stacking->step_imgs[i].img);
+                free(stacking->step_imgs[i].tri_warps);
+            }
+        free(stacking->step_imgs);
         free(stacking->final_ref_pt_pos);
+        free(stacking->img_ref_pt_pos);
+        free(stacking->img_ref_pt_valid);
         DA_FREE(stacking->curr_step_stacked_triangles);
         SKRY_free_image(stacking->image_stack);
+        accel_free_stack(stacking->accel_stack);
+        free(stacking->accel_tri_warps);
+        free(stacking->accumulator);
+        free(stacking->accum_fixed);
+        free(stacking->preview_accum);
         free(stacking->added_img_count);
         SKRY_free_image(stacking->flatfield);
+        SKRY_free_image(stacking->dark);
+        free(stacking->value_stats);
+        free(stacking->band_samples);
         free(stacking);
     }
     return 0;
 }
 
-/// Performs linear interpolation in 'img' (which has to be 32-bit floating point)
+/// Divides all channel values of 'img' (SKRY_PIX_MONO32F or SKRY_PIX_RGB32F) by 'divisor'
 static
-float interpolate_pixel_value(const float *pixels, ptrdiff_t line_stride_in_bytes,
-                              unsigned img_width, unsigned img_height,
-                              float x, float y, size_t channel, size_t bytes_per_pix)
+void divide_pixel_values(SKRY_Image *img, float divisor)
 {
-    if (x < 0 || x >= img_width-1 || y < 0 || y >= img_height-1)
-        return 0.0f;
+    size_t num_values_in_line = SKRY_get_img_width(img) * NUM_CHANNELS[SKRY_get_img_pix_fmt(img)];
+    for (unsigned y = 0; y < SKRY_get_img_height(img); y++)
+    {
+        float *line = SKRY_get_line(img, y);
+        for (size_t i = 0; i < num_values_in_line; i++)
+            line[i] /= divisor;
+    }
+}
 
-    double x0d, y0d;
-    float tx = modf(x, &x0d);
-    float ty = modf(y, &y0d);
-    int x0 = (int)x0d, y0 = (int)y0d;
+/// Fills 'img' with averaged values of an accumulator of the same size
+/** 'accum' contains (for each pixel, row by row) sums of the channels' values followed by
+    the number of stacked values, like 'SKRY_stacking::accumulator'. 'img' is SKRY_PIX_MONO32F
+    or SKRY_PIX_RGB32F. If 'scale_to_max' is nonzero, the result is divided by its max. value. */
+static
+void average_accumulated_values(const float *accum, int scale_to_max, SKRY_Image *img)
+{
+    unsigned width = SKRY_get_img_width(img),
+             height = SKRY_get_img_height(img);
+    size_t num_channels = NUM_CHANNELS[SKRY_get_img_pix_fmt(img)];
 
-    float * restrict line_lo = (float *)((uint8_t *)pixels + y0*line_stride_in_bytes);
-    float * restrict line_hi = (float *)((uint8_t *)line_lo + line_stride_in_bytes);
-    float v00 = ((float *)((char *)line_lo + x0    *bytes_per_pix))[channel],
-          v10 = ((float *)((char *)line_lo + (x0+1)*bytes_per_pix))[channel],
-          v01 = ((float *)((char *)line_hi + x0    *bytes_per_pix))[channel],
-          v11 = ((float *)((char *)line_hi + (x0+1)*bytes_per_pix))[channel];
+    float max_value = 0.0f;
+    for (unsigned y = 0; y < height; y++)
+    {
+        float *line = SKRY_get_line(img, y);
+        const float *accum_line = accum + (size_t)y * width * (num_channels + 1);
+        for (unsigned x = 0; x < width; x++)
+        {
+            const float *accum_pix = accum_line + x * (num_channels + 1);
+            for (size_t ch = 0; ch < num_channels; ch++)
+            {
+                float *val = &line[num_channels*x + ch];
+                *val = accum_pix[ch] / SKRY_MAX(1, accum_pix[num_channels]);
+                if (scale_to_max && *val > max_value)
+                    max_value = *val;
+            }
+        }
+    }
 
-    return (1.0f-ty) * ((1.0f-tx)*v00 + tx*v10) + ty * ((1.0-tx)*v01 + tx*v11);
+    if (scale_to_max && max_value > 0.0f)
+        divide_pixel_values(img, max_value);
 }
 
+/// Fills 'img_stack' (of the same size and format as the stack) with averaged values of stacked pixels
 static
-void normalize_image_stack(
-    // element value = number of triangles stacked for the corresponding pixel in 'img_stack'
-    const unsigned added_img_count[],
-    SKRY_Image *img_stack, int uses_flatfield)
+void normalize_image_stack(const SKRY_Stacking *stacking, SKRY_Image *img_stack)
 {
-    unsigned width = SKRY_get_img_width(img_stack),
-             height = SKRY_get_img_height(img_stack);
+    unsigned width = stacking->width,
+             height = stacking->height;
+
+    size_t num_channels = NUM_CHANNELS[stacking->stack_pix_fmt];
+    int uses_flatfield = (0 != stacking->flatfield);
+
+    if (!stacking->accum_fixed)
+    {
+        average_accumulated_values(stacking->accumulator, uses_flatfield, img_stack);
+        return;
+    }
 
-    size_t num_channels = NUM_CHANNELS[SKRY_get_img_pix_fmt(img_stack)];
+    // Fixed-point sums are expressed in units of the input images' native format
+    float fixed_point_to_float = 1.0f / (stacking->fixed_point_scale *
+        (BITS_PER_CHANNEL[stacking->native_pix_fmt] == 8 ? 0xFF : 0xFFFF));
 
     float max_stack_value = 0.0f;
     for (unsigned y = 0; y < height; y++)
     {
         float *line = SKRY_get_line(img_stack, y);
-            for (unsigned x = 0; x < width; x++)
-                for (size_t ch = 0; ch < num_channels; ch++)
-                {
-                    float *val = &line[num_channels*x + ch];
-                    *val /= (SKRY_MAX(1, added_img_count[x + y*width]));
-                    if (uses_flatfield && *val > max_stack_value)
-                        max_stack_value = *val;
-                }
+        const uint32_t *sums_line = stacking->accum_fixed + (size_t)y * width * num_channels;
+        const uint16_t *count_line = stacking->added_img_count + (size_t)y * width;
+        for (unsigned x = 0; x < width; x++)
+            for (size_t ch = 0; ch < num_channels; ch++)
+            {
+                float *val = &line[num_channels*x + ch];
+                *val = sums_line[num_channels*x + ch] * fixed_point_to_float / SKRY_MAX(1, count_line[x]);
+                if (uses_flatfield && *val > max_stack_value)
+                    max_stack_value = *val;
+            }
     }
 
     if (uses_flatfield && max_stack_value > 0.0f)
-        for (unsigned y = 0; y < height; y++)
-        {
-            float *line = SKRY_get_line(img_stack, y);
-            for (unsigned x = 0; x < width; x++)
-                for (size_t ch = 0; ch < num_channels; ch++)
-                    line[num_channels*x + ch] /= max_stack_value;
-        }
+        divide_pixel_values(img_stack, max_stack_value);
 }
 
-/// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
-enum SKRY_result SKRY_stacking_step(SKRY_Stacking *stacking)
+/// Returns the max. value of 'flatfield', or 1 if it is null
+static
+float get_max_flatfield_factor(const SKRY_Image *flatfield)
 {
-    enum SKRY_result result;
-    SKRY_ImgSequence *img_seq = SKRY_get_img_seq(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)));
-
-    if (stacking->first_step_complete)
-    {
-        result = SKRY_seek_next(img_seq);
-        if (SKRY_NO_MORE_IMAGES == result)
-        {
-            normalize_image_stack(stacking->added_img_count, stacking->image_stack,
-                                  0 != stacking->flatfield);
-
-            stacking->statistics.time.total_sec = SKRY_clock_sec() - stacking->statistics.time.start;
-            LOG_MSG(SKRY_LOG_STACKING, "Processing time: %.3f s", stacking->statistics.time.total_sec);
-
-            stacking->is_complete = 1;
-            return SKRY_LAST_STEP;
-        }
-        else if (SKRY_SUCCESS != result)
+    float max_val = 1.0f;
+    if (flatfield)
+        for (unsigned y = 0; y < SKRY_get_img_height(flatfield); y++)
         {
-            LOG_MSG(SKRY_LOG_STACKING, "Could not seek to the next image of image sequence %p (error: %d).",
-                    (void *)img_seq, (int)result);
-            return result;
+            const float *line = SKRY_get_line(flatfield, y);
+            for (unsigned x = 0; x < SKRY_get_img_width(flatfield); x++)
+                if (line[x] > max_val)
+                    max_val = line[x];
         }
-    }
 
-    SKRY_Image *img = SKRY_get_curr_img(img_seq, &result);
-    size_t curr_img_idx = SKRY_get_curr_img_idx_within_active_subset(img_seq);
-    if (SKRY_SUCCESS != result)
-    {
-        LOG_MSG(SKRY_LOG_STACKING, "Could not load image %zu from image sequence %p (error: %d).",
-                                 SKRY_get_curr_img_idx(img_seq),      (void *)img_seq, (int)result);
-        return result;
-    }
+    return max_val;
+}
 
-    struct SKRY_rect intersection = SKRY_get_intersection(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)));
-    struct SKRY_point alignment_ofs = SKRY_get_image_ofs(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)), curr_img_idx);
+/// Allocates the fixed-point accumulator if it can be used; returns SKRY_SUCCESS or SKRY_OUT_OF_MEMORY
+static
+enum SKRY_result init_fixed_point_accumulator(SKRY_Stacking *stacking)
+{
+    if (SKRY_STACK_ACCUM_FIXED_POINT != stacking->requested_accum)
+        return SKRY_SUCCESS;
 
-    if (SKRY_get_img_pix_fmt(img) != SKRY_get_img_pix_fmt(stacking->image_stack))
+    if (SKRY_STACK_MEAN != stacking->method ||
+        SKRY_PIX_INVALID == stacking->native_pix_fmt ||
+        stacking->num_images > UINT16_MAX)
     {
-        SKRY_Image *img32f = SKRY_convert_pix_fmt(img, SKRY_get_img_pix_fmt(stacking->image_stack), SKRY_DEMOSAIC_HQLINEAR);
-        SKRY_free_image(img);
-        img = img32f;
+        LOG_MSG(SKRY_LOG_STACKING, "Fixed-point accumulator cannot be used, using floating-point instead.");
+        return SKRY_SUCCESS;
     }
 
-    unsigned width = SKRY_get_img_width(img),
-             height = SKRY_get_img_height(img);
-    size_t num_channels = NUM_CHANNELS[SKRY_get_img_pix_fmt(img)],
-           bytes_per_pix = BYTES_PER_PIXEL[SKRY_get_img_pix_fmt(img)];
-
-    unsigned ff_width = 0, ff_height = 0;
-    if (stacking->flatfield)
+    // Choose the greatest scale for which the sums cannot overflow
+    double max_sum = (double)stacking->num_images *
+                     (BITS_PER_CHANNEL[stacking->native_pix_fmt] == 8 ? 0xFF : 0xFFFF) *
+                     get_max_flatfield_factor(stacking->flatfield);
+    if (max_sum + stacking->num_images >= UINT32_MAX)
     {
-        ff_width = SKRY_get_img_width(stacking->flatfield);
-        ff_height = SKRY_get_img_height(stacking->flatfield);
+        LOG_MSG(SKRY_LOG_STACKING, "Fixed-point accumulator would overflow, using floating-point instead.");
+        return SKRY_SUCCESS;
     }
 
-    // For each triangle, check if its vertices are valid in the current image. If they are,
-    // add the triangle's contents to the corresponding triangle patch in the stack.
-    DA_SET_SIZE(stacking->curr_step_stacked_triangles, 0);
-    const struct SKRY_triangulation *triangulation = SKRY_get_ref_pts_triangulation(stacking->ref_pt_align);
-
-    struct SKRY_rect envelope = { .x = 0, .y = 0,
-                                  .width = intersection.width,
-                                  .height = intersection.height };
-
-    // First, find the list of triangles valid in the current step
-    for (size_t tri_idx = 0; tri_idx < SKRY_get_num_triangles(triangulation); tri_idx++)
-    {
-        const struct SKRY_triangle *tri = &SKRY_get_triangles(triangulation)[tri_idx];
+    // (rounding of each added value may increase the sum by up to 1 per image)
+    int fract_bits = 0;
+    while (fract_bits < 16 && max_sum * (2 << fract_bits) + stacking->num_images < UINT32_MAX)
+        fract_bits++;
+    stacking->fixed_point_scale = (float)(1 << fract_bits);
 
-        struct
-        {
-            struct SKRY_point pos; // position of triangle's vertex in the current image
-            int is_valid;
-        } p0, p1, p2;
+    size_t num_pixels = (size_t)stacking->width * stacking->height;
+    stacking->accum_fixed = calloc(num_pixels * NUM_CHANNELS[stacking->stack_pix_fmt], sizeof(*stacking->accum_fixed));
+    stacking->added_img_count = calloc(num_pixels, sizeof(*stacking->added_img_count));
+    if (!stacking->accum_fixed || !stacking->added_img_count)
+        return SKRY_OUT_OF_MEMORY;
 
-        p0.pos = SKRY_get_ref_pt_pos(stacking->ref_pt_align, tri->v0, curr_img_idx, &p0.is_valid);
-        p1.pos = SKRY_get_ref_pt_pos(stacking->ref_pt_align, tri->v1, curr_img_idx, &p1.is_valid);
-        p2.pos = SKRY_get_ref_pt_pos(stacking->ref_pt_align, tri->v2, curr_img_idx, &p2.is_valid);
+    LOG_MSG(SKRY_LOG_STACKING, "Using fixed-point accumulator with %d fractional bits.", fract_bits);
 
-        if (p0.is_valid && p1.is_valid && p2.is_valid)
-        {
-            // Due to the way reference point alignment works, it is allowed for a point
-            // to be outside the image intersection at some times. Must be careful not to
-            // try interpolating pixel values from outside the current image.
-            // (Cannot use 'intersection' here directly, because its origin may not be (0,0),
-            // and p0, p1, p2 have coordinates relative to intersection's origin).
-            int p0_inside = SKRY_RECT_CONTAINS(envelope, p0.pos);
-            int p1_inside = SKRY_RECT_CONTAINS(envelope, p1.pos);
-            int p2_inside = SKRY_RECT_CONTAINS(envelope, p2.pos);
+    return SKRY_SUCCESS;
+}
 
-            if (p0_inside || p1_inside || p2_inside)
-                DA_APPEND(stacking->curr_step_stacked_triangles, tri_idx);
-        }
+/// Sets up 'stacking->accel_stack' if the accelerator can be used; returns SKRY_SUCCESS or SKRY_OUT_OF_MEMORY
+/** Requires the accumulator to be already allocated. If the accelerator is not used, the CPU stacks the images. */
+static
+enum SKRY_result init_accel_stacking(SKRY_Stacking *stacking)
+{
+    // The accelerator only accumulates sums of the warped values
+    if (!is_accel_stacking_enabled() ||
+        SKRY_STACK_MEAN != stacking->method || stacking->accum_fixed || stacking->preview_shift > 0)
+    {
+        return SKRY_SUCCESS;
     }
 
-    // Second, stack the triangles
-    float * restrict src_pixels = SKRY_get_line(img, 0);
-    ptrdiff_t src_stride = SKRY_get_line_stride_in_bytes(img);
-
-    float * restrict flatf_pixels = 0;
-    ptrdiff_t flatf_stride = 0;
-    if (stacking->flatfield)
+    size_t num_pixels = (size_t)stacking->width * stacking->height;
+    struct accel_stack_pixel *pixels = malloc(num_pixels * sizeof(*pixels));
+    stacking->accel_tri_warps = malloc(SKRY_MAX(1, stacking->num_triangles) * sizeof(*stacking->accel_tri_warps));
+    if (!pixels || !stacking->accel_tri_warps)
     {
-        flatf_pixels = SKRY_get_line(stacking->flatfield, 0);
-        flatf_stride = SKRY_get_line_stride_in_bytes(stacking->flatfield);
+        free(pixels);
+        return SKRY_OUT_OF_MEMORY;
     }
 
-    float * restrict stack_pixels = SKRY_get_line(stacking->image_stack, 0);
-    ptrdiff_t stack_stride = SKRY_get_line_stride_in_bytes(stacking->image_stack);
+    for (size_t i = 0; i < num_pixels; i++)
+        pixels[i].tri_idx = -1;
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < DA_SIZE(stacking->curr_step_stacked_triangles); i++)
+    // Barycentric coordinates are calculated the same way as in 'fn_warp_span's
+    for (size_t tri_idx = 0; tri_idx < stacking->num_triangles; tri_idx++)
     {
-        size_t tri_idx = stacking->curr_step_stacked_triangles.data[i];
-
-        const struct SKRY_triangle *tri = &SKRY_get_triangles(triangulation)[tri_idx];
-
-        struct
+        const struct rasterized_triangle *rtri = &stacking->rasterized_tris[tri_idx];
+        for (size_t s = 0; s < DA_SIZE(rtri->spans); s++)
         {
-            struct SKRY_point pos; // position of triangle's vertex in the current image
-            int is_valid;
-        } p0, p1, p2;
+            const struct stack_triangle_span *span = &rtri->spans.data[s];
+            for (int x = span->x_start; x < span->x_end; x++)
+                pixels[(size_t)span->y * stacking->width + x] = (struct accel_stack_pixel) {
+                    .tri_idx = (int)tri_idx,
+                    .u = span->u + (x - span->x_start) * rtri->du_dx,
+                    .v = span->v + (x - span->x_start) * rtri->dv_dx };
+        }
+    }
 
-        p0.pos = SKRY_get_ref_pt_pos(stacking->ref_pt_align, tri->v0, curr_img_idx, &p0.is_valid);
-        p1.pos = SKRY_get_ref_pt_pos(stacking->ref_pt_align, tri->v1, curr_img_idx, &p1.is_valid);
-        p2.pos = SKRY_get_ref_pt_pos(stacking->ref_pt_align, tri->v2, curr_img_idx, &p2.is_valid);
+    stacking->accel_stack = accel_create_stack(stacking->width, stacking->height, NUM_CHANNELS[stacking->stack_pix_fmt],
+                                               pixels, stacking->num_triangles, stacking->flatfield, stacking->dark);
+    free(pixels);
 
-        int p0_inside = SKRY_RECT_CONTAINS(envelope, p0.pos);
-        int p1_inside = SKRY_RECT_CONTAINS(envelope, p1.pos);
-        int p2_inside = SKRY_RECT_CONTAINS(envelope, p2.pos);
-        int all_inside = p0_inside && p1_inside && p2_inside;
+    if (stacking->accel_stack)
+        LOG_MSG(SKRY_LOG_STACKING, "Stacking is performed by the accelerator.");
+    else
+        LOG_MSG(SKRY_LOG_STACKING, "Could not set up the accelerator, stacking is performed by the CPU.");
 
-        for (size_t p = 0; p < DA_SIZE(stacking->rasterized_tris[tri_idx]); p++)
-        {
-            const struct stack_triangle_point *stp = &stacking->rasterized_tris[tri_idx].data[p];
-
-            float srcx = stp->u * p0.pos.x +
-                         stp->v * p1.pos.x +
-                         (1.0f - stp->u - stp->v) * p2.pos.x;
-            float srcy = stp->u * p0.pos.y +
-                         stp->v * p1.pos.y +
-                         (1.0f - stp->u - stp->v) * p2.pos.y;
-
-            if (all_inside ||
-                (srcx >= 0 && srcx <= intersection.width-1 &&
-                 srcy >= 0 && srcy <= intersection.height-1))
+    return SKRY_SUCCESS;
+}
+
+/// Copies the sums accumulated by the accelerator (if used) to 'stacking->accumulator'; returns SKRY_SUCCESS or an error code
+static
+enum SKRY_result sync_accumulator(const SKRY_Stacking *stacking)
+{
+    if (stacking->accel_stack)
+        return accel_read_stack(stacking->accel_stack, stacking->accumulator);
+    else
+        return SKRY_SUCCESS;
+}
+
+/// Copies the sums accumulated by the accelerator (if used) to 'stacking->accumulator' and stops using the accelerator
+/** Returns SKRY_SUCCESS or an error code. */
+static
+enum SKRY_result finish_accel_stacking(SKRY_Stacking *stacking)
+{
+    enum SKRY_result result = sync_accumulator(stacking);
+    accel_free_stack(stacking->accel_stack);
+    stacking->accel_stack = 0;
+    return result;
+}
+
+/// Sets up passes over the image sequence for the selected stacking method; returns SKRY_SUCCESS or SKRY_OUT_OF_MEMORY
+static
+enum SKRY_result init_stacking_passes(SKRY_Stacking *stacking)
+{
+    unsigned width = stacking->width,
+             height = stacking->height;
+    size_t num_channels = NUM_CHANNELS[stacking->stack_pix_fmt];
+
+    stacking->num_images = stacking->range_count ? stacking->range_count :
+        SKRY_get_active_img_count(SKRY_get_img_seq(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align))));
+
+    enum SKRY_result result = init_fixed_point_accumulator(stacking);
+    if (SKRY_SUCCESS != result)
+        return result;
+
+    // Values are stacked in units of the input images' native format if 'accum_fixed' is used
+    if (stacking->dark && stacking->accum_fixed)
+        divide_pixel_values(stacking->dark, 1.0f / (BITS_PER_CHANNEL[stacking->native_pix_fmt] == 8 ? 0xFF : 0xFFFF));
+
+    stacking->step_imgs = calloc(stacking->max_step_imgs, sizeof(*stacking->step_imgs));
+    if (!stacking->step_imgs)
+        return SKRY_OUT_OF_MEMORY;
+    for (size_t i = 0; i < stacking->max_step_imgs; i++)
+    {
+        stacking->step_imgs[i].tri_warps = malloc(stacking->num_triangles * sizeof(*stacking->step_imgs[i].tri_warps));
+        if (!stacking->step_imgs[i].tri_warps)
+            return SKRY_OUT_OF_MEMORY;
+    }
+
+    if (!stacking->accum_fixed)
+    {
+        stacking->accumulator = calloc((size_t)width * height * (num_channels + 1), sizeof(*stacking->accumulator));
+        if (!stacking->accumulator)
+            return SKRY_OUT_OF_MEMORY;
+    }
+
+    if (stacking->preview_shift > 0)
+    {
+        unsigned decimation = 1U << stacking->preview_shift;
+        stacking->preview_width = (width + decimation - 1) / decimation;
+        stacking->preview_height = (height + decimation - 1) / decimation;
+        stacking->preview_accum = calloc((size_t)stacking->preview_width * stacking->preview_height * (num_channels + 1),
+                                         sizeof(*stacking->preview_accum));
+        if (!stacking->preview_accum)
+            return SKRY_OUT_OF_MEMORY;
+    }
+
+    switch (stacking->method)
+    {
+    case SKRY_STACK_KAPPA_SIGMA:
+        stacking->value_stats = calloc((size_t)width * height * num_channels * 2, sizeof(*stacking->value_stats));
+        if (!stacking->value_stats)
+            return SKRY_OUT_OF_MEMORY;
+
+        stacking->num_passes = 2;
+        break;
+
+    case SKRY_STACK_MEDIAN:
+        {
+            size_t bytes_per_row = (size_t)width * num_channels * SKRY_MAX(stacking->num_images, 1) * sizeof(*stacking->band_samples);
+            stacking->band_height = SKRY_MAX(1, SKRY_MIN(height, stacking->mem_budget / bytes_per_row));
+            stacking->band_samples = malloc(stacking->band_height * bytes_per_row);
+            if (!stacking->band_samples)
+                return SKRY_OUT_OF_MEMORY;
+
+            stacking->num_passes = (height + stacking->band_height - 1) / stacking->band_height;
+        }
+        break;
+
+    default: stacking->num_passes = 1; break;
+    }
+
+    LOG_MSG(SKRY_LOG_STACKING, "Stacking method: %d, number of passes: %zu.", (int)stacking->method, stacking->num_passes);
+
+    return init_accel_stacking(stacking);
+}
+
+/// Updates 'stacking->accumulator' (and the method's data) after all images have been stacked in the current pass
+static
+void finish_stacking_pass(SKRY_Stacking *stacking)
+{
+    unsigned width = stacking->width,
+             height = stacking->height;
+    size_t num_channels = NUM_CHANNELS[stacking->stack_pix_fmt];
+    size_t accum_elems_per_pixel = num_channels + 1;
+
+    if (SKRY_STACK_KAPPA_SIGMA == stacking->method && 0 == stacking->curr_pass)
+    {
+        // Replace sums of squared differences with the max. accepted difference from the mean
+        // and start over with the accumulation
+        #pragma omp parallel for
+        for (unsigned y = 0; y < height; y++)
+            for (unsigned x = 0; x < width; x++)
             {
-                unsigned ffx = 0, ffy = 0;
-                if (stacking->flatfield)
+                size_t pix_idx = x + (size_t)y*width;
+                float num_values = stacking->accumulator[pix_idx * accum_elems_per_pixel + num_channels];
+                float *stats = stacking->value_stats + pix_idx * num_channels * 2;
+
+                for (size_t ch = 0; ch < num_channels; ch++)
+                    stats[2*ch + 1] = (num_values > 0) ? stacking->kappa * sqrtf(stats[2*ch + 1] / num_values) : 0;
+            }
+
+        memset(stacking->accumulator, 0, (size_t)width * height * accum_elems_per_pixel * sizeof(*stacking->accumulator));
+        if (stacking->preview_accum)
+            memset(stacking->preview_accum, 0, (size_t)stacking->preview_width * stacking->preview_height *
+                                               accum_elems_per_pixel * sizeof(*stacking->preview_accum));
+    }
+    else if (SKRY_STACK_KAPPA_SIGMA == stacking->method)
+    {
+        // If all values of a pixel have been rejected (possible for 'kappa' < 1
+        // or due to other channels), use their mean
+        #pragma omp parallel for
+        for (unsigned y = 0; y < height; y++)
+            for (unsigned x = 0; x < width; x++)
+            {
+                size_t pix_idx = x + (size_t)y*width;
+                float *accum_pix = stacking->accumulator + pix_idx * accum_elems_per_pixel;
+                if (0 == accum_pix[num_channels])
                 {
-                    ffx = SKRY_MIN(srcx + intersection.x + alignment_ofs.x, ff_width-1);
-                    ffy = SKRY_MIN(srcy + intersection.y + alignment_ofs.y, ff_height-1);
+                    for (size_t ch = 0; ch < num_channels; ch++)
+                        accum_pix[ch] = stacking->value_stats[pix_idx * num_channels * 2 + 2*ch];
+                    accum_pix[num_channels] = 1;
                 }
+            }
+    }
+    else if (SKRY_STACK_MEDIAN == stacking->method)
+    {
+        // Replace the values collected for the current band's pixels with their median
+        unsigned band_y_start = stacking->curr_pass * stacking->band_height,
+                 band_y_end = SKRY_MIN(height, band_y_start + stacking->band_height);
 
-                for (size_t ch = 0; ch < num_channels; ch++)
+        #pragma omp parallel for
+        for (unsigned y = band_y_start; y < band_y_end; y++)
+            for (unsigned x = 0; x < width; x++)
+            {
+                size_t pix_idx = x + (size_t)y*width;
+                float *accum_pix = stacking->accumulator + pix_idx * accum_elems_per_pixel;
+                float *samples = stacking->band_samples + (pix_idx - (size_t)band_y_start*width) * num_channels * stacking->num_images;
+
+                size_t num_values = accum_pix[num_channels];
+                if (num_values > 0)
                 {
-                    float src_val =
-                        interpolate_pixel_value(src_pixels, src_stride, width, height,
-                                                srcx + intersection.x + alignment_ofs.x,
-                                                srcy + intersection.y + alignment_ofs.y,
-                                                ch, bytes_per_pix);
+                    for (size_t ch = 0; ch < num_channels; ch++)
+                        accum_pix[ch] = get_median_flt(samples + ch*stacking->num_images, num_values);
+                    accum_pix[num_channels] = 1;
+                }
+            }
+    }
+}
 
-                    if (stacking->flatfield)
-                    {
-                        // 'stacking->flatfield' contains inverted flat-field values,
-                        // so we multiply instead of dividing
-                        src_val *= ((float*)((uint8_t *)flatf_pixels + ffy*flatf_stride))[ffx];
-                    }
+/// Adds values (one per channel) of a pixel of the current image to the preview (if enabled)
+/** Each block of pixels averaged by a preview pixel lies within a single tile,
+    so tiles can be processed in parallel. */
+static inline
+void add_preview_values(const SKRY_Stacking *stacking,
+                        unsigned x, unsigned y, ///< Position within the images' intersection
+                        const float values[], size_t num_channels)
+{
+    if (!stacking->preview_accum)
+        return;
+
+    size_t preview_idx = (x >> stacking->preview_shift) + (size_t)(y >> stacking->preview_shift) * stacking->preview_width;
+    float *accum_pix = stacking->preview_accum + preview_idx * (num_channels + 1);
+
+    for (size_t ch = 0; ch < num_channels; ch++)
+        accum_pix[ch] += values[ch];
+
+    accum_pix[num_channels] += 1;
+}
+
+/// Adds values (one per channel) of a pixel of the current image to the stack
+/** The values are expected to be non-negative (the warping clamps them after dark frame subtraction);
+    the fixed-point accumulator additionally guards its unsigned conversion. */
+static inline
+void add_pixel_values(const SKRY_Stacking *stacking,
+                      unsigned x, unsigned y, ///< Position within the images' intersection
+                      const float values[], size_t num_channels)
+{
+    size_t pix_idx = x + (size_t)y * stacking->width;
+
+    if (stacking->accum_fixed)
+    {
+        uint32_t *sums = stacking->accum_fixed + pix_idx * num_channels;
+        for (size_t ch = 0; ch < num_channels; ch++)
+            sums[ch] += (uint32_t)(SKRY_MAX(0.0f, values[ch]) * stacking->fixed_point_scale + 0.5f);
+
+        stacking->added_img_count[pix_idx] += 1;
+        add_preview_values(stacking, x, y, values, num_channels);
+        return;
+    }
+
+    float *accum_pix = stacking->accumulator + pix_idx * (num_channels + 1);
+
+    if (SKRY_STACK_KAPPA_SIGMA == stacking->method)
+    {
+        float *stats = stacking->value_stats + pix_idx * num_channels * 2;
+
+        if (0 == stacking->curr_pass)
+        {
+            // Update the running mean and sum of squared differences (Welford's algorithm)
+            float num_values = accum_pix[num_channels] + 1;
+            for (size_t ch = 0; ch < num_channels; ch++)
+            {
+                float delta = values[ch] - stats[2*ch];
+                stats[2*ch] += delta / num_values;
+                stats[2*ch + 1] += delta * (values[ch] - stats[2*ch]);
+            }
+        }
+        else
+            for (size_t ch = 0; ch < num_channels; ch++)
+                if (fabsf(values[ch] - stats[2*ch]) > stats[2*ch + 1])
+                    return;
+    }
+    else if (SKRY_STACK_MEDIAN == stacking->method)
+    {
+        size_t band_pix_idx = pix_idx - (size_t)stacking->curr_pass * stacking->band_height * stacking->width;
+        float *samples = stacking->band_samples + band_pix_idx * num_channels * stacking->num_images;
+        size_t num_values = accum_pix[num_channels];
+
+        for (size_t ch = 0; ch < num_channels; ch++)
+            samples[ch*stacking->num_images + num_values] = values[ch];
+
+        accum_pix[num_channels] += 1;
+        add_preview_values(stacking, x, y, values, num_channels);
+        return;
+    }
+
+    for (size_t ch = 0; ch < num_channels; ch++)
+        accum_pix[ch] += values[ch];
+
+    accum_pix[num_channels] += 1;
+    add_preview_values(stacking, x, y, values, num_channels);
+}
+
+/// Adds the current image's pixels corresponding to 'tspan' to the stack
+typedef void fn_warp_span(const struct warp_params *wp,
+                          const struct tile_span *tspan,
+                          const struct triangle_warp *warp,
+                          const struct rasterized_triangle *rtri);
+
+/// Defines a 'fn_warp_span' for images with 'NumChannels' channels of type 'ChannelT'
+/** For each pixel, the source position, its neighbors' addresses and the flat-field
+    value are determined once and used for all channels. Bilinear interpolation uses
+    pixels from 'wp->fragment' only (values outside it are 0). */
+#define DEFINE_WARP_SPAN(name, ChannelT, NumChannels)                                                  \
+static                                                                                                 \
+void name(const struct warp_params *wp,                                                                \
+          const struct tile_span *tspan,                                                               \
+          const struct triangle_warp *warp,                                                            \
+          const struct rasterized_triangle *rtri)                                                      \
+{                                                                                                      \
+    const struct stack_triangle_span *span = tspan->span;                                              \
+    struct SKRY_rect intersection = wp->intersection;                                                  \
+    struct SKRY_rect fragment = wp->fragment;                                                          \
+                                                                                                       \
+    for (int x = tspan->x_start; x < tspan->x_end; x++)                                                \
+    {                                                                                                  \
+        /* Barycentric coordinates are linear along the span */                                        \
+        float u = span->u + (x - span->x_start) * rtri->du_dx,                                         \
+              v = span->v + (x - span->x_start) * rtri->dv_dx;                                         \
+                                                                                                       \
+        float srcx = u * warp->p0.x +                                                                  \
+                     v * warp->p1.x +                                                                  \
+                     (1.0f - u - v) * warp->p2.x;                                                      \
+        float srcy = u * warp->p0.y +                                                                  \
+                     v * warp->p1.y +                                                                  \
+                     (1.0f - u - v) * warp->p2.y;                                                      \
+                                                                                                       \
+        if (!warp->all_inside &&                                                                       \
+            (srcx < 0 || srcx > intersection.width-1 ||                                                \
+             srcy < 0 || srcy > intersection.height-1))                                                \
+            continue;                                                                                  \
+                                                                                                       \
+        /* Position in the current image */                                                            \
+        float img_x = srcx + intersection.x + wp->alignment_ofs.x,                                     \
+              img_y = srcy + intersection.y + wp->alignment_ofs.y;                                     \
+                                                                                                       \
+        float values[NumChannels] = { 0.0f };                                                          \
+                                                                                                       \
+        if (img_x >= fragment.x && img_x < fragment.x + (int)fragment.width - 1 &&                     \
+            img_y >= fragment.y && img_y < fragment.y + (int)fragment.height - 1)                      \
+        {                                                                                              \
+            /* Coordinates are non-negative here, so truncation gives the integer part */              \
+            int x0 = (int)img_x, y0 = (int)img_y;                                                      \
+            float tx = img_x - x0, ty = img_y - y0;                                                    \
+                                                                                                       \
+            const ChannelT *p00 = (const ChannelT *)((const uint8_t *)wp->src_pixels +                 \
+                                  (y0 - fragment.y) * wp->src_stride) + (x0 - fragment.x) * NumChannels; \
+            const ChannelT *p01 = (const ChannelT *)((const uint8_t *)p00 + wp->src_stride);           \
+                                                                                                       \
+            for (size_t ch = 0; ch < NumChannels; ch++)                                                \
+                values[ch] = wp->src_val_scale *                                                       \
+                    ((1.0f-ty) * ((1.0f-tx)*p00[ch] + tx*p00[NumChannels + ch]) +                      \
+                           ty  * ((1.0f-tx)*p01[ch] + tx*p01[NumChannels + ch]));                      \
+                                                                                                       \
+            if (wp->dark_pixels)                                                                       \
+            {                                                                                          \
+                unsigned dx = SKRY_MIN(img_x, wp->dark_width-1),                                       \
+                         dy = SKRY_MIN(img_y, wp->dark_height-1);                                      \
+                                                                                                       \
+                const float *dark_val = (const float *)((const uint8_t *)wp->dark_pixels + dy*wp->dark_stride) \
+                                        + dx * NumChannels;                                            \
+                for (size_t ch = 0; ch < NumChannels; ch++)                                            \
+                    values[ch] = SKRY_MAX(0.0f, values[ch] - dark_val[ch]);                            \
+            }                                                                                          \
+        }                                                                                              \
+                                                                                                       \
+        if (wp->flatf_pixels)                                                                          \
+        {                                                                                              \
+            unsigned ffx = SKRY_MIN(img_x, wp->ff_width-1),                                            \
+                     ffy = SKRY_MIN(img_y, wp->ff_height-1);                                           \
+                                                                                                       \
+            /* The flat-field contains inverted values, so we multiply instead of dividing */          \
+            float ff_val = ((const float *)((const uint8_t *)wp->flatf_pixels + ffy*wp->flatf_stride))[ffx]; \
+            for (size_t ch = 0; ch < NumChannels; ch++)                                                \
+                values[ch] *= ff_val;                                                                  \
+        }                                                                                              \
+                                                                                                       \
+        add_pixel_values(wp->stacking, x, span->y, values, NumChannels);                              \
+    }                                                                                                  \
+}
+
+DEFINE_WARP_SPAN(warp_span_mono8,   uint8_t,  1)
+DEFINE_WARP_SPAN(warp_span_mono16,  uint16_t, 1)
+DEFINE_WARP_SPAN(warp_span_mono32f, float,    1)
+DEFINE_WARP_SPAN(warp_span_rgb8,    uint8_t,  3)
+DEFINE_WARP_SPAN(warp_span_rgb16,   uint16_t, 3)
+DEFINE_WARP_SPAN(warp_span_rgb32f,  float,    3)
+
+/// Returns the span warping function for images in 'pix_fmt' (one of formats used by 'stack_curr_img()')
+static
+fn_warp_span *get_warp_span_func(enum SKRY_pixel_format pix_fmt)
+{
+    switch (pix_fmt)
+    {
+    case SKRY_PIX_MONO8:   return warp_span_mono8;
+    case SKRY_PIX_MONO16:  return warp_span_mono16;
+    case SKRY_PIX_MONO32F: return warp_span_mono32f;
+    case SKRY_PIX_RGB8:    return warp_span_rgb8;
+    case SKRY_PIX_RGB16:   return warp_span_rgb16;
+    case SKRY_PIX_RGB32F:  return warp_span_rgb32f;
+    default: return 0;
+    }
+}
+
+/// Finds the bounding box of source positions (in the current image) of a triangle's pixels in stack rows [y_start; y_end)
+/** Returns 0 if the triangle has no pixels in these rows. Positions are relative to the images' intersection. */
+static
+int get_src_bbox_in_rows(const struct rasterized_triangle *rtri, const struct triangle_warp *warp,
+                         int y_start, int y_end,
+                         int *xmin, int *xmax, int *ymin, int *ymax)
+{
+    float fxmin = FLT_MAX, fxmax = -FLT_MAX, fymin = FLT_MAX, fymax = -FLT_MAX;
+    int has_pixels = 0;
+
+    for (size_t s = 0; s < DA_SIZE(rtri->spans); s++)
+    {
+        const struct stack_triangle_span *span = &rtri->spans.data[s];
+        if (span->y < y_start || span->y >= y_end)
+            continue;
+
+        has_pixels = 1;
+
+        // The source position is linear along the span, so its extremes are at the first and last pixel
+        for (int x = span->x_start; x < span->x_end; x += SKRY_MAX(1, span->x_end - 1 - span->x_start))
+        {
+            float u = span->u + (x - span->x_start) * rtri->du_dx,
+                  v = span->v + (x - span->x_start) * rtri->dv_dx;
+
+            float srcx = u * warp->p0.x + v * warp->p1.x + (1.0f - u - v) * warp->p2.x;
+            float srcy = u * warp->p0.y + v * warp->p1.y + (1.0f - u - v) * warp->p2.y;
+
+            fxmin = SKRY_MIN(fxmin, srcx); fxmax = SKRY_MAX(fxmax, srcx);
+            fymin = SKRY_MIN(fymin, srcy); fymax = SKRY_MAX(fymax, srcy);
+        }
+    }
+
+    if (has_pixels)
+    {
+        *xmin = SKRY_MIN(*xmin, (int)floorf(fxmin)); *xmax = SKRY_MAX(*xmax, (int)ceilf(fxmax));
+        *ymin = SKRY_MIN(*ymin, (int)floorf(fymin)); *ymax = SKRY_MAX(*ymax, (int)ceilf(fymax));
+    }
+    return has_pixels;
+}
+
+/// Determines placement of the triangles in the current image and reads the part of the image they cover
+/** Returns SKRY_SUCCESS or an error. */
+static
+enum SKRY_result read_step_img(SKRY_Stacking *stacking, SKRY_ImgSequence *img_seq, struct step_img *simg)
+{
+    size_t curr_img_idx = SKRY_get_curr_img_idx_within_active_subset(img_seq);
+    struct SKRY_rect intersection = SKRY_get_intersection(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)));
+    struct SKRY_point alignment_ofs = SKRY_get_image_ofs(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)), curr_img_idx);
+
+    // For each triangle, check if its vertices are valid in the current image. If they are,
+    // add the triangle's contents to the corresponding triangle patch in the stack.
+    const struct SKRY_triangulation *triangulation = SKRY_get_ref_pts_triangulation(stacking->ref_pt_align);
+
+    struct SKRY_rect envelope = { .x = 0, .y = 0,
+                                  .width = intersection.width,
+                                  .height = intersection.height };
+
+    // Bounding box of the stacked triangles in the current image
+    int xmin = INT_MAX, xmax = INT_MIN, ymin = INT_MAX, ymax = INT_MIN;
+
+    size_t num_stacked_tris = 0;
+
+    SKRY_get_ref_pt_positions_in_img(stacking->ref_pt_align, curr_img_idx,
+                                     stacking->img_ref_pt_pos, stacking->img_ref_pt_valid);
+
+    // A pass of SKRY_STACK_MEDIAN stacks only a band of rows, so only the triangles
+    // (and their parts) which overlap it are needed
+    int is_band_pass = (SKRY_STACK_MEDIAN == stacking->method);
+    int band_y_start = (int)(stacking->curr_pass * stacking->band_height),
+        band_y_end = SKRY_MIN((int)stacking->height, band_y_start + (int)stacking->band_height);
+
+    // Find the list of triangles valid in the current image
+    for (size_t tri_idx = 0; tri_idx < SKRY_get_num_triangles(triangulation); tri_idx++)
+    {
+        const struct SKRY_triangle *tri = &SKRY_get_triangles(triangulation)[tri_idx];
+        struct triangle_warp *warp = &simg->tri_warps[tri_idx];
+        warp->is_stacked = 0;
+
+        struct
+        {
+            struct SKRY_point pos; // position of triangle's vertex in the current image
+            int is_valid;
+        } p0, p1, p2;
 
-                    ((float *)((uint8_t *)stack_pixels + stack_stride*stp->y))[num_channels*stp->x + ch] += src_val;
+        p0.pos = stacking->img_ref_pt_pos[tri->v0]; p0.is_valid = stacking->img_ref_pt_valid[tri->v0];
+        p1.pos = stacking->img_ref_pt_pos[tri->v1]; p1.is_valid = stacking->img_ref_pt_valid[tri->v1];
+        p2.pos = stacking->img_ref_pt_pos[tri->v2]; p2.is_valid = stacking->img_ref_pt_valid[tri->v2];
+
+        if (p0.is_valid && p1.is_valid && p2.is_valid)
+        {
+            // Due to the way reference point alignment works, it is allowed for a point
+            // to be outside the image intersection at some times. Must be careful not to
+            // try interpolating pixel values from outside the current image.
+            // (Cannot use 'intersection' here directly, because its origin may not be (0,0),
+            // and p0, p1, p2 have coordinates relative to intersection's origin).
+            int p0_inside = SKRY_RECT_CONTAINS(envelope, p0.pos);
+            int p1_inside = SKRY_RECT_CONTAINS(envelope, p1.pos);
+            int p2_inside = SKRY_RECT_CONTAINS(envelope, p2.pos);
+
+            if (p0_inside || p1_inside || p2_inside)
+            {
+                *warp = (struct triangle_warp) { .p0 = p0.pos, .p1 = p1.pos, .p2 = p2.pos,
+                                                 .all_inside = p0_inside && p1_inside && p2_inside,
+                                                 .is_stacked = 1 };
+
+                if (is_band_pass)
+                    warp->is_stacked = get_src_bbox_in_rows(&stacking->rasterized_tris[tri_idx], warp,
+                                                            band_y_start, band_y_end,
+                                                            &xmin, &xmax, &ymin, &ymax);
+                else
+                {
+                    xmin = SKRY_MIN(xmin, SKRY_MIN(p0.pos.x, SKRY_MIN(p1.pos.x, p2.pos.x)));
+                    xmax = SKRY_MAX(xmax, SKRY_MAX(p0.pos.x, SKRY_MAX(p1.pos.x, p2.pos.x)));
+                    ymin = SKRY_MIN(ymin, SKRY_MIN(p0.pos.y, SKRY_MIN(p1.pos.y, p2.pos.y)));
+                    ymax = SKRY_MAX(ymax, SKRY_MAX(p0.pos.y, SKRY_MAX(p1.pos.y, p2.pos.y)));
                 }
 
-                stacking->added_img_count[stp->x + stp->y*intersection.width] += 1;
+                if (warp->is_stacked)
+                    num_stacked_tris++;
             }
         }
     }
 
-    SKRY_free_image(img);
+    simg->img = 0;
+    PERF_ADD(triangles_stacked, num_stacked_tris);
+    if (0 == num_stacked_tris)
+        return SKRY_SUCCESS;
+
+    // Pixels outside the images' intersection are not used
+    struct SKRY_rect bbox = { .x = SKRY_MAX(0, xmin),
+                              .y = SKRY_MAX(0, ymin) };
+    bbox.width = SKRY_MIN((int)intersection.width - 1, xmax) - bbox.x + 1;
+    bbox.height = SKRY_MIN((int)intersection.height - 1, ymax) - bbox.y + 1;
+
+    // Only the stacked triangles are sampled, so read just the part of image they cover
+    // (plus a margin which makes demosaicing and interpolation at the fragment's borders
+    // give the same results as for the whole image)
+    struct SKRY_rect fragment = { .x = intersection.x + alignment_ofs.x + bbox.x - FRAGMENT_MARGIN,
+                                  .y = intersection.y + alignment_ofs.y + bbox.y - FRAGMENT_MARGIN,
+                                  .width = bbox.width + 2*FRAGMENT_MARGIN,
+                                  .height = bbox.height + 2*FRAGMENT_MARGIN };
+
+    enum SKRY_result result;
+    simg->img = SKRY_get_curr_img_fragment(img_seq, &fragment, &result);
+    if (SKRY_SUCCESS != result)
+    {
+        LOG_MSG(SKRY_LOG_STACKING, "Could not load image %zu from image sequence %p (error: %d).",
+                                 SKRY_get_curr_img_idx(img_seq),      (void *)img_seq, (int)result);
+        return result;
+    }
+
+    simg->wp = (struct warp_params) { .stacking = stacking,
+                                      .fragment = fragment,
+                                      .intersection = intersection,
+                                      .alignment_ofs = alignment_ofs };
+
+    return SKRY_SUCCESS;
+}
+
+/// Frees the images read in the current step
+static
+void free_step_imgs(SKRY_Stacking *stacking)
+{
+    for (size_t i = 0; i < stacking->num_step_imgs; i++)
+        stacking->step_imgs[i].img = SKRY_free_image(stacking->step_imgs[i].img);
+}
+
+/// Adds contents of triangles selected in 'stacking->step_imgs' to the stack
+/** Returns SKRY_SUCCESS or an error. */
+static
+enum SKRY_result stack_step_imgs(SKRY_Stacking *stacking)
+{
+    // Images are sampled in their native integer format (if they have one), so that
+    // at most a (partial) demosaicing is needed instead of conversion to floating-point
+    enum SKRY_pixel_format src_pix_fmt =
+        (SKRY_PIX_INVALID != stacking->native_pix_fmt) ? stacking->native_pix_fmt : stacking->stack_pix_fmt;
+
+    // Multiplier of interpolated values: the float accumulator stores values from [0; 1]
+    float src_val_scale = 1.0f;
+    if (!stacking->accum_fixed && SKRY_PIX_INVALID != stacking->native_pix_fmt)
+        src_val_scale = 1.0f / (BITS_PER_CHANNEL[stacking->native_pix_fmt] == 8 ? 0xFF : 0xFFFF);
+
+    // Reading is sequential, but the images can be converted at the same time
+    int conversion_failed = 0;
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < stacking->num_step_imgs; i++)
+    {
+        struct step_img *simg = &stacking->step_imgs[i];
+        if (simg->img && SKRY_get_img_pix_fmt(simg->img) != src_pix_fmt)
+        {
+            SKRY_Image *converted = SKRY_convert_pix_fmt(simg->img, src_pix_fmt, SKRY_DEMOSAIC_HQLINEAR);
+            SKRY_free_image(simg->img);
+            simg->img = converted;
+            if (!converted)
+            {
+                #pragma omp atomic write
+                conversion_failed = 1;
+            }
+        }
+    }
+    if (conversion_failed)
+        return SKRY_OUT_OF_MEMORY;
+
+    for (size_t i = 0; i < stacking->num_step_imgs; i++)
+    {
+        struct step_img *simg = &stacking->step_imgs[i];
+        if (!simg->img)
+            continue;
+
+        simg->wp.src_pixels = SKRY_get_line(simg->img, 0);
+        simg->wp.src_stride = SKRY_get_line_stride_in_bytes(simg->img);
+        simg->wp.src_val_scale = src_val_scale;
+        if (stacking->flatfield)
+        {
+            simg->wp.flatf_pixels = SKRY_get_line(stacking->flatfield, 0);
+            simg->wp.flatf_stride = SKRY_get_line_stride_in_bytes(stacking->flatfield);
+            simg->wp.ff_width = SKRY_get_img_width(stacking->flatfield);
+            simg->wp.ff_height = SKRY_get_img_height(stacking->flatfield);
+        }
+        if (stacking->dark)
+        {
+            simg->wp.dark_pixels = SKRY_get_line(stacking->dark, 0);
+            simg->wp.dark_stride = SKRY_get_line_stride_in_bytes(stacking->dark);
+            simg->wp.dark_width = SKRY_get_img_width(stacking->dark);
+            simg->wp.dark_height = SKRY_get_img_height(stacking->dark);
+        }
+    }
+
+    // Images stacked (in order) by the accelerator; if it fails, the remaining ones are stacked by the CPU
+    size_t num_accel_stacked = 0;
+    if (stacking->accel_stack)
+    {
+        for (; num_accel_stacked < stacking->num_step_imgs; num_accel_stacked++)
+        {
+            const struct step_img *simg = &stacking->step_imgs[num_accel_stacked];
+            if (!simg->img)
+                continue;
+
+            for (size_t tri_idx = 0; tri_idx < stacking->num_triangles; tri_idx++)
+            {
+                const struct triangle_warp *warp = &simg->tri_warps[tri_idx];
+                stacking->accel_tri_warps[tri_idx] = (struct accel_tri_warp) {
+                    .p0x = warp->p0.x, .p0y = warp->p0.y,
+                    .p1x = warp->p1.x, .p1y = warp->p1.y,
+                    .p2x = warp->p2.x, .p2y = warp->p2.y,
+                    .all_inside = warp->all_inside,
+                    .is_stacked = warp->is_stacked };
+            }
+
+            if (SKRY_SUCCESS != accel_stack_image(stacking->accel_stack, simg->img, simg->wp.fragment,
+                                                  simg->wp.intersection, simg->wp.alignment_ofs,
+                                                  src_val_scale, stacking->accel_tri_warps))
+                break;
+        }
+
+        if (num_accel_stacked < stacking->num_step_imgs)
+        {
+            LOG_MSG(SKRY_LOG_STACKING, "Accelerator failed, continuing stacking on the CPU.");
+            enum SKRY_result result = finish_accel_stacking(stacking);
+            if (SKRY_SUCCESS != result)
+                return result;
+        }
+    }
+
+    fn_warp_span *warp_span = get_warp_span_func(src_pix_fmt);
+
+    // Rows stacked in the current pass
+    int band_y_start = 0, band_y_end = stacking->height;
+    if (SKRY_STACK_MEDIAN == stacking->method)
+    {
+        band_y_start = stacking->curr_pass * stacking->band_height;
+        band_y_end = SKRY_MIN(band_y_end, band_y_start + (int)stacking->band_height);
+    }
+
+    // Triangles' sizes vary a lot, so instead of distributing triangles among threads,
+    // distribute (dynamically) tiles of the stack; each tile's accumulator values
+    // are then kept in cache while stacking. A tile is processed by a single thread
+    // for all images of the step (in order), so there is enough work for all threads
+    // even if every image has few valid triangles, and the result does not depend
+    // on the number of images per step.
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t tile_idx = 0; tile_idx < (size_t)stacking->num_tiles_x * stacking->num_tiles_y; tile_idx++)
+    {
+        const tile_span_list_t *tile = &stacking->tiles[tile_idx];
+
+        for (size_t i = num_accel_stacked; i < stacking->num_step_imgs; i++)
+        {
+            const struct step_img *simg = &stacking->step_imgs[i];
+            if (!simg->img)
+                continue;
+
+            for (size_t s = 0; s < DA_SIZE(*tile); s++)
+            {
+                const struct tile_span *tspan = &tile->data[s];
+                const struct triangle_warp *warp = &simg->tri_warps[tspan->tri_idx];
+                if (!warp->is_stacked)
+                    continue;
+
+                if (tspan->span->y < band_y_start || tspan->span->y >= band_y_end)
+                    continue;
+
+                warp_span(&simg->wp, tspan, warp, &stacking->rasterized_tris[tspan->tri_idx]);
+            }
+        }
+    }
+
+    return SKRY_SUCCESS;
+}
+
+/// Moves to the first image of the stacked range
+static
+void seek_range_start(SKRY_Stacking *stacking, SKRY_ImgSequence *img_seq)
+{
+    SKRY_seek_start(img_seq);
+    for (size_t i = 0; i < stacking->range_first; i++)
+        SKRY_seek_next(img_seq);
+
+    stacking->curr_pass_num_stacked = 0;
+}
+
+/// Moves to the next image of the stacked range; returns SKRY_SUCCESS or SKRY_NO_MORE_IMAGES
+static
+enum SKRY_result seek_next_in_range(SKRY_Stacking *stacking, SKRY_ImgSequence *img_seq)
+{
+    if (stacking->range_count > 0 && stacking->curr_pass_num_stacked == stacking->range_count)
+        return SKRY_NO_MORE_IMAGES;
+    else
+        return SKRY_seek_next(img_seq);
+}
+
+static
+enum SKRY_result stacking_step(SKRY_Stacking *stacking)
+{
+    enum SKRY_result result;
+    SKRY_ImgSequence *img_seq = SKRY_get_img_seq(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)));
+
+    if (stacking->first_step_complete)
+    {
+        result = seek_next_in_range(stacking, img_seq);
+
+        if (SKRY_NO_MORE_IMAGES == result)
+        {
+            enum SKRY_result accel_result = finish_accel_stacking(stacking);
+            if (SKRY_SUCCESS != accel_result)
+                return accel_result;
+
+            finish_stacking_pass(stacking);
+        }
+
+        if (SKRY_NO_MORE_IMAGES == result && stacking->curr_pass + 1 < stacking->num_passes)
+        {
+            stacking->curr_pass++;
+            LOG_MSG(SKRY_LOG_STACKING, "Starting pass %zu of %zu.", stacking->curr_pass + 1, stacking->num_passes);
+            seek_range_start(stacking, img_seq);
+        }
+        else if (SKRY_NO_MORE_IMAGES == result)
+        {
+            stacking->image_stack = SKRY_new_image(stacking->width, stacking->height, stacking->stack_pix_fmt, 0, 1);
+            if (!stacking->image_stack)
+                return SKRY_OUT_OF_MEMORY;
+
+            normalize_image_stack(stacking, stacking->image_stack);
+
+            stacking->statistics.time.total_sec = SKRY_clock_sec() - stacking->statistics.time.start;
+            LOG_MSG(SKRY_LOG_STACKING, "Processing time: %.3f s", stacking->statistics.time.total_sec);
+
+            stacking->is_complete = 1;
+            return SKRY_LAST_STEP;
+        }
+        else if (SKRY_SUCCESS != result)
+        {
+            LOG_MSG(SKRY_LOG_STACKING, "Could not seek to the next image of image sequence %p (error: %d).",
+                    (void *)img_seq, (int)result);
+            return result;
+        }
+    }
+    else if (0 == stacking->num_passes)
+    {
+        if (SKRY_SUCCESS != (result = init_stacking_passes(stacking)))
+            return result;
+
+        seek_range_start(stacking, img_seq);
+    }
+
+    // Read the current image and (if there are enough) the subsequent ones of the current pass
+    stacking->num_step_imgs = 0;
+    do
+    {
+        result = read_step_img(stacking, img_seq, &stacking->step_imgs[stacking->num_step_imgs]);
+        stacking->num_step_imgs++;
+        if (SKRY_SUCCESS != result)
+        {
+            free_step_imgs(stacking);
+            return result;
+        }
+
+        stacking->curr_pass_num_stacked++;
+    } while (stacking->num_step_imgs < stacking->max_step_imgs &&
+             SKRY_SUCCESS == seek_next_in_range(stacking, img_seq));
+
+    DA_SET_SIZE(stacking->curr_step_stacked_triangles, 0);
+    for (size_t tri_idx = 0; tri_idx < stacking->num_triangles; tri_idx++)
+        for (size_t i = 0; i < stacking->num_step_imgs; i++)
+            if (stacking->step_imgs[i].tri_warps[tri_idx].is_stacked)
+            {
+                DA_APPEND(stacking->curr_step_stacked_triangles, tri_idx);
+                break;
+            }
+
+    result = stack_step_imgs(stacking);
+    free_step_imgs(stacking);
+    if (SKRY_SUCCESS != result)
+        return result;
 
     if (!stacking->first_step_complete)
         stacking->first_step_complete = 1;
@@ -543,6 +1551,453 @@ enum SKRY_result SKRY_stacking_step(SKRY_Stacking *stacking)
     return SKRY_SUCCESS;
 }
 
+/// Returns SKRY_SUCCESS (i.e. more steps left to do), SKRY_LAST_STEP (no more steps) or an error
+enum SKRY_result SKRY_stacking_step(SKRY_Stacking *stacking)
+{
+    struct perf_step perf_step;
+    begin_perf_step(&perf_step);
+
+    enum SKRY_result result = stacking_step(stacking);
+
+    const SKRY_ImgSequence *img_seq = SKRY_get_img_seq(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align)));
+    end_perf_step(&perf_step, &stacking->perf_stats, "Stacking", img_seq,
+                  SKRY_get_curr_img_idx_within_active_subset(img_seq));
+    return result;
+}
+
+static
+enum SKRY_result stacking_step_func(void *stacking) { return SKRY_stacking_step(stacking); }
+
+static
+size_t get_stacking_curr_pass(const void *stacking, size_t *num_passes)
+{
+    const SKRY_Stacking *s = stacking;
+    *num_passes = SKRY_MAX(s->num_passes, 1);
+    return s->curr_pass;
+}
+
+enum SKRY_result SKRY_stacking_run(SKRY_Stacking *stacking, size_t max_steps,
+                                   SKRY_progress_callback_fn progress_callback, void *callback_data,
+                                   const int *cancel_flag)
+{
+    if (SKRY_is_stacking_complete(stacking))
+        return SKRY_LAST_STEP;
+
+    return run_phase_steps(stacking_step_func, stacking, SKRY_get_img_seq(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align))),
+                           get_stacking_curr_pass, max_steps,
+                           progress_callback, callback_data, cancel_flag);
+}
+
+void SKRY_get_stacking_perf_stats(const SKRY_Stacking *stacking, struct SKRY_perf_stats *stats)
+{
+    *stats = stacking->perf_stats;
+}
+
+enum SKRY_result SKRY_set_stacking_method(SKRY_Stacking *stacking, enum SKRY_stacking_method method, float kappa)
+{
+    if (stacking->first_step_complete || stacking->num_passes > 0)
+        return SKRY_INVALID_PARAMETERS;
+
+    switch (method)
+    {
+    case SKRY_STACK_KAPPA_SIGMA:
+        if (!(kappa > 0.0f))
+            return SKRY_INVALID_PARAMETERS;
+        // fall through
+
+    case SKRY_STACK_MEAN:
+    case SKRY_STACK_MEDIAN:
+        stacking->method = method;
+        stacking->kappa = kappa;
+        return SKRY_SUCCESS;
+
+    default: return SKRY_INVALID_PARAMETERS;
+    }
+}
+
+enum SKRY_result SKRY_set_stacking_accumulator(SKRY_Stacking *stacking, enum SKRY_stacking_accumulator accum)
+{
+    if (stacking->first_step_complete || stacking->num_passes > 0)
+        return SKRY_INVALID_PARAMETERS;
+
+    switch (accum)
+    {
+    case SKRY_STACK_ACCUM_FLOAT:
+    case SKRY_STACK_ACCUM_FIXED_POINT:
+        stacking->requested_accum = accum;
+        return SKRY_SUCCESS;
+
+    default: return SKRY_INVALID_PARAMETERS;
+    }
+}
+
+enum SKRY_result SKRY_set_stacking_mem_budget(SKRY_Stacking *stacking, size_t max_bytes)
+{
+    if (stacking->first_step_complete || stacking->num_passes > 0)
+        return SKRY_INVALID_PARAMETERS;
+
+    stacking->mem_budget = max_bytes;
+    return SKRY_SUCCESS;
+}
+
+/// Returns 'dark' converted to 'stacking->stack_pix_fmt' or null if out of memory
+static
+SKRY_Image *prepare_dark_frame(const SKRY_Stacking *stacking, const SKRY_Image *dark)
+{
+    enum SKRY_pixel_format dark_pix_fmt = SKRY_get_img_pix_fmt(dark);
+    int is_raw_color_seq = (stacking->img_seq_pix_fmt > SKRY_PIX_CFA_MIN && stacking->img_seq_pix_fmt < SKRY_PIX_CFA_MAX);
+    int is_mono_dark = (NUM_CHANNELS[dark_pix_fmt] == 1 && !(dark_pix_fmt > SKRY_PIX_CFA_MIN && dark_pix_fmt < SKRY_PIX_CFA_MAX));
+
+    if (dark_pix_fmt == stacking->stack_pix_fmt && !is_raw_color_seq)
+        return SKRY_get_img_copy(dark);
+    else if (!is_raw_color_seq || !is_mono_dark)
+        return SKRY_convert_pix_fmt(dark, stacking->stack_pix_fmt, SKRY_DEMOSAIC_HQLINEAR);
+
+    // 'dark' is a mosaic of raw color values. It is demosaiced the same way as the images, so that
+    // (the demosaicing being linear) subtracting it from a demosaiced image is equivalent
+    // to subtracting it from the image's raw values.
+    unsigned width = SKRY_get_img_width(dark),
+             height = SKRY_get_img_height(dark);
+    SKRY_Image *float_dark = (SKRY_PIX_MONO32F == dark_pix_fmt) ? 0 : SKRY_convert_pix_fmt(dark, SKRY_PIX_MONO32F, SKRY_DEMOSAIC_DONT_CARE);
+    SKRY_Image *mosaic = SKRY_new_image(width, height, SKRY_PIX_MONO16, 0, 0);
+    SKRY_Image *result = 0;
+    if (mosaic && (float_dark || SKRY_PIX_MONO32F == dark_pix_fmt))
+    {
+        const SKRY_Image *src = float_dark ? float_dark : dark;
+        for (unsigned y = 0; y < height; y++)
+        {
+            const float *src_line = SKRY_get_line(src, y);
+            uint16_t *dest_line = SKRY_get_line(mosaic, y);
+            for (unsigned x = 0; x < width; x++)
+                dest_line[x] = (uint16_t)(SKRY_MAX(0.0f, SKRY_MIN(1.0f, src_line[x])) * 0xFFFF + 0.5f);
+        }
+
+        SKRY_reinterpret_as_CFA(mosaic, SKRY_PIX_CFA_PATTERN[stacking->img_seq_pix_fmt]);
+        result = SKRY_convert_pix_fmt(mosaic, SKRY_PIX_RGB32F, SKRY_DEMOSAIC_HQLINEAR);
+    }
+
+    SKRY_free_image(mosaic);
+    SKRY_free_image(float_dark);
+    return result;
+}
+
+enum SKRY_result SKRY_set_stacking_dark_frame(SKRY_Stacking *stacking, const SKRY_Image *dark)
+{
+    if (stacking->first_step_complete || stacking->num_passes > 0)
+        return SKRY_INVALID_PARAMETERS;
+
+    SKRY_Image *dark_copy = 0;
+    if (dark)
+    {
+        dark_copy = prepare_dark_frame(stacking, dark);
+        if (!dark_copy)
+            return SKRY_OUT_OF_MEMORY;
+    }
+
+    SKRY_free_image(stacking->dark);
+    stacking->dark = dark_copy;
+    return SKRY_SUCCESS;
+}
+
+enum SKRY_result SKRY_set_stacking_images_per_step(SKRY_Stacking *stacking, size_t num_images)
+{
+    if (stacking->first_step_complete || stacking->num_passes > 0 || 0 == num_images)
+        return SKRY_INVALID_PARAMETERS;
+
+    stacking->max_step_imgs = num_images;
+    return SKRY_SUCCESS;
+}
+
+enum SKRY_result SKRY_set_stacking_preview_decimation(SKRY_Stacking *stacking, unsigned decimation)
+{
+    if (stacking->first_step_complete || stacking->num_passes > 0 ||
+        1 == decimation || decimation > STACKING_TILE_SIZE || (decimation & (decimation - 1)) != 0)
+    {
+        return SKRY_INVALID_PARAMETERS;
+    }
+
+    stacking->preview_shift = 0;
+    while (decimation > 1U << stacking->preview_shift)
+        stacking->preview_shift++;
+
+    return SKRY_SUCCESS;
+}
+
+size_t SKRY_get_stacking_num_passes(const SKRY_Stacking *stacking)
+{
+    return stacking->num_passes;
+}
+
+enum SKRY_result SKRY_set_stacking_img_range(SKRY_Stacking *stacking, size_t first, size_t count)
+{
+    size_t num_active = SKRY_get_active_img_count(SKRY_get_img_seq(SKRY_get_img_align(SKRY_get_qual_est(stacking->ref_pt_align))));
+
+    if (stacking->first_step_complete || stacking->num_passes > 0 ||
+        0 == count || first >= num_active || count > num_active - first)
+    {
+        return SKRY_INVALID_PARAMETERS;
+    }
+
+    stacking->range_first = first;
+    stacking->range_count = count;
+    return SKRY_SUCCESS;
+}
+
+enum SKRY_result SKRY_set_stacking_ref_pt_positions(SKRY_Stacking *stacking,
+                                                    const struct SKRY_point_flt positions[],
+                                                    size_t num_points)
+{
+    if (stacking->first_step_complete || stacking->num_passes > 0 || num_points != stacking->num_ref_points)
+        return SKRY_INVALID_PARAMETERS;
+
+    memcpy(stacking->final_ref_pt_pos, positions, num_points * sizeof(*positions));
+
+    if (!rasterize_triangles(stacking))
+        return SKRY_OUT_OF_MEMORY;
+
+    return SKRY_SUCCESS;
+}
+
+/// Signature of partial stack files created by SKRY_save_partial_stack()
+static const char PARTIAL_STACK_SIGNATURE[8] = { 'S', 'K', 'R', 'Y', 'P', 'S', 'T', 'K' };
+
+#define PARTIAL_STACK_FILE_VERSION 1
+
+/** A partial stack file consists of the header followed by the accumulator's rows
+    (top to bottom). For each pixel, a row contains sums of the channels' values
+    (in the range of [0; 1] per image), followed by the number of stacked images.
+    All fields (including the float values) are stored little-endian. */
+struct partial_stack_header
+{
+    char signature[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_channels;
+    uint32_t uses_flatfield;
+    uint32_t num_images; ///< Number of images stacked to produce the partial stack
+};
+
+/// Swaps bytes of each element of 'values' if 'do_swap' is nonzero
+static
+void cnd_swap_floats(float values[], size_t num_values, int do_swap)
+{
+    if (do_swap)
+        for (size_t i = 0; i < num_values; i++)
+        {
+            uint32_t bits;
+            memcpy(&bits, &values[i], sizeof(bits));
+            bits = cnd_swap_32(bits, do_swap);
+            memcpy(&values[i], &bits, sizeof(bits));
+        }
+}
+
+/// Fills 'row' with the accumulator's row 'y' in the format of partial stack files
+static
+void get_accumulator_row(const SKRY_Stacking *stacking, unsigned y, float row[])
+{
+    size_t num_channels = NUM_CHANNELS[stacking->stack_pix_fmt];
+
+    if (stacking->accum_fixed)
+    {
+        float fixed_point_to_float = 1.0f / (stacking->fixed_point_scale *
+            (BITS_PER_CHANNEL[stacking->native_pix_fmt] == 8 ? 0xFF : 0xFFFF));
+
+        const uint32_t *sums_line = stacking->accum_fixed + (size_t)y * stacking->width * num_channels;
+        const uint16_t *count_line = stacking->added_img_count + (size_t)y * stacking->width;
+        for (unsigned x = 0; x < stacking->width; x++)
+        {
+            for (size_t ch = 0; ch < num_channels; ch++)
+                row[x*(num_channels + 1) + ch] = sums_line[x*num_channels + ch] * fixed_point_to_float;
+            row[x*(num_channels + 1) + num_channels] = count_line[x];
+        }
+    }
+    else
+        memcpy(row, stacking->accumulator + (size_t)y * stacking->width * (num_channels + 1),
+               stacking->width * (num_channels + 1) * sizeof(*row));
+}
+
+/// Saves the (un-normalized) accumulated values and pixel counts
+enum SKRY_result SKRY_save_partial_stack(const SKRY_Stacking *stacking, const char *file_name)
+{
+    if (SKRY_STACK_MEAN != stacking->method || 0 == stacking->num_passes)
+        return SKRY_INVALID_PARAMETERS;
+
+    enum SKRY_result sync_result = sync_accumulator(stacking);
+    if (SKRY_SUCCESS != sync_result)
+        return sync_result;
+
+    size_t num_channels = NUM_CHANNELS[stacking->stack_pix_fmt];
+    size_t row_len = stacking->width * (num_channels + 1);
+    float *row = malloc(row_len * sizeof(*row));
+    if (!row)
+        return SKRY_OUT_OF_MEMORY;
+
+    FILE *file = fopen(file_name, "wb");
+    if (!file)
+    {
+        free(row);
+        return SKRY_CANNOT_CREATE_FILE;
+    }
+
+    int is_machine_b_e = is_machine_big_endian();
+
+    struct partial_stack_header header;
+    memcpy(header.signature, PARTIAL_STACK_SIGNATURE, sizeof(header.signature));
+    header.version = cnd_swap_32(PARTIAL_STACK_FILE_VERSION, is_machine_b_e);
+    header.width = cnd_swap_32(stacking->width, is_machine_b_e);
+    header.height = cnd_swap_32(stacking->height, is_machine_b_e);
+    header.num_channels = cnd_swap_32(num_channels, is_machine_b_e);
+    header.uses_flatfield = cnd_swap_32(0 != stacking->flatfield, is_machine_b_e);
+    header.num_images = cnd_swap_32(stacking->curr_pass_num_stacked, is_machine_b_e);
+
+    enum SKRY_result result = SKRY_SUCCESS;
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        result = SKRY_FILE_IO_ERROR;
+
+    for (unsigned y = 0; y < stacking->height && SKRY_SUCCESS == result; y++)
+    {
+        get_accumulator_row(stacking, y, row);
+        cnd_swap_floats(row, row_len, is_machine_b_e);
+        if (fwrite(row, sizeof(*row), row_len, file) != row_len)
+            result = SKRY_FILE_IO_ERROR;
+    }
+
+    if (0 != fclose(file) && SKRY_SUCCESS == result)
+        result = SKRY_FILE_IO_ERROR;
+
+    free(row);
+    return result;
+}
+
+/// Adds contents of a partial stack file to 'merged' (allocating it if null)
+/** Returns SKRY_SUCCESS or an error. */
+static
+enum SKRY_result add_partial_stack(const char *file_name,
+                                   float **merged, ///< Format as in 'SKRY_stacking::accumulator'
+                                   struct partial_stack_header *merged_header ///< Set when 'merged' is allocated
+)
+{
+    FILE *file = fopen(file_name, "rb");
+    if (!file)
+        return SKRY_CANNOT_OPEN_FILE;
+
+    int is_machine_b_e = is_machine_big_endian();
+
+    struct partial_stack_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        0 != memcmp(header.signature, PARTIAL_STACK_SIGNATURE, sizeof(header.signature)) ||
+        PARTIAL_STACK_FILE_VERSION != cnd_swap_32(header.version, is_machine_b_e))
+    {
+        fclose(file);
+        return SKRY_UNSUPPORTED_FILE_FORMAT;
+    }
+    header.width = cnd_swap_32(header.width, is_machine_b_e);
+    header.height = cnd_swap_32(header.height, is_machine_b_e);
+    header.num_channels = cnd_swap_32(header.num_channels, is_machine_b_e);
+    header.uses_flatfield = cnd_swap_32(header.uses_flatfield, is_machine_b_e);
+    header.num_images = cnd_swap_32(header.num_images, is_machine_b_e);
+
+    if ((header.num_channels != 1 && header.num_channels != 3) || 0 == header.width || 0 == header.height)
+    {
+        fclose(file);
+        return SKRY_UNSUPPORTED_FILE_FORMAT;
+    }
+
+    size_t row_len = header.width * (header.num_channels + 1);
+    if (!*merged)
+    {
+        *merged = calloc(row_len * header.height, sizeof(**merged));
+        if (!*merged)
+        {
+            fclose(file);
+            return SKRY_OUT_OF_MEMORY;
+        }
+        *merged_header = header;
+        merged_header->num_images = 0;
+    }
+    else if (header.width != merged_header->width ||
+             header.height != merged_header->height ||
+             header.num_channels != merged_header->num_channels ||
+             header.uses_flatfield != merged_header->uses_flatfield)
+    {
+        fclose(file);
+        return SKRY_INVALID_PARAMETERS;
+    }
+
+    float *row = malloc(row_len * sizeof(*row));
+    if (!row)
+    {
+        fclose(file);
+        return SKRY_OUT_OF_MEMORY;
+    }
+
+    enum SKRY_result result = SKRY_SUCCESS;
+    for (unsigned y = 0; y < header.height; y++)
+    {
+        if (fread(row, sizeof(*row), row_len, file) != row_len)
+        {
+            result = SKRY_FILE_IO_ERROR;
+            break;
+        }
+        cnd_swap_floats(row, row_len, is_machine_b_e);
+
+        float *merged_row = *merged + y * row_len;
+        for (size_t i = 0; i < row_len; i++)
+            merged_row[i] += row[i];
+    }
+
+    merged_header->num_images += header.num_images;
+
+    free(row);
+    fclose(file);
+    return result;
+}
+
+/// Merges partial stacks saved with SKRY_save_partial_stack() and returns the normalized stack
+SKRY_Image *SKRY_merge_partial_stacks(size_t num_files,
+                                      const char *file_names[],
+                                      enum SKRY_result *result)
+{
+    if (0 == num_files)
+    {
+        if (result) *result = SKRY_INVALID_PARAMETERS;
+        return 0;
+    }
+
+    float *merged = 0;
+    struct partial_stack_header header;
+    memset(&header, 0, sizeof(header));
+    for (size_t i = 0; i < num_files; i++)
+    {
+        enum SKRY_result loc_result = add_partial_stack(file_names[i], &merged, &header);
+        if (SKRY_SUCCESS != loc_result)
+        {
+            LOG_MSG(SKRY_LOG_STACKING, "Could not merge partial stack %s (error: %d).", file_names[i], (int)loc_result);
+            free(merged);
+            if (result) *result = loc_result;
+            return 0;
+        }
+    }
+
+    SKRY_Image *img_stack = SKRY_new_image(header.width, header.height,
+                                           header.num_channels == 1 ? SKRY_PIX_MONO32F : SKRY_PIX_RGB32F, 0, 0);
+    if (!img_stack)
+    {
+        free(merged);
+        if (result) *result = SKRY_OUT_OF_MEMORY;
+        return 0;
+    }
+
+    average_accumulated_values(merged, header.uses_flatfield, img_stack);
+
+    LOG_MSG(SKRY_LOG_STACKING, "Merged %zu partial stacks (%u images in total).", num_files, (unsigned)header.num_images);
+
+    free(merged);
+    if (result) *result = SKRY_SUCCESS;
+    return img_stack;
+}
+
 /// Can be used only after stacking completes
 const SKRY_Image *SKRY_get_image_stack(const SKRY_Stacking *stacking)
 {
@@ -555,12 +2010,42 @@ const SKRY_Image *SKRY_get_image_stack(const SKRY_Stacking *stacking)
 /// Returns an incomplete image stack, updated after every stacking step
 SKRY_Image *SKRY_get_partial_image_stack(const SKRY_Stacking *stacking)
 {
-    SKRY_Image *result = SKRY_get_img_copy(stacking->image_stack);
-    normalize_image_stack(stacking->added_img_count, result,
-                          0 != stacking->flatfield);
+    if (stacking->is_complete)
+        return SKRY_get_img_copy(stacking->image_stack);
+
+    SKRY_Image *result = SKRY_new_image(stacking->width, stacking->height, stacking->stack_pix_fmt, 0, 1);
+    if (result && stacking->num_passes > 0)
+    {
+        if (SKRY_SUCCESS != sync_accumulator(stacking))
+            return SKRY_free_image(result);
+
+        normalize_image_stack(stacking, result);
+    }
     return result;
 }
 
+/// Returns a downsampled preview of the stack, updated after every stacking step
+SKRY_Image *SKRY_get_preview_image_stack(const SKRY_Stacking *stacking)
+{
+    if (0 == stacking->preview_shift)
+        return 0;
+
+    unsigned decimation = 1U << stacking->preview_shift;
+    SKRY_Image *preview = SKRY_new_image((stacking->width + decimation - 1) / decimation,
+                                         (stacking->height + decimation - 1) / decimation,
+                                         stacking->stack_pix_fmt, 0, 1);
+    if (preview && stacking->preview_accum)
+    {
+        average_accumulated_values(stacking->preview_accum, 0 != stacking->flatfield, preview);
+
+        // Values stacked with 'accum_fixed' are expressed in units of the native format
+        if (stacking->accum_fixed && !stacking->flatfield)
+            divide_pixel_values(preview, BITS_PER_CHANNEL[stacking->native_pix_fmt] == 8 ? 0xFF : 0xFFFF);
+    }
+
+    return preview;
+}
+
 int SKRY_is_stacking_complete(const SKRY_Stacking *stacking)
 {
     return stacking->is_complete;
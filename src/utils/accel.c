@@ -0,0 +1,803 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Accelerator (GPU) offload implementation.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if USE_OPENCL
+  #define CL_TARGET_OPENCL_VERSION 120
+  #if defined(__APPLE__)
+    #include <OpenCL/opencl.h>
+  #else
+    #include <CL/cl.h>
+  #endif
+#endif
+
+#include "accel.h"
+#include "logging.h"
+#include "match.h"
+#include "threads.h"
+
+
+static enum SKRY_accelerator g_accel = SKRY_ACCEL_NONE;
+
+#if USE_OPENCL
+
+#define MAX_OCL_PLATFORMS 16
+
+/// Number of ints per block in the block info buffer: offset of pixels, width, height, search center x, y
+#define BLOCK_INFO_LEN 5
+
+/** Work-item (x, y, b) calculates the cost of matching block 'b' at position
+    (x, y) of its search area, the same way as 'calc_block_match_cost()'.
+    Then work-item 'b' chooses the block's best position, testing them
+    in the same order as 'search_best_position()'.
+
+    For stacking, work-item (x, y) adds the value of stack pixel (x, y), warped, interpolated
+    and calibrated the same way as by 'fn_warp_span's in stacking.c. */
+static const char *ocl_kernels_src[] = {
+"#pragma OPENCL FP_CONTRACT OFF\n"
+"\n"
+"__kernel void calc_match_costs(\n"
+"    __global const uchar *img, int img_width, int img_height, int img_stride,\n"
+"    __global const uchar *blocks, __global const int *blk_info,\n"
+"    int search_radius, int min_fraction, __global ulong *costs)\n"
+"{\n"
+"    int diam = 2*search_radius;\n"
+"    int b = get_global_id(2);\n"
+"    __global const int *info = blk_info + 5*b;\n"
+"    int blkw = info[1], blkh = info[2];\n"
+"    int x = info[3] - search_radius + (int)get_global_id(0);\n"
+"    int y = info[4] - search_radius + (int)get_global_id(1);\n"
+"\n"
+"    int rx0 = (x >= blkw/2) ? 0 : blkw/2 - x;\n"
+"    int ry0 = (y >= blkh/2) ? 0 : blkh/2 - y;\n"
+"    int rx1 = (x + blkw/2 <= img_width) ? blkw : blkw - (x + blkw/2 - img_width);\n"
+"    int ry1 = (y + blkh/2 <= img_height) ? blkh : blkh - (y + blkh/2 - img_height);\n"
+"\n"
+"    ulong cost = ULONG_MAX;\n"
+"    if (rx0 < rx1 && ry0 < ry1\n"
+"        && rx1 - rx0 >= blkw/min_fraction && ry1 - ry0 >= blkh/min_fraction)\n"
+"    {\n"
+"        ulong sum = 0;\n"
+"        for (int j = ry0; j < ry1; j++)\n"
+"        {\n"
+"            __global const uchar *img_line = img + (y - blkh/2 + j)*img_stride + x - blkw/2;\n"
+"            __global const uchar *blk_line = blocks + info[0] + j*blkw;\n"
+"            uint line_sum = 0;\n"
+"            for (int i = rx0; i < rx1; i++)\n"
+"            {\n"
+"                int diff = img_line[i] - blk_line[i];\n"
+"                line_sum += diff*diff;\n"
+"            }\n"
+"            sum += line_sum;\n"
+"        }\n"
+"        cost = sum * (ulong)(blkw*blkh / ((rx1 - rx0)*(ry1 - ry0)));\n"
+"    }\n"
+"    costs[((size_t)b*diam + get_global_id(1))*diam + get_global_id(0)] = cost;\n"
+"}\n"
+"\n"
+"__kernel void find_min_costs(\n"
+"    __global const ulong *costs, __global const int *blk_info,\n"
+"    int search_radius, __global int *new_pos)\n"
+"{\n"
+"    int diam = 2*search_radius;\n"
+"    int b = get_global_id(0);\n"
+"    __global const ulong *blk_costs = costs + (size_t)b*diam*diam;\n"
+"\n"
+"    ulong min_cost = ULONG_MAX;\n"
+"    int best_x = 0, best_y = 0;\n"
+"    for (int j = 0; j < diam; j++)\n"
+"        for (int i = 0; i < diam; i++)\n"
+"            if (blk_costs[j*diam + i] < min_cost)\n"
+"            {\n"
+"                min_cost = blk_costs[j*diam + i];\n"
+"                best_x = blk_info[5*b + 3] - search_radius + i;\n"
+"                best_y = blk_info[5*b + 4] - search_radius + j;\n"
+"            }\n"
+"    new_pos[2*b] = best_x;\n"
+"    new_pos[2*b + 1] = best_y;\n"
+"}\n",
+
+"typedef struct { int tri_idx; float u, v; } stack_pixel;\n"
+"\n"
+"float load_value(__global const uchar *src, size_t ofs, int bytes_per_channel)\n"
+"{\n"
+"    if (1 == bytes_per_channel)\n"
+"        return src[ofs];\n"
+"    else if (2 == bytes_per_channel)\n"
+"        return *(__global const ushort *)(src + ofs);\n"
+"    else\n"
+"        return *(__global const float *)(src + ofs);\n"
+"}\n"
+"\n"
+"__kernel void stack_image(\n"
+"    __global const uchar *src, int src_stride, int bytes_per_channel,\n"
+"    int frag_x, int frag_y, int frag_width, int frag_height,\n"
+"    int isect_x, int isect_y, int isect_width, int isect_height,\n"
+"    int ofs_x, int ofs_y, float src_val_scale,\n"
+"    __global const stack_pixel *pixels, __global const int *tri_warps,\n"
+"    __global const float *flatfield, int ff_width, int ff_height,\n"
+"    __global const float *dark, int dark_width, int dark_height,\n"
+"    int stack_width, int num_channels, __global float *accum)\n"
+"{\n"
+"    size_t pix_idx = get_global_id(1) * stack_width + get_global_id(0);\n"
+"    int tri_idx = pixels[pix_idx].tri_idx;\n"
+"    if (tri_idx < 0)\n"
+"        return;\n"
+"\n"
+"    __global const int *warp = tri_warps + 8*tri_idx;\n"
+"    if (!warp[7])\n"
+"        return;\n"
+"\n"
+"    float u = pixels[pix_idx].u, v = pixels[pix_idx].v;\n"
+"    float srcx = u * warp[0] + v * warp[2] + (1.0f - u - v) * warp[4];\n"
+"    float srcy = u * warp[1] + v * warp[3] + (1.0f - u - v) * warp[5];\n"
+"    if (!warp[6] && (srcx < 0 || srcx > isect_width-1 || srcy < 0 || srcy > isect_height-1))\n"
+"        return;\n"
+"\n"
+"    float img_x = srcx + isect_x + ofs_x,\n"
+"          img_y = srcy + isect_y + ofs_y;\n"
+"\n"
+"    float values[3] = { 0.0f, 0.0f, 0.0f };\n"
+"    if (img_x >= frag_x && img_x < frag_x + frag_width - 1 &&\n"
+"        img_y >= frag_y && img_y < frag_y + frag_height - 1)\n"
+"    {\n"
+"        int x0 = (int)img_x, y0 = (int)img_y;\n"
+"        float tx = img_x - x0, ty = img_y - y0;\n"
+"        size_t ofs00 = (size_t)(y0 - frag_y) * src_stride + (size_t)(x0 - frag_x) * num_channels * bytes_per_channel;\n"
+"        size_t ofs01 = ofs00 + src_stride;\n"
+"        for (int ch = 0; ch < num_channels; ch++)\n"
+"        {\n"
+"            size_t ch_ofs = ch * bytes_per_channel, next_ofs = (num_channels + ch) * bytes_per_channel;\n"
+"            values[ch] = src_val_scale *\n"
+"                ((1.0f-ty) * ((1.0f-tx)*load_value(src, ofs00 + ch_ofs, bytes_per_channel) + tx*load_value(src, ofs00 + next_ofs, bytes_per_channel)) +\n"
+"                       ty  * ((1.0f-tx)*load_value(src, ofs01 + ch_ofs, bytes_per_channel) + tx*load_value(src, ofs01 + next_ofs, bytes_per_channel)));\n"
+"        }\n"
+"\n"
+"        if (dark_width > 0)\n"
+"        {\n"
+"            uint dx = (uint)fmin(img_x, (float)(dark_width-1)),\n"
+"                 dy = (uint)fmin(img_y, (float)(dark_height-1));\n"
+"            __global const float *dark_val = dark + ((size_t)dy*dark_width + dx) * num_channels;\n"
+"            for (int ch = 0; ch < num_channels; ch++)\n"
+"                values[ch] = fmax(0.0f, values[ch] - dark_val[ch]);\n"
+"        }\n"
+"    }\n"
+"\n"
+"    if (ff_width > 0)\n"
+"    {\n"
+"        uint ffx = (uint)fmin(img_x, (float)(ff_width-1)),\n"
+"             ffy = (uint)fmin(img_y, (float)(ff_height-1));\n"
+"        float ff_val = flatfield[(size_t)ffy*ff_width + ffx];\n"
+"        for (int ch = 0; ch < num_channels; ch++)\n"
+"            values[ch] *= ff_val;\n"
+"    }\n"
+"\n"
+"    __global float *accum_pix = accum + pix_idx * (num_channels + 1);\n"
+"    for (int ch = 0; ch < num_channels; ch++)\n"
+"        accum_pix[ch] += values[ch];\n"
+"    accum_pix[num_channels] += 1.0f;\n"
+"}\n"
+};
+
+/// Device buffer which is re-created only when a larger one is needed
+struct ocl_buffer
+{
+    cl_mem mem;
+    size_t capacity;
+};
+
+static struct
+{
+    cl_context context;
+    cl_command_queue queue;
+    cl_program program;
+    cl_kernel calc_match_costs, find_min_costs, stack_image;
+
+    struct ocl_buffer image, blocks, block_info, costs, new_pos;
+
+    /// Serializes the use of 'queue' and buffers
+    struct mutex *mutex;
+} ocl;
+
+static
+void release_buffer(struct ocl_buffer *buf)
+{
+    if (buf->mem)
+        clReleaseMemObject(buf->mem);
+    *buf = (struct ocl_buffer) { 0 };
+}
+
+static
+cl_int reserve_buffer(struct ocl_buffer *buf, size_t size, cl_mem_flags flags)
+{
+    if (buf->capacity >= size)
+        return CL_SUCCESS;
+
+    release_buffer(buf);
+
+    cl_int err;
+    buf->mem = clCreateBuffer(ocl.context, flags, size, 0, &err);
+    if (CL_SUCCESS == err)
+        buf->capacity = size;
+    else
+        buf->mem = 0;
+
+    return err;
+}
+
+static
+void free_opencl(void)
+{
+    release_buffer(&ocl.new_pos);
+    release_buffer(&ocl.costs);
+    release_buffer(&ocl.block_info);
+    release_buffer(&ocl.blocks);
+    release_buffer(&ocl.image);
+
+    if (ocl.stack_image)      clReleaseKernel(ocl.stack_image);
+    if (ocl.find_min_costs)   clReleaseKernel(ocl.find_min_costs);
+    if (ocl.calc_match_costs) clReleaseKernel(ocl.calc_match_costs);
+    if (ocl.program)          clReleaseProgram(ocl.program);
+    if (ocl.queue)            clReleaseCommandQueue(ocl.queue);
+    if (ocl.context)          clReleaseContext(ocl.context);
+    free_mutex(ocl.mutex);
+
+    memset(&ocl, 0, sizeof(ocl));
+}
+
+static
+void log_build_errors(cl_device_id device)
+{
+    size_t log_len = 0;
+    clGetProgramBuildInfo(ocl.program, device, CL_PROGRAM_BUILD_LOG, 0, 0, &log_len);
+    char *build_log = malloc(log_len + 1);
+    if (build_log)
+    {
+        if (CL_SUCCESS == clGetProgramBuildInfo(ocl.program, device, CL_PROGRAM_BUILD_LOG, log_len, build_log, 0))
+        {
+            build_log[log_len] = '\0';
+            LOG_MSG(SKRY_LOG_ACCEL, "OpenCL program build failed:\n%s", build_log);
+        }
+        free(build_log);
+    }
+}
+
+static
+enum SKRY_result init_opencl(void)
+{
+    cl_platform_id platforms[MAX_OCL_PLATFORMS];
+    cl_uint num_platforms = 0;
+    if (CL_SUCCESS != clGetPlatformIDs(MAX_OCL_PLATFORMS, platforms, &num_platforms) || 0 == num_platforms)
+    {
+        LOG_MSG(SKRY_LOG_ACCEL, "No OpenCL platforms found.");
+        return SKRY_ACCEL_UNAVAILABLE;
+    }
+    num_platforms = SKRY_MIN(num_platforms, MAX_OCL_PLATFORMS);
+
+    // Prefer a GPU, otherwise use any device
+    cl_device_id device = 0;
+    const cl_device_type device_types[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL };
+    for (size_t t = 0; t < sizeof(device_types)/sizeof(*device_types) && !device; t++)
+        for (cl_uint p = 0; p < num_platforms && !device; p++)
+            if (CL_SUCCESS != clGetDeviceIDs(platforms[p], device_types[t], 1, &device, 0))
+                device = 0;
+
+    if (!device)
+    {
+        LOG_MSG(SKRY_LOG_ACCEL, "No OpenCL devices found.");
+        return SKRY_ACCEL_UNAVAILABLE;
+    }
+
+    cl_int err;
+    ocl.context = clCreateContext(0, 1, &device, 0, 0, &err);
+    if (CL_SUCCESS == err)
+        ocl.queue = clCreateCommandQueue(ocl.context, device, 0, &err);
+    if (CL_SUCCESS == err)
+        ocl.program = clCreateProgramWithSource(ocl.context, sizeof(ocl_kernels_src)/sizeof(*ocl_kernels_src),
+                                                ocl_kernels_src, 0, &err);
+    if (CL_SUCCESS == err)
+    {
+        err = clBuildProgram(ocl.program, 1, &device, "", 0, 0);
+        if (CL_BUILD_PROGRAM_FAILURE == err)
+            log_build_errors(device);
+    }
+    if (CL_SUCCESS == err)
+        ocl.calc_match_costs = clCreateKernel(ocl.program, "calc_match_costs", &err);
+    if (CL_SUCCESS == err)
+        ocl.find_min_costs = clCreateKernel(ocl.program, "find_min_costs", &err);
+    if (CL_SUCCESS == err)
+        ocl.stack_image = clCreateKernel(ocl.program, "stack_image", &err);
+    if (CL_SUCCESS == err && !(ocl.mutex = create_mutex()))
+        err = CL_OUT_OF_HOST_MEMORY;
+
+    if (CL_SUCCESS != err)
+    {
+        LOG_MSG(SKRY_LOG_ACCEL, "OpenCL initialization failed (error %d).", (int)err);
+        free_opencl();
+        return SKRY_ACCEL_ERROR;
+    }
+
+    char device_name[256] = "";
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(device_name), device_name, 0);
+    device_name[sizeof(device_name) - 1] = '\0';
+    LOG_MSG(SKRY_LOG_ACCEL, "Using OpenCL device: %s", device_name);
+
+    return SKRY_SUCCESS;
+}
+
+/// Enqueues copying of 'img' to 'buf' (without line padding)
+static
+cl_int upload_image(const SKRY_Image *img, struct ocl_buffer *buf)
+{
+    unsigned height = SKRY_get_img_height(img);
+    size_t line_len = (size_t)SKRY_get_img_width(img) * SKRY_get_bytes_per_pixel(img);
+
+    cl_int err = reserve_buffer(buf, line_len * height, CL_MEM_READ_ONLY);
+
+    if (SKRY_get_line_stride_in_bytes(img) == (ptrdiff_t)line_len)
+    {
+        if (CL_SUCCESS == err)
+            err = clEnqueueWriteBuffer(ocl.queue, buf->mem, CL_FALSE, 0, line_len * height,
+                                       SKRY_get_line(img, 0), 0, 0, 0);
+    }
+    else
+    {
+        for (unsigned y = 0; y < height && CL_SUCCESS == err; y++)
+            err = clEnqueueWriteBuffer(ocl.queue, buf->mem, CL_FALSE, (size_t)y * line_len, line_len,
+                                       SKRY_get_line(img, y), 0, 0, 0);
+    }
+
+    return err;
+}
+
+static
+enum SKRY_result ocl_find_matching_positions(
+    const SKRY_Image *image,
+    size_t num_blocks,
+    const struct accel_match_block blocks[],
+    unsigned search_radius,
+    struct SKRY_point new_pos[])
+{
+    size_t total_blk_size = 0;
+    for (size_t i = 0; i < num_blocks; i++)
+        total_blk_size += (size_t)SKRY_get_img_width(blocks[i].ref_block) * SKRY_get_img_height(blocks[i].ref_block);
+
+    // All blocks' pixels (without line padding) and their parameters are uploaded at once
+    uint8_t *blk_pixels = malloc(total_blk_size);
+    cl_int *blk_info = malloc(num_blocks * BLOCK_INFO_LEN * sizeof(*blk_info));
+    cl_int *result_pos = malloc(2 * num_blocks * sizeof(*result_pos));
+    if (!blk_pixels || !blk_info || !result_pos)
+    {
+        free(blk_pixels);
+        free(blk_info);
+        free(result_pos);
+        return SKRY_OUT_OF_MEMORY;
+    }
+
+    size_t blk_ofs = 0;
+    for (size_t i = 0; i < num_blocks; i++)
+    {
+        unsigned blkw = SKRY_get_img_width(blocks[i].ref_block),
+                 blkh = SKRY_get_img_height(blocks[i].ref_block);
+
+        cl_int *info = &blk_info[i * BLOCK_INFO_LEN];
+        info[0] = blk_ofs;
+        info[1] = blkw;
+        info[2] = blkh;
+        info[3] = blocks[i].ref_pos.x;
+        info[4] = blocks[i].ref_pos.y;
+
+        for (unsigned y = 0; y < blkh; y++)
+            memcpy(blk_pixels + blk_ofs + y*blkw, SKRY_get_line(blocks[i].ref_block, y), blkw);
+
+        blk_ofs += (size_t)blkw * blkh;
+    }
+
+    size_t diam = 2 * search_radius;
+    cl_int img_width = SKRY_get_img_width(image),
+           img_height = SKRY_get_img_height(image),
+           radius = search_radius,
+           min_fraction = MIN_FRACTION_OF_BLOCK_TO_MATCH;
+
+    lock_mutex(ocl.mutex);
+
+    cl_int err = upload_image(image, &ocl.image);
+    if (CL_SUCCESS == err)
+        err = reserve_buffer(&ocl.blocks, total_blk_size, CL_MEM_READ_ONLY);
+    if (CL_SUCCESS == err)
+        err = reserve_buffer(&ocl.block_info, num_blocks * BLOCK_INFO_LEN * sizeof(cl_int), CL_MEM_READ_ONLY);
+    if (CL_SUCCESS == err)
+        err = reserve_buffer(&ocl.costs, num_blocks * diam * diam * sizeof(cl_ulong), CL_MEM_READ_WRITE);
+    if (CL_SUCCESS == err)
+        err = reserve_buffer(&ocl.new_pos, 2 * num_blocks * sizeof(cl_int), CL_MEM_WRITE_ONLY);
+
+    if (CL_SUCCESS == err)
+        err = clEnqueueWriteBuffer(ocl.queue, ocl.blocks.mem, CL_FALSE, 0, total_blk_size, blk_pixels, 0, 0, 0);
+    if (CL_SUCCESS == err)
+        err = clEnqueueWriteBuffer(ocl.queue, ocl.block_info.mem, CL_FALSE, 0,
+                                   num_blocks * BLOCK_INFO_LEN * sizeof(cl_int), blk_info, 0, 0, 0);
+
+    if (CL_SUCCESS == err)
+    {
+        cl_int img_stride = img_width;
+        cl_kernel k = ocl.calc_match_costs;
+        err =  clSetKernelArg(k, 0, sizeof(cl_mem), &ocl.image.mem);
+        err |= clSetKernelArg(k, 1, sizeof(cl_int), &img_width);
+        err |= clSetKernelArg(k, 2, sizeof(cl_int), &img_height);
+        err |= clSetKernelArg(k, 3, sizeof(cl_int), &img_stride);
+        err |= clSetKernelArg(k, 4, sizeof(cl_mem), &ocl.blocks.mem);
+        err |= clSetKernelArg(k, 5, sizeof(cl_mem), &ocl.block_info.mem);
+        err |= clSetKernelArg(k, 6, sizeof(cl_int), &radius);
+        err |= clSetKernelArg(k, 7, sizeof(cl_int), &min_fraction);
+        err |= clSetKernelArg(k, 8, sizeof(cl_mem), &ocl.costs.mem);
+    }
+    if (CL_SUCCESS == err)
+    {
+        size_t global_size[3] = { diam, diam, num_blocks };
+        err = clEnqueueNDRangeKernel(ocl.queue, ocl.calc_match_costs, 3, 0, global_size, 0, 0, 0, 0);
+    }
+
+    if (CL_SUCCESS == err)
+    {
+        cl_kernel k = ocl.find_min_costs;
+        err =  clSetKernelArg(k, 0, sizeof(cl_mem), &ocl.costs.mem);
+        err |= clSetKernelArg(k, 1, sizeof(cl_mem), &ocl.block_info.mem);
+        err |= clSetKernelArg(k, 2, sizeof(cl_int), &radius);
+        err |= clSetKernelArg(k, 3, sizeof(cl_mem), &ocl.new_pos.mem);
+    }
+    if (CL_SUCCESS == err)
+    {
+        size_t global_size = num_blocks;
+        err = clEnqueueNDRangeKernel(ocl.queue, ocl.find_min_costs, 1, 0, &global_size, 0, 0, 0, 0);
+    }
+
+    // The queue is in-order, so the blocking read also waits for the uploads
+    // (their source buffers can be freed afterwards)
+    if (CL_SUCCESS == err)
+        err = clEnqueueReadBuffer(ocl.queue, ocl.new_pos.mem, CL_TRUE, 0, 2 * num_blocks * sizeof(cl_int),
+                                  result_pos, 0, 0, 0);
+    else
+        clFinish(ocl.queue);
+
+    unlock_mutex(ocl.mutex);
+
+    if (CL_SUCCESS == err)
+        for (size_t i = 0; i < num_blocks; i++)
+            new_pos[i] = (struct SKRY_point) { .x = result_pos[2*i], .y = result_pos[2*i + 1] };
+    else
+        LOG_MSG(SKRY_LOG_ACCEL, "OpenCL block matching failed (error %d).", (int)err);
+
+    free(blk_pixels);
+    free(blk_info);
+    free(result_pos);
+
+    return (CL_SUCCESS == err) ? SKRY_SUCCESS : SKRY_ACCEL_ERROR;
+}
+
+struct accel_stack
+{
+    unsigned width, height, num_channels;
+    size_t num_triangles;
+
+    struct ocl_buffer pixels, tri_warps, flatfield, dark, accum;
+    int ff_width, ff_height, dark_width, dark_height;
+
+    struct ocl_buffer src; ///< Fragment of the image being stacked
+};
+
+static
+void ocl_free_stack(struct accel_stack *stack)
+{
+    release_buffer(&stack->src);
+    release_buffer(&stack->accum);
+    release_buffer(&stack->dark);
+    release_buffer(&stack->flatfield);
+    release_buffer(&stack->tri_warps);
+    release_buffer(&stack->pixels);
+    free(stack);
+}
+
+static
+struct accel_stack *ocl_create_stack(unsigned width, unsigned height, unsigned num_channels,
+                                     const struct accel_stack_pixel pixels[], size_t num_triangles,
+                                     const SKRY_Image *flatfield, const SKRY_Image *dark)
+{
+    struct accel_stack *stack = malloc(sizeof(*stack));
+    size_t accum_size = (size_t)width * height * (num_channels + 1) * sizeof(cl_float);
+    float *zeros = calloc(accum_size, 1);
+    if (!stack || !zeros)
+    {
+        free(stack);
+        free(zeros);
+        return 0;
+    }
+    *stack = (struct accel_stack) { .width = width, .height = height, .num_channels = num_channels,
+                                    .num_triangles = num_triangles };
+
+    size_t pixels_size = (size_t)width * height * sizeof(*pixels);
+
+    lock_mutex(ocl.mutex);
+
+    cl_int err = reserve_buffer(&stack->pixels, pixels_size, CL_MEM_READ_ONLY);
+    if (CL_SUCCESS == err)
+        err = reserve_buffer(&stack->tri_warps, SKRY_MAX(1, num_triangles) * sizeof(struct accel_tri_warp), CL_MEM_READ_ONLY);
+    if (CL_SUCCESS == err)
+        err = reserve_buffer(&stack->accum, accum_size, CL_MEM_READ_WRITE);
+    if (CL_SUCCESS == err)
+        err = clEnqueueWriteBuffer(ocl.queue, stack->pixels.mem, CL_FALSE, 0, pixels_size, pixels, 0, 0, 0);
+    if (CL_SUCCESS == err)
+        err = clEnqueueWriteBuffer(ocl.queue, stack->accum.mem, CL_FALSE, 0, accum_size, zeros, 0, 0, 0);
+    if (CL_SUCCESS == err && flatfield)
+    {
+        stack->ff_width = SKRY_get_img_width(flatfield);
+        stack->ff_height = SKRY_get_img_height(flatfield);
+        err = upload_image(flatfield, &stack->flatfield);
+    }
+    if (CL_SUCCESS == err && dark)
+    {
+        stack->dark_width = SKRY_get_img_width(dark);
+        stack->dark_height = SKRY_get_img_height(dark);
+        err = upload_image(dark, &stack->dark);
+    }
+
+    // The uploads' source buffers have to remain valid until they complete
+    cl_int finish_err = clFinish(ocl.queue);
+    if (CL_SUCCESS == err)
+        err = finish_err;
+
+    unlock_mutex(ocl.mutex);
+    free(zeros);
+
+    if (CL_SUCCESS != err)
+    {
+        LOG_MSG(SKRY_LOG_ACCEL, "Could not create OpenCL image stack (error %d).", (int)err);
+        ocl_free_stack(stack);
+        return 0;
+    }
+
+    return stack;
+}
+
+static
+enum SKRY_result ocl_stack_image(struct accel_stack *stack, const SKRY_Image *fragment,
+                                 struct SKRY_rect fragment_rect, struct SKRY_rect intersection,
+                                 struct SKRY_point alignment_ofs, float src_val_scale,
+                                 const struct accel_tri_warp tri_warps[])
+{
+    cl_int src_stride = SKRY_get_img_width(fragment) * SKRY_get_bytes_per_pixel(fragment),
+           bytes_per_channel = BITS_PER_CHANNEL[SKRY_get_img_pix_fmt(fragment)] / 8,
+           frag_x = fragment_rect.x, frag_y = fragment_rect.y,
+           frag_width = fragment_rect.width, frag_height = fragment_rect.height,
+           isect_x = intersection.x, isect_y = intersection.y,
+           isect_width = intersection.width, isect_height = intersection.height,
+           ofs_x = alignment_ofs.x, ofs_y = alignment_ofs.y,
+           stack_width = stack->width,
+           num_channels = stack->num_channels;
+    cl_float val_scale = src_val_scale;
+
+    lock_mutex(ocl.mutex);
+
+    cl_int err = upload_image(fragment, &stack->src);
+    if (CL_SUCCESS == err)
+        err = clEnqueueWriteBuffer(ocl.queue, stack->tri_warps.mem, CL_FALSE, 0,
+                                   stack->num_triangles * sizeof(*tri_warps), tri_warps, 0, 0, 0);
+    if (CL_SUCCESS == err)
+    {
+        cl_kernel k = ocl.stack_image;
+        cl_uint arg = 0;
+        err =  clSetKernelArg(k, arg++, sizeof(cl_mem), &stack->src.mem);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &src_stride);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &bytes_per_channel);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &frag_x);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &frag_y);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &frag_width);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &frag_height);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &isect_x);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &isect_y);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &isect_width);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &isect_height);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &ofs_x);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &ofs_y);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_float), &val_scale);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_mem), &stack->pixels.mem);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_mem), &stack->tri_warps.mem);
+        // Null buffers (if there is no flat-field or dark frame) are passed as null pointers
+        err |= clSetKernelArg(k, arg++, sizeof(cl_mem), &stack->flatfield.mem);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &stack->ff_width);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &stack->ff_height);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_mem), &stack->dark.mem);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &stack->dark_width);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &stack->dark_height);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &stack_width);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_int), &num_channels);
+        err |= clSetKernelArg(k, arg++, sizeof(cl_mem), &stack->accum.mem);
+    }
+    if (CL_SUCCESS == err)
+    {
+        size_t global_size[2] = { stack->width, stack->height };
+        err = clEnqueueNDRangeKernel(ocl.queue, ocl.stack_image, 2, 0, global_size, 0, 0, 0, 0);
+    }
+
+    // The sources of the uploads belong to the caller
+    cl_int finish_err = clFinish(ocl.queue);
+    if (CL_SUCCESS == err)
+        err = finish_err;
+
+    unlock_mutex(ocl.mutex);
+
+    if (CL_SUCCESS != err)
+    {
+        LOG_MSG(SKRY_LOG_ACCEL, "OpenCL stacking failed (error %d).", (int)err);
+        return SKRY_ACCEL_ERROR;
+    }
+
+    return SKRY_SUCCESS;
+}
+
+static
+enum SKRY_result ocl_read_stack(const struct accel_stack *stack, float accum[])
+{
+    lock_mutex(ocl.mutex);
+    cl_int err = clEnqueueReadBuffer(ocl.queue, stack->accum.mem, CL_TRUE, 0, stack->accum.capacity, accum, 0, 0, 0);
+    unlock_mutex(ocl.mutex);
+
+    if (CL_SUCCESS != err)
+    {
+        LOG_MSG(SKRY_LOG_ACCEL, "Could not read OpenCL image stack (error %d).", (int)err);
+        return SKRY_ACCEL_ERROR;
+    }
+
+    return SKRY_SUCCESS;
+}
+
+#endif // USE_OPENCL
+
+enum SKRY_result init_accel(enum SKRY_accelerator accel)
+{
+    free_accel();
+
+    switch (accel)
+    {
+    case SKRY_ACCEL_NONE: return SKRY_SUCCESS;
+
+    case SKRY_ACCEL_OPENCL:
+    {
+#if USE_OPENCL
+        enum SKRY_result result = init_opencl();
+        if (SKRY_SUCCESS == result)
+            g_accel = SKRY_ACCEL_OPENCL;
+        return result;
+#else
+        LOG_MSG(SKRY_LOG_ACCEL, "OpenCL support has not been enabled at build time.");
+        return SKRY_ACCEL_UNAVAILABLE;
+#endif
+    }
+
+    default: return SKRY_INVALID_PARAMETERS;
+    }
+}
+
+void free_accel(void)
+{
+#if USE_OPENCL
+    if (SKRY_ACCEL_OPENCL == g_accel)
+        free_opencl();
+#endif
+    g_accel = SKRY_ACCEL_NONE;
+}
+
+int is_accel_matching_enabled(void)
+{
+    return g_accel != SKRY_ACCEL_NONE;
+}
+
+enum SKRY_result accel_find_matching_positions(
+    const SKRY_Image *image,
+    size_t num_blocks,
+    const struct accel_match_block blocks[],
+    unsigned search_radius,
+    struct SKRY_point new_pos[])
+{
+    if (0 == num_blocks || 0 == search_radius)
+    {
+        for (size_t i = 0; i < num_blocks; i++)
+            new_pos[i] = blocks[i].ref_pos;
+        return SKRY_SUCCESS;
+    }
+
+#if USE_OPENCL
+    if (SKRY_ACCEL_OPENCL == g_accel)
+        return ocl_find_matching_positions(image, num_blocks, blocks, search_radius, new_pos);
+#else
+    (void)image;
+#endif
+
+    return SKRY_ACCEL_UNAVAILABLE;
+}
+
+int is_accel_stacking_enabled(void)
+{
+    return g_accel != SKRY_ACCEL_NONE;
+}
+
+struct accel_stack *accel_create_stack(
+    unsigned width, unsigned height,
+    unsigned num_channels,
+    const struct accel_stack_pixel pixels[],
+    size_t num_triangles,
+    const SKRY_Image *flatfield,
+    const SKRY_Image *dark)
+{
+#if USE_OPENCL
+    if (SKRY_ACCEL_OPENCL == g_accel)
+        return ocl_create_stack(width, height, num_channels, pixels, num_triangles, flatfield, dark);
+#else
+    (void)width; (void)height; (void)num_channels; (void)pixels; (void)num_triangles; (void)flatfield; (void)dark;
+#endif
+
+    return 0;
+}
+
+void accel_free_stack(struct accel_stack *stack)
+{
+#if USE_OPENCL
+    if (stack)
+        ocl_free_stack(stack);
+#else
+    (void)stack;
+#endif
+}
+
+enum SKRY_result accel_stack_image(
+    struct accel_stack *stack,
+    const SKRY_Image *fragment,
+    struct SKRY_rect fragment_rect,
+    struct SKRY_rect intersection,
+    struct SKRY_point alignment_ofs,
+    float src_val_scale,
+    const struct accel_tri_warp tri_warps[])
+{
+#if USE_OPENCL
+    if (SKRY_ACCEL_OPENCL == g_accel)
+        return ocl_stack_image(stack, fragment, fragment_rect, intersection, alignment_ofs, src_val_scale, tri_warps);
+#else
+    (void)stack; (void)fragment; (void)fragment_rect; (void)intersection; (void)alignment_ofs; (void)src_val_scale; (void)tri_warps;
+#endif
+
+    return SKRY_ACCEL_UNAVAILABLE;
+}
+
+enum SKRY_result accel_read_stack(const struct accel_stack *stack, float accum[])
+{
+#if USE_OPENCL
+    if (SKRY_ACCEL_OPENCL == g_accel)
+        return ocl_read_stack(stack, accum);
+#else
+    (void)stack; (void)accum;
+#endif
+
+    return SKRY_ACCEL_UNAVAILABLE;
+}
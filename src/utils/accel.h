@@ -0,0 +1,114 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Accelerator (GPU) offload header.
+*/
+
+#ifndef LIBSKRY_ACCEL_HEADER
+#define LIBSKRY_ACCEL_HEADER
+
+#include <stddef.h>
+
+#include <skry/defs.h>
+#include <skry/image.h>
+
+
+/// Block to be matched by 'accel_find_matching_positions()'
+struct accel_match_block
+{
+    struct SKRY_point ref_pos; ///< Center of the search area
+    const SKRY_Image *ref_block; ///< Must be SKRY_PIX_MONO8
+};
+
+/// Selects the accelerator used from now on; called by SKRY_set_accelerator()
+/** On failure, SKRY_ACCEL_NONE remains selected. */
+enum SKRY_result init_accel(enum SKRY_accelerator accel);
+
+/// Releases the accelerator (if any) and selects SKRY_ACCEL_NONE
+void free_accel(void);
+
+/// Returns nonzero if block matching is to be performed by 'accel_find_matching_positions()'
+int is_accel_matching_enabled(void);
+
+/// Finds the best matching positions of all 'blocks' in 'image' (uploaded once for all of them)
+/** Performs an exhaustive search over the positions [ref_pos - search_radius, ref_pos + search_radius)
+    using the same matching cost as 'find_matching_position()'. Can be called concurrently.
+    On failure, the caller should use 'find_matching_position()' instead. */
+enum SKRY_result accel_find_matching_positions(
+    const SKRY_Image *image, ///< Must be SKRY_PIX_MONO8
+    size_t num_blocks,
+    const struct accel_match_block blocks[],
+    unsigned search_radius,
+    struct SKRY_point new_pos[] ///< Receives 'num_blocks' elements
+);
+
+/// Device-resident sums of stacked values, created with 'accel_create_stack()'
+struct accel_stack;
+
+/// Stack pixel's placement in the triangle it belongs to
+struct accel_stack_pixel
+{
+    int tri_idx; ///< -1 if the pixel does not belong to any triangle
+    float u, v; ///< Barycentric coordinates in the triangle
+};
+
+/// Triangle's placement in the image being stacked (as in 'struct triangle_warp' in stacking.c)
+struct accel_tri_warp
+{
+    int p0x, p0y, p1x, p1y, p2x, p2y; ///< Positions of the vertices in the image
+    int all_inside; ///< 1 if all vertices are inside the images' intersection
+    int is_stacked; ///< 1 if the triangle is to be stacked
+};
+
+/// Returns nonzero if stacking can be performed by 'accel_stack_image()'
+int is_accel_stacking_enabled(void);
+
+/// Creates a device-resident stack (with all sums zero); returns null on failure
+/** The returned stack has to be freed with 'accel_free_stack()' before the accelerator is released. */
+struct accel_stack *accel_create_stack(
+    unsigned width, unsigned height,
+    unsigned num_channels, ///< 1 or 3
+    /// Element [y*width + x] corresponds to stack pixel (x, y)
+    const struct accel_stack_pixel pixels[],
+    size_t num_triangles,
+    const SKRY_Image *flatfield, ///< Inverted flat-field (SKRY_PIX_MONO32F); may be null
+    const SKRY_Image *dark ///< SKRY_PIX_MONO32F or SKRY_PIX_RGB32F (as the stack); may be null
+);
+
+void accel_free_stack(struct accel_stack *stack);
+
+/// Adds the triangles of an image to 'stack'
+/** Performs the same warping and calibration as 'fn_warp_span's in stacking.c.
+    Calls for the same stack must not be concurrent. On failure, 'stack' is unchanged
+    (but it may still be read with 'accel_read_stack()'). */
+enum SKRY_result accel_stack_image(
+    struct accel_stack *stack,
+    const SKRY_Image *fragment, ///< Part of the image; 8- or 16-bit integer or 32-bit float with 'num_channels' channels
+    struct SKRY_rect fragment_rect, ///< Position of 'fragment' in the image
+    struct SKRY_rect intersection, ///< Images' intersection
+    struct SKRY_point alignment_ofs, ///< Offset of the image
+    float src_val_scale, ///< Multiplier of interpolated values
+    const struct accel_tri_warp tri_warps[] ///< Element [i] corresponds to the i-th triangle
+);
+
+/// Copies the sums to 'accum' (format as in 'SKRY_Stacking::accumulator'); returns SKRY_SUCCESS or an error code
+enum SKRY_result accel_read_stack(const struct accel_stack *stack, float accum[]);
+
+#endif // LIBSKRY_ACCEL_HEADER
@@ -109,188 +109,111 @@ const unsigned CFA_RED_COL_OFS[] =
   HIGH-QUALITY LINEAR INTERPOLATION FOR DEMOSAICING OF BAYER-PATTERNED COLOR IMAGES
   Henrique S. Malvar, Li-wei He, Ross Cutler
 
- */
-#define DEMOSAIC_BLOCK_HQLINEAR()                          \
-{                                                          \
-  /* output red at red pixel in raw data */                \
-    RGB_at_R[RED]   = src_blk_R[dxR];                      \
-                                                           \
-  /*
-    output green at red pixel in raw data
-
-          +--+
-          |-1|
-          +--+
-          | 2|
-    +--+--+--+--+--+
-    |-1| 2| 4| 2|-1|    multiply everything by 1/8
-    +--+--+--+--+--+
-          | 2|
-          +--+
-          |-1|
-          +--+
-  */                                                       \
-                                                           \
-    RGB_at_R[GREEN] = (4*src_blk_R[dxR]                    \
-                    + 2*(src_blk_R[dxR-1]                  \
-                       + src_blk_R[dxR+1]                  \
-                       + src_blk_Rm1[dxR]                  \
-                       + src_blk_Rp1[dxR])                 \
-                    - src_blk_R[dxR-2]                     \
-                    - src_blk_R[dxR+2]                     \
-                    - src_blk_Rm2[dxR]                     \
-                    - src_blk_Rp2[dxR]) >> 3;              \
-  /*
-    output blue at red pixel in raw data
-
-          +--+
-          |-3|
-       +--+--+--+
-       | 4|  | 4|
-    +--+--+--+--+--+
-    |-3|  |12|  |-3|    multiply everything by 1/16
-    +--+--+--+--+--+
-       | 4|  | 4|
-       +--+--+--+
-          |-3|
-          +--+
-  */                                                       \
-                                                           \
-    RGB_at_R[BLUE]  = (12*src_blk_R[dxR]                   \
-                     + 4*(src_blk_Rp1[dxR+1]               \
-                        + src_blk_Rp1[dxR-1]               \
-                        + src_blk_Rm1[dxR-1]               \
-                        + src_blk_Rm1[dxR+1])              \
-                     - 3*(src_blk_Rm2[dxR]                 \
-                        + src_blk_Rp2[dxR]                 \
-                        + src_blk_R[dxR-2]                 \
-                        + src_blk_R[dxR+2])) >> 4;         \
-                                                           \
-  /*
-    output red at blue pixel in raw data,
-    (same coefficients as for blue at red)
-  */                                                       \
-                                                           \
-    RGB_at_B[RED]  = (12*src_blk_B[dxB]                    \
-                     + 4*(src_blk_Bp1[dxB+1]               \
-                        + src_blk_Bp1[dxB-1]               \
-                        + src_blk_Bm1[dxB-1]               \
-                        + src_blk_Bm1[dxB+1])              \
-                     - 3*(src_blk_Bm2[dxB]                 \
-                        + src_blk_Bp2[dxB]                 \
-                        + src_blk_B[dxB-2]                 \
-                        + src_blk_B[dxB+2])) >> 4;         \
-                                                           \
-  /*
-    output green at blue pixel in raw data
-    (same coefficients as for green at red)
-  */                                                       \
-                                                           \
-    RGB_at_B[GREEN] = (4*src_blk_B[dxB]                    \
-                    + 2*(src_blk_B[dxB-1]                  \
-                       + src_blk_B[dxB+1]                  \
-                       + src_blk_Bm1[dxB]                  \
-                       + src_blk_Bp1[dxB])                 \
-                    - src_blk_B[dxB-2]                     \
-                    - src_blk_B[dxB+2]                     \
-                    - src_blk_Bm2[dxB]                     \
-                    - src_blk_Bp2[dxB]) >> 3;              \
-                                                           \
-  /* output blue at blue pixel in raw data */              \
-    RGB_at_B[BLUE] = src_blk_B[dxB];                       \
-                                                           \
-  /*
-    output red at green pixel in red row in raw data
-
-          +--+
-          | 1|
-       +--+--+--+
-       |-2|  |-2|
-    +--+--+--+--+--+
-    |-2| 8|10| 8|-2|    multiply everything by 1/16
-    +--+--+--+--+--+
-       |-2|  |-2|
-       +--+--+--+
-          | 1|
-          +--+
-  */                                                       \
-    RGB_at_G_at_R_row[RED] = (10*src_blk_R[dxB]            \
-                           + 8*(src_blk_R[dxB-1]           \
-                              + src_blk_R[dxB+1])          \
-                           - 2*(src_blk_Rm1[dxB-1]         \
-                              + src_blk_Rm1[dxB+1]         \
-                              + src_blk_Rp1[dxB-1]         \
-                              + src_blk_Rp1[dxB+1]         \
-                              + src_blk_R[dxB-2]           \
-                              + src_blk_R[dxB+2])          \
-                           + src_blk_Rm2[dxB]              \
-                           + src_blk_Rp2[dxB]) >> 4;       \
-                                                           \
-  /* output green at green pixel in red row in raw data */ \
-    RGB_at_G_at_R_row[GREEN] = src_blk_R[dxB];             \
-                                                           \
-  /*
-    output blue at green pixel in red row in raw data
-          +--+
-          |-2|
-       +--+--+--+
-       |-2| 8|-2|
-    +--+--+--+--+--+
-    | 1|  |10|  | 1|    multiply everything by 1/16
-    +--+--+--+--+--+
-       |-2| 8|-2|
-       +--+--+--+
-          |-2|
-          +--+
-  */                                                       \
-                                                           \
-    RGB_at_G_at_R_row[BLUE] = (10*src_blk_R[dxB]           \
-                              + 8*(src_blk_Rm1[dxB]        \
-                                 + src_blk_Rp1[dxB])       \
-                              - 2*(src_blk_Rm1[dxB-1]      \
-                                 + src_blk_Rm1[dxB+1]      \
-                                 + src_blk_Rp1[dxB-1]      \
-                                 + src_blk_Rp1[dxB+1]      \
-                                 + src_blk_Rm2[dxB]        \
-                                 + src_blk_Rp2[dxB])       \
-                               + src_blk_R[dxB-2]          \
-                               + src_blk_R[dxB+2]) >> 4;   \
-                                                           \
-  /*
-    output red at green pixel in blue row in raw data
-    (same coefficients as for blue at green pixel in red row)
-  */                                                       \
-    RGB_at_G_at_B_row[RED] = (10*src_blk_B[dxR]            \
-                             + 8*(src_blk_Bm1[dxR]         \
-                                + src_blk_Bp1[dxR])        \
-                             - 2*(src_blk_Bm1[dxR-1]       \
-                                + src_blk_Bm1[dxR+1]       \
-                                + src_blk_Bp1[dxR-1]       \
-                                + src_blk_Bp1[dxR+1]       \
-                                + src_blk_Bm2[dxR]         \
-                                + src_blk_Bp2[dxR])        \
-                              + src_blk_B[dxR-2]           \
-                              + src_blk_B[dxR+2]) >> 4;    \
-                                                           \
-  /* output green at green pixel in raw data */            \
-    RGB_at_G_at_B_row[GREEN] = src_blk_B[dxR];             \
-  /*
-    output blue at green pixel in blue row in raw data
-    (same coefficients as for red at green pixel in red row)
-  */                                                       \
-    RGB_at_G_at_B_row[BLUE] = (10*src_blk_B[dxR]           \
-                           + 8*(src_blk_B[dxR-1]           \
-                              + src_blk_B[dxR+1])          \
-                           - 2*(src_blk_Bm1[dxR-1]         \
-                              + src_blk_Bm1[dxR+1]         \
-                              + src_blk_Bp1[dxR-1]         \
-                              + src_blk_Bp1[dxR+1]         \
-                              + src_blk_B[dxR-2]           \
-                              + src_blk_B[dxR+2])          \
-                           + src_blk_Bm2[dxR]              \
-                           + src_blk_Bp2[dxR]) >> 4;       \
+  The kernels (all coefficients are to be multiplied by 1/8 or 1/16, as noted):
+
+    green at red pixel          blue at red pixel           red at green pixel in red row
+    (and at blue pixel)         (and red at blue pixel)     (and blue at green pixel in blue row)
+
+          +--+                        +--+                        +--+
+          |-1|                        |-3|                        | 1|
+          +--+                     +--+--+--+                  +--+--+--+
+          | 2|                     | 4|  | 4|                  |-2|  |-2|
+    +--+--+--+--+--+         +--+--+--+--+--+            +--+--+--+--+--+
+    |-1| 2| 4| 2|-1|  1/8    |-3|  |12|  |-3|  1/16      |-2| 8|10| 8|-2|  1/16
+    +--+--+--+--+--+         +--+--+--+--+--+            +--+--+--+--+--+
+          | 2|                     | 4|  | 4|                  |-2|  |-2|
+          +--+                     +--+--+--+                  +--+--+--+
+          |-1|                        |-3|                        | 1|
+          +--+                        +--+                        +--+
+
+    Blue at green pixel in red row (and red at green pixel in blue row) uses
+    the red-at-green kernel rotated by 90 degrees.
+
+  All of them are combinations of the center pixel value 'c' and the sums of its neighbors:
+    h1, h2 - horizontal at distance 1, 2
+    v1, v2 - vertical at distance 1, 2
+    d1     - diagonal at distance 1
+  so every pixel of a row is processed the same way, and the kernel is selected depending
+  on whether the pixel's color is the row's own color (red in red rows, blue in blue rows)
+  or green. The result is identical to processing 2x2 blocks, but the inner loop has
+  no dependencies between pixels and is vectorized by the compiler.
+
+    row:         input row (red or blue) being demosaiced and its neighbors
+    own_col_ofs: 0 or 1, parity of columns containing the row's own color
+    is_red_row:  1 if the row contains red pixels, 0 if blue
+*/
+/// Number of pixels processed at once by 'DEMOSAIC_ROW_HQLINEAR()'
+#define HQLINEAR_CHUNK_LEN 256
+
+#define DEMOSAIC_ROW_HQLINEAR(InputT, OutputT, output_kind, n_out_ch, max_val, own_col_ofs, is_red_row) \
+{                                                                                       \
+    for (int chunk_x = 2; chunk_x < x_end; chunk_x += HQLINEAR_CHUNK_LEN)               \
+    {                                                                                   \
+        int chunk_len = SKRY_MIN(HQLINEAR_CHUNK_LEN, x_end - chunk_x);                  \
+                                                                                        \
+        /* Values are first stored separately for each channel, as interleaved
+           (RGB) stores would prevent vectorization */                                  \
+        int red[HQLINEAR_CHUNK_LEN], green[HQLINEAR_CHUNK_LEN], blue[HQLINEAR_CHUNK_LEN];    \
+                                                                                        \
+        for (int i = 0; i < chunk_len; i++)                                             \
+        {                                                                               \
+            int x = chunk_x + i;                                                        \
+                                                                                        \
+            int c  = row[x],                                                            \
+                h1 = row[x-1] + row[x+1],                                               \
+                h2 = row[x-2] + row[x+2],                                               \
+                v1 = row_m1[x] + row_p1[x],                                             \
+                v2 = row_m2[x] + row_p2[x],                                             \
+                d1 = row_m1[x-1] + row_m1[x+1] + row_p1[x-1] + row_p1[x+1];             \
+                                                                                        \
+            int is_own_color = ((x & 1) == (own_col_ofs));                              \
+                                                                                        \
+            int g     = is_own_color ? (4*c + 2*(h1 + v1) - h2 - v2) >> 3               \
+                                     : c;                                               \
+            int own   = is_own_color ? c                                                \
+                                     : (10*c + 8*h1 - 2*(d1 + h2) + v2) >> 4;           \
+            int other = is_own_color ? (12*c + 4*d1 - 3*(h2 + v2)) >> 4                 \
+                                     : (10*c + 8*v1 - 2*(d1 + v2) + h2) >> 4;           \
+                                                                                        \
+            red[i]   = CLAMP((is_red_row) ? own : other, max_val);                      \
+            green[i] = CLAMP(g, max_val);                                               \
+            blue[i]  = CLAMP((is_red_row) ? other : own, max_val);                      \
+        }                                                                               \
+                                                                                        \
+        OutputT *restrict dest = dest_row + chunk_x*n_out_ch;                           \
+        for (int i = 0; i < chunk_len; i++)                                             \
+            WRITE_PIXEL_##output_kind(dest, i, red[i], green[i], blue[i]);              \
+    }                                                                                   \
 }
 
+/*
+    Demosaics (in parallel) rows 2, 3, ..., 2*num_block_rows+1 using the HQLINEAR method.
+
+    dxR_val, dyR_val: offset of the red input pixel in each 2x2 block; the caller passes
+                      constants, so that the inner loop is specialized for each CFA pattern
+*/
+#define DEMOSAIC_ROWS_HQLINEAR(InputT, OutputT, output_kind, n_out_ch, max_val, dxR_val, dyR_val) \
+do {                                                                                    \
+    const int x_end = 2 + 2*(((int)width - 4)/2);                                       \
+    const int y_end = 2 + 2*(((int)height - 4)/2);                                      \
+                                                                                        \
+    _Pragma("omp parallel for")                                                         \
+    for (int y = 2; y < y_end; y++)                                                     \
+    {                                                                                   \
+        const InputT *restrict row    = (const InputT *)((uint8_t *)input + y*input_stride); \
+        const InputT *restrict row_m1 = (const InputT *)((uint8_t *)row - input_stride);    \
+        const InputT *restrict row_m2 = (const InputT *)((uint8_t *)row - 2*input_stride);  \
+        const InputT *restrict row_p1 = (const InputT *)((uint8_t *)row + input_stride);    \
+        const InputT *restrict row_p2 = (const InputT *)((uint8_t *)row + 2*input_stride);  \
+        OutputT *restrict dest_row = (OutputT *)((uint8_t *)output + y*output_stride);      \
+                                                                                        \
+        if ((y & 1) == (dyR_val))                                                       \
+            DEMOSAIC_ROW_HQLINEAR(InputT, OutputT, output_kind, n_out_ch, max_val, (dxR_val), 1) \
+        else                                                                            \
+            DEMOSAIC_ROW_HQLINEAR(InputT, OutputT, output_kind, n_out_ch, max_val, (dxR_val)^1, 0) \
+    }                                                                                   \
+} while (0)
+
 
 #define WRITE_OUTPUT_RGB()                                \
 {                                                         \
@@ -351,16 +274,27 @@ const unsigned CFA_RED_COL_OFS[] =
                      + RGB_at_G_at_B_row[BLUE]) / 3 >> 8; \
 }
 
-static
-void clamp(int RGB[3], int max_value)
-{
-    for (int ch = 0; ch < 3; ch++)
-    {
-        if (RGB[ch] < 0)
-            RGB[ch] = 0;
-        else if (RGB[ch] > max_value)
-            RGB[ch] = max_value;
-    }
+#define WRITE_PIXEL_RGB(dest_row, x, red, green, blue) \
+{                                                      \
+    dest_row[(x)*3 + RED]   = (red);                   \
+    dest_row[(x)*3 + GREEN] = (green);                 \
+    dest_row[(x)*3 + BLUE]  = (blue);                  \
+}
+
+#define WRITE_PIXEL_MONO8_from_RGB8(dest_row, x, red, green, blue) \
+    dest_row[(x)] = ((red) + (green) + (blue)) / 3
+
+#define WRITE_PIXEL_MONO8_from_RGB16(dest_row, x, red, green, blue) \
+    dest_row[(x)] = ((red) + (green) + (blue)) / 3 >> 8
+
+
+#define CLAMP(value, max_value) ((value) < 0 ? 0 : ((value) > (max_value) ? (max_value) : (value)))
+
+#define CLAMP_RGB(RGB, max_value)                 \
+{                                                 \
+    RGB[RED]   = CLAMP(RGB[RED], max_value);      \
+    RGB[GREEN] = CLAMP(RGB[GREEN], max_value);    \
+    RGB[BLUE]  = CLAMP(RGB[BLUE], max_value);     \
 }
 
 #define OUTPUT_AT(OutputT, nch, x, y) \
@@ -368,76 +302,107 @@ void clamp(int RGB[3], int max_value)
 
 
 /*
-    Type:            input/output data type (e.g. uint8_t)
-    algorithm:       SIMPLE or HQLINEAR
-    output_kind:     RGB, MONO8_from_RGB8, MONO8_from_RGB16
-    n_out_ch:        number of output channels
-    max_val:         max value of output (e.g. 0xFF)
+    Demosaics (in parallel) 2x2 blocks in rows 2, 4, ..., height-4 using the SIMPLE method.
+
+    dxR_val, dyR_val: offset of the red input pixel in each 2x2 block; the caller passes
+                      constants, so that the inner loop is specialized for each CFA pattern
 */
-#define DEMOSAIC(InputT, OutputT, algorithm, output_kind, n_out_ch, max_val)            \
+#define DEMOSAIC_ROWS_SIMPLE(InputT, OutputT, output_kind, n_out_ch, max_val, dxR_val, dyR_val) \
 do {                                                                                    \
-    if (width < 6 || height < 6)                                                        \
-        return;                                                                         \
-                                                                                        \
-    /* Offset of the red input pixel in each 2x2 block */                               \
-    int dxR = CFA_RED_COL_OFS[CFA_pattern],                                             \
-        dyR = CFA_RED_ROW_OFS[CFA_pattern];                                             \
+    const int dxR = (dxR_val),                                                          \
+              dyR = (dyR_val);                                                          \
                                                                                         \
     /* Offset of the blue input pixel in each 2x2 block */                              \
-    int dxB = dxR^1,                                                                    \
-        dyB = dyR^1;                                                                    \
-                                                                                        \
-    int RGB_at_R[3], /* RGB values at red input pixel location */                       \
-        RGB_at_B[3], /* RGB values at blue input pixel location */                      \
-        RGB_at_G_at_R_row[3], /* RGB values at green input pixel at red row */          \
-        RGB_at_G_at_B_row[3]; /* RGB values at green input pixel at blue row */         \
-                                                                                        \
-    /* skip 2 initial rows */                                                           \
-    InputT *src_row  = (InputT *)((uint8_t *)input + 2*input_stride);                   \
-    OutputT *dest_row = (OutputT *)((uint8_t *)output + 2*output_stride);               \
+    const int dxB = dxR^1,                                                              \
+              dyB = dyR^1;                                                              \
                                                                                         \
     /* Process pixels in 2x2 blocks; each block has to be
        at least 2 pixels from image border */                                           \
-    for (unsigned y = 2; y <= height-4; y += 2)                                         \
+    _Pragma("omp parallel for")                                                         \
+    for (int y = 2; y <= (int)height-4; y += 2)                                         \
     {                                                                                   \
-        /* skip 2 initial columns */                                                    \
-        InputT *src_blk = src_row + 2*1;                                                \
-        OutputT *dest_blk = dest_row + 2*n_out_ch;                                      \
+        int RGB_at_R[3], /* RGB values at red input pixel location */                   \
+            RGB_at_B[3], /* RGB values at blue input pixel location */                  \
+            RGB_at_G_at_R_row[3], /* RGB values at green input pixel at red row */      \
+            RGB_at_G_at_B_row[3]; /* RGB values at green input pixel at blue row */     \
                                                                                         \
-        for (unsigned x = 2; x <= width-4; x += 2)                                      \
-        {                                                                               \
-            /* Pointers to the current block's red row and its neighbors */             \
-            InputT *src_blk_R   = (InputT *)((uint8_t *)src_blk + dyR*input_stride);    \
-            InputT *src_blk_Rm1 = (InputT *)((uint8_t *)src_blk_R   - input_stride);    \
-            InputT *src_blk_Rm2 = (InputT *)((uint8_t *)src_blk_Rm1 - input_stride);    \
-            InputT *src_blk_Rp1 = (InputT *)((uint8_t *)src_blk_R   + input_stride);    \
-            InputT *src_blk_Rp2 = (InputT *)((uint8_t *)src_blk_Rp1 + input_stride);    \
+        /* Pointers to the red row and its neighbors */                                 \
+        const InputT *restrict src_R = (const InputT *)((uint8_t *)input + (y + dyR)*input_stride); \
+        const InputT *restrict src_Rm1 = (const InputT *)((uint8_t *)src_R   - input_stride);    \
+        const InputT *restrict src_Rm2 = (const InputT *)((uint8_t *)src_Rm1 - input_stride);    \
+        const InputT *restrict src_Rp1 = (const InputT *)((uint8_t *)src_R   + input_stride);    \
+        const InputT *restrict src_Rp2 = (const InputT *)((uint8_t *)src_Rp1 + input_stride);    \
                                                                                         \
-            /* Pointers to the current block's blue row and its neighbors */            \
-            InputT *src_blk_B   = (InputT *)((uint8_t *)src_blk + dyB*input_stride);    \
-            InputT *src_blk_Bm1 = (InputT *)((uint8_t *)src_blk_B   - input_stride);    \
-            InputT *src_blk_Bm2 = (InputT *)((uint8_t *)src_blk_Bm1 - input_stride);    \
-            InputT *src_blk_Bp1 = (InputT *)((uint8_t *)src_blk_B   + input_stride);    \
-            InputT *src_blk_Bp2 = (InputT *)((uint8_t *)src_blk_Bp1 + input_stride);    \
+        /* Pointers to the blue row and its neighbors */                                \
+        const InputT *restrict src_B = (const InputT *)((uint8_t *)input + (y + dyB)*input_stride); \
+        const InputT *restrict src_Bm1 = (const InputT *)((uint8_t *)src_B   - input_stride);    \
+        const InputT *restrict src_Bm2 = (const InputT *)((uint8_t *)src_Bm1 - input_stride);    \
+        const InputT *restrict src_Bp1 = (const InputT *)((uint8_t *)src_B   + input_stride);    \
+        const InputT *restrict src_Bp2 = (const InputT *)((uint8_t *)src_Bp1 + input_stride);    \
                                                                                         \
-            OutputT *dest_blk_R = (OutputT *)((uint8_t *)dest_blk + dyR*output_stride); \
-            OutputT *dest_blk_B = (OutputT *)((uint8_t *)dest_blk + dyB*output_stride); \
+        OutputT *restrict dest_R = (OutputT *)((uint8_t *)output + (y + dyR)*output_stride); \
+        OutputT *restrict dest_B = (OutputT *)((uint8_t *)output + (y + dyB)*output_stride); \
                                                                                         \
-            DEMOSAIC_BLOCK_##algorithm();                                               \
+        const int num_blocks = (width - 4)/2;                                           \
+        for (int i = 0; i < num_blocks; i++)                                            \
+        {                                                                               \
+            const InputT *src_blk_R   = src_R   + 2 + 2*i,                              \
+                         *src_blk_Rm1 = src_Rm1 + 2 + 2*i,                              \
+                         *src_blk_Rm2 = src_Rm2 + 2 + 2*i,                              \
+                         *src_blk_Rp1 = src_Rp1 + 2 + 2*i,                              \
+                         *src_blk_Rp2 = src_Rp2 + 2 + 2*i,                              \
+                         *src_blk_B   = src_B   + 2 + 2*i,                              \
+                         *src_blk_Bm1 = src_Bm1 + 2 + 2*i,                              \
+                         *src_blk_Bm2 = src_Bm2 + 2 + 2*i,                              \
+                         *src_blk_Bp1 = src_Bp1 + 2 + 2*i,                              \
+                         *src_blk_Bp2 = src_Bp2 + 2 + 2*i;                              \
                                                                                         \
-            clamp(RGB_at_R, max_val);                                                   \
-            clamp(RGB_at_B, max_val);                                                   \
-            clamp(RGB_at_G_at_R_row, max_val);                                          \
-            clamp(RGB_at_G_at_B_row, max_val);                                          \
+            OutputT *dest_blk_R = dest_R + (2 + 2*i)*n_out_ch,                          \
+                    *dest_blk_B = dest_B + (2 + 2*i)*n_out_ch;                          \
                                                                                         \
-            WRITE_OUTPUT_##output_kind();                                               \
+            DEMOSAIC_BLOCK_SIMPLE();                                                    \
                                                                                         \
-            src_blk += 2*1;                                                             \
-            dest_blk += 2*n_out_ch;                                                     \
+            CLAMP_RGB(RGB_at_R, max_val);                                               \
+            CLAMP_RGB(RGB_at_B, max_val);                                               \
+            CLAMP_RGB(RGB_at_G_at_R_row, max_val);                                      \
+            CLAMP_RGB(RGB_at_G_at_B_row, max_val);                                      \
+                                                                                        \
+            WRITE_OUTPUT_##output_kind();                                               \
         }                                                                               \
+    }                                                                                   \
+} while (0)
+
+/*
+    Type:            input/output data type (e.g. uint8_t)
+    algorithm:       SIMPLE or HQLINEAR
+    output_kind:     RGB, MONO8_from_RGB8, MONO8_from_RGB16
+    n_out_ch:        number of output channels
+    max_val:         max value of output (e.g. 0xFF)
+*/
+#define DEMOSAIC(InputT, OutputT, algorithm, output_kind, n_out_ch, max_val)            \
+do {                                                                                    \
+    if (width < 6 || height < 6)                                                        \
+        return;                                                                         \
                                                                                         \
-        src_row = (InputT *)((uint8_t *)src_row + 2*input_stride);                      \
-        dest_row = (OutputT *)((uint8_t *)dest_row + 2*output_stride);                  \
+    switch (CFA_pattern)                                                                \
+    {                                                                                   \
+    case SKRY_CFA_RGGB:                                                                 \
+        DEMOSAIC_ROWS_##algorithm(InputT, OutputT, output_kind, n_out_ch, max_val,    \
+                            CFA_RED_COL_OFS[SKRY_CFA_RGGB], CFA_RED_ROW_OFS[SKRY_CFA_RGGB]); \
+        break;                                                                          \
+    case SKRY_CFA_BGGR:                                                                 \
+        DEMOSAIC_ROWS_##algorithm(InputT, OutputT, output_kind, n_out_ch, max_val,    \
+                            CFA_RED_COL_OFS[SKRY_CFA_BGGR], CFA_RED_ROW_OFS[SKRY_CFA_BGGR]); \
+        break;                                                                          \
+    case SKRY_CFA_GRBG:                                                                 \
+        DEMOSAIC_ROWS_##algorithm(InputT, OutputT, output_kind, n_out_ch, max_val,    \
+                            CFA_RED_COL_OFS[SKRY_CFA_GRBG], CFA_RED_ROW_OFS[SKRY_CFA_GRBG]); \
+        break;                                                                          \
+    case SKRY_CFA_GBRG:                                                                 \
+        DEMOSAIC_ROWS_##algorithm(InputT, OutputT, output_kind, n_out_ch, max_val,    \
+                            CFA_RED_COL_OFS[SKRY_CFA_GBRG], CFA_RED_ROW_OFS[SKRY_CFA_GBRG]); \
+        break;                                                                          \
+    default: assert(0);                                                                 \
     }                                                                                   \
                                                                                         \
     /* Fill the borders */                                                              \
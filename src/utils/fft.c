@@ -0,0 +1,163 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Fast Fourier transform implementation.
+*/
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "fft.h"
+
+
+#define PI 3.14159265358979323846
+
+struct fft_plan
+{
+    size_t n;
+    size_t *bit_rev;          ///< Element 'i' is the index 'i' with reversed order of its log2(n) bits
+    struct complex_f *twiddle; ///< exp(-2*pi*i*k/n) for k = 0, ..., n/2-1
+};
+
+struct fft_plan *create_fft_plan(size_t n)
+{
+    assert(n > 0 && (n & (n-1)) == 0);
+
+    struct fft_plan *plan = malloc(sizeof(*plan));
+    if (!plan)
+        return 0;
+
+    plan->n = n;
+    plan->bit_rev = malloc(n * sizeof(*plan->bit_rev));
+    plan->twiddle = malloc((n/2 + 1) * sizeof(*plan->twiddle));
+    if (!plan->bit_rev || !plan->twiddle)
+        return free_fft_plan(plan);
+
+    unsigned log2n = 0;
+    while (((size_t)1 << log2n) < n)
+        log2n++;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t rev = 0;
+        for (unsigned b = 0; b < log2n; b++)
+            if (i & ((size_t)1 << b))
+                rev |= (size_t)1 << (log2n - 1 - b);
+        plan->bit_rev[i] = rev;
+    }
+
+    for (size_t k = 0; k < n/2; k++)
+    {
+        double angle = -2 * PI * k / n;
+        plan->twiddle[k] = (struct complex_f) { .re = cos(angle), .im = sin(angle) };
+    }
+
+    return plan;
+}
+
+struct fft_plan *free_fft_plan(struct fft_plan *plan)
+{
+    if (plan)
+    {
+        free(plan->bit_rev);
+        free(plan->twiddle);
+        free(plan);
+    }
+    return 0;
+}
+
+size_t get_fft_length(const struct fft_plan *plan)
+{
+    return plan->n;
+}
+
+/// Iterative radix-2 in-place transform of 'plan->n' elements spaced by 'step'
+static
+void fft_1d(const struct fft_plan *plan, struct complex_f data[], size_t step, int inverse)
+{
+    size_t n = plan->n;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t j = plan->bit_rev[i];
+        if (j > i)
+        {
+            struct complex_f tmp = data[i*step];
+            data[i*step] = data[j*step];
+            data[j*step] = tmp;
+        }
+    }
+
+    for (size_t len = 2; len <= n; len *= 2)
+    {
+        size_t half = len/2;
+        size_t tw_step = n/len;
+        for (size_t start = 0; start < n; start += len)
+            for (size_t k = 0; k < half; k++)
+            {
+                struct complex_f w = plan->twiddle[k * tw_step];
+                if (inverse)
+                    w.im = -w.im;
+
+                struct complex_f *a = &data[(start + k) * step];
+                struct complex_f *b = &data[(start + k + half) * step];
+                struct complex_f t = { .re = b->re * w.re - b->im * w.im,
+                                       .im = b->re * w.im + b->im * w.re };
+                b->re = a->re - t.re;
+                b->im = a->im - t.im;
+                a->re += t.re;
+                a->im += t.im;
+            }
+    }
+}
+
+void fft_2d(const struct fft_plan *plan, struct complex_f data[], int inverse)
+{
+    size_t n = plan->n;
+
+    #pragma omp parallel for
+    for (size_t row = 0; row < n; row++)
+        fft_1d(plan, data + row*n, 1, inverse);
+
+    // Columns are transformed in a contiguous copy, which is much more cache-friendly
+    // than striding over the whole array
+    #pragma omp parallel
+    {
+        struct complex_f *column = malloc(n * sizeof(*column));
+
+        #pragma omp for
+        for (size_t col = 0; col < n; col++)
+        {
+            if (column)
+            {
+                for (size_t i = 0; i < n; i++)
+                    column[i] = data[i*n + col];
+                fft_1d(plan, column, 1, inverse);
+                for (size_t i = 0; i < n; i++)
+                    data[i*n + col] = column[i];
+            }
+            else
+                fft_1d(plan, data + col, n, inverse);
+        }
+
+        free(column);
+    }
+}
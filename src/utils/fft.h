@@ -0,0 +1,51 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Fast Fourier transform header.
+*/
+
+#ifndef LIBSKRY_FFT_HEADER
+#define LIBSKRY_FFT_HEADER
+
+#include <stddef.h>
+
+
+struct complex_f
+{
+    float re, im;
+};
+
+/// Precomputed twiddle factors and bit-reversal permutation for transforms of a given length
+struct fft_plan;
+
+/// Returns null if out of memory; 'n' has to be a power of 2
+struct fft_plan *create_fft_plan(size_t n);
+
+/// Returns null
+struct fft_plan *free_fft_plan(struct fft_plan *plan);
+
+size_t get_fft_length(const struct fft_plan *plan);
+
+/// Performs an in-place 2D FFT of an n x n array (n = plan's length)
+/** Rows are stored contiguously, without padding. The inverse transform
+    is not normalized, i.e. forward+inverse multiplies values by n^2. */
+void fft_2d(const struct fft_plan *plan, struct complex_f data[], int inverse);
+
+#endif // LIBSKRY_FFT_HEADER
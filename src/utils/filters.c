@@ -26,15 +26,17 @@ File description:
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 #include <skry/defs.h>
 
 #include "filters.h"
+#include "perf.h"
 
 
-// Result of 3 iterations is quite close to a Gaussian blur
-#define QUALITY_ESTIMATE_BOX_BLUR_ITERATIONS 3
-
-/** Performs a blurring pass of a single row or column.
+/** Performs a horizontal blurring pass of a single row.
     Using a macro, because 'src' can be a pointer to uint8_t or uint32_t. */
 #define BOX_BLUR_PASS(src, pix_sum, box_radius, length, step)                                   \
 {                                                                                               \
@@ -65,16 +67,186 @@ File description:
     }                                                                                           \
 }
 
+void free_filter_buffers(struct filter_buffers *buffers)
+{
+    free(buffers->blurred);
+    free(buffers->pix_sum[0]);
+    free(buffers->pix_sum[1]);
+    *buffers = (struct filter_buffers) { 0 };
+}
+
+/// Ensures 'buffers' can hold 'num_pixels' pixels; returns 0 if out of memory
+static
+int reserve_filter_buffers(struct filter_buffers *buffers, size_t num_pixels)
+{
+    if (buffers->capacity >= num_pixels)
+        return 1;
+
+    free_filter_buffers(buffers);
+    buffers->blurred = malloc(num_pixels * sizeof(*buffers->blurred));
+    buffers->pix_sum[0] = malloc(num_pixels * sizeof(*buffers->pix_sum[0]));
+    buffers->pix_sum[1] = malloc(num_pixels * sizeof(*buffers->pix_sum[1]));
+    if (!buffers->blurred || !buffers->pix_sum[0] || !buffers->pix_sum[1])
+    {
+        free_filter_buffers(buffers);
+        return 0;
+    }
+
+    buffers->capacity = num_pixels;
+    return 1;
+}
+
+int reserve_thread_filter_buffers(struct thread_filter_buffers *tfb)
+{
+#if defined(_OPENMP)
+    size_t num_threads = omp_get_max_threads();
+#else
+    size_t num_threads = 1;
+#endif
+
+    if (tfb->num_threads >= num_threads)
+        return 1;
+
+    struct filter_buffers *new_buffers = realloc(tfb->buffers, num_threads * sizeof(*new_buffers));
+    if (!new_buffers)
+        return 0;
+
+    for (size_t i = tfb->num_threads; i < num_threads; i++)
+        new_buffers[i] = (struct filter_buffers) { 0 };
+
+    tfb->buffers = new_buffers;
+    tfb->num_threads = num_threads;
+    return 1;
+}
+
+struct filter_buffers *get_thread_filter_buffers(struct thread_filter_buffers *tfb)
+{
+#if defined(_OPENMP)
+    size_t thread_idx = omp_get_thread_num();
+#else
+    size_t thread_idx = 0;
+#endif
+
+    return (thread_idx < tfb->num_threads) ? &tfb->buffers[thread_idx] : 0;
+}
+
+void free_thread_filter_buffers(struct thread_filter_buffers *tfb)
+{
+    for (size_t i = 0; i < tfb->num_threads; i++)
+        free_filter_buffers(&tfb->buffers[i]);
+    free(tfb->buffers);
+    *tfb = (struct thread_filter_buffers) { 0 };
+}
+
+/// Parameters for dividing 32-bit unsigned integers by a constant using multiplication
+/** See T. Granlund, P. Montgomery, "Division by Invariant Integers using Multiplication" (1994), fig. 4.1.
+    Unlike integer division, the multiplication can be vectorized. */
+struct u32_divisor
+{
+    uint32_t mult;
+    unsigned shift1, shift2;
+};
+
+static
+struct u32_divisor get_u32_divisor(uint32_t d)
+{
+    assert(d > 0);
+
+    unsigned l = 0; // ceil(log2(d))
+    while (l < 32 && ((uint64_t)1 << l) < d)
+        l++;
+
+    return (struct u32_divisor) { .mult = (uint32_t)((((uint64_t)1 << 32) * (((uint64_t)1 << l) - d)) / d + 1),
+                                  .shift1 = SKRY_MIN(l, 1),
+                                  .shift2 = (l > 0) ? l - 1 : 0 };
+}
+
+/// Returns n/d (rounded down) for a 'd' prepared with 'get_u32_divisor()'
+static inline
+uint32_t divide_u32(uint32_t n, struct u32_divisor d)
+{
+    uint32_t t = ((uint64_t)n * d.mult) >> 32;
+    return (t + ((n - t) >> d.shift1)) >> d.shift2;
+}
+
+/// Divides a line of sums by 'divisor', storing results in 'sums' or (if not null) in 'output'
+static
+void divide_line_sums(uint32_t * restrict sums, uint8_t * restrict output, unsigned width, struct u32_divisor divisor)
+{
+    if (output)
+    {
+        for (unsigned x = 0; x < width; x++)
+            output[x] = divide_u32(sums[x], divisor);
+    }
+    else
+    {
+        for (unsigned x = 0; x < width; x++)
+            sums[x] = divide_u32(sums[x], divisor);
+    }
+}
+
+/// Updates a line of running vertical sums: dest = prev - removed + added
+static
+void update_line_sums(uint32_t * restrict dest, const uint32_t * restrict prev,
+                      const uint32_t * restrict removed, const uint32_t * restrict added,
+                      unsigned width)
+{
+    // Intermediate results can wrap around, but the final ones are correct
+    for (unsigned x = 0; x < width; x++)
+        dest[x] = prev[x] - removed[x] + added[x];
+}
+
+/// Calculates vertical neighborhood sums of 'horz_sums', divided by 'divisor'
+/** Lines are processed top to bottom; the (undivided) sums of a line are obtained
+    from those of the previous one, which is then divided while still in cache.
+    If 'output' is not null, divided sums are stored there instead of in 'sums'. */
+static
+void box_blur_vert_pass(const uint32_t *horz_sums, uint32_t *sums, unsigned width, unsigned height,
+                        unsigned box_radius, struct u32_divisor divisor,
+                        uint8_t *output, ptrdiff_t output_line_stride)
+{
+    // Sums for the first line (count the last line multiple times if needed)
+    for (unsigned x = 0; x < width; x++)
+        sums[x] = (box_radius + 1) * horz_sums[x];
+    for (unsigned i = 1; i <= box_radius; i++)
+    {
+        const uint32_t *line = horz_sums + (size_t)SKRY_MIN(i, height - 1) * width;
+        for (unsigned x = 0; x < width; x++)
+            sums[x] += line[x];
+    }
+
+    for (unsigned y = 1; y < height; y++)
+    {
+        uint32_t *prev_line = sums + (size_t)(y - 1) * width;
+
+        update_line_sums(prev_line + width, prev_line,
+                         horz_sums + (size_t)((y > box_radius) ? y - box_radius - 1 : 0) * width,
+                         horz_sums + (size_t)SKRY_MIN(y + box_radius, height - 1) * width,
+                         width);
+
+        divide_line_sums(prev_line, output ? output + (y - 1) * output_line_stride : 0, width, divisor);
+    }
+
+    divide_line_sums(sums + (size_t)(height - 1) * width,
+                     output ? output + (height - 1) * output_line_stride : 0,
+                     width, divisor);
+}
+
+/// Blurs 'src' into 'blurred'
+/** 'pix_sum_1' and 'pix_sum_2' have to have room for width*height elements. */
 static
-enum SKRY_result box_blur(uint8_t *src, uint8_t *blurred, unsigned width, unsigned height,
-                   ptrdiff_t src_line_stride, ptrdiff_t blurred_line_stride,
-                   unsigned box_radius, unsigned iterations)
+void box_blur(uint8_t *src, uint8_t *blurred, unsigned width, unsigned height,
+              ptrdiff_t src_line_stride, ptrdiff_t blurred_line_stride,
+              unsigned box_radius, unsigned iterations,
+              uint32_t *pix_sum_1, uint32_t *pix_sum_2)
 {
     assert(iterations > 0);
     assert(box_radius > 0);
 
     if (width == 0 || height == 0)
-        return SKRY_SUCCESS;
+        return;
+
+    PERF_ADD(blur_calls, 1);
 
     /* First the 32-bit unsigned sums of neighborhoods are calculated horizontally
        and (incrementally) vertically. The max value of a (unsigned) sum is:
@@ -85,35 +257,29 @@ enum SKRY_result box_blur(uint8_t *src, uint8_t *blurred, unsigned width, unsign
     */
     assert(box_radius < (1U<<11) - 1);
 
-    // We need 2 summation buffers to act as source/destination (and then vice versa)
-    uint32_t *pix_sum_1 = malloc(width * height * sizeof(*pix_sum_1));
-    uint32_t *pix_sum_2 = malloc(width * height * sizeof(*pix_sum_2));
-    if (!pix_sum_1 || !pix_sum_2)
-    {
-        free(pix_sum_1);
-        free(pix_sum_2);
-        return SKRY_OUT_OF_MEMORY;
-    }
-
-    unsigned divisor = SKRY_SQR(2*box_radius + 1);
+    // Sums are divided after every iteration. We choose not to divide just once
+    // after completing all iterations, because the 32-bit intermediate values
+    // would overflow in as little as 3 iterations with 8-pixel box radius
+    // for an all-white input image. In such case the final sums would be:
+    //
+    //   255 * ((2*8+1)^2)^3 = 6'155'080'095
+    //
+    // (where the exponent 3 = number of iterations)
+    struct u32_divisor divisor = get_u32_divisor(SKRY_SQR(2*box_radius + 1));
 
     // For pixels less than 'box_radius' away from image border, assume
     // the off-image neighborhood consists of copies of the border pixel.
 
-    uint32_t * restrict src_array = pix_sum_1,
-             * restrict dest_array = pix_sum_2;
+    uint32_t * restrict horz_sums = pix_sum_1; ///< Results of the horizontal pass
+    uint32_t * restrict iter_result = pix_sum_2; ///< Normalized results of an iteration
 
     for (unsigned n = 0; n < iterations; n++)
     {
-        uint32_t *tmp = src_array;
-        src_array = dest_array;
-        dest_array = tmp;
-
         // Calculate horizontal neighborhood sums
         if (n == 0)
         {
             uint8_t * restrict src_line = src;
-            uint32_t * restrict dest_line = dest_array;
+            uint32_t * restrict dest_line = horz_sums;
             // Special case: in iteration 0 the source is the 8-bit 'src'
             for (unsigned y = 0; y < height; y++)
             {
@@ -125,8 +291,8 @@ enum SKRY_result box_blur(uint8_t *src, uint8_t *blurred, unsigned width, unsign
         }
         else
         {
-            uint32_t * restrict src_line = src_array;
-            uint32_t * restrict dest_line = dest_array;
+            uint32_t * restrict src_line = iter_result;
+            uint32_t * restrict dest_line = horz_sums;
 
             for (unsigned y = 0; y < height; y++)
             {
@@ -137,60 +303,10 @@ enum SKRY_result box_blur(uint8_t *src, uint8_t *blurred, unsigned width, unsign
             }
         }
 
-        tmp = src_array;
-        src_array = dest_array;
-        dest_array = tmp;
-
-        // Calculate vertical neighborhood sums
-        uint32_t * restrict src_col = src_array;
-        uint32_t * restrict dest_col = dest_array;
-        for (unsigned x = 0; x < width; x++)
-        {
-            BOX_BLUR_PASS(src_col, dest_col, box_radius, height, width);
-
-            src_col += 1;
-            dest_col += 1;
-        }
-
-        // Divide to obtain normalized result. We choose not to divide just once
-        // after completing all iterations, because the 32-bit intermediate values
-        // would overflow in as little as 3 iterations with 8-pixel box radius
-        // for an all-white input image. In such case the final sums would be:
-        //
-        //   255 * ((2*8+1)^2)^3 = 6'155'080'095
-        //
-        // (where the exponent 3 = number of iterations)
-        uint32_t * line_ptr = dest_array;
-        for (unsigned y = 0; y < height; y++)
-        {
-            for (unsigned x = 0; x < width; x++)
-            {
-                line_ptr[x] /= divisor;
-            }
-            line_ptr += width;
-        }
-    }
-
-    uint8_t * restrict blurred_line = blurred;
-    // 'dest_array' is where the last summation results were stored,
-    // now use it as source for producing the final 8-bit image in 'blurred'
-    uint32_t * restrict pix_sum_line = dest_array;
-
-    for (unsigned y = 0; y < height; y++)
-    {
-        for (unsigned x = 0; x < width; x++)
-        {
-            blurred_line[x] = pix_sum_line[x];
-        }
-
-        blurred_line += blurred_line_stride;
-        pix_sum_line += width;
+        // Calculate vertical neighborhood sums; the last iteration produces the final 8-bit image in 'blurred'
+        box_blur_vert_pass(horz_sums, iter_result, width, height, box_radius, divisor,
+                           (n == iterations - 1) ? blurred : 0, blurred_line_stride);
     }
-
-    free(pix_sum_1);
-    free(pix_sum_2);
-
-    return SKRY_SUCCESS;
 }
 
 /// Returns blurred image (SKRY_PIX_MONO8) or null if out of memory
@@ -199,23 +315,26 @@ struct SKRY_image *box_blur_img(const struct SKRY_image *img, unsigned box_radiu
 {
     assert(SKRY_get_img_pix_fmt(img) == SKRY_PIX_MONO8);
 
-    SKRY_Image *blurred = SKRY_new_image(SKRY_get_img_width(img), SKRY_get_img_height(img), SKRY_PIX_MONO8, 0, 0);
-    if (blurred)
-    {
-        enum SKRY_result result = box_blur(SKRY_get_line(img, 0), SKRY_get_line(blurred, 0),
-                                     SKRY_get_img_width(img), SKRY_get_img_height(img),
-                                     SKRY_get_line_stride_in_bytes(img), SKRY_get_line_stride_in_bytes(blurred),
-                                     box_radius, iterations);
-        if (SKRY_SUCCESS == result)
-            return blurred;
-        else
-        {
-            SKRY_free_image(blurred);
-            return 0;
-        }
-    }
-    else
+    unsigned width = SKRY_get_img_width(img),
+             height = SKRY_get_img_height(img);
+
+    SKRY_Image *blurred = SKRY_new_image(width, height, SKRY_PIX_MONO8, 0, 0);
+    if (!blurred)
         return 0;
+
+    uint32_t *pix_sum_1 = malloc((size_t)width * height * sizeof(*pix_sum_1));
+    uint32_t *pix_sum_2 = malloc((size_t)width * height * sizeof(*pix_sum_2));
+    if (pix_sum_1 && pix_sum_2)
+        box_blur(SKRY_get_line(img, 0), SKRY_get_line(blurred, 0), width, height,
+                 SKRY_get_line_stride_in_bytes(img), SKRY_get_line_stride_in_bytes(blurred),
+                 box_radius, iterations, pix_sum_1, pix_sum_2);
+    else
+        blurred = SKRY_free_image(blurred);
+
+    free(pix_sum_1);
+    free(pix_sum_2);
+
+    return blurred;
 }
 
 /// Estimates quality of the specified area (8 bits per pixel)
@@ -223,11 +342,20 @@ struct SKRY_image *box_blur_img(const struct SKRY_image *img, unsigned box_radiu
     and its blurred version. In other words, sum of values
     of the high-frequency component. The sum is normalized
     by dividing by the number of pixels. */
-SKRY_quality_t estimate_quality(uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride, unsigned box_blur_radius)
+SKRY_quality_t estimate_quality(uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride, unsigned box_blur_radius,
+                                struct filter_buffers *buffers)
 {
-    uint8_t *blurred = malloc(width*height);
+    struct filter_buffers tmp_buffers = { 0 };
+    if (!buffers)
+        buffers = &tmp_buffers;
+
+    if (!reserve_filter_buffers(buffers, (size_t)width * height))
+        return 0;
+
+    uint8_t *blurred = buffers->blurred;
     box_blur(pixels, blurred, width, height, line_stride, width,
-             box_blur_radius, QUALITY_ESTIMATE_BOX_BLUR_ITERATIONS);
+             box_blur_radius, QUALITY_ESTIMATE_BOX_BLUR_ITERATIONS,
+             buffers->pix_sum[0], buffers->pix_sum[1]);
 
     SKRY_quality_t quality = 0;
 
@@ -242,66 +370,210 @@ SKRY_quality_t estimate_quality(uint8_t *pixels, unsigned width, unsigned height
         blurred_line +=  width;
     }
 
-    free(blurred);
+    free_filter_buffers(&tmp_buffers);
 
     return quality / (width*height);
 }
 
-static
-void insertion_sort(double array[], size_t array_len)
+SKRY_quality_t get_laplacian_variance(const uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride)
 {
-    for (int i = 1; i < (int)array_len; i++)
+    if (width < 3 || height < 3)
+        return 0;
+
+    // Laplacian values are within [-4*255; 4*255], so a line's sum of their squares
+    // fits in 32 bits for up to 2^32 / (4*255)^2 > 4000 pixels; use 64 bits to be safe
+    int64_t sum = 0;
+    uint64_t sum_sq = 0;
+
+    for (unsigned y = 1; y < height - 1; y++)
     {
-        double x = array[i];
-        int j = i - 1;
-        while (j >= 0 && array[j] > x)
+        const uint8_t * restrict above = pixels + (y - 1) * line_stride;
+        const uint8_t * restrict line  = pixels + y * line_stride;
+        const uint8_t * restrict below = pixels + (y + 1) * line_stride;
+
+        int32_t line_sum = 0;
+        uint64_t line_sum_sq = 0;
+        for (unsigned x = 1; x < width - 1; x++)
         {
-            array[j+1] = array[j];
-            j -= 1;
+            int32_t lapl = 4 * line[x] - line[x - 1] - line[x + 1] - above[x] - below[x];
+            line_sum += lapl;
+            line_sum_sq += (uint32_t)(lapl * lapl);
         }
-        array[j+1] = x;
+
+        sum += line_sum;
+        sum_sq += line_sum_sq;
     }
+
+    double num_pixels = (double)(width - 2) * (height - 2);
+    double mean = sum / num_pixels;
+
+    return (SKRY_quality_t)(sum_sq / num_pixels - mean * mean);
 }
 
-/** Finds 'remove_val' in the sorted 'array', replaces it with 'new_val'
-    and ensures 'array' remains sorted. */
+/// Range of estimation areas: columns [col0; col1), rows [row0; row1)
+struct area_range
+{
+    unsigned col0, col1, row0, row1;
+};
+
+/// Blurs a tile of estimation areas and adds up their differences from the source
+/** Returns 0 if out of memory. */
 static
-void shift_sorted_window(double array[], size_t length, double remove_val, double new_val)
+int estimate_tile_quality(uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride,
+                          unsigned box_blur_radius, unsigned area_size,
+                          struct area_range tile,
+                          struct filter_buffers *buffers, SKRY_quality_t area_quality[])
 {
-    // Use binary search to locate 'remove_val' in 'array'
-    size_t idx_lo = 0, idx_hi = length, idx_mid;
-    do
-    {
-        idx_mid = (idx_hi + idx_lo)/2;
-        if (array[idx_mid] < remove_val)
-            idx_lo = idx_mid;
-        else if (array[idx_mid] > remove_val)
-            idx_hi = idx_mid;
-        else
-            break;
+    // Each blurring iteration propagates the influence of the tile's border (where pixels
+    // are replicated) 'box_blur_radius' pixels inwards. Blurring an additional 'halo'
+    // around the tile makes its contents identical to a blur of the whole fragment.
+    unsigned halo = QUALITY_ESTIMATE_BOX_BLUR_ITERATIONS * box_blur_radius;
+
+    unsigned x0 = tile.col0 * area_size,
+             x1 = SKRY_MIN(tile.col1 * area_size, width),
+             y0 = tile.row0 * area_size,
+             y1 = SKRY_MIN(tile.row1 * area_size, height);
 
-    } while (idx_hi > idx_lo);
+    unsigned blur_x0 = (x0 > halo) ? x0 - halo : 0,
+             blur_x1 = SKRY_MIN(x1 + halo, width),
+             blur_y0 = (y0 > halo) ? y0 - halo : 0,
+             blur_y1 = SKRY_MIN(y1 + halo, height);
 
-    // Insert 'new_val' into 'array' and (if needed) move it to keep the array sorted
-    size_t curr_idx = idx_mid;
-    array[curr_idx] = new_val;
-    while (curr_idx <= length-2 && array[curr_idx] > array[curr_idx + 1])
+    unsigned blur_width = blur_x1 - blur_x0;
+
+    if (!reserve_filter_buffers(buffers, (size_t)blur_width * (blur_y1 - blur_y0)))
+        return 0;
+
+    box_blur(pixels + blur_x0 + blur_y0 * line_stride, buffers->blurred,
+             blur_width, blur_y1 - blur_y0, line_stride, blur_width,
+             box_blur_radius, QUALITY_ESTIMATE_BOX_BLUR_ITERATIONS,
+             buffers->pix_sum[0], buffers->pix_sum[1]);
+
+    unsigned num_areas_horz = (width + area_size - 1) / area_size;
+
+    for (unsigned row = tile.row0; row < tile.row1; row++)
+        for (unsigned col = tile.col0; col < tile.col1; col++)
+        {
+            unsigned ax0 = col * area_size,
+                     ax1 = SKRY_MIN(ax0 + area_size, width),
+                     ay0 = row * area_size,
+                     ay1 = SKRY_MIN(ay0 + area_size, height);
+
+            uint64_t diff_sum = 0;
+            for (unsigned y = ay0; y < ay1; y++)
+            {
+                const uint8_t * restrict src_line = pixels + y * line_stride;
+                const uint8_t * restrict blurred_line = buffers->blurred + (size_t)(y - blur_y0) * blur_width - blur_x0;
+
+                uint32_t line_sum = 0;
+                for (unsigned x = ax0; x < ax1; x++)
+                    line_sum += abs(src_line[x] - blurred_line[x]);
+
+                diff_sum += line_sum;
+            }
+
+            area_quality[col + row * num_areas_horz] = (SKRY_quality_t)diff_sum / ((ax1 - ax0) * (ay1 - ay0));
+        }
+
+    return 1;
+}
+
+int estimate_grid_quality(uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride,
+                          unsigned box_blur_radius, unsigned area_size,
+                          struct thread_filter_buffers *buffers,
+                          SKRY_quality_t area_quality[])
+{
+    assert(area_size > 0);
+
+    unsigned num_areas_horz = (width + area_size - 1) / area_size,
+             num_areas_vert = (height + area_size - 1) / area_size;
+
+    // Blur tiles of several areas, so that the halo is small compared to the tile,
+    // but the tile's work buffers still fit in a cache
+    unsigned areas_per_tile_side = SKRY_MAX(1U, QUALITY_GRID_TILE_SIZE / area_size);
+
+    unsigned num_tiles_horz = (num_areas_horz + areas_per_tile_side - 1) / areas_per_tile_side,
+             num_tiles_vert = (num_areas_vert + areas_per_tile_side - 1) / areas_per_tile_side;
+
+    // If out of memory, temporary buffers are allocated instead
+    reserve_thread_filter_buffers(buffers);
+
+    int out_of_memory = 0;
+
+    #pragma omp parallel for \
+     schedule(dynamic) \
+     reduction(|:out_of_memory)
+    for (unsigned i = 0; i < num_tiles_horz * num_tiles_vert; i++)
     {
-        double tmp = array[curr_idx + 1];
-        array[curr_idx + 1] = array[curr_idx];
-        array[curr_idx] = tmp;
-        curr_idx += 1;
+        struct filter_buffers tmp_buffers = { 0 };
+        struct filter_buffers *tile_buffers = get_thread_filter_buffers(buffers);
+        if (!tile_buffers)
+            tile_buffers = &tmp_buffers;
+
+        unsigned col0 = (i % num_tiles_horz) * areas_per_tile_side,
+                 row0 = (i / num_tiles_horz) * areas_per_tile_side;
+
+        struct area_range tile = { .col0 = col0, .col1 = SKRY_MIN(col0 + areas_per_tile_side, num_areas_horz),
+                                   .row0 = row0, .row1 = SKRY_MIN(row0 + areas_per_tile_side, num_areas_vert) };
+
+        if (!estimate_tile_quality(pixels, width, height, line_stride, box_blur_radius, area_size,
+                                   tile, tile_buffers, area_quality))
+        {
+            out_of_memory = 1;
+        }
+
+        free_filter_buffers(&tmp_buffers);
     }
-    while (curr_idx > 0 && array[curr_idx] < array[curr_idx - 1])
+
+    return !out_of_memory;
+}
+
+struct value_and_index
+{
+    double value;
+    size_t index;
+};
+
+static
+int compare_values(const void *a, const void *b)
+{
+    double va = ((const struct value_and_index *)a)->value,
+           vb = ((const struct value_and_index *)b)->value;
+
+    return (va > vb) - (va < vb);
+}
+
+/// Adds 'delta' to the count of element 'idx' of the Fenwick tree (binary indexed tree) 'tree'
+static
+void fenwick_add(unsigned tree[], size_t tree_len, size_t idx, int delta)
+{
+    for (size_t i = idx + 1; i <= tree_len; i += i & (~i + 1))
+        tree[i - 1] += delta;
+}
+
+/// Returns the index of the 'k'-th (counting from 0) element of the Fenwick tree 'tree'
+/** 'highest_bit' is the highest power of 2 not greater than 'tree_len'. */
+static
+size_t fenwick_find(const unsigned tree[], size_t tree_len, size_t highest_bit, size_t k)
+{
+    size_t pos = 0;
+    for (size_t step = highest_bit; step > 0; step >>= 1)
     {
-        double tmp = array[curr_idx - 1];
-        array[curr_idx - 1] = array[curr_idx];
-        array[curr_idx] = tmp;
-        curr_idx -= 1;
+        if (pos + step <= tree_len && tree[pos + step - 1] <= k)
+        {
+            pos += step;
+            k -= tree[pos - 1];
+        }
     }
+    return pos;
 }
 
+/// Max. window radius for which 'median_filter()' sorts the window directly
+#define MEDIAN_SMALL_WINDOW_RADIUS 8
+
 /// Perform median filtering on 'array'
+/** For large windows, the window is represented as counts of 'array's elements (ordered by value) in a Fenwick tree,
+    so each window shift takes O(log(array_len)) time regardless of the window's size. */
 void median_filter(const double array[],
                    double output[], ///< Receives filtered contents of 'array'
                    size_t array_len,
@@ -309,30 +581,263 @@ void median_filter(const double array[],
 {
     assert(window_radius > 0 && window_radius < array_len);
 
-    size_t wnd_len = 2*window_radius + 1;
-    // A sorted array
-    double *window = malloc(wnd_len * sizeof(*window));
-
-    // Set initial window contents
-    for (size_t i = 0; i <= window_radius; i++)
+    if (window_radius <= MEDIAN_SMALL_WINDOW_RADIUS)
     {
-        // upper half
-        window[window_radius + i] = array[i];
+        // Sorting a copy of the window at each position is faster than the setup of the tree below
+        double window[2*MEDIAN_SMALL_WINDOW_RADIUS + 1];
+        size_t window_len = 2*window_radius + 1;
 
-        // lower half (consists of repeated array[0] value)
-        if (i < window_radius)
-            window[i] = array[0];
+        for (size_t i = 0; i < array_len; i++)
+        {
+            for (size_t j = 0; j < window_len; j++)
+            {
+                double value = array[SKRY_MIN((size_t)SKRY_MAX((int)(i + j) - (int)window_radius, 0), array_len-1)];
+
+                size_t k = j;
+                while (k > 0 && window[k-1] > value)
+                {
+                    window[k] = window[k-1];
+                    k--;
+                }
+                window[k] = value;
+            }
+            output[i] = window[window_radius];
+        }
+        return;
+    }
+
+    // Rank of each element of 'array', i.e. its position after sorting
+    struct value_and_index *sorted = malloc(array_len * sizeof(*sorted));
+    size_t *rank = malloc(array_len * sizeof(*rank));
+    unsigned *tree = calloc(array_len, sizeof(*tree));
+    if (!sorted || !rank || !tree)
+    {
+        // Out of memory; leave the values unfiltered
+        memcpy(output, array, array_len * sizeof(*output));
+        free(sorted);
+        free(rank);
+        free(tree);
+        return;
     }
-    insertion_sort(window, wnd_len);
+
+    for (size_t i = 0; i < array_len; i++)
+        sorted[i] = (struct value_and_index) { .value = array[i], .index = i };
+    qsort(sorted, array_len, sizeof(*sorted), compare_values);
+    for (size_t i = 0; i < array_len; i++)
+        rank[sorted[i].index] = i;
+
+    size_t highest_bit = 1;
+    while (2*highest_bit <= array_len)
+        highest_bit *= 2;
+
+    // Set initial window contents: the upper half and the lower half (consisting of repeated array[0] value)
+    fenwick_add(tree, array_len, rank[0], window_radius);
+    for (size_t i = 0; i <= window_radius; i++)
+        fenwick_add(tree, array_len, rank[i], 1);
 
     // Replace every 'array' element in 'output' with window's median and shift the window
     for (size_t i = 0; i < array_len; i++)
     {
-        output[i] = window[window_radius];
-        shift_sorted_window(window, wnd_len,
-                            array[SKRY_MAX((int)i - (int)window_radius, 0)],
-                            array[SKRY_MIN(i+1 + window_radius, array_len-1)]);
+        output[i] = sorted[fenwick_find(tree, array_len, highest_bit, window_radius)].value;
+
+        fenwick_add(tree, array_len, rank[SKRY_MAX((int)i - (int)window_radius, 0)], -1);
+        fenwick_add(tree, array_len, rank[SKRY_MIN(i+1 + window_radius, array_len-1)], 1);
+    }
+
+    free(sorted);
+    free(rank);
+    free(tree);
+}
+
+/// Histogram of pixel values in a sliding window, with a coarse level for faster median search
+/** The median is tracked incrementally (it usually changes little between neighboring pixels). */
+struct median_histogram
+{
+    unsigned fine_bits; ///< A coarse bin contains 2^fine_bits values
+    uint32_t *coarse;
+    uint32_t *fine;
+
+    size_t median_rank; ///< Rank of the median in the (full) window
+
+    unsigned median_coarse; ///< Coarse bin containing the median
+    size_t count_below_coarse; ///< Number of values in coarse bins below 'median_coarse'
+
+    unsigned median; ///< Median value found previously
+    size_t count_below; ///< Number of values below 'median'
+};
+
+static inline
+void hist_add(struct median_histogram *hist, unsigned value, int delta)
+{
+    unsigned c = value >> hist->fine_bits;
+    hist->coarse[c] += delta;
+    hist->fine[value] += delta;
+    if (c < hist->median_coarse)
+        hist->count_below_coarse += delta;
+    if (value < hist->median)
+        hist->count_below += delta;
+}
+
+static
+unsigned hist_get_median(struct median_histogram *hist)
+{
+    while (hist->count_below_coarse > hist->median_rank)
+    {
+        hist->median_coarse--;
+        hist->count_below_coarse -= hist->coarse[hist->median_coarse];
+    }
+    while (hist->count_below_coarse + hist->coarse[hist->median_coarse] <= hist->median_rank)
+    {
+        hist->count_below_coarse += hist->coarse[hist->median_coarse];
+        hist->median_coarse++;
+    }
+
+    if (hist->median >> hist->fine_bits != hist->median_coarse)
+    {
+        // The median has moved to another coarse bin; continue from its start
+        hist->median = hist->median_coarse << hist->fine_bits;
+        hist->count_below = hist->count_below_coarse;
+    }
+
+    while (hist->count_below > hist->median_rank)
+    {
+        hist->median--;
+        hist->count_below -= hist->fine[hist->median];
+    }
+    while (hist->count_below + hist->fine[hist->median] <= hist->median_rank)
+    {
+        hist->count_below += hist->fine[hist->median];
+        hist->median++;
+    }
+
+    return hist->median;
+}
+
+/// Returns value of channel 'channel' of pixel 'x' in 'line' (containing 8- or 16-bit values)
+static inline
+unsigned get_channel_value(const void *line, int bits_per_channel, size_t num_channels, unsigned x, size_t channel)
+{
+    if (8 == bits_per_channel)
+        return ((const uint8_t *)line)[x * num_channels + channel];
+    else
+        return ((const uint16_t *)line)[x * num_channels + channel];
+}
+
+/// Median-filters a single line of an image channel using histogram 'hist' (empty on entry and on exit)
+static
+void median_filter_line(
+    const void *lines[], ///< 2*radius+1 lines of the window (centered on the filtered line)
+    void *out_line,
+    int width, int bits_per_channel, size_t num_channels, size_t channel, int radius,
+    struct median_histogram *hist)
+{
+    int r = radius;
+
+    // Border pixels are treated as repeated outside the image
+#define COL(x) (unsigned)SKRY_MAX(0, SKRY_MIN(width - 1, (x)))
+
+    for (int i = 0; i <= 2*r; i++)
+        for (int dx = -r; dx <= r; dx++)
+            hist_add(hist, get_channel_value(lines[i], bits_per_channel, num_channels, COL(dx), channel), 1);
+
+    for (int x = 0; x < width; x++)
+    {
+        unsigned median = hist_get_median(hist);
+        if (8 == bits_per_channel)
+            ((uint8_t *)out_line)[x * num_channels + channel] = median;
+        else
+            ((uint16_t *)out_line)[x * num_channels + channel] = median;
+
+        unsigned x_removed = COL(x - r),
+                 x_added = COL(x + r + 1);
+        for (int i = 0; i <= 2*r; i++)
+        {
+            hist_add(hist, get_channel_value(lines[i], bits_per_channel, num_channels, x_removed, channel), -1);
+            hist_add(hist, get_channel_value(lines[i], bits_per_channel, num_channels, x_added, channel), 1);
+        }
+    }
+
+    // Empty the histogram (cheaper than clearing all bins)
+    for (int i = 0; i <= 2*r; i++)
+        for (int dx = -r; dx <= r; dx++)
+            hist_add(hist, get_channel_value(lines[i], bits_per_channel, num_channels, COL(width + dx), channel), -1);
+
+#undef COL
+}
+
+SKRY_Image *median_filter_img(const SKRY_Image *img, unsigned radius)
+{
+    enum SKRY_pixel_format pix_fmt = SKRY_get_img_pix_fmt(img);
+    assert(radius > 0);
+    assert(pix_fmt != SKRY_PIX_PAL8 && (pix_fmt < SKRY_PIX_CFA_MIN || pix_fmt > SKRY_PIX_CFA_MAX));
+    assert(BITS_PER_CHANNEL[pix_fmt] == 8 || BITS_PER_CHANNEL[pix_fmt] == 16);
+
+    unsigned width = SKRY_get_img_width(img),
+             height = SKRY_get_img_height(img);
+
+    SKRY_Image *output = SKRY_new_image(width, height, pix_fmt, 0, 0);
+    if (!output)
+        return 0;
+
+    unsigned bits = BITS_PER_CHANNEL[pix_fmt];
+    size_t num_channels = NUM_CHANNELS[pix_fmt];
+    int out_of_memory = 0;
+
+    #pragma omp parallel reduction(|:out_of_memory)
+    {
+        struct median_histogram hist = { .fine_bits = bits/2,
+                                         .median_rank = SKRY_SQR(2*(size_t)radius + 1) / 2 };
+        hist.coarse = calloc((size_t)1 << (bits - hist.fine_bits), sizeof(*hist.coarse));
+        hist.fine = calloc((size_t)1 << bits, sizeof(*hist.fine));
+
+        const void **lines = malloc((2*(size_t)radius + 1) * sizeof(*lines));
+
+        #pragma omp for
+        for (unsigned y = 0; y < height; y++)
+        {
+            if (!hist.coarse || !hist.fine || !lines)
+            {
+                out_of_memory = 1;
+                continue;
+            }
+
+            // Border lines are treated as repeated outside the image
+            for (int i = 0; i <= 2*(int)radius; i++)
+                lines[i] = SKRY_get_line(img, SKRY_MAX(0, SKRY_MIN((int)height - 1, (int)y + i - (int)radius)));
+
+            for (size_t ch = 0; ch < num_channels; ch++)
+                median_filter_line(lines, SKRY_get_line(output, y), width, bits, num_channels, ch, radius, &hist);
+        }
+
+        free(hist.coarse);
+        free(hist.fine);
+        free(lines);
+    }
+
+    if (out_of_memory)
+        return SKRY_free_image(output);
+    else
+        return output;
+}
+
+SKRY_Image *downsample_img_2x(const SKRY_Image *img)
+{
+    unsigned width = SKRY_get_img_width(img)/2,
+             height = SKRY_get_img_height(img)/2;
+
+    SKRY_Image *result = SKRY_new_image(SKRY_MAX(width, 1), SKRY_MAX(height, 1), SKRY_PIX_MONO8, 0, 0);
+    if (!result)
+        return 0;
+
+    ptrdiff_t src_stride = SKRY_get_line_stride_in_bytes(img);
+    for (unsigned y = 0; y < height; y++)
+    {
+        const uint8_t *src0 = SKRY_get_line(img, 2*y);
+        const uint8_t *src1 = src0 + src_stride;
+        uint8_t *dest = SKRY_get_line(result, y);
+        for (unsigned x = 0; x < width; x++)
+            dest[x] = (src0[2*x] + src0[2*x+1] + src1[2*x] + src1[2*x+1] + 2) / 4;
     }
 
-    free(window);
+    return result;
 }
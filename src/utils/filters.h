@@ -24,10 +24,47 @@ File description:
 #ifndef LIBSKRY_FILTERS_HEADER
 #define LIBSKRY_FILTERS_HEADER
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <skry/defs.h>
 #include <skry/image.h>
 
 
+/// Number of box blur iterations used by 'estimate_quality()'
+/** Result of 3 iterations is quite close to a Gaussian blur. */
+#define QUALITY_ESTIMATE_BOX_BLUR_ITERATIONS 3
+
+/// Approximate side length of tiles blurred at once by 'estimate_grid_quality()'
+#define QUALITY_GRID_TILE_SIZE 128
+
+/// Work buffers of 'estimate_quality()', reused between calls; they grow as needed
+/** Initialize with all fields zeroed. Can be used by one thread at a time. */
+struct filter_buffers
+{
+    size_t capacity; ///< Number of pixels the buffers can hold
+    uint8_t *blurred;
+    uint32_t *pix_sum[2];
+};
+
+void free_filter_buffers(struct filter_buffers *buffers);
+
+/// Separate 'filter_buffers' for each thread of parallel loops
+/** Initialize with all fields zeroed. */
+struct thread_filter_buffers
+{
+    size_t num_threads;
+    struct filter_buffers *buffers; ///< Element [i] is used by thread 'i'
+};
+
+/// Has to be called before a parallel loop using 'get_thread_filter_buffers()'; returns 0 if out of memory
+int reserve_thread_filter_buffers(struct thread_filter_buffers *tfb);
+
+/// Returns the calling thread's buffers (or null if there are none)
+struct filter_buffers *get_thread_filter_buffers(struct thread_filter_buffers *tfb);
+
+void free_thread_filter_buffers(struct thread_filter_buffers *tfb);
+
 /// Returns blurred image (SKRY_PIX_MONO8) or null if out of memory
 /** Requirements: img is SKRY_PIX_MONO8, box_radius < 2^11 */
 struct SKRY_image *box_blur_img(const struct SKRY_image *img, unsigned box_radius, size_t iterations);
@@ -36,8 +73,25 @@ struct SKRY_image *box_blur_img(const struct SKRY_image *img, unsigned box_radiu
 /** Quality is the sum of differences between input image
     and its blurred version. In other words, sum of values
     of the high-frequency component. The sum is normalized
-    by dividing by the number of pixels. */
-SKRY_quality_t estimate_quality(uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride, unsigned box_blur_radius);
+    by dividing by the number of pixels. Returns 0 if out of memory. */
+SKRY_quality_t estimate_quality(uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride, unsigned box_blur_radius,
+                                /// If null, temporary buffers are allocated
+                                struct filter_buffers *buffers);
+
+/// Returns variance of the Laplacian (4-neighbor 3x3 kernel) of the specified area (8 bits per pixel)
+/** The area's edge pixels are skipped. Returns 0 if the area is smaller than 3x3. */
+SKRY_quality_t get_laplacian_variance(const uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride);
+
+/// Estimates quality of all areas of a grid covering the specified fragment (8 bits per pixel)
+/** The fragment is divided into squares of 'area_size' (those at the right and bottom
+    border may be smaller), whose quality is stored in 'area_quality' row by row.
+    Quality is defined as in 'estimate_quality()', but the whole fragment is blurred
+    at once, so pixels near areas' edges are blurred with their actual neighbors
+    (instead of copies of the edge pixels). Returns 0 if out of memory. */
+int estimate_grid_quality(uint8_t *pixels, unsigned width, unsigned height, ptrdiff_t line_stride,
+                          unsigned box_blur_radius, unsigned area_size,
+                          struct thread_filter_buffers *buffers,
+                          SKRY_quality_t area_quality[]);
 
 /// Perform median filtering on 'array'
 void median_filter(const double array[],
@@ -45,4 +99,13 @@ void median_filter(const double array[],
                    size_t array_len,
                    size_t window_radius);
 
+/// Returns median-filtered 'img' (in the same pixel format) or null if out of memory
+/** Each channel is filtered separately with a (2*radius+1)^2 window, using a sliding
+    histogram (Huang's algorithm). Requirements: 'img' has 8 or 16 bits per channel,
+    is not a palette or raw color image; radius > 0. */
+SKRY_Image *median_filter_img(const SKRY_Image *img, unsigned radius);
+
+/// Returns 'img' (SKRY_PIX_MONO8) downsampled 2x by averaging 2x2 pixel blocks, or null if out of memory
+SKRY_Image *downsample_img_2x(const SKRY_Image *img);
+
 #endif // LIBSKRY_FILTERS_HEADER
@@ -1,25 +1,68 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "dnarray.h"
 #include "img_pool.h"
 #include "logging.h"
+#include "perf.h"
+#include "threads.h"
 
 
+#define NOT_IN_HEAP SIZE_MAX
+
+struct img_seq_entry;
+
+/// Image stored in the pool
+struct pooled_img
+{
+    SKRY_Image *img;
+    struct img_seq_entry *img_seq_entry;
+    size_t img_idx;
+    enum pooled_img_kind kind;
+    unsigned kind_param;
+    size_t num_bytes;
+
+    double cost; ///< Time (in seconds) it took to create 'img'
+
+    /// Eviction priority; images with the lowest priority are evicted first
+    double priority;
+
+    /// Element index in 'SKRY_image_pool::heap'; NOT_IN_HEAP if the image is in use
+    size_t heap_pos;
+    unsigned use_count;
+
+    /// Next image with the same index (in a different pixel format or of a different kind)
+    struct pooled_img *next;
+};
+
 struct img_seq_entry
 {
     SKRY_ImgSequence *img_seq;
     size_t num_images;
-    SKRY_Image **images;
+    /// Element [i] is a list of images with index 'i' (at most one per pixel format and kind)
+    struct pooled_img **images;
 };
 
 /**
-    Contains a list of image sequences and an array of stored images for each of them.
+    Contains a list of image sequences and lists of stored images for each of them.
 
     Each element in 'img_seq_nodes' corresponds with an image sequence registered
-    in the pool. For each sequence there is an array of registered image pointers
-    (img_seq_entry::images). The 'img_seq_nodes' list's linkage changes during pool's
-    lifetime to reflect the order of most recent access. (Note that pointers to
-    the list's elements remain unchanged).
+    in the pool. For each sequence there is an array of lists of stored images
+    (img_seq_entry::images); the same image may be stored in several pixel formats,
+    and together with images derived from it (see 'enum pooled_img_kind').
+
+    Images not being currently used are kept in a binary min-heap ordered
+    by eviction priority, which follows the GreedyDual-Size policy:
+    an image's priority is set (when it is stored and on every use) to
+
+        inflation + cost / num_bytes
+
+    where 'cost' is the time it took to create the image (read, convert,
+    demosaic), and 'inflation' is the priority of the most recently
+    evicted image. This way the images which are cheap to re-create
+    per byte are evicted first, and images not used for a long time
+    eventually get evicted too (as 'inflation' grows).
 */
 struct SKRY_image_pool
 {
@@ -27,15 +70,114 @@ struct SKRY_image_pool
     size_t num_bytes; ///< Number of bytes occupied by all registered images
 
     /** List of image sequences connected to the pool ('data' fields point
-        to 'struct img_seq_entry'. The first node is the most recently used (MRU)
-        one, the last is the least recently used (LRU). */
+        to 'struct img_seq_entry'. */
     struct list_node *img_seq_nodes;
 
-    /// The least recently used (connected/read/modified) node in 'img_seq_nodes'
-    /** This is also the last node in the list. */
-    struct list_node *LRU;
+    /// Images not being currently used
+    DA_DECLARE(struct pooled_img *) heap;
+
+    double inflation;
+
+    /// Guards all of the above; image sequences using the pool may be processed in different threads (e.g. in a batch)
+    struct mutex *mutex;
 };
 
+static
+void heap_swap(SKRY_ImagePool *img_pool, size_t pos1, size_t pos2)
+{
+    struct pooled_img *p1 = img_pool->heap.data[pos1];
+    img_pool->heap.data[pos1] = img_pool->heap.data[pos2];
+    img_pool->heap.data[pos2] = p1;
+    img_pool->heap.data[pos1]->heap_pos = pos1;
+    img_pool->heap.data[pos2]->heap_pos = pos2;
+}
+
+static
+void heap_sift_up(SKRY_ImagePool *img_pool, size_t pos)
+{
+    struct pooled_img **heap = img_pool->heap.data;
+    while (pos > 0 && heap[(pos - 1) / 2]->priority > heap[pos]->priority)
+    {
+        heap_swap(img_pool, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static
+void heap_sift_down(SKRY_ImagePool *img_pool, size_t pos)
+{
+    struct pooled_img **heap = img_pool->heap.data;
+    size_t size = DA_SIZE(img_pool->heap);
+    for (;;)
+    {
+        size_t smallest = pos;
+        size_t left = 2*pos + 1, right = 2*pos + 2;
+        if (left < size && heap[left]->priority < heap[smallest]->priority)
+            smallest = left;
+        if (right < size && heap[right]->priority < heap[smallest]->priority)
+            smallest = right;
+
+        if (smallest == pos)
+            break;
+
+        heap_swap(img_pool, pos, smallest);
+        pos = smallest;
+    }
+}
+
+static
+void heap_insert(SKRY_ImagePool *img_pool, struct pooled_img *pimg)
+{
+    pimg->heap_pos = DA_SIZE(img_pool->heap);
+    DA_APPEND(img_pool->heap, pimg);
+    heap_sift_up(img_pool, pimg->heap_pos);
+}
+
+static
+void heap_remove(SKRY_ImagePool *img_pool, struct pooled_img *pimg)
+{
+    size_t pos = pimg->heap_pos;
+    size_t last = DA_SIZE(img_pool->heap) - 1;
+    assert(pos <= last);
+
+    if (pos != last)
+    {
+        heap_swap(img_pool, pos, last);
+        img_pool->heap.data_end--;
+        heap_sift_down(img_pool, pos);
+        heap_sift_up(img_pool, pos);
+    }
+    else
+        img_pool->heap.data_end--;
+
+    pimg->heap_pos = NOT_IN_HEAP;
+}
+
+static
+double get_priority(const SKRY_ImagePool *img_pool, const struct pooled_img *pimg)
+{
+    return img_pool->inflation + pimg->cost / (double)(pimg->num_bytes ? pimg->num_bytes : 1);
+}
+
+/// Removes 'pimg' from pool's structures and frees it; 'pimg' must not be in use
+static
+void remove_pooled_img(SKRY_ImagePool *img_pool, struct pooled_img *pimg)
+{
+    assert(0 == pimg->use_count);
+
+    if (pimg->heap_pos != NOT_IN_HEAP)
+        heap_remove(img_pool, pimg);
+
+    struct pooled_img **link = &pimg->img_seq_entry->images[pimg->img_idx];
+    while (*link != pimg)
+        link = &(*link)->next;
+    *link = pimg->next;
+
+    img_pool->num_bytes -= pimg->num_bytes;
+    SKRY_free_image(pimg->img);
+    free(pimg);
+}
+
 /// Returns null if out of memory
 SKRY_ImagePool *SKRY_create_image_pool(
     /// Value in bytes
@@ -50,7 +192,14 @@ SKRY_ImagePool *SKRY_create_image_pool(
         return 0;
 
     *img_pool = (SKRY_ImagePool) { 0 };
+    img_pool->mutex = create_mutex();
+    if (!img_pool->mutex)
+    {
+        free(img_pool);
+        return 0;
+    }
     img_pool->capacity = capacity;
+    DA_ALLOC(img_pool->heap, 0);
 
     LOG_MSG(SKRY_LOG_IMG_POOL, "Created image pool %p (%.1f MiB capacity).",
             (void *)img_pool, (double)capacity/(1U << 20));
@@ -77,15 +226,15 @@ struct list_node *connect_img_sequence(SKRY_ImagePool *img_pool, SKRY_ImgSequenc
     for (size_t i = 0; i < data->num_images; i++)
         data->images[i] = 0;
 
+    lock_mutex(img_pool->mutex);
     list_add(&img_pool->img_seq_nodes, data);
+    struct list_node *img_seq_node = img_pool->img_seq_nodes;
+    unlock_mutex(img_pool->mutex);
 
     LOG_MSG(SKRY_LOG_IMG_POOL, "Connected img. seq. %p to img. pool %p (node: %p).",
-            (void *)img_seq, (void *)img_pool, (void *)img_pool->img_seq_nodes);
-
-    if (!img_pool->LRU)
-        img_pool->LRU = img_pool->img_seq_nodes; // currently there is only one element
+            (void *)img_seq, (void *)img_pool, (void *)img_seq_node);
 
-    return img_pool->img_seq_nodes;
+    return img_seq_node;
 }
 
 void disconnect_img_sequence(SKRY_ImagePool *img_pool,
@@ -93,8 +242,15 @@ void disconnect_img_sequence(SKRY_ImagePool *img_pool,
                              struct list_node *img_seq_node)
 {
     struct img_seq_entry *entry = (struct img_seq_entry *)img_seq_node->data;
+
+    lock_mutex(img_pool->mutex);
     for (size_t i = 0; i < entry->num_images; i++)
-        SKRY_free_image(entry->images[i]);
+        while (entry->images[i])
+        {
+            // Images still in use are freed as well; the sequence is going away anyway
+            entry->images[i]->use_count = 0;
+            remove_pooled_img(img_pool, entry->images[i]);
+        }
 
     free(entry->images);
 
@@ -103,127 +259,180 @@ void disconnect_img_sequence(SKRY_ImagePool *img_pool,
 
     free(entry);
     list_remove(&img_pool->img_seq_nodes, img_seq_node);
+    unlock_mutex(img_pool->mutex);
     free(img_seq_node);
 }
 
+/** Stores 'img' (which is then considered in use, see 'release_image_to_pool()'),
+    unless an image with the same 'img_index', pixel format and kind is already stored.
+    If adding 'img' would exceed the pool's memory size limit, unused images
+    with the lowest eviction priority (of any img. sequence) are removed and freed,
+    until there is sufficient room. If there is still no room, the image
+    is not added to 'img_pool'. Returns 0 if 'img' has not been added. */
 static
-void mark_as_MRU(SKRY_ImagePool *img_pool, struct list_node *img_seq_node)
-{
-    struct list_node *MRU = img_pool->img_seq_nodes;
-
-    if (MRU == img_seq_node)
-        return;
-
-    if (img_seq_node->prev)
-        img_seq_node->prev->next = img_seq_node->next;
-
-    if (img_seq_node->next)
-        img_seq_node->next->prev = img_seq_node->prev;
-
-    if (img_pool->LRU == img_seq_node)
-        img_pool->LRU = img_seq_node->prev;
-
-    img_seq_node->prev = 0;
-    img_seq_node->next = MRU;
-    MRU->prev = img_seq_node;
-    img_pool->img_seq_nodes = img_seq_node;
-
-    LOG_MSG(SKRY_LOG_IMG_POOL, "Node %p (img. seq. %p) set as MRU in img. pool %p.",
-            (void *)img_seq_node, (void *)((struct img_seq_entry *)img_seq_node->data)->img_seq,
-            (void *)img_pool);
-}
-
-/** If an image has been already added for this 'img_seq' and 'img_index', it will be freed
-    and replaced by 'img'. Otherwise, if adding 'img' would exceed the pool's memory size limit,
-    images of the least recently used img. sequence in 'pool' will be removed and freed,
-    until there is sufficient room. If all images other than those of 'img_seq_node'
-    have been removed and there is still no room, the image will not be added to 'img_pool'. */
-void put_image_in_pool(SKRY_ImagePool *img_pool,
-                       /// Pointer returned by connect_img_sequence()
-                       struct list_node *img_seq_node,
-                       size_t img_index, SKRY_Image *img)
+int put_image_in_pool_locked(SKRY_ImagePool *img_pool,
+                             /// Pointer returned by connect_img_sequence()
+                             struct list_node *img_seq_node,
+                             size_t img_index, SKRY_Image *img,
+                             enum pooled_img_kind kind,
+                             unsigned kind_param, ///< Meaning depends on 'kind'
+                             /// Time (in seconds) it took to create 'img'; used as the re-creation cost estimate
+                             double cost)
 {
     assert(img_seq_node);
     struct img_seq_entry *data = img_seq_node->data;
     assert(img_index < data->num_images);
 
-    size_t img_bytes = SKRY_get_img_byte_count(img);
+    for (struct pooled_img *pimg = data->images[img_index]; pimg; pimg = pimg->next)
+        if (SKRY_get_img_pix_fmt(pimg->img) == SKRY_get_img_pix_fmt(img)
+            && pimg->kind == kind && pimg->kind_param == kind_param)
+        {
+            return 0;
+        }
 
-    struct list_node *less_recently_used_node = img_pool->LRU;
+    size_t img_bytes = SKRY_get_img_byte_count(img);
+    if (img_bytes > img_pool->capacity)
+        return 0;
 
-    // If the image cannot fit in the pool, try freeing images of
-    // less recently used image sequences until there is room.
     while (img_pool->num_bytes + img_bytes > img_pool->capacity
-           && less_recently_used_node
-           && less_recently_used_node != img_seq_node)
+           && DA_SIZE(img_pool->heap) > 0)
     {
-        size_t curr_lru_img_index_to_free = 0; // img index in 'less_recently_used_node'
-        struct img_seq_entry *data = less_recently_used_node->data;
-        while (img_pool->num_bytes + img_bytes > img_pool->capacity
-               && curr_lru_img_index_to_free < data->num_images)
-        {
-            SKRY_Image *img_to_free = data->images[curr_lru_img_index_to_free];
-            if (img_to_free)
-            {
-                img_pool->num_bytes -= SKRY_get_img_byte_count(img_to_free);
-                data->images[curr_lru_img_index_to_free] = SKRY_free_image(img_to_free);
-
-                LOG_MSG(SKRY_LOG_IMG_POOL, "Freed image %p (index %zu in img. seq. %p) from img. pool %p.",
-                        (void *)img_to_free, curr_lru_img_index_to_free,
-                        (void *)data->img_seq, (void *)img_pool);
-            }
-            curr_lru_img_index_to_free++;
-        }
-        less_recently_used_node = less_recently_used_node->prev;
-    }
+        struct pooled_img *victim = img_pool->heap.data[0];
+        img_pool->inflation = victim->priority;
 
-    if (img_pool->num_bytes + img_bytes <= img_pool->capacity)
-    {
-        if (data->images[img_index])
-        {
-            LOG_MSG(SKRY_LOG_IMG_POOL, "Replacing and freeing image %p (index %zu in img. seq. %p) in img. pool %p.",
-                    (void *)data->images[img_index], img_index, (void *)data->img_seq, (void *)img_pool);
-            img_pool->num_bytes -= SKRY_get_img_byte_count(data->images[img_index]);
-            SKRY_free_image(data->images[img_index]);
-        }
-        data->images[img_index] = img;
-        img_pool->num_bytes += img_bytes;
-        mark_as_MRU(img_pool, img_seq_node);
+        LOG_MSG(SKRY_LOG_IMG_POOL, "Freeing image %p (index %zu in img. seq. %p, %s) from img. pool %p.",
+                (void *)victim->img, victim->img_idx, (void *)victim->img_seq_entry->img_seq,
+                pix_fmt_str[SKRY_get_img_pix_fmt(victim->img)], (void *)img_pool);
 
-        LOG_MSG(SKRY_LOG_IMG_POOL, "Image %p (index %zu in img. seq. %p) put in img. pool %p (pool size is now %zu).",
-        (void *)img, img_index, (void *)data->img_seq, (void *)img_pool, img_pool->num_bytes);
+        remove_pooled_img(img_pool, victim);
     }
-    else
+
+    if (img_pool->num_bytes + img_bytes > img_pool->capacity)
     {
         LOG_MSG(SKRY_LOG_IMG_POOL, "Image %p (%zu bytes, index %zu in img. seq. %p) could not be put in img. pool %p (size: %zu, capacity: %zu).",
         (void *)img, img_bytes, img_index, (void *)data->img_seq, (void *)img_pool, img_pool->num_bytes, img_pool->capacity);
 
-        // report something to caller?
+        return 0;
     }
+
+    struct pooled_img *pimg = malloc(sizeof(*pimg));
+    if (!pimg)
+        return 0;
+
+    *pimg = (struct pooled_img) {
+        .img = img,
+        .img_seq_entry = data,
+        .img_idx = img_index,
+        .kind = kind,
+        .kind_param = kind_param,
+        .num_bytes = img_bytes,
+        .cost = cost,
+        .heap_pos = NOT_IN_HEAP,
+        .use_count = 1,
+        .next = data->images[img_index]
+    };
+    data->images[img_index] = pimg;
+    img_pool->num_bytes += img_bytes;
+
+    LOG_MSG(SKRY_LOG_IMG_POOL, "Image %p (index %zu in img. seq. %p, %s, cost: %.2f ms) put in img. pool %p (pool size is now %zu).",
+            (void *)img, img_index, (void *)data->img_seq, pix_fmt_str[SKRY_get_img_pix_fmt(img)],
+            cost * 1000.0, (void *)img_pool, img_pool->num_bytes);
+
+    return 1;
+}
+
+int put_image_in_pool(SKRY_ImagePool *img_pool, struct list_node *img_seq_node,
+                      size_t img_index, SKRY_Image *img,
+                      enum pooled_img_kind kind, unsigned kind_param,
+                      double cost)
+{
+    lock_mutex(img_pool->mutex);
+    int result = put_image_in_pool_locked(img_pool, img_seq_node, img_index, img, kind, kind_param, cost);
+    unlock_mutex(img_pool->mutex);
+    return result;
 }
 
 /// May return null; the caller must not attempt to free the returned image
-SKRY_Image *get_image_from_pool(SKRY_ImagePool *img_pool,
-                                /// Pointer returned by connect_img_sequence()
-                                struct list_node *img_seq_node,
-                                size_t img_idx)
+/** The returned image is considered in use (and cannot be evicted)
+    until it is passed to 'release_image_to_pool()'. */
+static
+SKRY_Image *get_image_from_pool_locked(SKRY_ImagePool *img_pool,
+                                       /// Pointer returned by connect_img_sequence()
+                                       struct list_node *img_seq_node,
+                                       size_t img_idx,
+                                       enum SKRY_pixel_format pix_fmt,
+                                       enum pooled_img_kind kind,
+                                       unsigned kind_param)
 {
     struct img_seq_entry *data = img_seq_node->data;
     assert(img_idx < data->num_images);
 
-    mark_as_MRU(img_pool, img_seq_node);
+    for (struct pooled_img *pimg = data->images[img_idx]; pimg; pimg = pimg->next)
+        if (SKRY_get_img_pix_fmt(pimg->img) == pix_fmt
+            && pimg->kind == kind && pimg->kind_param == kind_param)
+        {
+            if (pimg->heap_pos != NOT_IN_HEAP)
+                heap_remove(img_pool, pimg);
+            pimg->use_count++;
 
-    if (data->images[img_idx])
-    {
-        mark_as_MRU(img_pool, img_seq_node);
+            LOG_MSG(SKRY_LOG_IMG_POOL, "Got image %p (index %zu in img. seq. %p) from img. pool %p.",
+                    (void *)pimg->img, img_idx, (void *)data->img_seq, (void *)img_pool);
 
-        LOG_MSG(SKRY_LOG_IMG_POOL, "Got image %p (index %zu in img. seq. %p) from img. pool %p.",
-                (void *)data->images[img_idx], img_idx, (void *)data->img_seq, (void *)img_pool);
+            return pimg->img;
+        }
 
-        return data->images[img_idx];
-    }
+    return 0;
+}
+
+SKRY_Image *get_image_from_pool(SKRY_ImagePool *img_pool, struct list_node *img_seq_node,
+                                size_t img_idx, enum SKRY_pixel_format pix_fmt,
+                                enum pooled_img_kind kind, unsigned kind_param)
+{
+    lock_mutex(img_pool->mutex);
+    SKRY_Image *img = get_image_from_pool_locked(img_pool, img_seq_node, img_idx, pix_fmt, kind, kind_param);
+    unlock_mutex(img_pool->mutex);
+
+    if (img)
+        PERF_ADD(pool_hits, 1);
     else
-        return 0;
+        PERF_ADD(pool_misses, 1);
+
+    return img;
+}
+
+/// Returns 0 if 'img' is not stored in 'img_pool' (i.e. it has to be freed by the caller)
+static
+int release_image_to_pool_locked(SKRY_ImagePool *img_pool,
+                                 /// Pointer returned by connect_img_sequence()
+                                 struct list_node *img_seq_node,
+                                 size_t img_idx,
+                                 SKRY_Image *img)
+{
+    struct img_seq_entry *data = img_seq_node->data;
+    assert(img_idx < data->num_images);
+
+    for (struct pooled_img *pimg = data->images[img_idx]; pimg; pimg = pimg->next)
+        if (pimg->img == img)
+        {
+            assert(pimg->use_count > 0);
+            if (0 == --pimg->use_count)
+            {
+                pimg->priority = get_priority(img_pool, pimg);
+                heap_insert(img_pool, pimg);
+            }
+            return 1;
+        }
+
+    return 0;
+}
+
+int release_image_to_pool(SKRY_ImagePool *img_pool, struct list_node *img_seq_node,
+                          size_t img_idx, SKRY_Image *img)
+{
+    lock_mutex(img_pool->mutex);
+    int result = release_image_to_pool_locked(img_pool, img_seq_node, img_idx, img);
+    unlock_mutex(img_pool->mutex);
+    return result;
 }
 
 /// Returns null; also disconnects all image sequences that were using 'img_pool'
@@ -238,6 +447,8 @@ SKRY_ImagePool *SKRY_free_image_pool(SKRY_ImagePool *img_pool)
             SKRY_disconnect_from_img_pool(((struct img_seq_entry *)node->data)->img_seq);
             node = next;
         }
+        DA_FREE(img_pool->heap);
+        free_mutex(img_pool->mutex);
         free(img_pool);
     }
     return 0;
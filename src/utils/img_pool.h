@@ -32,6 +32,16 @@ File description:
 #include "list.h"
 
 
+/// Kind of a stored image (in addition to its pixel format)
+enum pooled_img_kind
+{
+    /// Image as read from the image sequence (possibly converted to another pixel format)
+    POOLED_IMG_ORIGINAL,
+
+    /// SKRY_PIX_MONO8 version of the image downsampled 2^(kind_param) times
+    POOLED_IMG_DOWNSAMPLED
+};
+
 /** Returns a pointer to be later passed to all functions that expect 'img_seq_node'.
     Returns null if out of memory. */
 struct list_node *connect_img_sequence(SKRY_ImagePool *img_pool, SKRY_ImgSequence *img_seq);
@@ -40,21 +50,37 @@ void disconnect_img_sequence(SKRY_ImagePool *img_pool,
                              /// Pointer returned by connect_img_sequence()
                              struct list_node *img_seq_node);
 
-/** If an image has been already added for this 'img_seq' and 'img_index', it will be freed
-    and replaced by 'img'. Otherwise, if adding 'img' would exceed the pool's memory size limit,
-    images of the least recently used img. sequence in 'pool' will be removed and freed,
-    until there is sufficient room. If all images other than those of 'img_seq_node'
-    have been removed and there is still no room, the image will not be added to 'img_pool'. */
-void put_image_in_pool(SKRY_ImagePool *img_pool,
-                       /// Pointer returned by connect_img_sequence()
-                       struct list_node *img_seq_node,
-                       size_t img_index, SKRY_Image *img);
+/** Stores 'img' (which is then considered in use, see 'release_image_to_pool()'),
+    unless an image with the same 'img_index', pixel format and kind is already stored.
+    If adding 'img' would exceed the pool's memory size limit, unused images
+    with the lowest eviction priority (of any img. sequence) are removed and freed,
+    until there is sufficient room. If there is still no room, the image
+    is not added to 'img_pool'. Returns 0 if 'img' has not been added. */
+int put_image_in_pool(SKRY_ImagePool *img_pool,
+                      /// Pointer returned by connect_img_sequence()
+                      struct list_node *img_seq_node,
+                      size_t img_index, SKRY_Image *img,
+                      enum pooled_img_kind kind,
+                      unsigned kind_param, ///< Meaning depends on 'kind'
+                      /// Time (in seconds) it took to create 'img'; used as the re-creation cost estimate
+                      double cost);
 
 /// May return null; the caller must not attempt to free the returned image
+/** The returned image is considered in use (and cannot be evicted)
+    until it is passed to 'release_image_to_pool()'. */
 SKRY_Image *get_image_from_pool(SKRY_ImagePool *img_pool,
                                 /// Pointer returned by connect_img_sequence()
                                 struct list_node *img_seq_node,
-                                size_t img_idx);
-
+                                size_t img_idx,
+                                enum SKRY_pixel_format pix_fmt,
+                                enum pooled_img_kind kind,
+                                unsigned kind_param);
+
+/// Returns 0 if 'img' is not stored in 'img_pool' (i.e. it has to be freed by the caller)
+int release_image_to_pool(SKRY_ImagePool *img_pool,
+                          /// Pointer returned by connect_img_sequence()
+                          struct list_node *img_seq_node,
+                          size_t img_idx,
+                          SKRY_Image *img);
 
 #endif // LIB_STACKISTRY_IMAGE_POOL_HEADER
@@ -22,8 +22,11 @@ File description:
 */
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <skry/skry.h>
 #include "logging.h"
+#include "threads.h"
 
 
 const char* pix_fmt_str[SKRY_NUM_PIX_FORMATS] =
@@ -89,18 +92,193 @@ const char *error_messages[SKRY_RESULT_LAST] =
     [SKRY_LIBAV_NO_VID_STREAM]          = "Video stream not found",
     [SKRY_LIBAV_UNSUPPORTED_FORMAT]     = "Unsupported format",
     [SKRY_LIBAV_DECODING_ERROR]         = "Decoding error",
-    [SKRY_LIBAV_INTERNAL_ERROR]         = "Internal libav error"
+    [SKRY_LIBAV_INTERNAL_ERROR]         = "Internal libav error",
+
+    [SKRY_CANNOT_START_THREAD]          = "Cannot start thread",
+
+    [SKRY_ACCEL_UNAVAILABLE]            = "Accelerator not available",
+    [SKRY_ACCEL_ERROR]                  = "Accelerator error",
+
+    [SKRY_CHECKPOINT_MISMATCH]          = "Checkpoint does not match the image sequence",
+
+    [SKRY_CANCELLED]                    = "Processing cancelled"
 };
 
 SKRY_log_callback_fn *g_log_msg_callback;
 
 unsigned g_log_event_type_mask = 0U;
 
-char g_log_msg_buf[LOG_MSG_MAX_LEN];
+struct queued_log_msg
+{
+    unsigned log_event_type;
+    char msg[LOG_MSG_MAX_LEN];
+};
+
+static struct
+{
+    /// Serializes calls to the callback; if async. logging is enabled, guards the queue
+    struct mutex *mutex;
+
+    // Fields below are used only with asynchronous logging ---------
+
+    struct thread *consumer; ///< Delivers queued messages; null if async. logging is disabled
+    struct cond_var *queue_changed; ///< Broadcast when a message is queued and on shutdown
+    int quit; ///< If true, the consumer delivers the remaining messages and exits
+
+    /// Circular buffer of queued messages
+    struct queued_log_msg *queue;
+    size_t queue_len;
+    size_t first; ///< Index of the oldest queued message
+    size_t num_queued;
+
+    size_t num_dropped; ///< Number of messages dropped since the last delivery
+    unsigned dropped_event_types; ///< Combined event types of dropped messages
+} g_log;
+
+enum SKRY_result init_logging(void)
+{
+    if (!g_log.mutex && !(g_log.mutex = create_mutex()))
+        return SKRY_OUT_OF_MEMORY;
+    return SKRY_SUCCESS;
+}
+
+void free_logging(void)
+{
+    SKRY_set_async_logging(0);
+    g_log.mutex = free_mutex(g_log.mutex);
+}
+
+static
+void log_consumer_func(void *arg)
+{
+    (void)arg;
+    struct queued_log_msg qmsg;
+
+    lock_mutex(g_log.mutex);
+    for (;;)
+    {
+        while (!g_log.quit && 0 == g_log.num_queued && 0 == g_log.num_dropped)
+            wait_cond_var(g_log.queue_changed, g_log.mutex);
+
+        if (g_log.num_queued > 0)
+        {
+            qmsg = g_log.queue[g_log.first];
+            g_log.first = (g_log.first + 1) % g_log.queue_len;
+            g_log.num_queued--;
+        }
+        else if (g_log.num_dropped > 0)
+        {
+            qmsg.log_event_type = g_log.dropped_event_types;
+            snprintf(qmsg.msg, LOG_MSG_MAX_LEN, "%zu log message(s) dropped (queue full).", g_log.num_dropped);
+            g_log.num_dropped = 0;
+            g_log.dropped_event_types = 0;
+        }
+        else // quitting and nothing left to deliver
+            break;
+
+        unlock_mutex(g_log.mutex);
+
+        SKRY_log_callback_fn *callback = g_log_msg_callback;
+        if (callback)
+            callback(qmsg.log_event_type, qmsg.msg);
+
+        lock_mutex(g_log.mutex);
+    }
+    unlock_mutex(g_log.mutex);
+}
+
+void deliver_log_msg(unsigned log_event_type, const char *msg)
+{
+    if (!g_log.mutex)
+    {
+        // The library has not been initialized
+        g_log_msg_callback(log_event_type, msg);
+        return;
+    }
+
+    lock_mutex(g_log.mutex);
+    if (g_log.consumer)
+    {
+        if (g_log.num_queued < g_log.queue_len)
+        {
+            struct queued_log_msg *qmsg = &g_log.queue[(g_log.first + g_log.num_queued) % g_log.queue_len];
+            qmsg->log_event_type = log_event_type;
+            strncpy(qmsg->msg, msg, LOG_MSG_MAX_LEN - 1);
+            qmsg->msg[LOG_MSG_MAX_LEN - 1] = '\0';
+            g_log.num_queued++;
+        }
+        else
+        {
+            g_log.num_dropped++;
+            g_log.dropped_event_types |= log_event_type;
+        }
+        broadcast_cond_var(g_log.queue_changed);
+    }
+    else
+    {
+        SKRY_log_callback_fn *callback = g_log_msg_callback;
+        if (callback)
+            callback(log_event_type, msg);
+    }
+    unlock_mutex(g_log.mutex);
+}
+
+enum SKRY_result SKRY_set_async_logging(size_t queue_len)
+{
+    if (g_log.consumer)
+    {
+        lock_mutex(g_log.mutex);
+        g_log.quit = 1;
+        broadcast_cond_var(g_log.queue_changed);
+        unlock_mutex(g_log.mutex);
+
+        g_log.consumer = join_thread(g_log.consumer);
+        g_log.queue_changed = free_cond_var(g_log.queue_changed);
+        free(g_log.queue);
+        g_log.queue = 0;
+        g_log.quit = 0;
+    }
+
+    if (0 == queue_len)
+        return SKRY_SUCCESS;
+
+    if (!g_log.mutex)
+        return SKRY_INVALID_PARAMETERS;
+
+    g_log.queue = malloc(queue_len * sizeof(*g_log.queue));
+    g_log.queue_changed = create_cond_var();
+    if (!g_log.queue || !g_log.queue_changed)
+    {
+        free(g_log.queue);
+        g_log.queue = 0;
+        g_log.queue_changed = free_cond_var(g_log.queue_changed);
+        return SKRY_OUT_OF_MEMORY;
+    }
+    g_log.queue_len = queue_len;
+    g_log.first = 0;
+    g_log.num_queued = 0;
+    g_log.num_dropped = 0;
+    g_log.dropped_event_types = 0;
+
+    // The consumer is not running yet, so locking is needed only to publish 'g_log.consumer'
+    lock_mutex(g_log.mutex);
+    g_log.consumer = start_thread(log_consumer_func, 0);
+    unlock_mutex(g_log.mutex);
+    if (!g_log.consumer)
+    {
+        free(g_log.queue);
+        g_log.queue = 0;
+        g_log.queue_changed = free_cond_var(g_log.queue_changed);
+        return SKRY_CANNOT_START_THREAD;
+    }
+
+    return SKRY_SUCCESS;
+}
 
 /// Provides a callback for messages generated by libskry.
 /** The string pointer and the string's contents passed to the callback
-    are valid only for the duration of callback's execution. */
+    are valid only for the duration of callback's execution. The callback may
+    be called from different threads, but never concurrently. */
 void SKRY_set_logging(unsigned log_event_type_mask,
                       SKRY_log_callback_fn callback_func)
 {
@@ -33,17 +33,29 @@ extern const char* pix_fmt_str[SKRY_NUM_PIX_FORMATS];
 
 extern SKRY_log_callback_fn *g_log_msg_callback;
 #define LOG_MSG_MAX_LEN 1024 /// Includes the NUL terminator
-extern char g_log_msg_buf[LOG_MSG_MAX_LEN];
 extern unsigned g_log_event_type_mask;
 
+/// Called by SKRY_initialize(); returns SKRY_SUCCESS or SKRY_OUT_OF_MEMORY
+enum SKRY_result init_logging(void);
+
+/// Called by SKRY_deinitialize(); delivers all queued messages first
+void free_logging(void);
+
+/// Passes the message to the logging callback, or queues it if asynchronous logging is enabled
+/** Can be called from multiple threads at the same time; the callback is never
+    called concurrently. */
+void deliver_log_msg(unsigned log_event_type, const char *msg);
+
 /// Message formatting wrapper
+/** The message is formatted (in a buffer on the caller's stack) only if its event type is enabled. */
 #define LOG_MSG(log_event_type, ...)                           \
 do {                                                           \
     if (g_log_msg_callback                                     \
-        && (g_log_event_type_mask & log_event_type))           \
+        && (g_log_event_type_mask & (log_event_type)))         \
     {                                                          \
-        snprintf(g_log_msg_buf, LOG_MSG_MAX_LEN, __VA_ARGS__); \
-        g_log_msg_callback(log_event_type, g_log_msg_buf);     \
+        char log_msg_buf[LOG_MSG_MAX_LEN];                     \
+        snprintf(log_msg_buf, LOG_MSG_MAX_LEN, __VA_ARGS__);   \
+        deliver_log_msg(log_event_type, log_msg_buf);          \
     }                                                          \
 } while (0)
 
@@ -0,0 +1,185 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Memory-mapped file implementation.
+*/
+
+#if !defined(_WIN32)
+  #define _POSIX_C_SOURCE 200809L
+  #define _FILE_OFFSET_BITS 64
+#endif
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include <skry/defs.h>
+
+#include "logging.h"
+#include "mapped_file.h"
+
+
+struct mapped_file
+{
+    uint8_t *data;
+    uint64_t size;
+    unsigned ref_count;
+};
+
+struct mapped_file *map_file(const char *file_name)
+{
+    struct mapped_file *mfile = malloc(sizeof(*mfile));
+    if (!mfile)
+        return 0;
+
+    *mfile = (struct mapped_file) { .ref_count = 1 };
+
+#if defined(_WIN32)
+
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, 0,
+                              OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, 0);
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        free(mfile);
+        return 0;
+    }
+
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(file, &fsize) || 0 == fsize.QuadPart
+        || (uint64_t)fsize.QuadPart > (uint64_t)SIZE_MAX)
+    {
+        CloseHandle(file);
+        free(mfile);
+        return 0;
+    }
+
+    // The view remains valid after closing both handles
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+    CloseHandle(file);
+    if (!mapping)
+    {
+        free(mfile);
+        return 0;
+    }
+
+    mfile->data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!mfile->data)
+    {
+        free(mfile);
+        return 0;
+    }
+    mfile->size = fsize.QuadPart;
+
+#else
+
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+    {
+        free(mfile);
+        return 0;
+    }
+
+    struct stat fstatus;
+    if (fstat(fd, &fstatus) || 0 == fstatus.st_size
+        || (uint64_t)fstatus.st_size > (uint64_t)SIZE_MAX)
+    {
+        close(fd);
+        free(mfile);
+        return 0;
+    }
+
+    // MAP_PRIVATE with write access: callers may modify returned images in-place
+    // (e.g. reinterpret or byte-swap), which must never affect the file
+    void *addr = mmap(0, (size_t)fstatus.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping remains valid after closing the descriptor
+    if (MAP_FAILED == addr)
+    {
+        free(mfile);
+        return 0;
+    }
+    mfile->data = addr;
+    mfile->size = fstatus.st_size;
+
+#endif
+
+    LOG_MSG(SKRY_LOG_IMAGE, "Mapped file %s (%" PRIu64 " bytes) at %p.",
+            file_name, mfile->size, (void *)mfile->data);
+
+    return mfile;
+}
+
+struct mapped_file *acquire_mapped_file(struct mapped_file *mfile)
+{
+#if defined(__GNUC__)
+    __atomic_add_fetch(&mfile->ref_count, 1, __ATOMIC_ACQ_REL);
+#else
+    #pragma omp atomic
+    mfile->ref_count++;
+#endif
+
+    return mfile;
+}
+
+struct mapped_file *release_mapped_file(struct mapped_file *mfile)
+{
+    if (!mfile)
+        return 0;
+
+    unsigned new_count;
+#if defined(__GNUC__)
+    new_count = __atomic_sub_fetch(&mfile->ref_count, 1, __ATOMIC_ACQ_REL);
+#else
+    #pragma omp atomic capture
+    new_count = --mfile->ref_count;
+#endif
+
+    if (0 == new_count)
+    {
+        LOG_MSG(SKRY_LOG_IMAGE, "Unmapping file data at %p.", (void *)mfile->data);
+#if defined(_WIN32)
+        UnmapViewOfFile(mfile->data);
+#else
+        munmap(mfile->data, (size_t)mfile->size);
+#endif
+        free(mfile);
+    }
+
+    return 0;
+}
+
+uint8_t *get_mapped_data(const struct mapped_file *mfile)
+{
+    return mfile->data;
+}
+
+uint64_t get_mapped_size(const struct mapped_file *mfile)
+{
+    return mfile->size;
+}
@@ -0,0 +1,52 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Memory-mapped file header.
+*/
+
+#ifndef LIBSKRY_MAPPED_FILE_HEADER
+#define LIBSKRY_MAPPED_FILE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Reference-counted, copy-on-write mapping of a whole file
+/** Writes into the mapped memory never reach the file. */
+struct mapped_file;
+
+/// Maps the whole file; returns null on failure (e.g. file too big for the address space)
+/** The returned mapping has reference count 1. */
+struct mapped_file *map_file(const char *file_name);
+
+/// Increments the reference count; returns 'mfile'
+struct mapped_file *acquire_mapped_file(struct mapped_file *mfile);
+
+/// Decrements the reference count and unmaps the file when it reaches zero; returns null
+/** Thread-safe with respect to other acquire/release calls. */
+struct mapped_file *release_mapped_file(struct mapped_file *mfile);
+
+/// Returns the start of mapped data
+uint8_t *get_mapped_data(const struct mapped_file *mfile);
+
+/// Returns the number of mapped bytes (i.e. the file size)
+uint64_t get_mapped_size(const struct mapped_file *mfile);
+
+#endif // LIBSKRY_MAPPED_FILE_HEADER
@@ -25,10 +25,275 @@ File description:
 #include <limits.h>
 #include <stdint.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__) && defined(__SSE2__))
+  #define SSD_X86 1
+  #include <immintrin.h>
+#elif defined(__ARM_NEON)
+  #define SSD_NEON 1
+  #include <arm_neon.h>
+#endif
+
+#include <skry/skry.h>
+
+#include "filters.h"
 #include "match.h"
+#include "perf.h"
+
+
+/// Search radius (in pixels of the coarsest pyramid level used) of the exhaustive coarse search
+#define PYRAMID_COARSE_SEARCH_RADIUS 8
+
+/// Min. size of a reference block downsampled for a pyramid level
+#define PYRAMID_MIN_BLOCK_SIZE 8
+
+/// Search radius used to refine the position found at the next coarser level
+#define PYRAMID_REFINEMENT_RADIUS 2
+
+/// Number of rows after which 'calc_sum_of_squared_diffs_bounded()' checks the partial sum
+#define BOUNDED_SSD_ROWS_PER_CHECK 4
+
+/// Max. number of pixels (width*height) passed at once to a 'fn_sq_diffs' function
+/** Guarantees that the SIMD versions' 32-bit partial sums do not overflow. */
+#define MAX_SQ_DIFFS_AREA 65536
+
+/// Returns the sum of squared differences between two 'width'x'height' blocks of 8-bit pixels
+/** 'width'*'height' has to be at most MAX_SQ_DIFFS_AREA. */
+typedef uint64_t fn_sq_diffs(const uint8_t *p1, ptrdiff_t stride1,
+                             const uint8_t *p2, ptrdiff_t stride2,
+                             unsigned width, unsigned height);
+
+/// Reference implementation
+static
+uint64_t sq_diffs_scalar(const uint8_t *p1, ptrdiff_t stride1,
+                         const uint8_t *p2, ptrdiff_t stride2,
+                         unsigned width, unsigned height)
+{
+    uint64_t result = 0;
+    for (unsigned y = 0; y < height; y++)
+    {
+        const uint8_t * restrict line1 = p1 + y*stride1;
+        const uint8_t * restrict line2 = p2 + y*stride2;
+        for (unsigned x = 0; x < width; x++)
+            result += SKRY_SQR(line1[x] - line2[x]);
+    }
+    return result;
+}
 
+#if SSD_X86
 
-#define MIN_FRACTION_OF_BLOCK_TO_MATCH 4
+static inline
+uint64_t hsum_epu32(__m128i sums)
+{
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, sums);
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+/// Returns 32-bit sums of squared differences of 16 pairs of pixels
+static inline
+__m128i sq_diffs_16px_sse2(const uint8_t *p1, const uint8_t *p2)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v1 = _mm_loadu_si128((const __m128i *)p1),
+            v2 = _mm_loadu_si128((const __m128i *)p2);
+
+    __m128i diff_lo = _mm_sub_epi16(_mm_unpacklo_epi8(v1, zero), _mm_unpacklo_epi8(v2, zero)),
+            diff_hi = _mm_sub_epi16(_mm_unpackhi_epi8(v1, zero), _mm_unpackhi_epi8(v2, zero));
+
+    return _mm_add_epi32(_mm_madd_epi16(diff_lo, diff_lo), _mm_madd_epi16(diff_hi, diff_hi));
+}
+
+static
+uint64_t sq_diffs_sse2(const uint8_t *p1, ptrdiff_t stride1,
+                       const uint8_t *p2, ptrdiff_t stride2,
+                       unsigned width, unsigned height)
+{
+    unsigned simd_width = width / 16 * 16;
+    __m128i sums = _mm_setzero_si128();
+    uint64_t remainder = 0;
+    for (unsigned y = 0; y < height; y++)
+    {
+        const uint8_t *line1 = p1 + y*stride1;
+        const uint8_t *line2 = p2 + y*stride2;
+        for (unsigned x = 0; x < simd_width; x += 16)
+            sums = _mm_add_epi32(sums, sq_diffs_16px_sse2(line1 + x, line2 + x));
+
+        for (unsigned x = simd_width; x < width; x++)
+            remainder += SKRY_SQR(line1[x] - line2[x]);
+    }
+
+    return hsum_epu32(sums) + remainder;
+}
+
+__attribute__((target("avx2")))
+static
+uint64_t sq_diffs_avx2(const uint8_t *p1, ptrdiff_t stride1,
+                       const uint8_t *p2, ptrdiff_t stride2,
+                       unsigned width, unsigned height)
+{
+    unsigned simd_width = width / 16 * 16;
+    __m256i sums = _mm256_setzero_si256();
+    uint64_t remainder = 0;
+    for (unsigned y = 0; y < height; y++)
+    {
+        const uint8_t *line1 = p1 + y*stride1;
+        const uint8_t *line2 = p2 + y*stride2;
+        for (unsigned x = 0; x < simd_width; x += 16)
+        {
+            __m256i diff = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(line1 + x))),
+                                            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(line2 + x))));
+            sums = _mm256_add_epi32(sums, _mm256_madd_epi16(diff, diff));
+        }
+
+        for (unsigned x = simd_width; x < width; x++)
+            remainder += SKRY_SQR(line1[x] - line2[x]);
+    }
+
+    return hsum_epu32(_mm256_castsi256_si128(sums)) + hsum_epu32(_mm256_extracti128_si256(sums, 1))
+           + remainder;
+}
+
+__attribute__((target("avx512bw")))
+static
+uint64_t sq_diffs_avx512(const uint8_t *p1, ptrdiff_t stride1,
+                         const uint8_t *p2, ptrdiff_t stride2,
+                         unsigned width, unsigned height)
+{
+    unsigned simd_width = width / 32 * 32;
+    int has_16px_tail = (width - simd_width >= 16);
+    __m512i sums = _mm512_setzero_si512();
+    __m256i tail_sums = _mm256_setzero_si256();
+    uint64_t remainder = 0;
+    for (unsigned y = 0; y < height; y++)
+    {
+        const uint8_t *line1 = p1 + y*stride1;
+        const uint8_t *line2 = p2 + y*stride2;
+        for (unsigned x = 0; x < simd_width; x += 32)
+        {
+            __m512i diff = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(line1 + x))),
+                                            _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(line2 + x))));
+            sums = _mm512_add_epi32(sums, _mm512_madd_epi16(diff, diff));
+        }
+
+        unsigned x = simd_width;
+        if (has_16px_tail)
+        {
+            __m256i diff = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(line1 + x))),
+                                            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(line2 + x))));
+            tail_sums = _mm256_add_epi32(tail_sums, _mm256_madd_epi16(diff, diff));
+            x += 16;
+        }
+
+        for (; x < width; x++)
+            remainder += SKRY_SQR(line1[x] - line2[x]);
+    }
+
+    return hsum_epu32(_mm512_extracti32x4_epi32(sums, 0)) + hsum_epu32(_mm512_extracti32x4_epi32(sums, 1))
+           + hsum_epu32(_mm512_extracti32x4_epi32(sums, 2)) + hsum_epu32(_mm512_extracti32x4_epi32(sums, 3))
+           + hsum_epu32(_mm256_castsi256_si128(tail_sums)) + hsum_epu32(_mm256_extracti128_si256(tail_sums, 1))
+           + remainder;
+}
+
+#elif SSD_NEON
+
+static
+uint64_t sq_diffs_neon(const uint8_t *p1, ptrdiff_t stride1,
+                       const uint8_t *p2, ptrdiff_t stride2,
+                       unsigned width, unsigned height)
+{
+    unsigned simd_width = width / 16 * 16;
+    uint32x4_t sums = vdupq_n_u32(0);
+    uint64_t remainder = 0;
+    for (unsigned y = 0; y < height; y++)
+    {
+        const uint8_t *line1 = p1 + y*stride1;
+        const uint8_t *line2 = p2 + y*stride2;
+        for (unsigned x = 0; x < simd_width; x += 16)
+        {
+            uint8x16_t abs_diff = vabdq_u8(vld1q_u8(line1 + x), vld1q_u8(line2 + x));
+            sums = vpadalq_u16(sums, vmull_u8(vget_low_u8(abs_diff), vget_low_u8(abs_diff)));
+            sums = vpadalq_u16(sums, vmull_u8(vget_high_u8(abs_diff), vget_high_u8(abs_diff)));
+        }
+
+        for (unsigned x = simd_width; x < width; x++)
+            remainder += SKRY_SQR(line1[x] - line2[x]);
+    }
+
+    uint32_t lanes[4];
+    vst1q_u32(lanes, sums);
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3] + remainder;
+}
+
+#endif
+
+/// Selected by 'init_block_matching()'
+static fn_sq_diffs *sq_diffs = sq_diffs_scalar;
+
+void init_block_matching(void)
+{
+#if SSD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+        sq_diffs = sq_diffs_avx512;
+    else if (__builtin_cpu_supports("avx2"))
+        sq_diffs = sq_diffs_avx2;
+    else
+        sq_diffs = sq_diffs_sse2;
+#elif SSD_NEON
+    sq_diffs = sq_diffs_neon;
+#else
+    sq_diffs = sq_diffs_scalar;
+#endif
+}
+
+/// Common implementation of 'calc_sum_of_squared_diffs()' and 'calc_sum_of_squared_diffs_bounded()'
+static
+uint64_t calc_sum_of_squared_diffs_impl(
+    const SKRY_Image *img,
+    const SKRY_Image *ref_block,
+    const struct SKRY_point *pos,
+    const struct SKRY_rect refblk_rect,
+    uint64_t bound,
+    unsigned rows_per_check ///< Number of rows after which the partial sum is compared with 'bound'
+    )
+{
+    uint64_t result = 0;
+
+    int block_width = SKRY_get_img_width(ref_block);
+    int block_height = SKRY_get_img_height(ref_block);
+
+    // Both 'x0' and 'y0' will be non-negative (ensured by the caller)
+    int x0 = pos->x - block_width/2 + refblk_rect.x,
+        y0 = pos->y - block_height/2 + refblk_rect.y;
+
+    assert(x0 >= 0);
+    assert(y0 >= 0);
+
+    const uint8_t *img_line = (const uint8_t *)SKRY_get_line(img, y0) + x0;
+    ptrdiff_t img_stride = SKRY_get_line_stride_in_bytes(img);
+
+    const uint8_t *blk_line = (const uint8_t *)SKRY_get_line(ref_block, refblk_rect.y) + refblk_rect.x;
+    ptrdiff_t blk_stride = SKRY_get_line_stride_in_bytes(ref_block);
+
+    // Split the area so that sq_diffs() does not overflow (normally there is a single piece per 'rows_per_check')
+    unsigned piece_width = SKRY_MIN(refblk_rect.width, MAX_SQ_DIFFS_AREA);
+    unsigned piece_height = SKRY_MIN(MAX_SQ_DIFFS_AREA / piece_width, rows_per_check);
+    for (unsigned y = 0; y < refblk_rect.height; y += piece_height)
+    {
+        for (unsigned x = 0; x < refblk_rect.width; x += piece_width)
+        {
+            result += sq_diffs(img_line + y*img_stride + x, img_stride,
+                               blk_line + y*blk_stride + x, blk_stride,
+                               SKRY_MIN(refblk_rect.width - x, piece_width),
+                               SKRY_MIN(refblk_rect.height - y, piece_height));
+        }
+
+        if (result > bound)
+            break;
+    }
+
+    return result;
+}
 
 /** Returns the sum of squared differences between pixels of 'img' and 'ref_block',
     with 'ref_block's center aligned on 'pos' over 'img'. The differences are
@@ -44,50 +309,259 @@ uint64_t calc_sum_of_squared_diffs(
     const struct SKRY_rect refblk_rect ///< Part of 'ref_block' to be used for comparison
     )
 {
-    uint64_t result = 0;
+    return calc_sum_of_squared_diffs_impl(img, ref_block, pos, refblk_rect, UINT64_MAX, UINT_MAX);
+}
 
-    int block_width = SKRY_get_img_width(ref_block);
-    int block_height = SKRY_get_img_height(ref_block);
+uint64_t calc_sum_of_squared_diffs_bounded(
+    const SKRY_Image *img,
+    const SKRY_Image *ref_block,
+    const struct SKRY_point *pos,
+    const struct SKRY_rect refblk_rect,
+    uint64_t bound
+    )
+{
+    return calc_sum_of_squared_diffs_impl(img, ref_block, pos, refblk_rect, bound, BOUNDED_SSD_ROWS_PER_CHECK);
+}
 
-    uint8_t * restrict img_line = SKRY_get_line(img, pos->y - block_height/2 + refblk_rect.y);
-    ptrdiff_t img_stride = SKRY_get_line_stride_in_bytes(img);
+#define CLAMP_xmin(val)  ((val) > search_envelope.x + block_width/2  ? (val) : search_envelope.x + block_width/2)
+#define CLAMP_ymin(val)  ((val) > search_envelope.y + block_height/2 ? (val) : search_envelope.y + block_height/2)
+#define CLAMP_xmax(val) SKRY_MIN(val, search_envelope.x + search_envelope.width - block_width/2)
+#define CLAMP_ymax(val) SKRY_MIN(val, search_envelope.x + search_envelope.height - block_height/2)
 
-    uint8_t * restrict blk_line = SKRY_get_line(ref_block, refblk_rect.y);
-    ptrdiff_t blk_stride = SKRY_get_line_stride_in_bytes(ref_block);
+/// Range of positions where a reference block is match-tested with an image
+/** Using signed type is necessary, as the positions may be negative
+    (then the block is appropriately clipped before comparison). */
+struct search_pos_t
+{
+    int xmin, ymin; // inclusive
+    int xmax, ymax; // exclusive
+};
+
+/// Returns the sum of squared differences normalized to the whole 'ref_block' centered at (x, y) in 'image'
+/** Returns UINT64_MAX if the part of 'ref_block' lying within 'image' is too small to compare,
+    or if the sum is greater than 'bound' (the calculation is then stopped early). */
+static
+uint64_t calc_block_match_cost(const SKRY_Image *image, const SKRY_Image *ref_block, int x, int y, uint64_t bound)
+{
+    unsigned blkw = SKRY_get_img_width(ref_block),
+             blkh = SKRY_get_img_height(ref_block),
+             imgw = SKRY_get_img_width(image),
+             imgh = SKRY_get_img_height(image);
+
+    /*
+        It is allowed for 'ref_block' to not be entirely inside 'image'.
+        Before calling calc_sum_of_squared_diffs(), find a sub-rectangle
+        'refblk_rect' of 'ref_block' which lies within 'image':
+
+        +======== ref_block ========+
+        |                           |
+        |   +-------- img ----------|-------
+        |   |.......................|
+        |   |..........*............|
+        |   |.......................|
+        |   |.......................|
+        +===========================+
+            |
+            |
+
+        *: current search position (x, y); corresponds with the middle
+           of 'ref_block' during block matching
+
+        Dotted area is the 'refblk_rect'. Start coordinates of 'refblk_rect'
+        are relative to the 'ref_block'; if whole 'ref_block' fits in 'image',
+        then refblk_rect = {0, 0, blkw, blkh}.
+    */
+
+    struct SKRY_rect refblk_rect =
+        { .x = (x >= (int)blkw/2) ? 0 : (int)blkw/2 - x,
+          .y = (y >= (int)blkh/2) ? 0 : (int)blkh/2 - y };
+
+    int refblk_rect_xmax = (x + (int)blkw/2 <= (int)imgw) ? blkw : blkw - (x + (int)blkw/2 - (int)imgw);
+    int refblk_rect_ymax = (y + (int)blkh/2 <= (int)imgh) ? blkh : blkh - (y + (int)blkh/2 - (int)imgh);
+
+    if (refblk_rect.x >= refblk_rect_xmax ||
+        refblk_rect.y >= refblk_rect_ymax)
+    {
+        // ref. block completely outside image
+        return UINT64_MAX;
+    }
 
-    assert(pos->x - (int)block_width/2  + refblk_rect.x >= 0);
-    assert(pos->y - (int)block_height/2 + refblk_rect.y >= 0);
+    refblk_rect.width = refblk_rect_xmax - refblk_rect.x;
+    refblk_rect.height = refblk_rect_ymax - refblk_rect.y;
 
-    // Both 'x' and 'y' will be non-negative at all times (ensured by the caller)
-    for (int y = pos->y - (int)block_height/2 + refblk_rect.y;
-             y < pos->y - (int)block_height/2 + refblk_rect.y + (int)refblk_rect.height;
-             y++)
+    if (refblk_rect.width < blkw/MIN_FRACTION_OF_BLOCK_TO_MATCH ||
+        refblk_rect.height < blkh/MIN_FRACTION_OF_BLOCK_TO_MATCH)
     {
-        for (int x = pos->x - (int)block_width/2 + refblk_rect.x;
-                 x < pos->x - (int)block_width/2 + refblk_rect.x + (int)refblk_rect.width;
-                 x++)
+        // ref. block too small to compare
+        return UINT64_MAX;
+    }
+
+    // The sum must be normalized in order to be comparable with others
+    unsigned norm_factor = blkw*blkh / (refblk_rect.width*refblk_rect.height);
+
+    // For integers: sum*norm_factor > bound  <=>  sum > bound/norm_factor
+    uint64_t sum_sq_diffs = calc_sum_of_squared_diffs_bounded(image, ref_block,
+                                                              &(struct SKRY_point) { .x = x, .y = y },
+                                                              refblk_rect, bound / norm_factor);
+    if (sum_sq_diffs > bound / norm_factor)
+        return UINT64_MAX;
+
+    return sum_sq_diffs * norm_factor;
+}
+
+/// Match-tests 'ref_block' at every 'step'-th position of 'search_pos'
+/** 'best_pos' receives the best matching position; it is left unchanged
+    if there are no positions where the block can be compared.
+
+    If 'predicted_pos' is one of the tested positions, it is tested first;
+    the resulting cost bounds the calculation for all other positions, most
+    of which can be rejected after comparing only a part of the block.
+    The result is the same as when testing in the regular order. */
+static
+void search_best_position(const SKRY_Image *image, const SKRY_Image *ref_block,
+                          struct search_pos_t search_pos, unsigned step,
+                          struct SKRY_point predicted_pos,
+                          struct SKRY_point *best_pos)
+{
+    // Min. sum of squared differences between pixel values of
+    // the reference block and the image at candidate positions.
+    uint64_t min_sq_diff_sum = UINT64_MAX;
+
+    int is_predicted_tested =
+        predicted_pos.x >= search_pos.xmin && predicted_pos.x < search_pos.xmax
+        && predicted_pos.y >= search_pos.ymin && predicted_pos.y < search_pos.ymax
+        && (predicted_pos.x - search_pos.xmin) % step == 0
+        && (predicted_pos.y - search_pos.ymin) % step == 0;
+
+    // Positions with a greater cost than the predicted one cannot be the best
+    uint64_t predicted_cost = is_predicted_tested
+        ? calc_block_match_cost(image, ref_block, predicted_pos.x, predicted_pos.y, UINT64_MAX)
+        : UINT64_MAX;
+
+    // (x, y) = position in 'img' for which a block match test is performed.
+    for (int y = search_pos.ymin; y < search_pos.ymax;  y += step)
+        for (int x = search_pos.xmin; x < search_pos.xmax;  x += step)
         {
-            result += SKRY_SQR(img_line[x] - blk_line[x - pos->x + (int)block_width/2]);
+            uint64_t sum_sq_diffs;
+            if (is_predicted_tested && x == predicted_pos.x && y == predicted_pos.y)
+                sum_sq_diffs = predicted_cost;
+            else
+            {
+                // Positions with cost equal to 'min_sq_diff_sum' are not selected,
+                // those with cost equal to 'predicted_cost' may be (if tested before the predicted one)
+                uint64_t bound = SKRY_MIN(min_sq_diff_sum - 1, predicted_cost);
+                sum_sq_diffs = calc_block_match_cost(image, ref_block, x, y, bound);
+            }
+
+            if (sum_sq_diffs < min_sq_diff_sum)
+            {
+                min_sq_diff_sum = sum_sq_diffs;
+                best_pos->x = x;
+                best_pos->y = y;
+            }
         }
 
-        img_line += img_stride;
-        blk_line += blk_stride;
+    if (search_pos.xmax > search_pos.xmin && search_pos.ymax > search_pos.ymin)
+        PERF_ADD(block_match_evals, (uint64_t)((search_pos.xmax - search_pos.xmin + step - 1) / step)
+                                              * ((search_pos.ymax - search_pos.ymin + step - 1) / step));
+}
+
+unsigned get_num_pyramid_levels_for_matching(unsigned block_width, unsigned block_height, unsigned search_radius)
+{
+    unsigned num_levels = 0;
+    while (num_levels < PYRAMID_MAX_LEVELS
+           && (search_radius >> num_levels) > PYRAMID_COARSE_SEARCH_RADIUS
+           && (block_width >> (num_levels+1)) >= PYRAMID_MIN_BLOCK_SIZE
+           && (block_height >> (num_levels+1)) >= PYRAMID_MIN_BLOCK_SIZE)
+    {
+        num_levels++;
+    }
+    return num_levels;
+}
+
+enum SKRY_result create_image_pyramid(const SKRY_Image *img, unsigned num_levels, struct image_pyramid *pyramid)
+{
+    assert(SKRY_get_img_pix_fmt(img) == SKRY_PIX_MONO8);
+    assert(num_levels <= PYRAMID_MAX_LEVELS);
+
+    *pyramid = (struct image_pyramid) { 0 };
+    for (unsigned i = 0; i < num_levels; i++)
+    {
+        pyramid->levels[i] = downsample_img_2x(i == 0 ? img : pyramid->levels[i-1]);
+        if (!pyramid->levels[i])
+        {
+            free_image_pyramid(pyramid);
+            return SKRY_OUT_OF_MEMORY;
+        }
+        pyramid->num_levels++;
     }
+    return SKRY_SUCCESS;
+}
 
+void free_image_pyramid(struct image_pyramid *pyramid)
+{
+    for (unsigned i = 0; i < pyramid->num_levels; i++)
+        SKRY_free_image(pyramid->levels[i]);
+    *pyramid = (struct image_pyramid) { 0 };
+}
 
-    return result;
+int g_pyramid_matching_enabled = 0;
+
+void SKRY_enable_pyramid_matching(int enabled)
+{
+    g_pyramid_matching_enabled = enabled;
 }
 
-#define CLAMP_xmin(val)  ((val) > search_envelope.x + block_width/2  ? (val) : search_envelope.x + block_width/2)
-#define CLAMP_ymin(val)  ((val) > search_envelope.y + block_height/2 ? (val) : search_envelope.y + block_height/2)
-#define CLAMP_xmax(val) SKRY_MIN(val, search_envelope.x + search_envelope.width - block_width/2)
-#define CLAMP_ymax(val) SKRY_MIN(val, search_envelope.x + search_envelope.height - block_height/2)
+/// Performs coarse-to-fine matching over the first 'num_levels' levels of both pyramids
+static
+void find_matching_position_in_pyramid(
+    struct SKRY_point ref_pos,
+    const SKRY_Image *ref_block,
+    const struct image_pyramid *ref_block_pyramid,
+    const SKRY_Image *image,
+    const struct image_pyramid *pyramid,
+    unsigned num_levels,
+    unsigned search_radius,
+    struct SKRY_point *new_pos)
+{
+    // Reference blocks downsampled the same way as 'image'; element 0 is 'ref_block' itself
+    const SKRY_Image *blocks[PYRAMID_MAX_LEVELS + 1] = { ref_block };
+    for (unsigned i = 1; i <= num_levels; i++)
+        blocks[i] = ref_block_pyramid->levels[i-1];
+
+    // Exhaustive search at the coarsest level; its radius does not exceed PYRAMID_COARSE_SEARCH_RADIUS
+    // (rounded up), so the cost does not depend on 'search_radius'
+    int coarse_radius = (search_radius + (1U << num_levels) - 1) >> num_levels;
+    struct SKRY_point best_pos = { .x = ref_pos.x >> num_levels, .y = ref_pos.y >> num_levels };
+    search_best_position(pyramid->levels[num_levels-1], blocks[num_levels],
+                         (struct search_pos_t) { .xmin = best_pos.x - coarse_radius,
+                                                 .ymin = best_pos.y - coarse_radius,
+                                                 .xmax = best_pos.x + coarse_radius,
+                                                 .ymax = best_pos.y + coarse_radius },
+                         1, best_pos, &best_pos);
+
+    // Refine the position at each finer level
+    for (int level = (int)num_levels - 1; level >= 0; level--)
+    {
+        best_pos.x *= 2;
+        best_pos.y *= 2;
+        search_best_position(level > 0 ? pyramid->levels[level-1] : image, blocks[level],
+                             (struct search_pos_t) { .xmin = best_pos.x - PYRAMID_REFINEMENT_RADIUS,
+                                                     .ymin = best_pos.y - PYRAMID_REFINEMENT_RADIUS,
+                                                     .xmax = best_pos.x + PYRAMID_REFINEMENT_RADIUS + 1,
+                                                     .ymax = best_pos.y + PYRAMID_REFINEMENT_RADIUS + 1 },
+                             1, best_pos, &best_pos);
+    }
+
+    *new_pos = best_pos;
+}
 
-//TODO: add comments
 void find_matching_position(
     struct SKRY_point ref_pos,
     const SKRY_Image *ref_block,
+    const struct image_pyramid *ref_block_pyramid,
     const SKRY_Image *image,
+    const struct image_pyramid *pyramid,
     unsigned search_radius,
     unsigned initial_search_step,
     struct SKRY_point *new_pos)
@@ -96,9 +570,19 @@ void find_matching_position(
     assert(SKRY_get_img_pix_fmt(ref_block) == SKRY_PIX_MONO8);
 
     unsigned blkw = SKRY_get_img_width(ref_block),
-             blkh = SKRY_get_img_height(ref_block),
-             imgw = SKRY_get_img_width(image),
-             imgh = SKRY_get_img_height(image);
+             blkh = SKRY_get_img_height(ref_block);
+
+    if (pyramid && ref_block_pyramid)
+    {
+        unsigned num_levels = SKRY_MIN(SKRY_MIN(pyramid->num_levels, ref_block_pyramid->num_levels),
+                                       get_num_pyramid_levels_for_matching(blkw, blkh, search_radius));
+        if (num_levels > 0)
+        {
+            find_matching_position_in_pyramid(ref_pos, ref_block, ref_block_pyramid, image, pyramid,
+                                              num_levels, search_radius, new_pos);
+            return;
+        }
+    }
 
     // At first using a coarse step when trying to match 'ref_block'
     // with 'img' at different positions. Once an approximate matching
@@ -106,98 +590,21 @@ void find_matching_position(
     // using a smaller step, until the step becomes 1.
     unsigned search_step = initial_search_step;
 
-    // Range of positions where 'ref_block' will be match-tested with 'img'.
-    // Using signed type is necessary, as the positions may be negative
-    // (then the block is appropriately clipped before comparison).
-    struct search_pos_t
-    {
-        int xmin, ymin; // inclusive
-        int xmax, ymax; // exclusive
-    } search_pos = { .xmin = ref_pos.x - (int)search_radius,
-                     .ymin = ref_pos.y - (int)search_radius,
-                     .xmax = ref_pos.x + (int)search_radius,
-                     .ymax = ref_pos.y + (int)search_radius };
+    struct search_pos_t search_pos = { .xmin = ref_pos.x - (int)search_radius,
+                                       .ymin = ref_pos.y - (int)search_radius,
+                                       .xmax = ref_pos.x + (int)search_radius,
+                                       .ymax = ref_pos.y + (int)search_radius };
 
     struct SKRY_point best_pos = { .x = 0, .y = 0 };
 
+    // The block is most likely to be found near its previous position,
+    // and later near the position found using the previous (larger) step
+    struct SKRY_point predicted_pos = ref_pos;
+
     while (search_step)
     {
-        // Min. sum of squared differences between pixel values of
-        // the reference block and the image at candidate positions.
-        uint64_t min_sq_diff_sum = UINT64_MAX;
-
-        // (x, y) = position in 'img' for which a block match test is performed.
-        for (int y = search_pos.ymin; y < search_pos.ymax;  y += search_step)
-            for (int x = search_pos.xmin; x < search_pos.xmax;  x += search_step)
-            {
-                /*
-                    It is allowed for 'ref_block' to not be entirely inside 'image'.
-                    Before calling calc_sum_of_squared_diffs(), find a sub-rectangle
-                    'refblk_rect' of 'ref_block' which lies within 'image':
-
-                    +======== ref_block ========+
-                    |                           |
-                    |   +-------- img ----------|-------
-                    |   |.......................|
-                    |   |..........*............|
-                    |   |.......................|
-                    |   |.......................|
-                    +===========================+
-                        |
-                        |
-
-                    *: current search position (x, y); corresponds with the middle
-                       of 'ref_block' during block matching
-
-                    Dotted area is the 'refblk_rect'. Start coordinates of 'refblk_rect'
-                    are relative to the 'ref_block'; if whole 'ref_block' fits in 'image',
-                    then refblk_rect = {0, 0, blkw, blkh}.
-                */
-
-                struct SKRY_rect refblk_rect =
-                    { .x = (x >= (int)blkw/2) ? 0 : (int)blkw/2 - x,
-                      .y = (y >= (int)blkh/2) ? 0 : (int)blkh/2 - y };
-
-                int refblk_rect_xmax = (x + (int)blkw/2 <= (int)imgw) ? blkw : blkw - (x + (int)blkw/2 - (int)imgw);
-                int refblk_rect_ymax = (y + (int)blkh/2 <= (int)imgh) ? blkh : blkh - (y + (int)blkh/2 - (int)imgh);
-
-                uint64_t sum_sq_diffs;
-
-                if (refblk_rect.x >= refblk_rect_xmax ||
-                    refblk_rect.y >= refblk_rect_ymax)
-                {
-                    // ref. block completely outside image
-                   sum_sq_diffs = UINT64_MAX;
-                }
-                else
-                {
-                    refblk_rect.width = refblk_rect_xmax - refblk_rect.x;
-                    refblk_rect.height = refblk_rect_ymax - refblk_rect.y;
-
-                    if (refblk_rect.width < blkw/MIN_FRACTION_OF_BLOCK_TO_MATCH ||
-                        refblk_rect.height < blkh/MIN_FRACTION_OF_BLOCK_TO_MATCH)
-                    {
-                        // ref. block too small to compare
-                        sum_sq_diffs = UINT64_MAX;
-                    }
-                    else
-                    {
-                        sum_sq_diffs = calc_sum_of_squared_diffs(image, ref_block,
-                                                                &(struct SKRY_point) { .x = x, .y = y },
-                                                                refblk_rect);
-
-                        // The sum must be normalized in order to be comparable with others
-                        sum_sq_diffs *= blkw*blkh / (refblk_rect.width*refblk_rect.height);
-                    }
-                }
-
-                if (sum_sq_diffs < min_sq_diff_sum)
-                {
-                    min_sq_diff_sum = sum_sq_diffs;
-                    best_pos.x = x;
-                    best_pos.y = y;
-                }
-            }
+        search_best_position(image, ref_block, search_pos, search_step, predicted_pos, &best_pos);
+        predicted_pos = best_pos;
 
         search_pos = (struct search_pos_t) { .xmin = best_pos.x - search_step,
                                              .ymin = best_pos.y - search_step,
@@ -28,6 +28,13 @@ File description:
 #include <skry/image.h>
 
 
+/// A block is compared with an image only if at least 1/MIN_FRACTION_OF_BLOCK_TO_MATCH of its width and height lie inside
+#define MIN_FRACTION_OF_BLOCK_TO_MATCH 4
+
+/// Selects the implementation of 'calc_sum_of_squared_diffs()' best suited to the CPU
+/** Called by SKRY_initialize(). */
+void init_block_matching(void);
+
 /** Returns the sum of squared differences between pixels of 'img' and 'ref_block',
     with 'ref_block's center aligned on 'pos' over 'img'. The differences are
     calculated only for the 'refblk_rect' portion of 'ref_block'.
@@ -43,11 +50,52 @@ uint64_t calc_sum_of_squared_diffs(
 );
 
 
-//TODO: add comments
+/// Same as 'calc_sum_of_squared_diffs()', but stops early once the partial sum exceeds 'bound'
+/** Returns the sum if it is at most 'bound'; otherwise returns a partial sum greater than 'bound'. */
+uint64_t calc_sum_of_squared_diffs_bounded(
+    const SKRY_Image *img,
+    const SKRY_Image *ref_block,
+    const struct SKRY_point *pos,
+    const struct SKRY_rect refblk_rect,
+    uint64_t bound
+);
+
+/// Set by SKRY_enable_pyramid_matching()
+extern int g_pyramid_matching_enabled;
+
+/// Max. number of downsampled levels of an image pyramid
+#define PYRAMID_MAX_LEVELS 2
+
+/// Image downsampled 2x, 4x, ... used for coarse-to-fine block matching
+/** Created once per image and shared by all blocks matched against it; reference blocks
+    keep their own pyramids for as long as they do not change. */
+struct image_pyramid
+{
+    unsigned num_levels;
+    /// Element [i] is the original image (SKRY_PIX_MONO8) downsampled 2^(i+1) times
+    SKRY_Image *levels[PYRAMID_MAX_LEVELS];
+};
+
+/// Returns the number of pyramid levels worth using for the specified block size and search radius
+/** Returns 0 if the search radius is small enough for a full-resolution search. */
+unsigned get_num_pyramid_levels_for_matching(unsigned block_width, unsigned block_height, unsigned search_radius);
+
+/// Returns SKRY_SUCCESS or SKRY_OUT_OF_MEMORY
+/** Requirements: img is SKRY_PIX_MONO8, num_levels <= PYRAMID_MAX_LEVELS. */
+enum SKRY_result create_image_pyramid(const SKRY_Image *img, unsigned num_levels, struct image_pyramid *pyramid);
+
+void free_image_pyramid(struct image_pyramid *pyramid);
+
+/// Finds the position in 'image' where 'ref_block' matches best
+/** If both pyramids are not null and have levels suitable for 'ref_block' and 'search_radius',
+    the search is performed coarse-to-fine (and 'initial_search_step' is not used).
+    Otherwise, the search begins at full resolution with 'initial_search_step'. */
 void find_matching_position(
-    struct SKRY_point ref_pos,
+    struct SKRY_point ref_pos, ///< Position of 'ref_block's center in the previous image
     const SKRY_Image *ref_block,
+    const struct image_pyramid *ref_block_pyramid, ///< Pyramid of 'ref_block' or null
     const SKRY_Image *image,
+    const struct image_pyramid *pyramid, ///< Pyramid of 'image' or null
     unsigned search_radius,
     unsigned initial_search_step,
     struct SKRY_point *new_pos);
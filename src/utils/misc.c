@@ -25,8 +25,12 @@ File description:
 #include <ctype.h>   // for tolower()
 #include <math.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 #include "filters.h"
 #include "misc.h"
@@ -152,6 +156,17 @@ double SKRY_clock_sec()
     return clock_func();
 }
 
+/// Returns wall-clock time in seconds (if built without OpenMP, returns processor time)
+/** Unlike SKRY_clock_sec(), has sub-millisecond resolution; used for internal measurements. */
+double get_precise_time_sec(void)
+{
+#if defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
 void find_min_max_brightness(const SKRY_Image *img, ///< Has to be SKRY_PIX_MONO8
                              uint8_t *bmin, uint8_t *bmax)
 {
@@ -197,6 +212,15 @@ uint32_t cnd_swap_32(uint32_t x, int do_swap)
         return x;
 }
 
+/// Conditionally swaps bytes in a 64-bit value
+uint64_t cnd_swap_64(uint64_t x, int do_swap)
+{
+    if (do_swap)
+        return ((uint64_t)cnd_swap_32((uint32_t)x, 1) << 32) | cnd_swap_32((uint32_t)(x >> 32), 1);
+    else
+        return x;
+}
+
 /// Conditionally swaps two lower bytes of a 32-bit value
 uint32_t cnd_swap_16_in_32(uint32_t x, int do_swap)
 {
@@ -216,6 +240,74 @@ uint16_t cnd_swap_16(uint16_t x, int do_swap)
         return x;
 }
 
+/// Returns the gradient direction histogram bin for the specified gradient, or -1 if the gradient is zero
+static
+int get_gradient_dir_bin(double grad_x, double grad_y)
+{
+    double grad_len = sqrt(SKRY_SQR(grad_x) + SKRY_SQR(grad_y));
+    if (grad_len == 0.0)
+        return -1;
+
+    double cos_dir = grad_x/grad_len;
+    double dir = acos(cos_dir);
+    if (grad_y < 0)
+        dir = -dir;
+
+    int index = GRADIENT_NUM_DIRS/2 + dir * GRADIENT_NUM_DIRS/(2*3.1415926);
+
+    if (index < 0)
+        index = 0;
+    else if (index >= GRADIENT_NUM_DIRS)
+        index = GRADIENT_NUM_DIRS-1;
+
+    return index;
+}
+
+/// Returns 1 if the histogram of gradient directions 'dirs' is not dominated by a single direction
+static
+int is_gradient_variability_sufficient(const double dirs[GRADIENT_NUM_DIRS])
+{
+    // Smooth out the histogram to remove spikes (caused by Sobel filter's anisotropy)
+    double dirs_smooth[GRADIENT_NUM_DIRS];
+    median_filter(dirs, dirs_smooth, GRADIENT_NUM_DIRS, 1);
+
+    // We declare that gradient variability is too low if there are
+    // consecutive zeros over more than 1/2 of the histogram and
+    // the longest non-zero sequence is shorter than 1/4 of histogram
+
+    size_t zero_count = 0,
+           nzero_count = 0;
+
+    size_t max_zero_count = 0,
+           max_nzero_count = 0;
+
+    for (size_t i = 0; i < GRADIENT_NUM_DIRS; i++)
+    {
+        if (dirs_smooth[i] == 0.0)
+        {
+            zero_count++;
+
+            if (nzero_count > max_nzero_count)
+                max_nzero_count = nzero_count;
+
+            nzero_count = 0;
+        }
+        else
+        {
+            if (zero_count > max_zero_count)
+                max_zero_count = zero_count;
+
+            zero_count = 0;
+            nzero_count++;
+        }
+    }
+
+    if (max_zero_count > GRADIENT_NUM_DIRS/3 && max_nzero_count < GRADIENT_NUM_DIRS/4)
+        return 0;
+    else
+        return 1;
+}
+
 /// Returns 1 if the specified position 'pos' in 'img' is appropriate for block matching
 /** Uses the distribution of gradient directions around 'pos' to decide
     if the location is safe for block matching. It is not if the image
@@ -254,9 +346,7 @@ int assess_gradients_for_block_matching(
 
     // Determine the histogram of gradient directions within 'block_blurred'
 
-#define NUM_DIRS 512
-
-    double dirs[NUM_DIRS] = { 0.0 }; ///< Contains sums of gradient lengths
+    double dirs[GRADIENT_NUM_DIRS] = { 0.0 }; ///< Contains sums of gradient lengths
 
     for (unsigned y = 1; y <= block_size-2; y++)
     {
@@ -271,23 +361,9 @@ int assess_gradients_for_block_matching(
                              + line_p1[x+1] - line_m1[x+1]
                              + line_p1[x-1] - line_m1[x-1];
 
-            double grad_len = sqrt(SKRY_SQR(grad_x) + SKRY_SQR(grad_y));
-            if (grad_len > 0.0)
-            {
-                double cos_dir = grad_x/grad_len;
-                double dir = acos(cos_dir);
-                if (grad_y < 0)
-                    dir = -dir;
-
-                int index = NUM_DIRS/2 + dir * NUM_DIRS/(2*3.1415926);
-
-                if (index < 0)
-                    index = 0;
-                else if (index >= NUM_DIRS)
-                    index = NUM_DIRS-1;
-
-                dirs[index] += grad_len;
-            }
+            int index = get_gradient_dir_bin(grad_x, grad_y);
+            if (index >= 0)
+                dirs[index] += sqrt(SKRY_SQR(grad_x) + SKRY_SQR(grad_y));
         }
 
         line_m1 = line_0;
@@ -295,48 +371,196 @@ int assess_gradients_for_block_matching(
         line_p1 += line_stride;
     }
 
-    // Smooth out the histogram to remove spikes (caused by Sobel filter's anisotropy)
-    double dirs_smooth[NUM_DIRS];
-    median_filter(dirs, dirs_smooth, NUM_DIRS, 1);
+    SKRY_free_image(block_blurred);
 
-    // We declare that gradient variability is too low if there are
-    // consecutive zeros over more than 1/2 of the histogram and
-    // the longest non-zero sequence is shorter than 1/4 of histogram
+    return is_gradient_variability_sufficient(dirs);
+}
 
-    size_t zero_count = 0,
-           nzero_count = 0;
+/// Returns gradient direction bins of all pixels of 'img' or null if out of memory
+uint16_t *get_gradient_dirs(const SKRY_Image *img)
+{
+    unsigned width = SKRY_get_img_width(img),
+             height = SKRY_get_img_height(img);
 
-    size_t max_zero_count = 0,
-           max_nzero_count = 0;
+    uint16_t *grad_dirs = malloc((size_t)width * height * sizeof(*grad_dirs));
+    if (!grad_dirs)
+        return 0;
 
-    for (size_t i = 0; i < NUM_DIRS; i++)
+    // Blur to reduce noise impact
+    SKRY_Image *img_blurred = box_blur_img(img, 1, 3);
+    if (!img_blurred)
     {
-        if (dirs_smooth[i] == 0.0)
-        {
-            zero_count++;
+        free(grad_dirs);
+        return 0;
+    }
 
-            if (nzero_count > max_nzero_count)
-                max_nzero_count = nzero_count;
+    #pragma omp parallel for
+    for (unsigned y = 0; y < height; y++)
+    {
+        uint16_t *dirs_line = grad_dirs + (size_t)y * width;
 
-            nzero_count = 0;
+        if (y == 0 || y == height-1 || width < 3)
+        {
+            for (unsigned x = 0; x < width; x++)
+                dirs_line[x] = GRADIENT_DIR_NONE;
+            continue;
         }
-        else
+
+        const uint8_t *line_m1 = SKRY_get_line(img_blurred, y-1);
+        const uint8_t *line_0  = SKRY_get_line(img_blurred, y);
+        const uint8_t *line_p1 = SKRY_get_line(img_blurred, y+1);
+
+        dirs_line[0] = dirs_line[width-1] = GRADIENT_DIR_NONE;
+        for (unsigned x = 1; x <= width-2; x++)
         {
-            if (zero_count > max_zero_count)
-                max_zero_count = zero_count;
+            // Calculate gradient using Sobel filter
+            double grad_x = 2*(line_0[x+1] - line_0[x-1])
+                             + line_m1[x+1] - line_m1[x-1]
+                             + line_p1[x+1] - line_p1[x-1];
 
-            zero_count = 0;
-            nzero_count++;
+            double grad_y = 2*(line_p1[x] - line_m1[x])
+                             + line_p1[x+1] - line_m1[x+1]
+                             + line_p1[x-1] - line_m1[x-1];
+
+            int index = get_gradient_dir_bin(grad_x, grad_y);
+            dirs_line[x] = (index >= 0) ? index : GRADIENT_DIR_NONE;
         }
     }
 
-    int assessment_result = 1;
-    if (max_zero_count > NUM_DIRS/3 && max_nzero_count < NUM_DIRS/4)
-        assessment_result = 0;
+    SKRY_free_image(img_blurred);
 
-#undef NUM_DIRS
+    return grad_dirs;
+}
 
-    SKRY_free_image(block_blurred);
+/// Equivalent of 'assess_gradients_for_block_matching()' using the output of 'get_gradient_dirs()'
+int assess_gradient_dirs_for_block_matching(
+    const uint16_t grad_dirs[],
+    unsigned width,
+    unsigned height,
+    struct SKRY_point pos,
+    unsigned neighborhood_radius)
+{
+    // Only the non-zero bins of the histogram matter, so counts can be used instead of sums of gradient lengths
+    double dirs[GRADIENT_NUM_DIRS] = { 0.0 };
+
+    int r = neighborhood_radius - 1; // The block's edge pixels have no gradient
+    int ystart = SKRY_MAX(pos.y - r, 0),
+        yend = SKRY_MIN(pos.y + r, (int)height - 1),
+        xstart = SKRY_MAX(pos.x - r, 0),
+        xend = SKRY_MIN(pos.x + r, (int)width - 1);
+
+    for (int y = ystart; y <= yend; y++)
+    {
+        const uint16_t *dirs_line = grad_dirs + (size_t)y * width;
+        for (int x = xstart; x <= xend; x++)
+            if (dirs_line[x] != GRADIENT_DIR_NONE)
+                dirs[dirs_line[x]] += 1.0;
+    }
+
+    return is_gradient_variability_sufficient(dirs);
+}
+
+/// Moves the k-th smallest element of 'values' to position 'k' (and smaller ones before it)
+static
+void select_kth_flt(float values[], size_t num_values, size_t k)
+{
+    size_t left = 0, right = num_values - 1;
+    while (left < right)
+    {
+        float pivot = values[left + (right - left)/2];
+        size_t i = left, j = right;
+        while (i <= j)
+        {
+            while (values[i] < pivot) i++;
+            while (values[j] > pivot) j--;
+            if (i <= j)
+            {
+                float tmp = values[i];
+                values[i] = values[j];
+                values[j] = tmp;
+                i++;
+                if (j == 0)
+                    break;
+                j--;
+            }
+        }
+
+        if (k <= j)
+            right = j;
+        else if (k >= i)
+            left = i;
+        else
+            break;
+    }
+}
+
+/// Returns the median of 'values' (the mean of the two middle ones if 'num_values' is even)
+float get_median_flt(float values[], size_t num_values)
+{
+    size_t mid = num_values/2;
+    select_kth_flt(values, num_values, mid);
+    if (num_values % 2)
+        return values[mid];
+
+    // All elements before 'mid' are not greater than it; the lower middle one is their maximum
+    float lower = values[0];
+    for (size_t i = 1; i < mid; i++)
+        if (values[i] > lower)
+            lower = values[i];
+
+    return 0.5f * (lower + values[mid]);
+}
+
+/// Returns the value of a flag which may be set by another thread
+static
+int read_shared_flag(const int *flag)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+#else
+    int value;
+    #pragma omp atomic read
+    value = *flag;
+    return value;
+#endif
+}
+
+/// Performs steps of a processing phase; implements the SKRY_xx_run() functions
+/** Returns SKRY_SUCCESS (i.e. 'max_steps' steps performed and more steps left to do),
+    SKRY_LAST_STEP (no more steps), SKRY_CANCELLED or an error. Progress is reported
+    as images processed over all passes. */
+enum SKRY_result run_phase_steps(
+    enum SKRY_result (*step_func)(void *phase_obj),
+    void *phase_obj,
+    const SKRY_ImgSequence *img_seq, ///< Image sequence processed by 'phase_obj'
+    /// May be null (one pass); returns the current pass over 'img_seq' and receives the number of passes
+    size_t (*get_curr_pass)(const void *phase_obj, size_t *num_passes),
+    size_t max_steps, ///< If zero, all remaining steps are performed
+    SKRY_progress_callback_fn progress_callback, ///< May be null
+    void *callback_data,
+    const int *cancel_flag ///< May be null; if non-zero, processing stops before the next step
+)
+{
+    size_t num_imgs = SKRY_get_active_img_count(img_seq);
+    enum SKRY_result result = SKRY_SUCCESS;
+
+    for (size_t i = 0; SKRY_SUCCESS == result && (0 == max_steps || i < max_steps); i++)
+    {
+        if (cancel_flag && read_shared_flag(cancel_flag))
+            return SKRY_CANCELLED;
+
+        result = step_func(phase_obj);
+
+        if (progress_callback && (SKRY_SUCCESS == result || SKRY_LAST_STEP == result))
+        {
+            size_t num_passes = 1;
+            size_t curr_pass = get_curr_pass ? get_curr_pass(phase_obj, &num_passes) : 0;
+            size_t num_done = (SKRY_LAST_STEP == result) ? num_imgs
+                                                         : SKRY_get_curr_img_idx_within_active_subset(img_seq) + 1;
+
+            progress_callback(curr_pass * num_imgs + num_done, num_passes * num_imgs, callback_data);
+        }
+    }
 
-    return assessment_result;
+    return result;
 }
@@ -26,9 +26,22 @@ File description:
 
 #include <stdint.h>
 #include <skry/image.h>
+#include <skry/imgseq.h>
 
 #define WHITE_8bit 0xFF
 
+/* We need a 64-bit offset-capable file seek function;
+   'fseek' is fine only if sizeof(long)==8, e.g. on 64-bit
+   Linux, but not on Windows (32- or 64-bit) */
+
+#if defined (_MSC_VER) || defined(__MINGW32__)
+  #define FSEEK64 _fseeki64
+
+  // TODO: add more cases (OS X)
+#else
+  #define FSEEK64 fseek
+#endif
+
 /// Returns 1 on equality
 int compare_extension(const char *file_name,
                       const char *extension ///< lowercase without '.'
@@ -44,6 +57,10 @@ void SKRY_set_clock_func(SKRY_clock_sec_fn new_clock_func);
 
 double SKRY_clock_sec(void);
 
+/// Returns wall-clock time in seconds (if built without OpenMP, returns processor time)
+/** Unlike SKRY_clock_sec(), has sub-millisecond resolution; used for internal measurements. */
+double get_precise_time_sec(void);
+
 void find_min_max_brightness(const SKRY_Image *img, ///< Has to be SKRY_PIX_MONO8
                              uint8_t *bmin, uint8_t *bmax);
 
@@ -52,6 +69,9 @@ int is_machine_big_endian(void);
 /// Conditionally swaps bytes in a 32-bit value
 uint32_t cnd_swap_32(uint32_t x, int do_swap);
 
+/// Conditionally swaps bytes in a 64-bit value
+uint64_t cnd_swap_64(uint64_t x, int do_swap);
+
 /// Conditionally swaps two lower bytes of a 32-bit value
 uint32_t cnd_swap_16_in_32(uint32_t x, int do_swap);
 
@@ -72,4 +92,49 @@ int assess_gradients_for_block_matching(
     struct SKRY_point pos,
     unsigned neighborhood_radius);
 
+/// Number of bins of histograms of gradient directions used by 'assess_gradients_for_block_matching()'
+#define GRADIENT_NUM_DIRS 512
+
+/// Value of an element of 'get_gradient_dirs()' output for pixels with zero gradient
+#define GRADIENT_DIR_NONE UINT16_MAX
+
+/// Returns gradient direction bins of all pixels of 'img' or null if out of memory
+/** The gradients are determined as in 'assess_gradients_for_block_matching()';
+    image's edge pixels get GRADIENT_DIR_NONE. The result has to be freed
+    with free(). Requirements: 'img' is SKRY_PIX_MONO8. */
+uint16_t *get_gradient_dirs(const SKRY_Image *img);
+
+/// Counterpart of 'assess_gradients_for_block_matching()' using the output of 'get_gradient_dirs()'
+/** The result is not identical to that of 'assess_gradients_for_block_matching()'
+    called on an extracted neighborhood: gradient directions are precomputed
+    for the whole (blurred) image, so pixels near the neighborhood's border
+    are influenced by their surroundings instead of by zero padding, and
+    the part outside the image is skipped instead of being treated as black. */
+int assess_gradient_dirs_for_block_matching(
+    const uint16_t grad_dirs[], ///< Result of 'get_gradient_dirs()'
+    unsigned width,             ///< Width of image passed to 'get_gradient_dirs()'
+    unsigned height,            ///< Height of image passed to 'get_gradient_dirs()'
+    struct SKRY_point pos,
+    unsigned neighborhood_radius);
+
+/// Returns the median of 'values' (the mean of the two middle ones if 'num_values' is even)
+/** Elements of 'values' are reordered. Requirements: num_values > 0. */
+float get_median_flt(float values[], size_t num_values);
+
+/// Performs steps of a processing phase; implements the SKRY_xx_run() functions
+/** Returns SKRY_SUCCESS (i.e. 'max_steps' steps performed and more steps left to do),
+    SKRY_LAST_STEP (no more steps), SKRY_CANCELLED or an error. Progress is reported
+    as images processed over all passes. */
+enum SKRY_result run_phase_steps(
+    enum SKRY_result (*step_func)(void *phase_obj),
+    void *phase_obj,
+    const SKRY_ImgSequence *img_seq, ///< Image sequence processed by 'phase_obj'
+    /// May be null (one pass); returns the current pass over 'img_seq' and receives the number of passes
+    size_t (*get_curr_pass)(const void *phase_obj, size_t *num_passes),
+    size_t max_steps, ///< If zero, all remaining steps are performed
+    SKRY_progress_callback_fn progress_callback, ///< May be null
+    void *callback_data,
+    const int *cancel_flag ///< May be null; if non-zero, processing stops before the next step
+);
+
 #endif // LIBSKRY_MISC_UTILS_HEADER
@@ -0,0 +1,206 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Performance counters and tracing implementation.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <skry/skry.h>
+
+#include "dnarray.h"
+#include "perf.h"
+#include "threads.h"
+
+
+/// Invokes X(field) for every field of 'struct SKRY_perf_stats' updated with PERF_ADD()
+#define PERF_EVENT_COUNTERS(X) \
+    X(frames_read)             \
+    X(bytes_read)              \
+    X(read_time)               \
+    X(conversion_time)         \
+    X(block_match_evals)       \
+    X(blur_calls)              \
+    X(triangles_stacked)       \
+    X(pool_hits)               \
+    X(pool_misses)
+
+int g_perf_enabled = 0;
+
+struct SKRY_perf_stats g_perf_stats;
+
+/// Chrome trace event file being written; fields are guarded by 'mutex'
+static struct
+{
+    FILE *file; ///< Null if tracing is disabled
+    struct mutex *mutex;
+    double start_time;
+    int num_events;
+
+    /// Element [i] is the 'track' passed to end_perf_step() shown as thread 'i' in the trace
+    DA_DECLARE(const void *) tracks;
+} g_trace;
+
+static
+void read_perf_counters(struct SKRY_perf_stats *stats)
+{
+#define READ_COUNTER(field)          \
+    _Pragma("omp atomic read")       \
+    stats->field = g_perf_stats.field;
+
+    PERF_EVENT_COUNTERS(READ_COUNTER)
+
+#undef READ_COUNTER
+}
+
+void begin_perf_step(struct perf_step *step)
+{
+    step->is_measured = g_perf_enabled || g_trace.file;
+    if (step->is_measured)
+    {
+        read_perf_counters(&step->start_stats);
+        step->start_time = get_precise_time_sec();
+    }
+}
+
+/// Returns the track's index in the trace, adding it if necessary; 'g_trace.mutex' has to be locked
+static
+size_t get_trace_track(const void *track)
+{
+    for (size_t i = 0; i < DA_SIZE(g_trace.tracks); i++)
+        if (g_trace.tracks.data[i] == track)
+            return i;
+
+    DA_APPEND(g_trace.tracks, track);
+    size_t idx = DA_SIZE(g_trace.tracks) - 1;
+    fprintf(g_trace.file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+                          "\"args\":{\"name\":\"Image sequence %zu\"}}",
+            g_trace.num_events++ ? ",\n" : "", idx, idx);
+    return idx;
+}
+
+void end_perf_step(const struct perf_step *step, struct SKRY_perf_stats *phase_stats,
+                   const char *name, const void *track, size_t img_idx)
+{
+    if (!step->is_measured)
+        return;
+
+    double end_time = get_precise_time_sec();
+    struct SKRY_perf_stats end_stats;
+    read_perf_counters(&end_stats);
+
+    struct SKRY_perf_stats delta = { .num_steps = 1, .step_time = end_time - step->start_time };
+
+#define ADD_DELTA(field)                                                  \
+    delta.field = end_stats.field - step->start_stats.field;              \
+    phase_stats->field += delta.field;
+
+    PERF_EVENT_COUNTERS(ADD_DELTA)
+
+#undef ADD_DELTA
+
+    phase_stats->num_steps++;
+    phase_stats->step_time += delta.step_time;
+    PERF_ADD(num_steps, 1);
+    PERF_ADD(step_time, delta.step_time);
+
+    if (g_trace.file)
+    {
+        lock_mutex(g_trace.mutex);
+        if (g_trace.file)
+        {
+            size_t tid = get_trace_track(track);
+            fprintf(g_trace.file, "%s{\"name\":\"%s\",\"cat\":\"skry\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,"
+                                  "\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"img_idx\":%zu,"
+                                  "\"frames_read\":%" PRIu64 ",\"read_ms\":%.3f,\"conversion_ms\":%.3f,"
+                                  "\"block_match_evals\":%" PRIu64 ",\"blur_calls\":%" PRIu64 ","
+                                  "\"triangles_stacked\":%" PRIu64 "}}",
+                    g_trace.num_events++ ? ",\n" : "", name, tid,
+                    (step->start_time - g_trace.start_time) * 1.0e6, delta.step_time * 1.0e6,
+                    img_idx, delta.frames_read, delta.read_time * 1.0e3, delta.conversion_time * 1.0e3,
+                    delta.block_match_evals, delta.blur_calls, delta.triangles_stacked);
+        }
+        unlock_mutex(g_trace.mutex);
+    }
+}
+
+void SKRY_enable_perf_stats(int enabled)
+{
+    g_perf_enabled = enabled;
+}
+
+void SKRY_get_perf_stats(struct SKRY_perf_stats *stats)
+{
+    read_perf_counters(stats);
+
+    #pragma omp atomic read
+    stats->num_steps = g_perf_stats.num_steps;
+
+    #pragma omp atomic read
+    stats->step_time = g_perf_stats.step_time;
+}
+
+void SKRY_reset_perf_stats(void)
+{
+    g_perf_stats = (struct SKRY_perf_stats) { 0 };
+}
+
+enum SKRY_result SKRY_start_trace(const char *file_name)
+{
+    SKRY_stop_trace();
+
+    g_trace.mutex = create_mutex();
+    if (!g_trace.mutex)
+        return SKRY_OUT_OF_MEMORY;
+
+    FILE *file = fopen(file_name, "w");
+    if (!file)
+    {
+        g_trace.mutex = free_mutex(g_trace.mutex);
+        return SKRY_CANNOT_CREATE_FILE;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    g_trace.start_time = get_precise_time_sec();
+    g_trace.num_events = 0;
+    DA_ALLOC(g_trace.tracks, 0);
+    g_trace.file = file;
+
+    return SKRY_SUCCESS;
+}
+
+enum SKRY_result SKRY_stop_trace(void)
+{
+    if (!g_trace.file)
+        return SKRY_SUCCESS;
+
+    lock_mutex(g_trace.mutex);
+    fprintf(g_trace.file, "\n]}\n");
+    int error = ferror(g_trace.file);
+    error |= fclose(g_trace.file);
+    g_trace.file = 0;
+    DA_FREE(g_trace.tracks);
+    unlock_mutex(g_trace.mutex);
+
+    g_trace.mutex = free_mutex(g_trace.mutex);
+    return error ? SKRY_FILE_IO_ERROR : SKRY_SUCCESS;
+}
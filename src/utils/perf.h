@@ -0,0 +1,83 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Performance counters and tracing header.
+*/
+
+#ifndef LIBSKRY_PERF_HEADER
+#define LIBSKRY_PERF_HEADER
+
+#include <skry/defs.h>
+
+#include "misc.h"
+
+
+/// Set by SKRY_enable_perf_stats()
+extern int g_perf_enabled;
+
+/// Totals of all counters; updated atomically
+extern struct SKRY_perf_stats g_perf_stats;
+
+/// Adds 'value' to the field 'counter' of 'g_perf_stats' if performance counters are enabled
+/** Can be used in parallel loops. */
+#define PERF_ADD(counter, value)                \
+do {                                            \
+    if (g_perf_enabled)                         \
+    {                                           \
+        _Pragma("omp atomic")                   \
+        g_perf_stats.counter += (value);        \
+    }                                           \
+} while (0)
+
+/// Returns the current time for use with PERF_ADD_TIME_SINCE() (or 0 if performance counters are disabled)
+#define PERF_TIME() (g_perf_enabled ? get_precise_time_sec() : 0.0)
+
+/// Adds the time elapsed since 'start_time' (obtained from PERF_TIME()) to the field 'counter' of 'g_perf_stats'
+/** Does nothing if performance counters were disabled at 'start_time'. */
+#define PERF_ADD_TIME_SINCE(counter, start_time)                        \
+do {                                                                    \
+    if ((start_time) != 0.0)                                            \
+        PERF_ADD(counter, get_precise_time_sec() - (start_time));      \
+} while (0)
+
+/// Start of a processing step; see begin_perf_step()
+struct perf_step
+{
+    int is_measured;
+    double start_time;
+    struct SKRY_perf_stats start_stats; ///< Values of 'g_perf_stats' at the start
+};
+
+/// Has to be called at the start of each step of a processing phase
+void begin_perf_step(struct perf_step *step);
+
+/// Has to be called at the end of the step started with begin_perf_step()
+/** Adds the step's counters to 'phase_stats' and writes the step's span to the trace
+    (if enabled). The step's counters are the change of 'g_perf_stats' since begin_perf_step(),
+    so they also include work done concurrently for other image sequences. */
+void end_perf_step(const struct perf_step *step,
+                   struct SKRY_perf_stats *phase_stats, ///< Counters of the phase object
+                   const char *name, ///< Name of the step's span
+                   /// Steps with the same 'track' are shown in the same row of the trace
+                   const void *track,
+                   size_t img_idx ///< Index of the processed image
+                  );
+
+#endif // LIBSKRY_PERF_HEADER
@@ -0,0 +1,227 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Minimal threading primitives implementation.
+*/
+
+#if !defined(_WIN32)
+  #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+#include "threads.h"
+
+
+#if defined(_WIN32)
+
+struct mutex { CRITICAL_SECTION cs; };
+
+struct cond_var { CONDITION_VARIABLE cv; };
+
+struct thread
+{
+    HANDLE handle;
+    fn_thread_func *func;
+    void *arg;
+};
+
+#else
+
+struct mutex { pthread_mutex_t mtx; };
+
+struct cond_var { pthread_cond_t cv; };
+
+struct thread
+{
+    pthread_t handle;
+    fn_thread_func *func;
+    void *arg;
+};
+
+#endif
+
+struct mutex *create_mutex(void)
+{
+    struct mutex *mtx = malloc(sizeof(*mtx));
+    if (!mtx)
+        return 0;
+
+#if defined(_WIN32)
+    InitializeCriticalSection(&mtx->cs);
+#else
+    if (pthread_mutex_init(&mtx->mtx, 0))
+    {
+        free(mtx);
+        return 0;
+    }
+#endif
+    return mtx;
+}
+
+struct mutex *free_mutex(struct mutex *mtx)
+{
+    if (mtx)
+    {
+#if defined(_WIN32)
+        DeleteCriticalSection(&mtx->cs);
+#else
+        pthread_mutex_destroy(&mtx->mtx);
+#endif
+        free(mtx);
+    }
+    return 0;
+}
+
+void lock_mutex(struct mutex *mtx)
+{
+#if defined(_WIN32)
+    EnterCriticalSection(&mtx->cs);
+#else
+    pthread_mutex_lock(&mtx->mtx);
+#endif
+}
+
+void unlock_mutex(struct mutex *mtx)
+{
+#if defined(_WIN32)
+    LeaveCriticalSection(&mtx->cs);
+#else
+    pthread_mutex_unlock(&mtx->mtx);
+#endif
+}
+
+struct cond_var *create_cond_var(void)
+{
+    struct cond_var *cv = malloc(sizeof(*cv));
+    if (!cv)
+        return 0;
+
+#if defined(_WIN32)
+    InitializeConditionVariable(&cv->cv);
+#else
+    if (pthread_cond_init(&cv->cv, 0))
+    {
+        free(cv);
+        return 0;
+    }
+#endif
+    return cv;
+}
+
+struct cond_var *free_cond_var(struct cond_var *cv)
+{
+    if (cv)
+    {
+#if !defined(_WIN32)
+        pthread_cond_destroy(&cv->cv);
+#endif
+        free(cv);
+    }
+    return 0;
+}
+
+void wait_cond_var(struct cond_var *cv, struct mutex *mtx)
+{
+#if defined(_WIN32)
+    SleepConditionVariableCS(&cv->cv, &mtx->cs, INFINITE);
+#else
+    pthread_cond_wait(&cv->cv, &mtx->mtx);
+#endif
+}
+
+void broadcast_cond_var(struct cond_var *cv)
+{
+#if defined(_WIN32)
+    WakeAllConditionVariable(&cv->cv);
+#else
+    pthread_cond_broadcast(&cv->cv);
+#endif
+}
+
+#if defined(_WIN32)
+
+static
+DWORD WINAPI thread_entry(LPVOID param)
+{
+    struct thread *thr = param;
+    thr->func(thr->arg);
+    return 0;
+}
+
+#else
+
+static
+void *thread_entry(void *param)
+{
+    struct thread *thr = param;
+    thr->func(thr->arg);
+    return 0;
+}
+
+#endif
+
+struct thread *start_thread(fn_thread_func *func, void *arg)
+{
+    struct thread *thr = malloc(sizeof(*thr));
+    if (!thr)
+        return 0;
+
+    thr->func = func;
+    thr->arg = arg;
+
+#if defined(_WIN32)
+    thr->handle = CreateThread(0, 0, thread_entry, thr, 0, 0);
+    if (!thr->handle)
+    {
+        free(thr);
+        return 0;
+    }
+#else
+    if (pthread_create(&thr->handle, 0, thread_entry, thr))
+    {
+        free(thr);
+        return 0;
+    }
+#endif
+
+    return thr;
+}
+
+struct thread *join_thread(struct thread *thr)
+{
+    if (thr)
+    {
+#if defined(_WIN32)
+        WaitForSingleObject(thr->handle, INFINITE);
+        CloseHandle(thr->handle);
+#else
+        pthread_join(thr->handle, 0);
+#endif
+        free(thr);
+    }
+    return 0;
+}
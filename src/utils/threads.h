@@ -0,0 +1,63 @@
+/*
+libskry - astronomical image stacking
+Copyright (C) 2016, 2017 Filip Szczerek <ga.software@yahoo.com>
+
+This file is part of libskry.
+
+Libskry is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Libskry is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with libskry.  If not, see <http://www.gnu.org/licenses/>.
+
+File description:
+    Minimal threading primitives header (POSIX threads or Win32).
+*/
+
+#ifndef LIBSKRY_THREADS_HEADER
+#define LIBSKRY_THREADS_HEADER
+
+
+struct mutex;
+struct cond_var;
+struct thread;
+
+typedef void fn_thread_func(void *arg);
+
+/// Returns null if out of memory or on failure
+struct mutex *create_mutex(void);
+
+/// Returns null
+struct mutex *free_mutex(struct mutex *mtx);
+
+void lock_mutex(struct mutex *mtx);
+
+void unlock_mutex(struct mutex *mtx);
+
+/// Returns null if out of memory or on failure
+struct cond_var *create_cond_var(void);
+
+/// Returns null
+struct cond_var *free_cond_var(struct cond_var *cv);
+
+/// Atomically unlocks 'mtx' and waits; 'mtx' is locked again on return
+/** Spurious wakeups are possible. */
+void wait_cond_var(struct cond_var *cv, struct mutex *mtx);
+
+/// Wakes up all threads waiting on 'cv'
+void broadcast_cond_var(struct cond_var *cv);
+
+/// Starts a new thread executing 'func(arg)'; returns null on failure
+struct thread *start_thread(fn_thread_func *func, void *arg);
+
+/// Waits for 'thr' to finish and frees it; returns null
+struct thread *join_thread(struct thread *thr);
+
+#endif // LIBSKRY_THREADS_HEADER
@@ -23,6 +23,7 @@ File description:
 
 #include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -720,6 +721,79 @@ int point_belongs_to_line(const struct SKRY_point *p,
                  v0->x*p->y + v1->x*p->y;
 }
 
+/// Returns a positive value if 'p' lies to the left of the directed line 'a'->'b', negative if to the right, 0 if on the line
+static inline
+int64_t get_orientation(const struct SKRY_point *a, const struct SKRY_point *b, const struct SKRY_point *p)
+{
+    return (int64_t)(b->x - a->x) * (p->y - a->y) - (int64_t)(b->y - a->y) * (p->x - a->x);
+}
+
+/// Finds a triangle containing point 'p' (inside or on its boundary) by walking from triangle 'start' towards 'p'
+/** In each step the walk crosses an edge which separates the current triangle from 'p'.
+    Uses exact integer arithmetic. A walk in a Delaunay triangulation always terminates,
+    but as a safeguard, SKRY_EMPTY is returned if it takes more steps than there are triangles. */
+static
+size_t locate_point(const SKRY_Triangulation *tri, const struct SKRY_point *p, size_t start)
+{
+    size_t tidx = start;
+    for (size_t num_steps = 0; num_steps <= DA_SIZE(tri->triangles); num_steps++)
+    {
+        const struct SKRY_triangle *t = &tri->triangles.data[tidx];
+        const size_t tri_edges[3] = { t->e0, t->e1, t->e2 };
+
+        size_t next_tidx = SKRY_EMPTY;
+        for (int i = 0; i < 3 && SKRY_EMPTY == next_tidx; i++)
+        {
+            const struct SKRY_edge *e = &tri->edges.data[tri_edges[i]];
+            size_t opposite = (t->v0 != e->v0 && t->v0 != e->v1) ? t->v0 :
+                              (t->v1 != e->v0 && t->v1 != e->v1) ? t->v1 : t->v2;
+
+            int64_t p_side = get_orientation(&tri->vertices[e->v0], &tri->vertices[e->v1], p);
+            int64_t opp_side = get_orientation(&tri->vertices[e->v0], &tri->vertices[e->v1], &tri->vertices[opposite]);
+
+            if ((p_side < 0 && opp_side > 0) || (p_side > 0 && opp_side < 0))
+            {
+                next_tidx = (e->t0 == tidx) ? e->t1 : e->t0;
+                if (SKRY_EMPTY == next_tidx)
+                    return SKRY_EMPTY; // 'p' is outside the triangulation
+            }
+        }
+
+        if (SKRY_EMPTY == next_tidx)
+            return tidx;
+
+        tidx = next_tidx;
+    }
+
+    return SKRY_EMPTY;
+}
+
+/// Coarse grid over the triangulated points; each cell holds a triangle from which point location starts
+/** Any triangle is a valid starting point of 'locate_point()', so the hints need not be
+    updated when triangles are modified. Thanks to them, a walk is short regardless
+    of the order of inserted points. */
+struct location_grid
+{
+    struct SKRY_rect area;
+    unsigned num_cols, num_rows;
+
+    /// Element [i] = triangle into which a point of the i-th cell has been inserted most recently (or SKRY_EMPTY)
+    size_t *start_tri;
+};
+
+/// Returns index of the cell containing 'p'
+static
+size_t get_location_cell(const struct location_grid *grid, const struct SKRY_point *p)
+{
+    int col = (int)(((int64_t)(p->x - grid->area.x) * grid->num_cols) / (int)grid->area.width),
+        row = (int)(((int64_t)(p->y - grid->area.y) * grid->num_rows) / (int)grid->area.height);
+
+    col = SKRY_MAX(0, SKRY_MIN((int)grid->num_cols - 1, col));
+    row = SKRY_MAX(0, SKRY_MIN((int)grid->num_rows - 1, row));
+
+    return (size_t)col + (size_t)row * grid->num_cols;
+}
+
 /** Finds Delaunay triangulation for the specified point set; also adds (at the end
     of points' list) three additional points for the initial triangle which covers
     the whole set and 'envelope'. Returns null if out of memory. */
@@ -735,11 +809,24 @@ SKRY_Triangulation *SKRY_find_delaunay_triangulation(
         return 0;
     tri->num_vertices = num_points + 3;
     tri->vertices = malloc(tri->num_vertices * sizeof(struct SKRY_point));
-    if (!tri->vertices)
+
+    // About 1 point per cell
+    struct location_grid grid = { .area = envelope,
+                                  .num_cols = SKRY_MAX(1, (unsigned)sqrt((double)num_points * envelope.width / SKRY_MAX(1, envelope.height))) };
+    grid.num_rows = SKRY_MAX(1, num_points / grid.num_cols);
+    grid.area.width = SKRY_MAX(1, grid.area.width);
+    grid.area.height = SKRY_MAX(1, grid.area.height);
+    grid.start_tri = malloc((size_t)grid.num_cols * grid.num_rows * sizeof(*grid.start_tri));
+
+    if (!tri->vertices || !grid.start_tri)
     {
+        free(tri->vertices);
+        free(grid.start_tri);
         free(tri);
         return 0;
     }
+    for (size_t i = 0; i < (size_t)grid.num_cols * grid.num_rows; i++)
+        grid.start_tri[i] = SKRY_EMPTY;
     memcpy(tri->vertices, points, num_points * sizeof(struct SKRY_point));
 
     DA_ALLOC(tri->edges, 0);
@@ -792,16 +879,24 @@ SKRY_Triangulation *SKRY_find_delaunay_triangulation(
 
     // Process subsequent points and incrementally refresh the triangulation
 
+    size_t last_tidx = 0; // Triangle into which the previous point has been inserted
     for (size_t pidx = 0; pidx < num_points; pidx++)
     {
-        // 1) Find an existing triangle 't' with index 'tidx' to which 'pidx' belongs
-        size_t tidx = SKRY_EMPTY;
-        for (size_t j = 0; j < DA_SIZE(tri->triangles); j++)
-            if (is_inside_triangle(pidx, j, tri))
-            {
-                tidx = j;
-                break;
-            }
+        // 1) Find an existing triangle 't' with index 'tidx' to which 'pidx' belongs;
+        //    start from the most recent insertion nearby (or the previous one)
+        size_t cell = get_location_cell(&grid, &points[pidx]);
+        size_t tidx = locate_point(tri, &points[pidx], SKRY_EMPTY != grid.start_tri[cell] ? grid.start_tri[cell] : last_tidx);
+
+        if (SKRY_EMPTY == tidx)
+        {
+            LOG_MSG(SKRY_LOG_TRIANGULATION, "Could not locate point %zu by walking, checking all triangles.", pidx);
+            for (size_t j = 0; j < DA_SIZE(tri->triangles); j++)
+                if (is_inside_triangle(pidx, j, tri))
+                {
+                    tidx = j;
+                    break;
+                }
+        }
 
         assert(tidx != SKRY_EMPTY); // Will never happen, unless 'envelope' does not contain all 'points'
 
@@ -830,8 +925,14 @@ SKRY_Triangulation *SKRY_find_delaunay_triangulation(
             add_point_on_edge(tri, pidx, insertion_edge);
         else
             add_point_inside_triangle(tri, pidx, tidx);
+
+        // The triangle still exists (possibly elsewhere, if it has been modified by an edge swap)
+        last_tidx = tidx;
+        grid.start_tri[cell] = tidx;
     }
 
+    free(grid.start_tri);
+
     return tri;
 }
 